@@ -440,6 +440,26 @@ tiler_blk_handle tiler_alloc_block_area_aligned(enum tiler_fmt fmt, u32 width,
  */
 void tiler_free_block_area(tiler_blk_handle block);
 
+/**
+ * Takes a reference on the Tiler block containing a system space address.
+ * The block is not freed until the reference is dropped, even if its owner
+ * frees it.
+ *
+ * @param ssptr		Tiler system space address within the block
+ *
+ * @return handle	Handle to tiler block information.  NULL if no block
+ *			contains ssptr.
+ */
+tiler_blk_handle tiler_get_block(u32 ssptr);
+
+/**
+ * Drops a reference taken by tiler_get_block
+ *
+ * @param handle	Handle to tiler block information
+ *
+ */
+void tiler_put_block(tiler_blk_handle block);
+
 /**
  * Pins a set of physical pages into the Tiler using the area defined in a
  * handle
@@ -26,7 +26,11 @@ struct tiler_pa_info;
 int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 			struct tiler_pa_info **pas,
 			bool early_callback,
-			void (*cb_fn)(void *, int), void *cb_arg);
+			void (*cb_fn)(void *, int), void *cb_arg,
+			void *owner);
+int dsscomp_gralloc_register(struct dsscomp_buffer_reg *reg, void *owner);
+int dsscomp_gralloc_unregister(u32 ix, void *owner);
+void dsscomp_gralloc_unregister_all(void *owner);
 
 void dsscomp_set_platform_data(struct dsscomp_platform_data *data);
 
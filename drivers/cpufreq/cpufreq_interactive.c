@@ -19,6 +19,7 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/input.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/rwsem.h>
@@ -52,6 +53,9 @@ struct cpufreq_interactive_cpuinfo {
 	u64 hispeed_validate_time;
 	struct rw_semaphore enable_sem;
 	int governor_enabled;
+	unsigned int load_avg;
+	int load_trend;
+	u64 predict_timestamp;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -109,6 +113,15 @@ static u64 boostpulse_endtime;
 #define DEFAULT_TIMER_SLACK (4 * DEFAULT_TIMER_RATE)
 static int timer_slack_val = DEFAULT_TIMER_SLACK;
 
+/*
+ * Weight in percent of the newest sample in the predicted load, or 0 to
+ * choose speeds from the measured load alone.
+ */
+static unsigned int predict_weight_val;
+
+/* Non-zero means boost on touchscreen input for boostpulse_duration */
+static int input_boost_val;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -277,6 +290,42 @@ static u64 update_load(int cpu)
 	return now;
 }
 
+/*
+ * Smooth the load with an exponentially weighted moving average and
+ * extrapolate it one sample ahead along its trend.  The larger of the
+ * measured and predicted loads is used, so that speed ramps ahead of a
+ * rising load and a short idle gap only lowers speed as fast as the
+ * average decays.
+ */
+static unsigned int predict_load(struct cpufreq_interactive_cpuinfo *pcpu,
+				 unsigned int loadadjfreq, u64 now)
+{
+	unsigned int weight = predict_weight_val;
+	s64 avg, trend, predicted;
+
+	/* History older than a few samples says nothing about the load. */
+	if (now - pcpu->predict_timestamp > 4 * timer_rate) {
+		pcpu->load_avg = loadadjfreq;
+		pcpu->load_trend = 0;
+		pcpu->predict_timestamp = now;
+		return loadadjfreq;
+	}
+
+	pcpu->predict_timestamp = now;
+	avg = pcpu->load_avg;
+	avg += div_s64(((s64)loadadjfreq - avg) * weight, 100);
+	trend = pcpu->load_trend;
+	trend += div_s64((avg - pcpu->load_avg - trend) * weight, 100);
+	pcpu->load_avg = avg;
+	pcpu->load_trend = trend;
+
+	predicted = avg + trend;
+	if (predicted > (s64)pcpu->policy->max * 100)
+		predicted = (s64)pcpu->policy->max * 100;
+
+	return predicted > loadadjfreq ? predicted : loadadjfreq;
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	u64 now;
@@ -307,6 +356,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	do_div(cputime_speedadj, delta_time);
 	loadadjfreq = (unsigned int)cputime_speedadj * 100;
+	if (predict_weight_val)
+		loadadjfreq = predict_load(pcpu, loadadjfreq, now);
 	cpu_load = loadadjfreq / pcpu->target_freq;
 	boosted = boost_val || now < boostpulse_endtime;
 
@@ -552,6 +603,98 @@ static void cpufreq_interactive_boost(void)
 		wake_up_process(speedchange_task);
 }
 
+/*
+ * Touch input is the earliest sign of an interactive burst; boost straight
+ * from the event instead of waiting for userspace to write boostpulse.
+ */
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	u64 now;
+
+	if (!input_boost_val || type == EV_SYN)
+		return;
+
+	/* A gesture is a stream of events, pulse at most twice a period. */
+	now = ktime_to_us(ktime_get());
+	if (now + boostpulse_duration_val / 2 < boostpulse_endtime)
+		return;
+
+	boostpulse_endtime = now + boostpulse_duration_val;
+	trace_cpufreq_interactive_boost("input");
+	cpufreq_interactive_boost();
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	{
+		/* multi-touch touchscreens */
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) },
+	},
+	{
+		/* single-touch touchscreens */
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] = BIT_MASK(ABS_X) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event = cpufreq_interactive_input_event,
+	.connect = cpufreq_interactive_input_connect,
+	.disconnect = cpufreq_interactive_input_disconnect,
+	.name = "cpufreq_interactive",
+	.id_table = cpufreq_interactive_ids,
+};
+
+/* set if GOV_START registered the input handler; protected by gov_lock */
+static bool input_handler_registered;
+
 static int cpufreq_interactive_notifier(
 	struct notifier_block *nb, unsigned long val, void *data)
 {
@@ -869,6 +1012,53 @@ static ssize_t store_boostpulse_duration(
 
 define_one_global_rw(boostpulse_duration);
 
+static ssize_t show_input_boost(struct kobject *kobj, struct attribute *attr,
+				char *buf)
+{
+	return sprintf(buf, "%d\n", input_boost_val);
+}
+
+static ssize_t store_input_boost(struct kobject *kobj, struct attribute *attr,
+				 const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	input_boost_val = val;
+	return count;
+}
+
+define_one_global_rw(input_boost);
+
+static ssize_t show_predict_weight(struct kobject *kobj,
+				   struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", predict_weight_val);
+}
+
+static ssize_t store_predict_weight(struct kobject *kobj,
+				    struct attribute *attr, const char *buf,
+				    size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val > 100)
+		return -EINVAL;
+
+	predict_weight_val = val;
+	return count;
+}
+
+define_one_global_rw(predict_weight);
+
 static struct attribute *interactive_attributes[] = {
 	&target_loads_attr.attr,
 	&hispeed_freq_attr.attr,
@@ -880,6 +1070,8 @@ static struct attribute *interactive_attributes[] = {
 	&boost.attr,
 	&boostpulse.attr,
 	&boostpulse_duration.attr,
+	&input_boost.attr,
+	&predict_weight.attr,
 	NULL,
 };
 
@@ -940,6 +1132,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 				ktime_to_us(ktime_get());
 			pcpu->hispeed_validate_time =
 				pcpu->floor_validate_time;
+			pcpu->predict_timestamp = 0;
 			down_write(&pcpu->enable_sem);
 			expires = jiffies + usecs_to_jiffies(timer_rate);
 			pcpu->cpu_timer.expires = expires;
@@ -972,6 +1165,11 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		idle_notifier_register(&cpufreq_interactive_idle_nb);
 		cpufreq_register_notifier(
 			&cpufreq_notifier_block, CPUFREQ_TRANSITION_NOTIFIER);
+		if (input_register_handler(&cpufreq_interactive_input_handler))
+			pr_warn("%s: failed to register input handler\n",
+				__func__);
+		else
+			input_handler_registered = true;
 		mutex_unlock(&gov_lock);
 		break;
 
@@ -991,6 +1189,11 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			return 0;
 		}
 
+		if (input_handler_registered) {
+			input_unregister_handler(
+				&cpufreq_interactive_input_handler);
+			input_handler_registered = false;
+		}
 		cpufreq_unregister_notifier(
 			&cpufreq_notifier_block, CPUFREQ_TRANSITION_NOTIFIER);
 		idle_notifier_unregister(&cpufreq_interactive_idle_nb);
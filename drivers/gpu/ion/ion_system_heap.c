@@ -15,71 +15,302 @@
  */
 
 #include <linux/err.h>
+#include <linux/freezer.h>
+#include <linux/highmem.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
 #include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
+/*
+ * Buffers are built from the largest of these orders that still fits, so
+ * big graphics buffers need few scatterlist entries.  Every chunk is
+ * split_page()d once allocated, which lets the kernel and user mappings
+ * keep working on individual order-0 pages.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+/*
+ * Pages each order's pool may hold, clean and dirty together; chunks freed
+ * beyond that go straight back to the system.
+ */
+static unsigned int system_pool_max_pages = 4096;
+module_param(system_pool_max_pages, uint, 0644);
+
+/**
+ * struct ion_page_pool - freed chunks of a single order
+ * @clean:	chunks that have been zeroed and can be handed out as is
+ * @dirty:	chunks freed by ion that still hold the old contents
+ *
+ * Chunks are linked through the lru field of their first page.  Counts
+ * are in chunks, the statistics in allocations served.
+ */
+struct ion_page_pool {
+	spinlock_t lock;
+	unsigned int order;
+	struct list_head clean;
+	struct list_head dirty;
+	unsigned long nr_clean;
+	unsigned long nr_dirty;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool pools[NUM_ORDERS];
+	struct shrinker shrinker;
+	struct task_struct *zero_thread;
+	wait_queue_head_t zero_wait;
+	atomic_t zeroed_bg;
+	atomic_t zeroed_sync;
+	atomic_t shrunk;
+};
+
+struct ion_system_chunk {
+	struct page *page;
+	unsigned int order;
+};
+
+/**
+ * struct ion_system_buffer - the memory behind a system heap buffer
+ * @pages:	every page of the buffer, in order, for the cpu mappings
+ * @chunks:	the physically contiguous pieces, for the scatterlist
+ */
+struct ion_system_buffer {
+	struct page **pages;
+	struct ion_system_chunk *chunks;
+	int nr_chunks;
+};
+
+static inline struct ion_system_heap *to_system_heap(struct ion_heap *heap)
+{
+	return container_of(heap, struct ion_system_heap, heap);
+}
+
+static gfp_t order_to_gfp(unsigned int order)
+{
+	gfp_t gfp = GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO;
+
+	/*
+	 * A failed high-order attempt just falls back to the next order, so
+	 * don't let it retry hard or warn; the largest one must not even
+	 * enter reclaim.
+	 */
+	if (order)
+		gfp |= __GFP_NOWARN | __GFP_NORETRY;
+	if (order == orders[0])
+		gfp &= ~__GFP_WAIT;
+	return gfp;
+}
+
+static void ion_zero_chunk(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		clear_highpage(page + i);
+}
+
+static void ion_free_chunk(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		__free_page(page + i);
+}
+
+/* Take a chunk from @pool, clean ones first.  *dirty says which it was. */
+static struct page *ion_page_pool_get(struct ion_page_pool *pool, bool *dirty)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->nr_clean) {
+		page = list_first_entry(&pool->clean, struct page, lru);
+		pool->nr_clean--;
+		*dirty = false;
+	} else if (pool->nr_dirty) {
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		pool->nr_dirty--;
+		*dirty = true;
+	}
+	if (page) {
+		list_del(&page->lru);
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	spin_unlock(&pool->lock);
+
+	return page;
+}
+
+static struct page *ion_system_heap_alloc_chunk(struct ion_system_heap *sys,
+						unsigned long size,
+						unsigned int max_order,
+						unsigned int *order)
+{
+	struct page *page;
+	bool dirty;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (orders[i] > max_order || size < (PAGE_SIZE << orders[i]))
+			continue;
+
+		page = ion_page_pool_get(&sys->pools[i], &dirty);
+		if (page) {
+			if (dirty) {
+				ion_zero_chunk(page, orders[i]);
+				atomic_add(1 << orders[i], &sys->zeroed_sync);
+			}
+			*order = orders[i];
+			return page;
+		}
+
+		page = alloc_pages(order_to_gfp(orders[i]), orders[i]);
+		if (!page)
+			continue;
+		if (orders[i])
+			split_page(page, orders[i]);
+		*order = orders[i];
+		return page;
+	}
+
+	return NULL;
+}
+
+static struct ion_page_pool *order_to_pool(struct ion_system_heap *sys,
+					   unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (orders[i] == order)
+			return &sys->pools[i];
+	BUG();
+	return NULL;
+}
+
+/*
+ * Freed chunks go back to their pool's dirty list; the zeroing thread
+ * cleans them before the next allocation has to.  A full pool releases
+ * the chunk instead.
+ */
+static void ion_system_heap_free_chunk(struct ion_system_heap *sys,
+				       struct page *page, unsigned int order)
+{
+	struct ion_page_pool *pool = order_to_pool(sys, order);
+	bool pooled = false;
+
+	spin_lock(&pool->lock);
+	if ((pool->nr_clean + pool->nr_dirty + 1) << order <=
+	    system_pool_max_pages) {
+		list_add_tail(&page->lru, &pool->dirty);
+		pool->nr_dirty++;
+		pooled = true;
+	}
+	spin_unlock(&pool->lock);
+
+	if (!pooled)
+		ion_free_chunk(page, order);
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    unsigned long size, unsigned long align,
 				    unsigned long flags)
 {
+	struct ion_system_heap *sys = to_system_heap(heap);
 	int n_pages = PAGE_ALIGN(size) / PAGE_SIZE;
-	struct page **page_list;
-	const int gfp_mask = GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO;
-	int i = 0;
-
-	page_list = kmalloc(n_pages * sizeof(void *), GFP_KERNEL);
+	unsigned long remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
+	struct ion_system_buffer *sysbuf;
+	int i, j, n = 0;
 
-	for (i = 0; i < n_pages; i++) {
-		page_list[i] = alloc_page(gfp_mask);
-		if (page_list[i] == NULL)
-			goto out;
+	sysbuf = kzalloc(sizeof(*sysbuf), GFP_KERNEL);
+	if (!sysbuf)
+		return -ENOMEM;
+	sysbuf->pages = kmalloc(n_pages * sizeof(void *), GFP_KERNEL);
+	sysbuf->chunks = kmalloc(n_pages * sizeof(struct ion_system_chunk),
+				 GFP_KERNEL);
+	if (!sysbuf->pages || !sysbuf->chunks)
+		goto err;
+
+	while (remaining) {
+		struct ion_system_chunk *chunk =
+			&sysbuf->chunks[sysbuf->nr_chunks];
+
+		chunk->page = ion_system_heap_alloc_chunk(sys, remaining,
+							  max_order,
+							  &chunk->order);
+		if (!chunk->page)
+			goto err;
+
+		for (j = 0; j < (1 << chunk->order); j++)
+			sysbuf->pages[n++] = chunk->page + j;
+		remaining -= PAGE_SIZE << chunk->order;
+		/* chunks only get smaller, so a failed order isn't retried */
+		max_order = chunk->order;
+		sysbuf->nr_chunks++;
 	}
 
-	buffer->priv_virt = page_list;
+	buffer->priv_virt = sysbuf;
 	return 0;
 
-out:
-	/* failed on i, so go to i-1 */
-	i--;
-
-	for (; i >= 0; i--)
-		__free_page(page_list[i]);
-
-	kfree(page_list);
+err:
+	for (i = 0; i < sysbuf->nr_chunks; i++)
+		ion_system_heap_free_chunk(sys, sysbuf->chunks[i].page,
+					   sysbuf->chunks[i].order);
+	if (sysbuf->nr_chunks && sys->zero_thread)
+		wake_up(&sys->zero_wait);
+	kfree(sysbuf->chunks);
+	kfree(sysbuf->pages);
+	kfree(sysbuf);
 	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
+	struct ion_system_heap *sys = to_system_heap(buffer->heap);
+	struct ion_system_buffer *sysbuf = buffer->priv_virt;
 	int i;
-	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	struct page **page_list = (struct page **)buffer->priv_virt;
 
-	for (i = 0; i < n_pages; i++)
-		__free_page(page_list[i]);
-	kfree(page_list);
+	for (i = 0; i < sysbuf->nr_chunks; i++)
+		ion_system_heap_free_chunk(sys, sysbuf->chunks[i].page,
+					   sysbuf->chunks[i].order);
+	if (sys->zero_thread)
+		wake_up(&sys->zero_wait);
+
+	kfree(sysbuf->chunks);
+	kfree(sysbuf->pages);
+	kfree(sysbuf);
 }
 
 struct scatterlist *ion_system_heap_map_dma(struct ion_heap *heap,
 					    struct ion_buffer *buffer)
 {
 	struct scatterlist *sglist;
-	struct page **page_list = (struct page **)buffer->priv_virt;
+	struct ion_system_buffer *sysbuf = buffer->priv_virt;
 	int i;
-	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	int n = sysbuf->nr_chunks;
 
-	sglist = vmalloc(n_pages * sizeof(struct scatterlist));
+	sglist = vmalloc(n * sizeof(struct scatterlist));
 	if (!sglist)
 		return ERR_PTR(-ENOMEM);
-	memset(sglist, 0, n_pages * sizeof(struct scatterlist));
-	sg_init_table(sglist, n_pages);
-	for (i = 0; i < n_pages; i++)
-		sg_set_page(&sglist[i], page_list[i], PAGE_SIZE, 0);
+	memset(sglist, 0, n * sizeof(struct scatterlist));
+	sg_init_table(sglist, n);
+	for (i = 0; i < n; i++)
+		sg_set_page(&sglist[i], sysbuf->chunks[i].page,
+			    PAGE_SIZE << sysbuf->chunks[i].order, 0);
 	/* XXX do cache maintenance for dma? */
 	return sglist;
 }
@@ -95,9 +326,9 @@ void *ion_system_heap_map_kernel(struct ion_heap *heap,
 				 struct ion_buffer *buffer)
 {
 	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	struct page **page_list = (struct page **)buffer->priv_virt;
+	struct ion_system_buffer *sysbuf = buffer->priv_virt;
 
-	return vm_map_ram(page_list, n_pages, -1, PAGE_KERNEL);
+	return vm_map_ram(sysbuf->pages, n_pages, -1, PAGE_KERNEL);
 }
 
 void ion_system_heap_unmap_kernel(struct ion_heap *heap,
@@ -114,7 +345,8 @@ int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	unsigned long uaddr = vma->vm_start;
 	unsigned long usize = vma->vm_end - vma->vm_start;
 	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	struct page **page_list = (struct page **)buffer->priv_virt;
+	struct ion_system_buffer *sysbuf = buffer->priv_virt;
+	struct page **page_list = sysbuf->pages;
 	int i;
 
 	if (usize /* + pgoff << PAGE_SHIFT */  > (n_pages << PAGE_SHIFT))
@@ -124,7 +356,7 @@ int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	do {
 		int ret;
 
-		ret = vm_insert_page(vma, uaddr, page_list[i]);
+		ret = vm_insert_page(vma, uaddr, page_list[i++]);
 		if (ret)
 			return ret;
 
@@ -137,6 +369,33 @@ int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	return 0;
 }
 
+static int ion_system_heap_debug_show(struct ion_heap *heap,
+				      struct seq_file *s)
+{
+	struct ion_system_heap *sys = to_system_heap(heap);
+	int i;
+
+	seq_printf(s, "\n%8s %8s %8s %8s %8s\n", "order", "clean",
+		   "dirty", "hits", "misses");
+	for (i = 0; i < NUM_ORDERS; i++) {
+		struct ion_page_pool *pool = &sys->pools[i];
+
+		spin_lock(&pool->lock);
+		seq_printf(s, "%8u %8lu %8lu %8lu %8lu\n", pool->order,
+			   pool->nr_clean << pool->order,
+			   pool->nr_dirty << pool->order,
+			   pool->hits, pool->misses);
+		spin_unlock(&pool->lock);
+	}
+	seq_printf(s, "pages zeroed in background: %d\n",
+		   atomic_read(&sys->zeroed_bg));
+	seq_printf(s, "pages zeroed on allocation: %d\n",
+		   atomic_read(&sys->zeroed_sync));
+	seq_printf(s, "pages released to shrinker: %d\n",
+		   atomic_read(&sys->shrunk));
+	return 0;
+}
+
 static struct ion_heap_ops vmalloc_ops = {
 	.allocate = ion_system_heap_allocate,
 	.free = ion_system_heap_free,
@@ -145,23 +404,188 @@ static struct ion_heap_ops vmalloc_ops = {
 	.map_kernel = ion_system_heap_map_kernel,
 	.unmap_kernel = ion_system_heap_unmap_kernel,
 	.map_user = ion_system_heap_map_user,
+	.debug_show = ion_system_heap_debug_show,
 };
 
+static bool ion_system_heap_has_dirty(struct ion_system_heap *sys)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (sys->pools[i].nr_dirty)
+			return true;
+	return false;
+}
+
+/*
+ * Zero freed chunks one at a time at low priority, so gralloc's next
+ * allocation of the same size finds them ready in the clean list.
+ */
+static int ion_system_heap_zero_thread(void *data)
+{
+	struct ion_system_heap *sys = data;
+	int i;
+
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(sys->zero_wait,
+				     ion_system_heap_has_dirty(sys) ||
+				     kthread_should_stop());
+
+		for (i = 0; i < NUM_ORDERS; i++) {
+			struct ion_page_pool *pool = &sys->pools[i];
+			struct page *page;
+
+			for (;;) {
+				spin_lock(&pool->lock);
+				if (!pool->nr_dirty) {
+					spin_unlock(&pool->lock);
+					break;
+				}
+				page = list_first_entry(&pool->dirty,
+							struct page, lru);
+				list_del(&page->lru);
+				pool->nr_dirty--;
+				spin_unlock(&pool->lock);
+
+				ion_zero_chunk(page, pool->order);
+				atomic_add(1 << pool->order, &sys->zeroed_bg);
+
+				spin_lock(&pool->lock);
+				list_add_tail(&page->lru, &pool->clean);
+				pool->nr_clean++;
+				spin_unlock(&pool->lock);
+
+				cond_resched();
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int ion_page_pool_total(struct ion_system_heap *sys)
+{
+	int i, total = 0;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		struct ion_page_pool *pool = &sys->pools[i];
+
+		total += (pool->nr_clean + pool->nr_dirty) << pool->order;
+	}
+	return total;
+}
+
+/* Give up to @nr pages from one of @pool's lists back to the system. */
+static int ion_page_pool_shrink_list(struct ion_page_pool *pool,
+				     struct list_head *list,
+				     unsigned long *count, int nr)
+{
+	struct page *page;
+	int freed = 0;
+
+	spin_lock(&pool->lock);
+	while (freed < nr && *count) {
+		page = list_first_entry(list, struct page, lru);
+		list_del(&page->lru);
+		(*count)--;
+		spin_unlock(&pool->lock);
+
+		ion_free_chunk(page, pool->order);
+		freed += 1 << pool->order;
+
+		spin_lock(&pool->lock);
+	}
+	spin_unlock(&pool->lock);
+
+	return freed;
+}
+
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys = container_of(shrinker,
+						   struct ion_system_heap,
+						   shrinker);
+	int nr = sc->nr_to_scan;
+	int i, freed = 0;
+
+	if (nr <= 0)
+		return ion_page_pool_total(sys);
+
+	for (i = 0; i < NUM_ORDERS && freed < nr; i++) {
+		struct ion_page_pool *pool = &sys->pools[i];
+
+		freed += ion_page_pool_shrink_list(pool, &pool->dirty,
+						   &pool->nr_dirty, nr - freed);
+	}
+	for (i = 0; i < NUM_ORDERS && freed < nr; i++) {
+		struct ion_page_pool *pool = &sys->pools[i];
+
+		freed += ion_page_pool_shrink_list(pool, &pool->clean,
+						   &pool->nr_clean, nr - freed);
+	}
+	atomic_add(freed, &sys->shrunk);
+
+	return ion_page_pool_total(sys);
+}
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *sys;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
-	if (!heap)
+	sys = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
+	if (!sys)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	sys->heap.ops = &vmalloc_ops;
+	sys->heap.type = ION_HEAP_TYPE_SYSTEM;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		struct ion_page_pool *pool = &sys->pools[i];
+
+		spin_lock_init(&pool->lock);
+		pool->order = orders[i];
+		INIT_LIST_HEAD(&pool->clean);
+		INIT_LIST_HEAD(&pool->dirty);
+	}
+
+	init_waitqueue_head(&sys->zero_wait);
+	sys->zero_thread = kthread_run(ion_system_heap_zero_thread, sys,
+				       "ion_zero");
+	if (IS_ERR(sys->zero_thread)) {
+		/* freed pages then get zeroed when they are reused */
+		pr_err("%s: failed to start zeroing thread\n", __func__);
+		sys->zero_thread = NULL;
+	}
+
+	sys->shrinker.shrink = ion_system_heap_shrink;
+	sys->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sys->shrinker);
+
+	return &sys->heap;
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys = to_system_heap(heap);
+	int i;
+
+	unregister_shrinker(&sys->shrinker);
+	if (sys->zero_thread)
+		kthread_stop(sys->zero_thread);
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		struct ion_page_pool *pool = &sys->pools[i];
+
+		ion_page_pool_shrink_list(pool, &pool->dirty, &pool->nr_dirty,
+					  INT_MAX);
+		ion_page_pool_shrink_list(pool, &pool->clean, &pool->nr_clean,
+					  INT_MAX);
+	}
+	kfree(sys);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
@@ -203,6 +627,17 @@ struct scatterlist *ion_system_contig_heap_map_dma(struct ion_heap *heap,
 	return sglist;
 }
 
+void *ion_system_contig_heap_map_kernel(struct ion_heap *heap,
+					struct ion_buffer *buffer)
+{
+	return buffer->priv_virt;
+}
+
+void ion_system_contig_heap_unmap_kernel(struct ion_heap *heap,
+					 struct ion_buffer *buffer)
+{
+}
+
 int ion_system_contig_heap_map_user(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    struct vm_area_struct *vma)
@@ -219,8 +654,8 @@ static struct ion_heap_ops kmalloc_ops = {
 	.phys = ion_system_contig_heap_phys,
 	.map_dma = ion_system_contig_heap_map_dma,
 	.unmap_dma = ion_system_heap_unmap_dma,
-	.map_kernel = ion_system_heap_map_kernel,
-	.unmap_kernel = ion_system_heap_unmap_kernel,
+	.map_kernel = ion_system_contig_heap_map_kernel,
+	.unmap_kernel = ion_system_contig_heap_unmap_kernel,
 	.map_user = ion_system_contig_heap_map_user,
 };
 
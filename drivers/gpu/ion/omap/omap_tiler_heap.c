@@ -17,11 +17,15 @@
 
 #include <linux/err.h>
 #include <linux/genalloc.h>
+#include <linux/highmem.h>
+#include <linux/hrtimer.h>
 #include <linux/io.h>
 #include <linux/ion.h>
 #include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/omap_ion.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <mach/tiler.h>
@@ -35,6 +39,49 @@
 bool use_dynamic_pages;
 #define TILER_ENABLE_NON_PAGE_ALIGNED_ALLOCATIONS  1
 
+/*
+ * Dynamic pages are taken in 64K chunks where the buddy allocator has
+ * them, so that one cache maintenance operation covers sixteen pages.
+ */
+#define TILER_CHUNK_ORDER	4
+
+/*
+ * Freed backing pages are kept for the next allocation.  The cpu only
+ * ever reaches them through the TILER aperture, never through their own
+ * physical address, so they are still clean from the flush done when they
+ * were first allocated and can be pinned again without maintenance.
+ */
+static unsigned int tiler_pool_max_pages = 2048;
+module_param(tiler_pool_max_pages, uint, 0644);
+
+static DEFINE_SPINLOCK(tiler_pool_lock);
+static LIST_HEAD(tiler_pool);
+static unsigned int tiler_pool_pages;
+
+/* allocation latency, bucketed by NV12 frame size */
+enum {
+	TILER_STAT_720P,
+	TILER_STAT_1080P,
+	TILER_STAT_LARGER,
+	TILER_STAT_NR,
+};
+
+static const char * const tiler_stat_names[TILER_STAT_NR] = {
+	"<=720p", "<=1080p", ">1080p",
+};
+
+static struct tiler_alloc_stats {
+	unsigned long count;
+	u64 total_ns;
+	u64 max_ns;
+} tiler_alloc_stats[TILER_STAT_NR];
+
+static unsigned long tiler_pool_hits;
+static unsigned long tiler_pages_allocated;
+static unsigned long tiler_chunks_allocated;
+static unsigned long tiler_full_flushes;
+static unsigned long tiler_range_flushes;
+
 struct omap_ion_heap {
 	struct ion_heap heap;
 	struct gen_pool *pool;
@@ -120,34 +167,121 @@ static void omap_tiler_free_carveout(struct ion_heap *heap,
 		gen_pool_free(omap_heap->pool, info->phys_addrs[i], PAGE_SIZE);
 }
 
-static int omap_tiler_alloc_dynamicpages(struct omap_tiler_info *info)
+static void per_cpu_cache_flush_arm(void *arg);
+
+/* Take up to @n clean pages from the pool; returns how many it took. */
+static u32 omap_tiler_pool_get(u32 *phys_addrs, u32 n)
 {
-	int i;
-	int ret;
 	struct page *pg;
+	u32 i = 0;
+
+	spin_lock(&tiler_pool_lock);
+	while (i < n && tiler_pool_pages) {
+		pg = list_first_entry(&tiler_pool, struct page, lru);
+		list_del(&pg->lru);
+		tiler_pool_pages--;
+		phys_addrs[i++] = page_to_phys(pg);
+	}
+	tiler_pool_hits += i;
+	spin_unlock(&tiler_pool_lock);
 
-	for (i = 0; i < info->n_phys_pages; i++) {
-		pg = alloc_page(GFP_KERNEL | GFP_DMA | GFP_HIGHUSER);
+	return i;
+}
+
+/*
+ * Write back and invalidate the pages in phys_addrs[start..n) in one go:
+ * each physically contiguous lowmem run gets a single L1 and a single L2
+ * range operation, highmem pages are mapped and flushed one at a time, and
+ * past FULL_CACHE_FLUSH_THRESHOLD the whole of both caches is flushed instead.
+ */
+static void omap_tiler_flush_pages(u32 *phys_addrs, u32 start, u32 n)
+{
+	u32 i, run;
+
+	if ((n - start) * PAGE_SIZE > FULL_CACHE_FLUSH_THRESHOLD) {
+		on_each_cpu(per_cpu_cache_flush_arm, NULL, 1);
+		outer_flush_all();
+		tiler_full_flushes++;
+		return;
+	}
+
+	for (i = start; i < n; i += run) {
+		struct page *pg = phys_to_page(phys_addrs[i]);
+		void *va;
+
+		run = 1;
+		if (PageHighMem(pg)) {
+			va = kmap_atomic(pg, KM_USER0);
+			dmac_flush_range(va, va + PAGE_SIZE);
+			kunmap_atomic(va, KM_USER0);
+		} else {
+			va = page_address(pg);
+			for (; i + run < n; run++) {
+				u32 pa = phys_addrs[i + run];
+
+				if (pa != phys_addrs[i] + run * PAGE_SIZE ||
+				    PageHighMem(phys_to_page(pa)))
+					break;
+			}
+			dmac_flush_range(va, va + run * PAGE_SIZE);
+		}
+
+		outer_flush_range(phys_addrs[i],
+				  phys_addrs[i] + run * PAGE_SIZE);
+		tiler_range_flushes++;
+	}
+}
+
+static void omap_tiler_free_dynamicpages(struct omap_tiler_info *info);
+
+static int omap_tiler_alloc_dynamicpages(struct omap_tiler_info *info)
+{
+	int j;
+	u32 i, reused;
+	struct page *pg;
+	unsigned int order;
+
+	reused = omap_tiler_pool_get(info->phys_addrs, info->n_phys_pages);
+
+	for (i = reused; i < info->n_phys_pages; i += 1 << order) {
+		order = 0;
+		pg = NULL;
+		if (info->n_phys_pages - i >= (1 << TILER_CHUNK_ORDER)) {
+			order = TILER_CHUNK_ORDER;
+			pg = alloc_pages(GFP_KERNEL | GFP_DMA | GFP_HIGHUSER |
+					 __GFP_NORETRY | __GFP_NOWARN, order);
+			if (pg) {
+				split_page(pg, order);
+				tiler_chunks_allocated++;
+			} else {
+				order = 0;
+			}
+		}
+		if (!pg)
+			pg = alloc_page(GFP_KERNEL | GFP_DMA | GFP_HIGHUSER);
 		if (!pg) {
-			ret = -ENOMEM;
 			pr_err("%s: alloc_page failed\n",
 				__func__);
 			goto err_page_alloc;
 		}
-		info->phys_addrs[i] = page_to_phys(pg);
-		dmac_flush_range((void *)page_address(pg),
-			(void *)page_address(pg) + PAGE_SIZE);
-		outer_flush_range(info->phys_addrs[i],
-			info->phys_addrs[i] + PAGE_SIZE);
+		for (j = 0; j < (1 << order); j++)
+			info->phys_addrs[i + j] = page_to_phys(pg + j);
+		tiler_pages_allocated += 1 << order;
 	}
+
+	/* only the fresh pages need cache maintenance */
+	if (reused < info->n_phys_pages)
+		omap_tiler_flush_pages(info->phys_addrs, reused,
+				       info->n_phys_pages);
 	return 0;
 
 err_page_alloc:
-	for (i -= 1; i >= 0; i--) {
-		pg = phys_to_page(info->phys_addrs[i]);
-		__free_page(pg);
-	}
-	return ret;
+	/* the fresh pages are not flushed yet, so don't pool them */
+	for (; i > reused; i--)
+		__free_page(phys_to_page(info->phys_addrs[i - 1]));
+	info->n_phys_pages = reused;
+	omap_tiler_free_dynamicpages(info);
+	return -ENOMEM;
 }
 
 static void omap_tiler_free_dynamicpages(struct omap_tiler_info *info)
@@ -155,13 +289,65 @@ static void omap_tiler_free_dynamicpages(struct omap_tiler_info *info)
 	int i;
 	struct page *pg;
 
+	spin_lock(&tiler_pool_lock);
 	for (i = 0; i < info->n_phys_pages; i++) {
 		pg = phys_to_page(info->phys_addrs[i]);
-		__free_page(pg);
+		if (tiler_pool_pages < tiler_pool_max_pages) {
+			list_add(&pg->lru, &tiler_pool);
+			tiler_pool_pages++;
+		} else {
+			__free_page(pg);
+		}
 	}
+	spin_unlock(&tiler_pool_lock);
 	return;
 }
 
+static int omap_tiler_pool_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct page *pg;
+	int nr = sc->nr_to_scan;
+
+	spin_lock(&tiler_pool_lock);
+	while (nr-- > 0 && tiler_pool_pages) {
+		pg = list_first_entry(&tiler_pool, struct page, lru);
+		list_del(&pg->lru);
+		tiler_pool_pages--;
+		__free_page(pg);
+	}
+	nr = tiler_pool_pages;
+	spin_unlock(&tiler_pool_lock);
+
+	return nr;
+}
+
+static struct shrinker omap_tiler_pool_shrinker = {
+	.shrink = omap_tiler_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+static bool tiler_pool_shrinker_registered;
+
+static void omap_tiler_account(u32 n_phys_pages, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	struct tiler_alloc_stats *st;
+
+	if (n_phys_pages <= PAGE_ALIGN(1280 * 720 * 3 / 2) >> PAGE_SHIFT)
+		st = &tiler_alloc_stats[TILER_STAT_720P];
+	else if (n_phys_pages <= PAGE_ALIGN(1920 * 1088 * 3 / 2) >> PAGE_SHIFT)
+		st = &tiler_alloc_stats[TILER_STAT_1080P];
+	else
+		st = &tiler_alloc_stats[TILER_STAT_LARGER];
+
+	spin_lock(&tiler_pool_lock);
+	st->count++;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	spin_unlock(&tiler_pool_lock);
+}
+
 int omap_tiler_alloc(struct ion_heap *heap,
 		     struct ion_client *client,
 		     struct omap_ion_tiler_alloc_data *data)
@@ -238,6 +424,8 @@ int omap_tiler_alloc(struct ion_heap *heap,
 
 	if ((heap->id == OMAP_ION_HEAP_TILER) ||
 	    (heap->id == OMAP_ION_HEAP_NONSECURE_TILER)) {
+		ktime_t start = ktime_get();
+
 		if (use_dynamic_pages)
 			ret = omap_tiler_alloc_dynamicpages(info);
 		else
@@ -245,6 +433,7 @@ int omap_tiler_alloc(struct ion_heap *heap,
 
 		if (ret)
 			goto err_alloc;
+		omap_tiler_account(info->n_phys_pages, start);
 
 		ret = tiler_pin_block(info->tiler_handle, info->phys_addrs,
 				      info->n_phys_pages);
@@ -454,6 +643,45 @@ int omap_tiler_heap_inval_user(struct ion_buffer *buffer, size_t len,
 	return omap_tiler_cache_operation(buffer, len, vaddr, CACHE_INVALIDATE);
 }
 
+static int omap_tiler_heap_debug_show(struct ion_heap *heap,
+				      struct seq_file *s)
+{
+	struct tiler_alloc_stats stats[TILER_STAT_NR];
+	unsigned int pool_pages;
+	int i;
+
+	spin_lock(&tiler_pool_lock);
+	memcpy(stats, tiler_alloc_stats, sizeof(stats));
+	pool_pages = tiler_pool_pages;
+	spin_unlock(&tiler_pool_lock);
+
+	seq_printf(s, "\n%s pages\n", use_dynamic_pages ? "dynamic" : "carveout");
+	seq_printf(s, "%8s %8s %12s %12s\n", "size", "allocs",
+		   "avg_us", "max_us");
+	for (i = 0; i < TILER_STAT_NR; i++) {
+		u64 avg = stats[i].total_ns;
+
+		if (stats[i].count)
+			do_div(avg, stats[i].count);
+		do_div(avg, NSEC_PER_USEC);
+		do_div(stats[i].max_ns, NSEC_PER_USEC);
+		seq_printf(s, "%8s %8lu %12llu %12llu\n", tiler_stat_names[i],
+			   stats[i].count, avg, stats[i].max_ns);
+	}
+
+	if (!use_dynamic_pages)
+		return 0;
+
+	seq_printf(s, "pool pages: %u (max %u)\n", pool_pages,
+		   tiler_pool_max_pages);
+	seq_printf(s, "pages reused from pool: %lu\n", tiler_pool_hits);
+	seq_printf(s, "pages allocated: %lu in %lu 64K chunks\n",
+		   tiler_pages_allocated, tiler_chunks_allocated);
+	seq_printf(s, "cache flushes: %lu full, %lu by range\n",
+		   tiler_full_flushes, tiler_range_flushes);
+	return 0;
+}
+
 static struct ion_heap_ops omap_tiler_ops = {
 	.allocate = omap_tiler_heap_allocate,
 	.free = omap_tiler_heap_free,
@@ -461,6 +689,7 @@ static struct ion_heap_ops omap_tiler_ops = {
 	.map_user = omap_tiler_heap_map_user,
 	.flush_user = omap_tiler_heap_flush_user,
 	.inval_user = omap_tiler_heap_inval_user,
+	.debug_show = omap_tiler_heap_debug_show,
 };
 
 struct ion_heap *omap_tiler_heap_create(struct ion_platform_heap *data)
@@ -496,6 +725,11 @@ struct ion_heap *omap_tiler_heap_create(struct ion_platform_heap *data)
 		use_dynamic_pages = false;
 #endif
 
+	if (use_dynamic_pages && !tiler_pool_shrinker_registered) {
+		register_shrinker(&omap_tiler_pool_shrinker);
+		tiler_pool_shrinker_registered = true;
+	}
+
 	return &heap->heap;
 }
 
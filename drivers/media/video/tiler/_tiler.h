@@ -86,12 +86,14 @@ struct gid_info {
 struct area_info {
 	struct list_head by_gid;	/* areas in this sid/gid */
 	struct list_head blocks;	/* blocks in this area */
+	struct list_head all;		/* all 2D areas */
 	u32 nblocks;			/* # of blocks in this area */
 
 	struct tcm_area area;		/* area details */
 	struct gid_info *gi;		/* link to parent, if still alive */
 
 	u32 allowed_modes;
+	u16 align;			/* alignment of area (in slots) */
 };
 
 /* info for a block */
@@ -55,6 +55,17 @@ struct tcm_area {
 	struct tcm_pt  p1;
 };
 
+/* container usage and allocator cost, see tcm_get_stats() */
+struct tcm_stats {
+	u32 reserve_2d;		/* 2D reservations attempted */
+	u32 reserve_1d;		/* 1D reservations attempted */
+	u32 failed;		/* reservations that found no space */
+	u64 probes;		/* candidate positions examined */
+	u32 free_slots;		/* currently free slots */
+	u32 free_runs;		/* maximal horizontal runs of free slots */
+	u16 max_run;		/* longest horizontal run of free slots */
+};
+
 struct tcm {
 	u16 width, height;	/* container dimensions */
 
@@ -70,6 +81,7 @@ struct tcm {
 	s32 (*reserve_1d)(struct tcm *tcm, u32 slots, struct tcm_area *area);
 	s32 (*free)      (struct tcm *tcm, struct tcm_area *area);
 	void (*deinit)   (struct tcm *tcm);
+	void (*get_stats)(struct tcm *tcm, struct tcm_stats *stats);
 };
 
 /*=============================================================================
@@ -216,6 +228,21 @@ static inline s32 tcm_free(struct tcm_area *area)
 	return res;
 }
 
+/**
+ * Get usage and allocation cost statistics of a container.
+ *
+ * @param tcm	Pointer to container manager.
+ * @param stats	Pointer to where the statistics should be stored.  All
+ *		fields are zero if the container manager does not keep
+ *		statistics.
+ */
+static inline void tcm_get_stats(struct tcm *tcm, struct tcm_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (tcm && tcm->get_stats)
+		tcm->get_stats(tcm, stats);
+}
+
 /*=============================================================================
     HELPER FUNCTION FOR ANY TILER CONTAINER MANAGER
 =============================================================================*/
@@ -76,10 +76,19 @@ struct score {
 	u16    neighs;		/* number of busy neighbors */
 };
 
+/*
+ * Besides the slot map, a bitmap of busy slots and the longest free run is
+ * kept for every row, so that rows that cannot hold an area are skipped
+ * and free areas are checked a word at a time.
+ */
 struct sita_pvt {
 	struct mutex mtx;
 	struct tcm_pt div_pt;	/* divider point splitting container */
 	struct tcm_area ***map;	/* pointers to the parent area for each slot */
+	unsigned long *busy;	/* busy slot bitmap, row_longs per row */
+	u16 row_longs;		/* longs in a row of the busy bitmap */
+	u16 *max_run;		/* longest free run in each row */
+	struct tcm_stats stats;	/* allocation counters */
 };
 
 #endif
@@ -17,6 +17,7 @@
  * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
  *
  */
+#include <linux/bitmap.h>
 #include <linux/slab.h>
 
 #include "_tcm-sita.h"
@@ -46,6 +47,7 @@ static s32 sita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
 static s32 sita_reserve_1d(struct tcm *tcm, u32 slots, struct tcm_area *area);
 static s32 sita_free(struct tcm *tcm, struct tcm_area *area);
 static void sita_deinit(struct tcm *tcm);
+static void sita_get_stats(struct tcm *tcm, struct tcm_stats *stats);
 
 /*********************************************
  *	Main Scanner functions
@@ -72,7 +74,9 @@ static s32 scan_r2l_b2t_one_dim(struct tcm *tcm, u32 num_slots,
 /*********************************************
  *	Support Infrastructure Methods
  *********************************************/
-static s32 is_area_free(struct tcm_area ***map, u16 x0, u16 y0, u16 w, u16 h);
+static s32 is_area_free(struct sita_pvt *pvt, u16 x0, u16 y0, u16 w, u16 h);
+
+static s32 last_short_row(struct sita_pvt *pvt, u16 y0, u16 w, u16 h);
 
 static s32 update_candidate(struct tcm *tcm, u16 x0, u16 y0, u16 w, u16 h,
 			    struct tcm_area *field, s32 criteria,
@@ -118,6 +122,7 @@ struct tcm *sita_init(u16 width, u16 height, struct tcm_pt *attr)
 	tcm->reserve_1d = sita_reserve_1d;
 	tcm->free = sita_free;
 	tcm->deinit = sita_deinit;
+	tcm->get_stats = sita_get_stats;
 	tcm->pvt = (void *)pvt;
 
 	mutex_init(&(pvt->mtx));
@@ -139,6 +144,21 @@ struct tcm *sita_init(u16 width, u16 height, struct tcm_pt *attr)
 		}
 	}
 
+	/* Creating free space index */
+	pvt->row_longs = BITS_TO_LONGS(tcm->width);
+	pvt->busy = kzalloc(sizeof(*pvt->busy) * pvt->row_longs * tcm->height,
+								GFP_KERNEL);
+	pvt->max_run = kmalloc(sizeof(*pvt->max_run) * tcm->height,
+								GFP_KERNEL);
+	if (!pvt->busy || !pvt->max_run) {
+		kfree(pvt->busy);
+		kfree(pvt->max_run);
+		for (i = 0; i < tcm->width; i++)
+			kfree(pvt->map[i]);
+		kfree(pvt->map);
+		goto error;
+	}
+
 	if (attr && attr->x <= tcm->width && attr->y <= tcm->height) {
 		pvt->div_pt.x = attr->x;
 		pvt->div_pt.y = attr->y;
@@ -177,12 +197,61 @@ static void sita_deinit(struct tcm *tcm)
 
 	mutex_destroy(&(pvt->mtx));
 
-	for (i = 0; i < tcm->height; i++)
+	for (i = 0; i < tcm->width; i++)
 		kfree(pvt->map[i]);
 	kfree(pvt->map);
+	kfree(pvt->busy);
+	kfree(pvt->max_run);
 	kfree(pvt);
 }
 
+/* busy slot bitmap of a row */
+static inline unsigned long *row_busy(struct sita_pvt *pvt, u16 y)
+{
+	return pvt->busy + y * pvt->row_longs;
+}
+
+/* recalculate the longest free run of a row */
+static void update_max_run(struct tcm *tcm, u16 y)
+{
+	struct sita_pvt *pvt = (struct sita_pvt *)tcm->pvt;
+	unsigned long *row = row_busy(pvt, y);
+	u16 x0, x1 = 0, max = 0;
+
+	while (x1 < tcm->width) {
+		x0 = find_next_zero_bit(row, tcm->width, x1);
+		if (x0 >= tcm->width)
+			break;
+		x1 = find_next_bit(row, tcm->width, x0);
+		max = max_t(u16, max, x1 - x0);
+	}
+	pvt->max_run[y] = max;
+}
+
+static void sita_get_stats(struct tcm *tcm, struct tcm_stats *stats)
+{
+	struct sita_pvt *pvt = (struct sita_pvt *)tcm->pvt;
+	unsigned long *row;
+	u16 x0, x1, y;
+
+	mutex_lock(&(pvt->mtx));
+	*stats = pvt->stats;
+	for (y = 0; y < tcm->height; y++) {
+		row = row_busy(pvt, y);
+		stats->free_slots += tcm->width -
+					bitmap_weight(row, tcm->width);
+		stats->max_run = max(stats->max_run, pvt->max_run[y]);
+		for (x1 = 0; x1 < tcm->width; ) {
+			x0 = find_next_zero_bit(row, tcm->width, x1);
+			if (x0 >= tcm->width)
+				break;
+			x1 = find_next_bit(row, tcm->width, x0);
+			stats->free_runs++;
+		}
+	}
+	mutex_unlock(&(pvt->mtx));
+}
+
 /**
  * Reserve a 1D area in the container
  *
@@ -207,10 +276,13 @@ static s32 sita_reserve_1d(struct tcm *tcm, u32 num_slots,
 	/* Scanning entire container */
 	assign(&field, tcm->width - 1, tcm->height - 1, 0, 0);
 #endif
+	pvt->stats.reserve_1d++;
 	ret = scan_r2l_b2t_one_dim(tcm, num_slots, &field, area);
 	if (!ret)
 		/* update map */
 		fill_area(tcm, area, area);
+	else
+		pvt->stats.failed++;
 
 	mutex_unlock(&(pvt->mtx));
 	return ret;
@@ -240,10 +312,13 @@ static s32 sita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
 	align = align <= 1 ? 1 : align <= 32 ? 32 : 64;
 
 	mutex_lock(&(pvt->mtx));
+	pvt->stats.reserve_2d++;
 	ret = scan_areas_and_find_fit(tcm, w, h, align, area);
 	if (!ret)
 		/* update map */
 		fill_area(tcm, area, area);
+	else
+		pvt->stats.failed++;
 
 	mutex_unlock(&(pvt->mtx));
 	return ret;
@@ -295,9 +370,10 @@ static s32 sita_free(struct tcm *tcm, struct tcm_area *area)
 static s32 scan_r2l_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
 			struct tcm_area *field, struct tcm_area *area)
 {
-	s32 x, y;
+	s32 x, y, r;
 	s16 start_x, end_x, start_y, end_y, found_x = -1;
-	struct tcm_area ***map = ((struct sita_pvt *)tcm->pvt)->map;
+	struct sita_pvt *pvt = (struct sita_pvt *)tcm->pvt;
+	struct tcm_area ***map = pvt->map;
 	struct score best = {{0}, {0}, {0}, 0};
 
 	PA(2, "scan_r2l_t2b:", field);
@@ -328,8 +404,15 @@ static s32 scan_r2l_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
 
 	/* scan field top-to-bottom, right-to-left */
 	for (y = start_y; y <= end_y; y++) {
+		/* no start row up to a row that is too full can work */
+		r = last_short_row(pvt, y, w, h);
+		if (r >= 0) {
+			y = r;
+			continue;
+		}
+
 		for (x = start_x; x >= end_x; x -= align) {
-			if (is_area_free(map, x, y, w, h)) {
+			if (is_area_free(pvt, x, y, w, h)) {
 				P3("found shoulder: %d,%d", x, y);
 				found_x = x;
 
@@ -382,9 +465,10 @@ static s32 scan_r2l_b2t(struct tcm *tcm, u16 w, u16 h, u16 align,
 	/* TODO: Should I check scan area?
 	 * Might have to take it as input during initialization
 	 */
-	s32 x, y;
+	s32 x, y, r;
 	s16 start_x, end_x, start_y, end_y, found_x = -1;
-	struct tcm_area ***map = ((struct sita_pvt *)tcm->pvt)->map;
+	struct sita_pvt *pvt = (struct sita_pvt *)tcm->pvt;
+	struct tcm_area ***map = pvt->map;
 	struct score best = {{0}, {0}, {0}, 0};
 
 	PA(2, "scan_r2l_b2t:", field);
@@ -415,8 +499,15 @@ static s32 scan_r2l_b2t(struct tcm *tcm, u16 w, u16 h, u16 align,
 
 	/* scan field bottom-to-top, right-to-left */
 	for (y = start_y; y >= end_y; y--) {
+		/* no start row that covers a row that is too full can work */
+		r = last_short_row(pvt, y, w, h);
+		if (r >= 0) {
+			y = r - h + 1;
+			continue;
+		}
+
 		for (x = start_x; x >= end_x; x -= align) {
-			if (is_area_free(map, x, y, w, h)) {
+			if (is_area_free(pvt, x, y, w, h)) {
 				P3("found shoulder: %d,%d", x, y);
 				found_x = x;
 
@@ -465,9 +556,10 @@ done:
 static s32 scan_l2r_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
 			struct tcm_area *field, struct tcm_area *area)
 {
-	s32 x, y;
+	s32 x, y, r;
 	s16 start_x, end_x, start_y, end_y, found_x = -1;
-	struct tcm_area ***map = ((struct sita_pvt *)tcm->pvt)->map;
+	struct sita_pvt *pvt = (struct sita_pvt *)tcm->pvt;
+	struct tcm_area ***map = pvt->map;
 	struct score best = {{0}, {0}, {0}, 0};
 
 	PA(2, "scan_l2r_t2b:", field);
@@ -500,8 +592,15 @@ static s32 scan_l2r_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
 
 	/* scan field top-to-bottom, left-to-right */
 	for (y = start_y; y <= end_y; y++) {
+		/* no start row up to a row that is too full can work */
+		r = last_short_row(pvt, y, w, h);
+		if (r >= 0) {
+			y = r;
+			continue;
+		}
+
 		for (x = start_x; x <= end_x; x += align) {
-			if (is_area_free(map, x, y, w, h)) {
+			if (is_area_free(pvt, x, y, w, h)) {
 				P3("found shoulder: %d,%d", x, y);
 				found_x = x;
 
@@ -550,9 +649,10 @@ done:
 static s32 scan_l2r_b2t(struct tcm *tcm, u16 w, u16 h, u16 align,
 			struct tcm_area *field, struct tcm_area *area)
 {
-	s32 x, y;
+	s32 x, y, r;
 	s16 start_x, end_x, start_y, end_y, found_x = -1;
-	struct tcm_area ***map = ((struct sita_pvt *)tcm->pvt)->map;
+	struct sita_pvt *pvt = (struct sita_pvt *)tcm->pvt;
+	struct tcm_area ***map = pvt->map;
 	struct score best = {{0}, {0}, {0}, 0};
 
 	PA(2, "scan_l2r_b2t:", field);
@@ -585,8 +685,15 @@ static s32 scan_l2r_b2t(struct tcm *tcm, u16 w, u16 h, u16 align,
 
 	/* scan field bottom-to-top, left-to-right */
 	for (y = start_y; y >= end_y; y--) {
+		/* no start row that covers a row that is too full can work */
+		r = last_short_row(pvt, y, w, h);
+		if (r >= 0) {
+			y = r - h + 1;
+			continue;
+		}
+
 		for (x = start_x; x <= end_x; x += align) {
-			if (is_area_free(map, x, y, w, h)) {
+			if (is_area_free(pvt, x, y, w, h)) {
 				P3("found shoulder: %d,%d", x, y);
 				found_x = x;
 
@@ -672,6 +779,20 @@ static s32 scan_r2l_b2t_one_dim(struct tcm *tcm, u32 num_slots,
 			area->p1.y = y;
 		}
 
+		pvt->stats.probes++;
+
+		/* take entirely free rows in one step */
+		if (x == tcm->width - 1 && pvt->max_run[y] == tcm->width) {
+			if (num_slots - found <= tcm->width) {
+				x = tcm->width - (num_slots - found);
+				found = num_slots;
+				break;
+			}
+			found += tcm->width;
+			y--;
+			continue;
+		}
+
 		/* skip busy regions */
 		p = pvt->map[x][y];
 		if (p) {
@@ -770,18 +891,33 @@ static s32 scan_areas_and_find_fit(struct tcm *tcm, u16 w, u16 h, u16 align,
 }
 
 /* check if an entire area is free */
-static s32 is_area_free(struct tcm_area ***map, u16 x0, u16 y0, u16 w, u16 h)
+static s32 is_area_free(struct sita_pvt *pvt, u16 x0, u16 y0, u16 w, u16 h)
 {
-	u16 x = 0, y = 0;
+	u16 y;
+
+	pvt->stats.probes++;
 	for (y = y0; y < y0 + h; y++) {
-		for (x = x0; x < x0 + w; x++) {
-			if (map[x][y])
-				return false;
-		}
+		if (pvt->max_run[y] < w ||
+		    find_next_bit(row_busy(pvt, y), x0 + w, x0) < x0 + w)
+			return false;
 	}
 	return true;
 }
 
+/*
+ * Return the last row of rows y0..y0+h-1 that has no free run of w slots,
+ * or -1 if every row has one.
+ */
+static s32 last_short_row(struct sita_pvt *pvt, u16 y0, u16 w, u16 h)
+{
+	s32 y;
+
+	for (y = y0 + h - 1; y >= y0; y--)
+		if (pvt->max_run[y] < w)
+			return y;
+	return -1;
+}
+
 /* fills an area with a parent tcm_area */
 static void fill_area(struct tcm *tcm, struct tcm_area *area,
 			struct tcm_area *parent)
@@ -799,6 +935,15 @@ static void fill_area(struct tcm *tcm, struct tcm_area *area,
 			for (y = a.p0.y; y <= a.p1.y; ++y)
 				pvt->map[x][y] = parent;
 
+		for (y = a.p0.y; y <= a.p1.y; ++y) {
+			if (parent)
+				bitmap_set(row_busy(pvt, y), a.p0.x,
+					   a.p1.x - a.p0.x + 1);
+			else
+				bitmap_clear(row_busy(pvt, y), a.p0.x,
+					     a.p1.x - a.p0.x + 1);
+			update_max_run(tcm, y);
+		}
 	}
 }
 
@@ -63,6 +63,15 @@ static struct tiler_ops tiler;		/* shared methods and variables */
 static struct list_head blocks;		/* all tiler blocks */
 static struct list_head orphan_areas;	/* orphaned 2D areas */
 static struct list_head orphan_onedim;	/* orphaned 1D areas */
+static struct list_head all_areas;	/* all 2D areas, for defrag */
+
+/* defragmentation counters */
+static struct {
+	u32 runs;			/* reservation failures that ran it */
+	u32 areas_moved;		/* areas relocated */
+	u32 slots_moved;		/* slots in relocated areas */
+	u32 retries_ok;			/* retried reservations that fit */
+} defrag_stats;
 
 #ifdef CONFIG_TILER_ENABLE_USERSPACE
 struct tiler_dev {
@@ -240,6 +249,30 @@ static void map_2d_info(char **map, int xdiv, int ydiv, char *nice,
 							a->p0.x, a->p1.x);
 }
 
+static void debug_stats(struct seq_file *s, u32 arg)
+{
+	struct tcm_stats st;
+
+	tcm_get_stats(tcm[TILFMT_8BIT], &st);
+
+	seq_printf(s, "reservations: %u 2D, %u 1D, %u failed\n",
+		   st.reserve_2d, st.reserve_1d, st.failed);
+	seq_printf(s, "positions probed: %llu\n", st.probes);
+	seq_printf(s, "free slots: %u in %u runs, longest run %u\n",
+		   st.free_slots, st.free_runs, st.max_run);
+
+	mutex_lock(&mtx);
+	seq_printf(s, "defrag: %u runs, %u areas (%u slots) moved, "
+		   "%u reservations saved\n", defrag_stats.runs,
+		   defrag_stats.areas_moved, defrag_stats.slots_moved,
+		   defrag_stats.retries_ok);
+	mutex_unlock(&mtx);
+}
+
+static const struct tiler_debugfs_data debugfs_stats = {
+	"stats", debug_stats, 0
+};
+
 static void debug_allocation_map(struct seq_file *s, u32 arg)
 {
 	int xdiv = (arg >> 8) & 0xFF;
@@ -422,12 +455,101 @@ static void release_gi(struct gid_info *gi)
  *  ==========================================================================
  */
 
+/* (must have mutex) check that no block of an area has been handed out */
+static bool _m_area_idle(struct area_info *ai)
+{
+	struct mem_info *mi;
+
+	list_for_each_entry(mi, &ai->blocks, by_area)
+		if (mi->alloced || mi->refs || mi->pa.mem)
+			return false;
+	return true;
+}
+
+/* whether area a is closer than area b to where SiTA starts scanning */
+static bool _m_area_better(struct tcm_area *a, struct tcm_area *b, u16 align)
+{
+	if (a->p0.y != b->p0.y)
+		return a->p0.y < b->p0.y;
+	/* aligned areas are packed from the left, others from the right */
+	return align > 1 ? a->p0.x < b->p0.x : a->p1.x > b->p1.x;
+}
+
+/*
+ * Relocate idle 2D areas, i.e. ones only holding blocks that were reserved
+ * but never handed out, to the best place the container now has for them,
+ * so that the space they leave behind can coalesce.  Blocks that have been
+ * handed out cannot move: their TILER address is known to their users.
+ *
+ * Returns the number of areas moved.
+ */
+static int defrag_areas(struct tcm *tcm)
+{
+	struct area_info *ai, *ai_, *nai;
+	struct mem_info *mi;
+	int moved = 0;
+
+	mutex_lock(&mtx);
+	defrag_stats.runs++;
+	list_for_each_entry_safe(ai, ai_, &all_areas, all) {
+		if (ai->area.tcm != tcm || !ai->gi || !_m_area_idle(ai))
+			continue;
+
+		nai = kzalloc(sizeof(*nai), GFP_KERNEL);
+		if (!nai)
+			break;
+
+		/* the old area is still held, so this can only be elsewhere */
+		if (tcm_reserve_2d(tcm, tcm_awidth(ai->area),
+				   tcm_aheight(ai->area), ai->align,
+				   &nai->area)) {
+			kfree(nai);
+			continue;
+		}
+		if (!_m_area_better(&nai->area, &ai->area, ai->align)) {
+			tcm_free(&nai->area);
+			kfree(nai);
+			continue;
+		}
+
+		/* blocks keep their offset within the area */
+		list_for_each_entry(mi, &ai->blocks, by_area) {
+			u16 w = tcm_awidth(mi->area);
+
+			mi->area.p0.x += nai->area.p0.x - ai->area.p0.x;
+			mi->area.p1.x = mi->area.p0.x + w - 1;
+			mi->area.p0.y = nai->area.p0.y;
+			mi->area.p1.y = nai->area.p1.y;
+			mi->parent = nai;
+		}
+
+		INIT_LIST_HEAD(&nai->blocks);
+		list_splice(&ai->blocks, &nai->blocks);
+		nai->nblocks = ai->nblocks;
+		nai->gi = ai->gi;
+		nai->allowed_modes = ai->allowed_modes;
+		nai->align = ai->align;
+		list_replace(&ai->by_gid, &nai->by_gid);
+		list_replace(&ai->all, &nai->all);
+
+		defrag_stats.areas_moved++;
+		defrag_stats.slots_moved += tcm_sizeof(ai->area);
+		tcm_free(&ai->area);
+		kfree(ai);
+		moved++;
+	}
+	mutex_unlock(&mtx);
+
+	return moved;
+}
+
 /* allocate an reserved area of size, alignment and link it to gi */
 /* leaves mutex locked to be able to add block to area */
 static struct area_info *area_new_m(enum tiler_fmt fmt, u16 width, u16 height,
 					u16 align, struct gid_info *gi,
 					u32 alloc_flags)
 {
+	bool defragged = false;
 	struct area_info *ai = kmalloc(sizeof(*ai), GFP_KERNEL);
 	if (!ai)
 		return NULL;
@@ -436,18 +558,26 @@ static struct area_info *area_new_m(enum tiler_fmt fmt, u16 width, u16 height,
 	memset(ai, 0x0, sizeof(*ai));
 	INIT_LIST_HEAD(&ai->blocks);
 
-	/* reserve an allocation area */
+	/* reserve an allocation area, making room once if needed */
 	if (tcm_reserve_2d(tcm[fmt], width, height, align, &ai->area)) {
-		kfree(ai);
-		return NULL;
+		if (!defrag_areas(tcm[fmt]) ||
+		    tcm_reserve_2d(tcm[fmt], width, height, align, &ai->area)) {
+			kfree(ai);
+			return NULL;
+		}
+		defragged = true;
 	}
 
 	ai->gi = gi;
+	ai->align = align;
 	if (alloc_flags & FLAGS_ALLOC_NO_COLOCATE)
 		ai->allowed_modes |= 1 << fmt;
 
 	mutex_lock(&mtx);
+	if (defragged)
+		defrag_stats.retries_ok++;
 	list_add_tail(&ai->by_gid, &gi->areas);
+	list_add_tail(&ai->all, &all_areas);
 	return ai;
 }
 
@@ -456,6 +586,7 @@ static inline void _m_area_free(struct area_info *ai)
 {
 	if (ai) {
 		list_del(&ai->by_gid);
+		list_del(&ai->all);
 		kfree(ai);
 	}
 }
@@ -901,6 +1032,7 @@ static s32 _m_free(struct mem_info *mi)
 
 			res = tcm_free(&ai->area);
 			list_del(&ai->by_gid);
+			list_del(&ai->all);
 			/* try to remove parent if it became empty */
 			_m_try_free_group(ai->gi);
 			kfree(ai);
@@ -1212,11 +1344,12 @@ static struct mem_info *alloc_area(enum tiler_fmt fmt, u32 width, u32 height,
 	mi->alloced = true;
 	mi->refs++;
 	gi->refs--;
-	mutex_unlock(&mtx);
 
+	/* the area is fixed from here on, as the block is no longer idle */
 	mi->blk.phys = tiler.addr(fmt,
 		mi->area.p0.x * g->slot_w,
 		mi->area.p0.y * g->slot_h) + remainder;
+	mutex_unlock(&mtx);
 	return mi;
 }
 
@@ -1713,12 +1846,16 @@ static s32 __init tiler_init(void)
 	INIT_LIST_HEAD(&blocks);
 	INIT_LIST_HEAD(&orphan_areas);
 	INIT_LIST_HEAD(&orphan_onedim);
+	INIT_LIST_HEAD(&all_areas);
 
 	dbgfs = debugfs_create_dir("tiler", NULL);
 	if (IS_ERR_OR_NULL(dbgfs))
 		dev_warn(device, "failed to create debug files.\n");
 	else
 		dbg_map = debugfs_create_dir("map", dbgfs);
+	if (!IS_ERR_OR_NULL(dbgfs))
+		debugfs_create_file(debugfs_stats.name, S_IRUGO, dbgfs,
+				(void *) &debugfs_stats, &tiler_debug_fops);
 	if (!IS_ERR_OR_NULL(dbg_map)) {
 		int i;
 		for (i = 0; i < ARRAY_SIZE(debugfs_maps); i++)
@@ -1805,6 +1942,22 @@ void tiler_free_block_area(tiler_blk_handle block)
 }
 EXPORT_SYMBOL(tiler_free_block_area);
 
+tiler_blk_handle tiler_get_block(u32 ssptr)
+{
+	/* if tiler is not initialized fail gracefully */
+	if (!tilerdev_class)
+		return NULL;
+
+	return find_block_by_ssptr(ssptr);
+}
+EXPORT_SYMBOL(tiler_get_block);
+
+void tiler_put_block(tiler_blk_handle block)
+{
+	unlock_n_free(block, false);
+}
+EXPORT_SYMBOL(tiler_put_block);
+
 tiler_blk_handle tiler_alloc_block_area(enum tiler_fmt fmt, u32 width,
 					u32 height, u32 *ssptr, u32 *virt_array)
 {
@@ -336,6 +336,39 @@ static void free_callback(struct gccallbackinfo *gccallbackinfo)
 	GCUNLOCK(&gccontext->callbacklock);
 }
 
+/* Asynchronous batches are counted from submission until their completion
+ * callback, so that CPU operations know whether they may overtake the 2D
+ * core. */
+static void async_submit(void)
+{
+	struct gccontext *gccontext = get_context();
+
+	GCLOCK(&gccontext->callbacklock);
+	gccontext->asyncpending += 1;
+	GCUNLOCK(&gccontext->callbacklock);
+}
+
+static void async_complete(void)
+{
+	struct gccontext *gccontext = get_context();
+
+	GCLOCK(&gccontext->callbacklock);
+	gccontext->asyncpending -= 1;
+	GCUNLOCK(&gccontext->callbacklock);
+}
+
+bool async_idle(void)
+{
+	struct gccontext *gccontext = get_context();
+	bool idle;
+
+	GCLOCK(&gccontext->callbacklock);
+	idle = (gccontext->asyncpending == 0);
+	GCUNLOCK(&gccontext->callbacklock);
+
+	return idle;
+}
+
 void callbackbltsville(void *callbackinfo)
 {
 	struct gccallbackinfo *gccallbackinfo;
@@ -348,8 +381,11 @@ void callbackbltsville(void *callbackinfo)
 	GCDBG(GCZONE_CALLBACK, "bltsville_param    = 0x%08X\n",
 	      (unsigned int) gccallbackinfo->info.callback.data);
 
-	gccallbackinfo->info.callback.fn(NULL,
-					 gccallbackinfo->info.callback.data);
+	async_complete();
+
+	if (gccallbackinfo->info.callback.fn != NULL)
+		gccallbackinfo->info.callback.fn(NULL,
+					gccallbackinfo->info.callback.data);
 	free_callback(gccallbackinfo);
 
 	GCEXIT(GCZONE_CALLBACK);
@@ -1136,6 +1172,7 @@ void bv_init(void)
 	GCDBG_REGISTER(fill);
 	GCDBG_REGISTER(blit);
 	GCDBG_REGISTER(filter);
+	GCDBG_REGISTER(cpu);
 
 	GCLOCK_INIT(&gccontext->batchlock);
 	GCLOCK_INIT(&gccontext->bufferlock);
@@ -1411,6 +1448,8 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 	struct bvrect *srcrect[2];
 	unsigned short rop;
 	struct gcicommit gcicommit;
+	struct gccpuop gccpuop;
+	bool cpuexec = false;
 	int i, srccount, res;
 
 	GCENTERARG(GCZONE_BLIT, "bvbltparams = 0x%08X\n",
@@ -1703,6 +1742,12 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 			BVSETBLTERROR(BVERR_OP,
 				      "operation not supported");
 			goto exit;
+		} else if ((type == (BVFLAG_BATCH_NONE >> BVFLAG_BATCH_SHIFT)) &&
+			   (srccount == 1) &&
+			   cpu_prepare(bvbltparams, gcbatch,
+				       &srcinfo[0], &gccpuop)) {
+			GCDBG(GCZONE_BLIT, "  op: cpu.\n");
+			cpuexec = true;
 		} else {
 			for (i = 0; i < srccount; i += 1) {
 				int srcw, srch;
@@ -1768,7 +1813,11 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 		}
 	}
 
-	if (batchexec) {
+	/* A CPU operation only needs the 2D core to drain the work
+	 * submitted ahead of it.  Synchronous batches are complete by the
+	 * time they return; work of other gccore clients is not ordered
+	 * against ours. */
+	if (batchexec && (!cpuexec || (!async_idle() && !gc_idle()))) {
 		struct gcmoflush *flush;
 
 		GCDBG(GCZONE_BLIT, "preparing to submit the batch.\n");
@@ -1790,7 +1839,7 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 		flush->flush.reg = gcregflush_pe2D;
 
 		/* Process asynchronous operation. */
-		if ((bvbltparams->flags & BVFLAG_ASYNC) == 0) {
+		if (((bvbltparams->flags & BVFLAG_ASYNC) == 0) || cpuexec) {
 			GCDBG(GCZONE_BLIT, "synchronous batch.\n");
 			gcicommit.callback = NULL;
 			gcicommit.callbackparam = NULL;
@@ -1801,44 +1850,40 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 			GCDBG(GCZONE_BLIT, "asynchronous batch (0x%08X):\n",
 			      bvbltparams->flags);
 
-			if (bvbltparams->callbackfn == NULL) {
-				GCDBG(GCZONE_BLIT, "no callback given.\n");
-				gcicommit.callback = NULL;
-				gcicommit.callbackparam = NULL;
-			} else {
-				bverror = get_callbackinfo(&gccallbackinfo);
-				if (bverror != BVERR_NONE) {
-					BVSETBLTERROR(BVERR_OOM,
-						      "callback allocation "
-						      "failed");
-					goto exit;
-				}
-
-				gccallbackinfo->info.callback.fn
-					= bvbltparams->callbackfn;
-				gccallbackinfo->info.callback.data
-					= bvbltparams->callbackdata;
-
-				gcicommit.callback = callbackbltsville;
-				gcicommit.callbackparam = gccallbackinfo;
-
-				GCDBG(GCZONE_BLIT,
-				      "gcbv_callback = 0x%08X\n",
-				      (unsigned int) gcicommit.callback);
-				GCDBG(GCZONE_BLIT,
-				      "gcbv_param    = 0x%08X\n",
-				      (unsigned int) gcicommit.callbackparam);
-				GCDBG(GCZONE_BLIT,
-				      "bltsville_callback = 0x%08X\n",
-				      (unsigned int)
-				      gccallbackinfo->info.callback.fn);
-				GCDBG(GCZONE_BLIT,
-				      "bltsville_param    = 0x%08X\n",
-				      (unsigned int)
-				      gccallbackinfo->info.callback.data);
+			/* The callback is armed even when the client did
+			 * not give one, to track completion of the batch. */
+			bverror = get_callbackinfo(&gccallbackinfo);
+			if (bverror != BVERR_NONE) {
+				BVSETBLTERROR(BVERR_OOM,
+					      "callback allocation failed");
+				goto exit;
 			}
 
+			gccallbackinfo->info.callback.fn
+				= bvbltparams->callbackfn;
+			gccallbackinfo->info.callback.data
+				= bvbltparams->callbackdata;
+
+			gcicommit.callback = callbackbltsville;
+			gcicommit.callbackparam = gccallbackinfo;
+
+			GCDBG(GCZONE_BLIT,
+			      "gcbv_callback = 0x%08X\n",
+			      (unsigned int) gcicommit.callback);
+			GCDBG(GCZONE_BLIT,
+			      "gcbv_param    = 0x%08X\n",
+			      (unsigned int) gcicommit.callbackparam);
+			GCDBG(GCZONE_BLIT,
+			      "bltsville_callback = 0x%08X\n",
+			      (unsigned int)
+			      gccallbackinfo->info.callback.fn);
+			GCDBG(GCZONE_BLIT,
+			      "bltsville_param    = 0x%08X\n",
+			      (unsigned int)
+			      gccallbackinfo->info.callback.data);
+
 			gcicommit.asynchronous = true;
+			async_submit();
 		}
 
 		/* Process scheduled unmappings. */
@@ -1866,6 +1911,9 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 
 		/* Error? */
 		if (gcicommit.gcerror != GCERR_NONE) {
+			if (gcicommit.asynchronous)
+				async_complete();
+
 			switch (gcicommit.gcerror) {
 			case GCERR_OODM:
 			case GCERR_CTX_ALLOC:
@@ -1884,7 +1932,19 @@ enum bverror bv_blt(struct bvbltparams *bvbltparams)
 		GCDBG(GCZONE_BLIT, "batch is submitted.\n");
 	}
 
+	if (cpuexec) {
+		cpu_execute(&gccpuop);
+
+		if (((bvbltparams->flags & BVFLAG_ASYNC) != 0) &&
+		    (bvbltparams->callbackfn != NULL))
+			bvbltparams->callbackfn(NULL,
+						bvbltparams->callbackdata);
+	}
+
 exit:
+	if (cpuexec)
+		cpu_release(&gccpuop);
+
 	if ((gcbatch != NULL) && batchexec) {
 		free_batch(gcbatch);
 		bvbltparams->batch = NULL;
@@ -189,6 +189,9 @@ struct gccontext {
 	struct list_head callbacklist;		/* gccallbackinfo */
 	struct list_head callbackvac;		/* gccallbackinfo */
 
+	/* Asynchronous batches submitted and not yet completed. */
+	unsigned int asyncpending;
+
 	/* Access locks. */
 	GCLOCK_TYPE batchlock;
 	GCLOCK_TYPE bufferlock;
@@ -370,6 +373,49 @@ struct surfaceinfo {
 };
 
 
+/*******************************************************************************
+ * Software rendering structures.
+ */
+
+/* CPU view of a surface: pixel (x, y) of the rotated surface is located at
+ * base + x * xstep + y * ystep. */
+struct gccpusurf {
+	unsigned char *base;
+	int xstep;
+	int ystep;
+
+	/* Kernel mapping of a physically described surface. */
+	void *mapping;
+
+	/* Kernel virtual range covered by cache maintenance. */
+	unsigned char *start;
+	unsigned int size;
+};
+
+enum gccputype {
+	GCCPU_FILL,
+	GCCPU_COPY,
+	GCCPU_SCALE
+};
+
+/* Operation prepared for execution on the CPU. */
+struct gccpuop {
+	enum gccputype type;
+	unsigned int bpp;
+
+	/* Premultiplied SRC1OVER blending. */
+	bool blend;
+	int alphashift;
+
+	struct gccpusurf src;
+	struct gccpusurf dst;
+
+	struct gcrect srcrect;
+	struct gcrect dstrect;
+	struct gcrect dstclipped;
+};
+
+
 /*******************************************************************************
  * Batch structures.
  */
@@ -609,4 +655,15 @@ enum bverror do_filter(struct bvbltparams *bvbltparams,
 		       struct gcbatch *gcbatch,
 		       struct surfaceinfo *srcinfo);
 
+/* Completion of asynchronous batches. */
+bool async_idle(void);
+
+/* Software rendering. */
+bool cpu_prepare(struct bvbltparams *bvbltparams,
+		 struct gcbatch *gcbatch,
+		 struct surfaceinfo *srcinfo,
+		 struct gccpuop *gccpuop);
+void cpu_execute(struct gccpuop *gccpuop);
+void cpu_release(struct gccpuop *gccpuop);
+
 #endif
@@ -0,0 +1,589 @@
+/*
+ * This file is provided under a dual BSD/GPLv2 license.  When using or
+ * redistributing this file, you may do so under either license.
+ *
+ * GPL LICENSE SUMMARY
+ *
+ * Copyright(c) 2012 Vivante Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ * BSD LICENSE
+ *
+ * Copyright(c) 2012 Vivante Corporation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Vivante Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gcbv.h"
+#include <linux/vmalloc.h>
+#include <asm/cacheflush.h>
+
+#define GCZONE_NONE		0
+#define GCZONE_ALL		(~0U)
+#define GCZONE_CPU		(1 << 0)
+
+GCDBG_FILTERDEF(cpu, GCZONE_NONE,
+		"cpu")
+
+
+/*******************************************************************************
+ * Software rendering of simple single source operations.  Enabled for every
+ * operation with the cpublit module parameter, or with cpuoffload only while
+ * the 2D core is busy with work that the operation does not have to wait
+ * for; anything not handled here goes to the 2D core.
+ */
+
+static bool cpublit;
+module_param(cpublit, bool, 0644);
+MODULE_PARM_DESC(cpublit, "Execute simple operations on the CPU");
+
+static bool cpuoffload;
+module_param(cpuoffload, bool, 0644);
+MODULE_PARM_DESC(cpuoffload,
+		 "Execute simple operations on the CPU while the 2D core is "
+		 "busy");
+
+/* Number of operations executed on the CPU; reset by writing 0. */
+static unsigned int cpucount;
+module_param(cpucount, uint, 0644);
+
+static bool cpu_map(struct surfaceinfo *surfaceinfo, struct gccpusurf *surf)
+{
+	struct bvbuffdesc *bvbuffdesc = surfaceinfo->buf.desc;
+	struct bvsurfgeom *geom = surfaceinfo->geom;
+	unsigned char *ptr;
+	int bpp, stride;
+
+	GCENTER(GCZONE_CPU);
+
+	surf->mapping = NULL;
+	surf->start = NULL;
+	surf->size = 0;
+
+	if (bvbuffdesc->auxtype == BVAT_PHYSDESC) {
+		struct bvphysdesc *bvphysdesc;
+		struct page **pages;
+		unsigned long pfn;
+		unsigned int i;
+
+		/* Only pages covered by the kernel memory map can be
+		 * mapped; TILER containers stay on the 2D core. */
+		bvphysdesc = (struct bvphysdesc *) bvbuffdesc->auxptr;
+		if (bvphysdesc->pagesize != PAGE_SIZE)
+			goto fail;
+
+		pages = kmalloc(bvphysdesc->pagecount * sizeof(struct page *),
+				GFP_KERNEL);
+		if (pages == NULL)
+			goto fail;
+
+		for (i = 0; i < bvphysdesc->pagecount; i += 1) {
+			pfn = bvphysdesc->pagearray[i] >> PAGE_SHIFT;
+			if (!pfn_valid(pfn))
+				break;
+			pages[i] = pfn_to_page(pfn);
+		}
+
+		/* The pages are also in the cacheable linear map, so the
+		 * mapping has to be cacheable as well; cpu_cacheop keeps it
+		 * coherent with the 2D core and the display. */
+		if (i == bvphysdesc->pagecount)
+			surf->mapping = vmap(pages, i, VM_MAP, PAGE_KERNEL);
+		kfree(pages);
+
+		if (surf->mapping == NULL)
+			goto fail;
+
+		surf->start = surf->mapping;
+		surf->size = bvphysdesc->pagecount * PAGE_SIZE;
+		ptr = (unsigned char *) surf->mapping + bvphysdesc->pageoffset;
+	} else if ((bvbuffdesc->virtaddr != NULL) &&
+		   (virt_addr_valid(bvbuffdesc->virtaddr) ||
+		    is_vmalloc_addr(bvbuffdesc->virtaddr))) {
+		surf->start = bvbuffdesc->virtaddr;
+		surf->size = bvbuffdesc->length;
+		ptr = (unsigned char *) bvbuffdesc->virtaddr;
+	} else {
+		goto fail;
+	}
+
+	/* Surface rectangles are given in the rotated space; express the
+	 * physical address of a point (x, y) as base + x * xstep + y * ystep,
+	 * rotating back to 0 degrees the same way rotate_gcrect does. */
+	bpp = surfaceinfo->format.bitspp / 8;
+	stride = geom->virtstride;
+
+	switch ((4 - surfaceinfo->angle) % 4) {
+	case ROT_ANGLE_0:
+		surf->base = ptr;
+		surf->xstep = bpp;
+		surf->ystep = stride;
+		break;
+
+	case ROT_ANGLE_90:
+		surf->base = ptr + (geom->height - 1) * bpp;
+		surf->xstep = stride;
+		surf->ystep = -bpp;
+		break;
+
+	case ROT_ANGLE_180:
+		surf->base = ptr + (geom->width - 1) * bpp
+			   + (geom->height - 1) * stride;
+		surf->xstep = -bpp;
+		surf->ystep = -stride;
+		break;
+
+	default:
+		surf->base = ptr + (geom->width - 1) * stride;
+		surf->xstep = -stride;
+		surf->ystep = bpp;
+	}
+
+	GCDBG(GCZONE_CPU, "base = 0x%08X, step = %d,%d\n",
+	      (unsigned int) surf->base, surf->xstep, surf->ystep);
+
+	GCEXIT(GCZONE_CPU);
+	return true;
+
+fail:
+	GCEXIT(GCZONE_CPU);
+	return false;
+}
+
+static void cpu_unmap(struct gccpusurf *surf)
+{
+	if (surf->mapping != NULL) {
+		vunmap(surf->mapping);
+		surf->mapping = NULL;
+	}
+}
+
+/* Cache maintenance on the whole surface, inner cache first as in
+ * gcbvcacheop.  DMA_BIDIRECTIONAL writes back and invalidates so that the
+ * CPU sees what the 2D core wrote; DMA_TO_DEVICE writes back the result of
+ * the CPU operation. */
+static void cpu_cacheop(struct gccpusurf *surf, int dir)
+{
+	unsigned char *addr, *end;
+	unsigned long phys;
+	unsigned int size;
+
+	if (surf->size == 0)
+		return;
+
+	end = surf->start + surf->size;
+
+	if (dir == DMA_BIDIRECTIONAL)
+		dmac_flush_range(surf->start, end);
+	else
+		dmac_map_area(surf->start, surf->size, dir);
+
+	for (addr = surf->start; addr < end; addr += size) {
+		size = min_t(unsigned int, PAGE_SIZE - offset_in_page(addr),
+			     end - addr);
+
+		if (is_vmalloc_addr(addr))
+			phys = page_to_phys(vmalloc_to_page(addr))
+			     + offset_in_page(addr);
+		else
+			phys = __pa(addr);
+
+		if (dir == DMA_BIDIRECTIONAL)
+			outer_flush_range(phys, phys + size);
+		else
+			outer_clean_range(phys, phys + size);
+	}
+}
+
+static inline unsigned char *cpu_pixel(struct gccpusurf *surf, int x, int y)
+{
+	return surf->base + x * surf->xstep + y * surf->ystep;
+}
+
+static bool same_layout(struct bvformatxlate *f1, struct bvformatxlate *f2)
+{
+	return (f1->type == BVFMT_RGB) && (f2->type == BVFMT_RGB) &&
+	       (f1->bitspp == f2->bitspp) &&
+	       (f1->format == f2->format) &&
+	       (f1->swizzle == f2->swizzle);
+}
+
+bool cpu_prepare(struct bvbltparams *bvbltparams,
+		 struct gcbatch *batch,
+		 struct surfaceinfo *srcinfo,
+		 struct gccpuop *gccpuop)
+{
+	struct surfaceinfo *dstinfo;
+	struct bvformatxlate *format;
+	unsigned int op;
+	int srcw, srch, dstw, dsth;
+
+	GCENTER(GCZONE_CPU);
+
+	/* Offloading pays only if the operation need not wait for the
+	 * 2D core: none of our asynchronous batches may be in flight. */
+	if (!cpublit && !(cpuoffload && async_idle() && !gc_idle()))
+		goto fail;
+
+	op = bvbltparams->flags & BVFLAG_OP_MASK;
+	if (op == BVFLAG_ROP) {
+		if (bvbltparams->op.rop != 0xCCCC)
+			goto fail;
+		gccpuop->blend = false;
+	} else if (op == BVFLAG_BLEND) {
+		if (bvbltparams->op.blend != BVBLEND_SRC1OVER)
+			goto fail;
+		gccpuop->blend = true;
+	} else {
+		goto fail;
+	}
+
+	/* Only plain src1 operations; the destination as src2 is implied
+	 * by SRC1OVER. */
+	if ((srcinfo->index != 0) || (srcinfo->mirror != GCREG_MIRROR_NONE))
+		goto fail;
+
+	if (parse_destination(bvbltparams, batch) != BVERR_NONE)
+		goto fail;
+
+	dstinfo = &batch->dstinfo;
+	if (batch->haveaux || (dstinfo->buf.desc == srcinfo->buf.desc))
+		goto fail;
+
+	format = &dstinfo->format;
+	if (!same_layout(format, &srcinfo->format))
+		goto fail;
+
+	srcw = srcinfo->rect.right - srcinfo->rect.left;
+	srch = srcinfo->rect.bottom - srcinfo->rect.top;
+	dstw = dstinfo->rect.right - dstinfo->rect.left;
+	dsth = dstinfo->rect.bottom - dstinfo->rect.top;
+
+	if ((srcw <= 0) || (srch <= 0) || (dstw <= 0) || (dsth <= 0))
+		goto fail;
+
+	if ((srcw == 1) && (srch == 1)) {
+		gccpuop->type = GCCPU_FILL;
+	} else if ((srcw == dstw) && (srch == dsth)) {
+		gccpuop->type = GCCPU_COPY;
+	} else {
+		/* Filtering is only done on 32-bit formats. */
+		if (format->bitspp != 32)
+			goto fail;
+		gccpuop->type = GCCPU_SCALE;
+	}
+
+	if (gccpuop->blend) {
+		const struct bvcomponent *alpha = &format->cs.rgb.comp->a;
+
+		if ((format->bitspp != 32) || !srcinfo->format.premultiplied)
+			goto fail;
+
+		/* Opaque formats blend into a plain copy. */
+		if (alpha->size == 0)
+			gccpuop->blend = false;
+		else if (alpha->size == 8)
+			gccpuop->alphashift = alpha->shift;
+		else
+			goto fail;
+	}
+
+	gccpuop->bpp = format->bitspp;
+	gccpuop->srcrect = srcinfo->rect;
+	gccpuop->dstrect = dstinfo->rect;
+	gccpuop->dstclipped = batch->dstclipped;
+
+	if (!cpu_map(srcinfo, &gccpuop->src))
+		goto fail;
+
+	if (!cpu_map(dstinfo, &gccpuop->dst)) {
+		cpu_unmap(&gccpuop->src);
+		goto fail;
+	}
+
+	GCDBG(GCZONE_CPU, "type = %d, blend = %d\n",
+	      gccpuop->type, gccpuop->blend);
+
+	GCEXIT(GCZONE_CPU);
+	return true;
+
+fail:
+	GCEXIT(GCZONE_CPU);
+	return false;
+}
+
+void cpu_release(struct gccpuop *gccpuop)
+{
+	cpu_unmap(&gccpuop->src);
+	cpu_unmap(&gccpuop->dst);
+}
+
+
+/*******************************************************************************
+ * Pixel loops.  The inner loops are kept free of branches and work on whole
+ * rows with constant strides so that they vectorize.
+ */
+
+/* Premultiplied source over destination, two channels at a time; the
+ * division by 255 is rounded exactly. */
+static inline u32 blend_over(u32 src, u32 dst, int alphashift)
+{
+	u32 ia = 255 - ((src >> alphashift) & 0xFF);
+	u32 rb = (dst & 0x00FF00FF) * ia + 0x00800080;
+	u32 ag = ((dst >> 8) & 0x00FF00FF) * ia + 0x00800080;
+
+	rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+	ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+	return src + (rb | ag);
+}
+
+/* Linear interpolation with an 8-bit weight, two channels at a time. */
+static inline u32 lerp(u32 p0, u32 p1, u32 w)
+{
+	u32 iw = 256 - w;
+	u32 rb = ((p0 & 0x00FF00FF) * iw + (p1 & 0x00FF00FF) * w
+		  + 0x00800080) >> 8;
+	u32 ag = ((p0 >> 8) & 0x00FF00FF) * iw + ((p1 >> 8) & 0x00FF00FF) * w
+	       + 0x00800080;
+
+	return (rb & 0x00FF00FF) | (ag & 0xFF00FF00);
+}
+
+static void fill_row(struct gccpuop *gccpuop, unsigned char *dst,
+		     u32 color, int count)
+{
+	int xstep = gccpuop->dst.xstep;
+	int i;
+
+	if (gccpuop->bpp == 16) {
+		if (xstep == 2) {
+			u16 *d = (u16 *) dst;
+			for (i = 0; i < count; i += 1)
+				d[i] = (u16) color;
+		} else {
+			for (i = 0; i < count; i += 1, dst += xstep)
+				*(u16 *) dst = (u16) color;
+		}
+	} else if (gccpuop->blend) {
+		for (i = 0; i < count; i += 1, dst += xstep)
+			*(u32 *) dst = blend_over(color, *(u32 *) dst,
+						  gccpuop->alphashift);
+	} else if (xstep == 4) {
+		u32 *d = (u32 *) dst;
+		for (i = 0; i < count; i += 1)
+			d[i] = color;
+	} else {
+		for (i = 0; i < count; i += 1, dst += xstep)
+			*(u32 *) dst = color;
+	}
+}
+
+static void copy_row(struct gccpuop *gccpuop, unsigned char *dst,
+		     unsigned char *src, int count)
+{
+	int xstep = gccpuop->dst.xstep;
+	int sxstep = gccpuop->src.xstep;
+	int bytes = gccpuop->bpp / 8;
+	int i;
+
+	if (gccpuop->blend) {
+		if ((xstep == 4) && (sxstep == 4)) {
+			u32 *d = (u32 *) dst, *s = (u32 *) src;
+			for (i = 0; i < count; i += 1)
+				d[i] = blend_over(s[i], d[i],
+						  gccpuop->alphashift);
+		} else {
+			for (i = 0; i < count; i += 1) {
+				*(u32 *) dst = blend_over(*(u32 *) src,
+							  *(u32 *) dst,
+							  gccpuop->alphashift);
+				dst += xstep;
+				src += sxstep;
+			}
+		}
+	} else if ((xstep == bytes) && (sxstep == bytes)) {
+		memcpy(dst, src, count * bytes);
+	} else if (bytes == 2) {
+		for (i = 0; i < count; i += 1, dst += xstep, src += sxstep)
+			*(u16 *) dst = *(u16 *) src;
+	} else {
+		for (i = 0; i < count; i += 1, dst += xstep, src += sxstep)
+			*(u32 *) dst = *(u32 *) src;
+	}
+}
+
+/* Source coordinate of the first destination pixel and the increment per
+ * destination pixel in 16.16, sampling at pixel centers. */
+static inline void scale_setup(int srcsize, int dstsize, int *pos, int *inc)
+{
+	*inc = (srcsize << 16) / dstsize;
+	*pos = (*inc >> 1) - 0x8000;
+}
+
+static inline int scale_clamp(int pos, int srcsize)
+{
+	if (pos < 0)
+		return 0;
+	if (pos > ((srcsize - 1) << 16))
+		return (srcsize - 1) << 16;
+	return pos;
+}
+
+static void scale_row(struct gccpuop *gccpuop, unsigned char *dst,
+		      int count, int xpos, int xinc, int srcw, int y)
+{
+	struct gccpusurf *src = &gccpuop->src;
+	struct gcrect *srcrect = &gccpuop->srcrect;
+	int srch = srcrect->bottom - srcrect->top;
+	int sy, wy, y0, y1, i;
+
+	y = scale_clamp(y, srch);
+	sy = y >> 16;
+	wy = (y >> 8) & 0xFF;
+	y0 = srcrect->top + sy;
+	y1 = srcrect->top + min(sy + 1, srch - 1);
+
+	for (i = 0; i < count; i += 1, xpos += xinc) {
+		int x = scale_clamp(xpos, srcw);
+		int sx = x >> 16;
+		int wx = (x >> 8) & 0xFF;
+		int x0 = srcrect->left + sx;
+		int x1 = srcrect->left + min(sx + 1, srcw - 1);
+		u32 top, bottom, pixel;
+
+		top = lerp(*(u32 *) cpu_pixel(src, x0, y0),
+			   *(u32 *) cpu_pixel(src, x1, y0), wx);
+		bottom = lerp(*(u32 *) cpu_pixel(src, x0, y1),
+			      *(u32 *) cpu_pixel(src, x1, y1), wx);
+		pixel = lerp(top, bottom, wy);
+
+		if (gccpuop->blend)
+			pixel = blend_over(pixel, *(u32 *) dst,
+					   gccpuop->alphashift);
+
+		*(u32 *) dst = pixel;
+		dst += gccpuop->dst.xstep;
+	}
+}
+
+void cpu_execute(struct gccpuop *gccpuop)
+{
+	struct gcrect *srcrect = &gccpuop->srcrect;
+	struct gcrect *dstrect = &gccpuop->dstrect;
+	struct gcrect *clip = &gccpuop->dstclipped;
+	int dx, dy, width, height, y;
+
+	GCENTER(GCZONE_CPU);
+
+	/* Everything is done on the clipped rectangle; the source is
+	 * offset by the same amount as the destination. */
+	dx = clip->left - dstrect->left;
+	dy = clip->top - dstrect->top;
+	width = clip->right - clip->left;
+	height = clip->bottom - clip->top;
+
+	if ((width <= 0) || (height <= 0))
+		goto exit;
+
+	/* The 2D core has finished with both surfaces by now. */
+	cpu_cacheop(&gccpuop->src, DMA_BIDIRECTIONAL);
+	cpu_cacheop(&gccpuop->dst, DMA_BIDIRECTIONAL);
+
+	switch (gccpuop->type) {
+	case GCCPU_FILL:
+		{
+			unsigned char *s;
+			u32 color;
+
+			s = cpu_pixel(&gccpuop->src,
+				      srcrect->left, srcrect->top);
+			color = (gccpuop->bpp == 16)
+			      ? *(u16 *) s : *(u32 *) s;
+
+			for (y = 0; y < height; y += 1)
+				fill_row(gccpuop,
+					 cpu_pixel(&gccpuop->dst,
+						   clip->left, clip->top + y),
+					 color, width);
+		}
+		break;
+
+	case GCCPU_COPY:
+		for (y = 0; y < height; y += 1)
+			copy_row(gccpuop,
+				 cpu_pixel(&gccpuop->dst,
+					   clip->left, clip->top + y),
+				 cpu_pixel(&gccpuop->src,
+					   srcrect->left + dx,
+					   srcrect->top + dy + y),
+				 width);
+		break;
+
+	case GCCPU_SCALE:
+		{
+			int srcw = srcrect->right - srcrect->left;
+			int srch = srcrect->bottom - srcrect->top;
+			int dstw = dstrect->right - dstrect->left;
+			int dsth = dstrect->bottom - dstrect->top;
+			int xpos, xinc, ypos, yinc;
+
+			scale_setup(srcw, dstw, &xpos, &xinc);
+			scale_setup(srch, dsth, &ypos, &yinc);
+			xpos += dx * xinc;
+			ypos += dy * yinc;
+
+			for (y = 0; y < height; y += 1, ypos += yinc)
+				scale_row(gccpuop,
+					  cpu_pixel(&gccpuop->dst,
+						    clip->left, clip->top + y),
+					  width, xpos, xinc, srcw, ypos);
+		}
+		break;
+	}
+
+	cpu_cacheop(&gccpuop->dst, DMA_TO_DEVICE);
+
+	cpucount += 1;
+
+exit:
+	GCEXIT(GCZONE_CPU);
+}
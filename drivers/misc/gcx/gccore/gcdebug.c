@@ -454,6 +454,90 @@ static const struct file_operations gc_debug_fops_blt_stats = {
 
 /*****************************************************************************/
 
+struct gc_submit_status {
+	int totalCount;
+	int commitCount;
+	int interruptCount;
+	int maxCommits;
+	long long int totalBytes;
+	int reasonCount[GC_SUBMIT_REASONS];
+};
+
+static struct gc_submit_status g_gcSubmitStats;
+
+static const char *gc_submit_reason_string[GC_SUBMIT_REASONS] = {
+	[GC_SUBMIT_IMMEDIATE] = "immediate",
+	[GC_SUBMIT_SYNC] = "synchronous",
+	[GC_SUBMIT_DEADLINE] = "deadline",
+	[GC_SUBMIT_FLUSH] = "flush",
+	[GC_SUBMIT_FULL] = "buffer full",
+};
+
+void gc_debug_submit(enum gc_submit_reason reason, unsigned int commits,
+		     unsigned int size, bool interrupt)
+{
+	if (reason >= GC_SUBMIT_REASONS)
+		return;
+
+	g_gcSubmitStats.reasonCount[reason]++;
+	g_gcSubmitStats.totalCount++;
+	g_gcSubmitStats.commitCount += commits;
+	g_gcSubmitStats.totalBytes += size;
+
+	if (interrupt)
+		g_gcSubmitStats.interruptCount++;
+
+	if (commits > g_gcSubmitStats.maxCommits)
+		g_gcSubmitStats.maxCommits = commits;
+}
+
+static int gc_debug_show_submit_stats(struct seq_file *s, void *data)
+{
+	int i;
+	int total = g_gcSubmitStats.totalCount;
+
+	seq_printf(s, "total submits: %d\n", total);
+	seq_printf(s, "total commits: %d\n", g_gcSubmitStats.commitCount);
+	seq_printf(s, "total interrupts: %d\n",
+		   g_gcSubmitStats.interruptCount);
+	seq_printf(s, "total bytes: %lld\n", g_gcSubmitStats.totalBytes);
+
+	if (total) {
+		seq_printf(s, "commits per submit: %d.%02d (max %d)\n",
+			   g_gcSubmitStats.commitCount / total,
+			   g_gcSubmitStats.commitCount * 100 / total % 100,
+			   g_gcSubmitStats.maxCommits);
+		seq_printf(s, "bytes per submit: %lld\n",
+			   div64_s64(g_gcSubmitStats.totalBytes, total));
+
+		for (i = 0; i < GC_SUBMIT_REASONS; i++) {
+			int count = g_gcSubmitStats.reasonCount[i];
+
+			seq_printf(s, " %s: %d (%d%%)\n",
+				   gc_submit_reason_string[i],
+				   count, count * 100 / total);
+		}
+	}
+
+	memset(&g_gcSubmitStats, 0, sizeof(g_gcSubmitStats));
+
+	return 0;
+}
+
+static int gc_debug_open_submit_stats(struct inode *inode, struct file *file)
+{
+	return single_open(file, gc_debug_show_submit_stats, 0);
+}
+
+static const struct file_operations gc_debug_fops_submit_stats = {
+	.open = gc_debug_open_submit_stats,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*****************************************************************************/
+
 static int gc_debug_show_log_dump(struct seq_file *s, void *data)
 {
 	GCDBG_FLUSHDUMP(s);
@@ -612,6 +696,8 @@ void gc_debug_init(void)
 			    &gc_debug_fops_gpu_status);
 	debugfs_create_file("blt_stats", 0664, debug_root, NULL,
 			    &gc_debug_fops_blt_stats);
+	debugfs_create_file("submit_stats", 0664, debug_root, NULL,
+			    &gc_debug_fops_submit_stats);
 	debugfs_create_file("last_error", 0664, debug_root, NULL,
 			    &gc_debug_fops_gpu_last_error);
 	debugfs_create_bool("cache_status_every_irq", 0664, debug_root,
@@ -546,6 +546,11 @@ void gc_commit(struct gcicommit *gcicommit, bool fromuser)
 	if (gcicommit->gcerror != GCERR_NONE)
 		goto exit;
 
+	/* Submit commits held back for another client. */
+	gcicommit->gcerror = gcqueue_flush(gccorecontext, gcmmucontext);
+	if (gcicommit->gcerror != GCERR_NONE)
+		goto exit;
+
 	/* Set the master table. */
 	gcicommit->gcerror = gcmmu_set_master(gccorecontext, gcmmucontext);
 	if (gcicommit->gcerror != GCERR_NONE)
@@ -642,9 +647,9 @@ void gc_commit(struct gcicommit *gcicommit, bool fromuser)
 			goto exit;
 	}
 
-	/* Execute the buffer. */
-	gcicommit->gcerror = gcqueue_execute(gccorecontext, false,
-					     gcicommit->asynchronous);
+	/* Execute the buffer; asynchronous commits may be coalesced. */
+	gcicommit->gcerror = gcqueue_commit(gccorecontext, gcmmucontext,
+					    gcicommit->asynchronous);
 
 exit:
 	GCUNLOCK(&gccorecontext->mmucontextlock);
@@ -791,6 +796,22 @@ exit:
 }
 EXPORT_SYMBOL(gc_callback);
 
+bool gc_idle(void)
+{
+	struct gccorecontext *gccorecontext = &g_context;
+	bool idle;
+
+	GCENTER(GCZONE_COMMIT);
+
+	GCLOCK(&gccorecontext->mmucontextlock);
+	idle = gcqueue_idle(gccorecontext);
+	GCUNLOCK(&gccorecontext->mmucontextlock);
+
+	GCEXITARG(GCZONE_COMMIT, "idle = %d\n", idle);
+	return idle;
+}
+EXPORT_SYMBOL(gc_idle);
+
 void gc_release(void)
 {
 	struct gccorecontext *gccorecontext = &g_context;
@@ -802,6 +823,9 @@ void gc_release(void)
 
 	GCLOCK(&gccorecontext->mmucontextlock);
 
+	/* Held commits may reference the context being destroyed. */
+	gcqueue_flush(gccorecontext, NULL);
+
 	pid = current->tgid;
 	GCDBG(GCZONE_CONTEXT, "scanning context records for pid %d.\n", pid);
 
@@ -13,6 +13,7 @@
  */
 
 #include <linux/slab.h>
+#include <linux/module.h>
 #include <linux/kthread.h>
 #include <linux/interrupt.h>
 #include <asm/cacheflush.h>
@@ -94,6 +95,16 @@ GCDBG_FILTERDEF(queue, GCZONE_NONE,
 #define GC_SIG_MASK_MMU_ERROR	(1 << GC_SIG_MMU_ERROR)
 #define GC_SIG_MASK_DMA_DONE	((1 << GC_SIG_DMA_DONE_BITS) - 1)
 
+/* Default flush deadline in microseconds for coalesced submissions.
+ * The deadline starts with the first commit held back, so no commit is
+ * delayed by more than this. Zero disables coalescing. */
+#define GC_COALESCE_DEADLINE	500
+
+static unsigned int coalesce_us = GC_COALESCE_DEADLINE;
+module_param(coalesce_us, uint, 0644);
+MODULE_PARM_DESC(coalesce_us,
+		 "Flush deadline for coalesced command buffers (usec, 0=off)");
+
 
 /*******************************************************************************
  * ISR.
@@ -886,6 +897,44 @@ static int gccmdthread(void *_gccorecontext)
 	return 0;
 }
 
+/*******************************************************************************
+ * Submission coalescing.
+ */
+
+static void coalesce_work(struct work_struct *work)
+{
+	struct gcqueue *gcqueue;
+	struct gccorecontext *gccorecontext;
+
+	gcqueue = container_of(work, struct gcqueue, coalescework);
+	gccorecontext = container_of(gcqueue, struct gccorecontext, gcqueue);
+
+	GCLOCK(&gccorecontext->mmucontextlock);
+
+	if (gcqueue->coalescecount != 0) {
+		GCDBG(GCZONE_EXEC, "flush deadline expired (%d commits).\n",
+		      gcqueue->coalescecount);
+
+		gcqueue->submitreason = GC_SUBMIT_DEADLINE;
+		gcqueue_execute(gccorecontext, false, true);
+	}
+
+	GCUNLOCK(&gccorecontext->mmucontextlock);
+}
+
+static enum hrtimer_restart coalesce_timer(struct hrtimer *timer)
+{
+	struct gcqueue *gcqueue;
+
+	gcqueue = container_of(timer, struct gcqueue, coalescetimer);
+
+	/* Execution needs the context lock; defer to process context. */
+	schedule_work(&gcqueue->coalescework);
+
+	return HRTIMER_NORESTART;
+}
+
+
 /*******************************************************************************
  * Command buffer API.
  */
@@ -909,6 +958,13 @@ enum gcerror gcqueue_start(struct gccorecontext *gccorecontext)
 	/* ISR not installed yet. */
 	gcqueue->isrroutine = -1;
 
+	/* Initialize submission coalescing. */
+	hrtimer_init(&gcqueue->coalescetimer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	gcqueue->coalescetimer.function = coalesce_timer;
+	INIT_WORK(&gcqueue->coalescework, coalesce_work);
+	gcqueue->submitreason = GC_SUBMIT_IMMEDIATE;
+
 	/* Initialize all storage buffers. */
 	for (i = 0; i < GC_STORAGE_COUNT; i += 1) {
 		/* Get a shortcut to the current storage buffer. */
@@ -1032,6 +1088,10 @@ enum gcerror gcqueue_stop(struct gccorecontext *gccorecontext)
 	/* Get a shortcut to the queue object. */
 	gcqueue = &gccorecontext->gcqueue;
 
+	/* Stop the flush deadline. */
+	hrtimer_cancel(&gcqueue->coalescetimer);
+	cancel_work_sync(&gcqueue->coalescework);
+
 	/* Stop the command buffer thread. */
 	if (gcqueue->cmdthread != NULL) {
 		GCDBG(GCZONE_INIT, "stopping the command queue thread.\n");
@@ -1424,6 +1484,7 @@ enum gcerror gcqueue_alloc(struct gccorecontext *gccorecontext,
 		/* Execute the current command buffer. */
 		GCDBG_QUEUE(GCZONE_ALLOC, "current ", gccmdbuf);
 		GCDBG(GCZONE_ALLOC, "out of available space.\n");
+		gcqueue->submitreason = GC_SUBMIT_FULL;
 		gcerror = gcqueue_execute(gccorecontext, true, true);
 		if (gcerror != GCERR_NONE)
 			goto exit;
@@ -1603,6 +1664,16 @@ enum gcerror gcqueue_execute(struct gccorecontext *gccorecontext,
 						= GCREG_EVENT_PE_SRC_ENABLE;
 	}
 
+	/* Account for the submission. */
+	gc_debug_submit(asynchronous ? gcqueue->submitreason : GC_SUBMIT_SYNC,
+			gcqueue->coalescecount, gccmdbuf->size,
+			!list_empty(&gccmdbuf->events));
+
+	/* The coalesced commits are on their way. */
+	gcqueue->coalesceowner = NULL;
+	gcqueue->coalescecount = 0;
+	gcqueue->submitreason = GC_SUBMIT_IMMEDIATE;
+
 	/* Append the current command buffer to the queue. */
 	append_cmdbuf(gccorecontext, gcqueue);
 
@@ -1619,6 +1690,116 @@ exit:
 	return gcerror;
 }
 
+enum gcerror gcqueue_commit(struct gccorecontext *gccorecontext,
+			    struct gcmmucontext *gcmmucontext,
+			    bool asynchronous)
+{
+	enum gcerror gcerror = GCERR_NONE;
+	struct gcqueue *gcqueue;
+	unsigned int deadline;
+
+	GCENTERARG(GCZONE_EXEC, "context = 0x%08X, asynchronous = %d\n",
+		   (unsigned int) gccorecontext, asynchronous);
+
+	/* Get a shortcut to the queue object. */
+	gcqueue = &gccorecontext->gcqueue;
+
+	/* The commit is now part of the current command buffer. */
+	gcqueue->coalescecount += 1;
+
+	/* Execute synchronous commits right away; so is everything if
+	 * coalescing is disabled. */
+	deadline = coalesce_us;
+	if (!asynchronous || (deadline == 0)) {
+		gcerror = gcqueue_execute(gccorecontext, false, asynchronous);
+		goto exit;
+	}
+
+	/* Hold the commit; start the deadline with the first one. */
+	gcqueue->coalesceowner = gcmmucontext;
+	if (gcqueue->coalescecount == 1)
+		hrtimer_start(&gcqueue->coalescetimer,
+			      ns_to_ktime((u64) deadline * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+
+	GCDBG(GCZONE_EXEC, "holding commit (%d pending).\n",
+	      gcqueue->coalescecount);
+
+exit:
+	GCEXITARG(GCZONE_EXEC, "gc%s = 0x%08X\n",
+		(gcerror == GCERR_NONE) ? "result" : "error", gcerror);
+	return gcerror;
+}
+
+enum gcerror gcqueue_flush(struct gccorecontext *gccorecontext,
+			   struct gcmmucontext *gcmmucontext)
+{
+	enum gcerror gcerror = GCERR_NONE;
+	struct gcqueue *gcqueue;
+
+	GCENTER(GCZONE_EXEC);
+
+	/* Get a shortcut to the queue object. */
+	gcqueue = &gccorecontext->gcqueue;
+
+	/* Nothing held back? */
+	if (gcqueue->coalescecount == 0)
+		goto exit;
+
+	/* The same client may keep adding to the held commits as long as
+	 * that does not require another MMU flush; the current command
+	 * buffer has room for one only. */
+	if ((gcmmucontext != NULL) &&
+	    (gcmmucontext == gcqueue->coalesceowner) &&
+	    !gcmmucontext->dirty)
+		goto exit;
+
+	GCDBG(GCZONE_EXEC, "flushing %d held commits.\n",
+	      gcqueue->coalescecount);
+
+	gcqueue->submitreason = GC_SUBMIT_FLUSH;
+	gcerror = gcqueue_execute(gccorecontext, false, true);
+
+exit:
+	GCEXITARG(GCZONE_EXEC, "gc%s = 0x%08X\n",
+		(gcerror == GCERR_NONE) ? "result" : "error", gcerror);
+	return gcerror;
+}
+
+bool gcqueue_idle(struct gccorecontext *gccorecontext)
+{
+	struct gcqueue *gcqueue = &gccorecontext->gcqueue;
+	unsigned int pc1, pc2, dmapc;
+	bool idle;
+
+	GCENTER(GCZONE_THREAD);
+
+	GCLOCK(&gcqueue->queuelock);
+
+	if (gcqueue->coalescecount != 0) {
+		/* Held commits have not even been started. */
+		idle = false;
+	} else if (gcqueue->gcmoterminator == NULL) {
+		/* Nothing was submitted since the GPU was stopped. */
+		idle = true;
+	} else {
+		/* Same test the queue thread uses before powering down:
+		 * the FE is parked on the terminator of the last buffer. */
+		pc1 = gcqueue->gcmoterminator->u3.linkwait.address;
+		pc2 = pc1
+		    + sizeof(struct gccmdwait)
+		    + sizeof(struct gccmdlink);
+
+		dmapc = gc_read_reg(GCREG_FE_DEBUG_CUR_CMD_ADR_Address);
+		idle = (dmapc >= pc1) && (dmapc <= pc2);
+	}
+
+	GCUNLOCK(&gcqueue->queuelock);
+
+	GCEXITARG(GCZONE_THREAD, "idle = %d\n", idle);
+	return idle;
+}
+
 enum gcerror gcqueue_wait_idle(struct gccorecontext *gccorecontext)
 {
 	enum gcerror gcerror = GCERR_NONE;
@@ -1628,6 +1809,11 @@ enum gcerror gcqueue_wait_idle(struct gccorecontext *gccorecontext)
 
 	GCENTER(GCZONE_THREAD);
 
+	/* Submit held commits before going idle. */
+	GCLOCK(&gccorecontext->mmucontextlock);
+	gcqueue_flush(gccorecontext, NULL);
+	GCUNLOCK(&gccorecontext->mmucontextlock);
+
 	/* Indicate shutdown immediately. */
 	gcqueue->suspend = true;
 	complete(&gcqueue->ready);
@@ -16,6 +16,8 @@
 #define GCQUEUE_H
 
 #include <linux/gccore.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
 
 
 /*******************************************************************************
@@ -177,6 +179,20 @@ struct gcqueue {
 	/* MMU flush pointers. */
 	struct gcmommuflush *flushlogical;
 	unsigned int flushaddress;
+
+	/* Submission coalescing. Asynchronous commits from the same client
+	 * are kept in the current command buffer instead of being executed
+	 * right away, so that back-to-back blits share one submission and
+	 * one completion interrupt. The buffer is executed when the flush
+	 * deadline expires, another client commits or a synchronous
+	 * operation is requested. */
+	struct gcmmucontext *coalesceowner;
+	unsigned int coalescecount;
+	struct hrtimer coalescetimer;
+	struct work_struct coalescework;
+
+	/* Reason for the next execution (enum gc_submit_reason). */
+	unsigned int submitreason;
 };
 
 
@@ -211,6 +227,11 @@ enum gcerror gcqueue_free(struct gccorecontext *gccorecontext,
 			  unsigned int size);
 enum gcerror gcqueue_execute(struct gccorecontext *gccorecontext,
 			     bool switchtonext, bool asynchronous);
+enum gcerror gcqueue_commit(struct gccorecontext *gccorecontext,
+			    struct gcmmucontext *gcmmucontext,
+			    bool asynchronous);
+enum gcerror gcqueue_flush(struct gccorecontext *gccorecontext,
+			   struct gcmmucontext *gcmmucontext);
 
 enum gcerror gcqueue_alloc_event(struct gcqueue *gcqueue,
 				 struct gcevent **gcevent);
@@ -227,5 +248,6 @@ enum gcerror gcqueue_alloc_int(struct gcqueue *gcqueue,
 			       unsigned int *interrupt);
 
 enum gcerror gcqueue_wait_idle(struct gccorecontext *gccorecontext);
+bool gcqueue_idle(struct gccorecontext *gccorecontext);
 
 #endif
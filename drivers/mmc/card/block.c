@@ -59,6 +59,10 @@ MODULE_ALIAS("mmc:block");
 #define INAND_CMD38_ARG_SECTRIM1 0x81
 #define INAND_CMD38_ARG_SECTRIM2 0x88
 
+#define PACKED_CMD_VER		0x01
+#define PACKED_CMD_WR		0x02
+#define MMC_CMD23_ARG_PACKED	(1 << 30)
+
 static DEFINE_MUTEX(block_mutex);
 
 /*
@@ -102,6 +106,7 @@ struct mmc_blk_data {
 	 */
 	unsigned int	part_curr;
 	struct device_attribute force_ro;
+	struct device_attribute packed_stats;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -178,6 +183,59 @@ out:
 	return ret;
 }
 
+static const char *mmc_packed_stop_names[MMC_PACKED_STOP_MAX] = {
+	[MMC_PACKED_STOP_EMPTY]		= "empty",
+	[MMC_PACKED_STOP_MAX_ENTRIES]	= "max_entries",
+	[MMC_PACKED_STOP_DIR]		= "read",
+	[MMC_PACKED_STOP_FLUSH_DISCARD]	= "flush_discard",
+	[MMC_PACKED_STOP_REL_WR]	= "rel_wr",
+	[MMC_PACKED_STOP_SECTORS]	= "sectors",
+	[MMC_PACKED_STOP_SEGMENTS]	= "segments",
+};
+
+/*
+ * How well writes are being packed: packed writes issued and the requests
+ * they carried, writes that went out alone, how many entries the packed
+ * writes had, and what ended the gathering of each write.
+ */
+static ssize_t packed_stats_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_packed_stats *stats = &md->queue.packed_stats;
+	int i, ret;
+
+	ret = scnprintf(buf, PAGE_SIZE, "packed %lu requests %lu single %lu\n",
+			stats->packed, stats->packed_reqs, stats->single);
+
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, "entries");
+	for (i = 2; i <= MMC_PACKED_MAX_ENTRIES; i++)
+		if (stats->entries[i])
+			ret += scnprintf(buf + ret, PAGE_SIZE - ret, " %d:%lu",
+					 i, stats->entries[i]);
+
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, "\nstop");
+	for (i = 0; i < MMC_PACKED_STOP_MAX; i++)
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, " %s:%lu",
+				 mmc_packed_stop_names[i], stats->stop[i]);
+	ret += scnprintf(buf + ret, PAGE_SIZE - ret, "\n");
+
+	mmc_blk_put(md);
+	return ret;
+}
+
+/* Any write clears the counters */
+static ssize_t packed_stats_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	memset(&md->queue.packed_stats, 0, sizeof(md->queue.packed_stats));
+	mmc_blk_put(md);
+	return count;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -351,6 +409,7 @@ static int mmc_blk_ioctl_cmd(struct block_device *bdev,
 	mrq.cmd = &cmd;
 
 	mmc_claim_host(card->host);
+	mmc_stop_bkops(card);
 
 	if (idata->ic.is_acmd) {
 		err = mmc_app_cmd(card->host, card);
@@ -431,14 +490,6 @@ static const struct block_device_operations mmc_bdops = {
 #endif
 };
 
-struct mmc_blk_request {
-	struct mmc_request	mrq;
-	struct mmc_command	sbc;
-	struct mmc_command	cmd;
-	struct mmc_command	stop;
-	struct mmc_data		data;
-};
-
 static inline int mmc_blk_part_switch(struct mmc_card *card,
 				      struct mmc_blk_data *md)
 {
@@ -561,6 +612,16 @@ static int get_card_status(struct mmc_card *card, u32 *status, int retries)
 #define ERR_ABORT	1
 #define ERR_CONTINUE	0
 
+enum mmc_blk_status {
+	MMC_BLK_SUCCESS = 0,
+	MMC_BLK_PARTIAL,
+	MMC_BLK_RETRY,
+	MMC_BLK_RETRY_SINGLE,
+	MMC_BLK_DATA_ERR,
+	MMC_BLK_CMD_ERR,
+	MMC_BLK_ABORT,
+};
+
 static int mmc_blk_cmd_error(struct request *req, const char *name, int error,
 	bool status_valid, u32 status)
 {
@@ -807,16 +868,20 @@ out:
 static int mmc_blk_issue_flush(struct mmc_queue *mq, struct request *req)
 {
 	struct mmc_blk_data *md = mq->data;
+	int err;
 
 	/*
-	 * No-op, only service this because we need REQ_FUA for reliable
-	 * writes.
+	 * Write back the card's cache, if it has one turned on. Otherwise
+	 * this is a no-op, only serviced because we need REQ_FUA for
+	 * reliable writes.
 	 */
+	err = mmc_flush_cache(md->queue.card) ? -EIO : 0;
+
 	spin_lock_irq(&md->lock);
-	__blk_end_request_all(req, 0);
+	__blk_end_request_all(req, err);
 	spin_unlock_irq(&md->lock);
 
-	return 1;
+	return err ? 0 : 1;
 }
 
 /*
@@ -850,12 +915,193 @@ static inline void mmc_apply_rel_rw(struct mmc_blk_request *brq,
 	 R1_CC_ERROR |		/* Card controller error */		\
 	 R1_ERROR)		/* General/unknown error */
 
-static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
+/*
+ * Wait for a write to leave the programming state. Returns nonzero if
+ * the card could not be asked for its status.
+ */
+static int mmc_blk_wait_prg(struct mmc_card *card, struct request *req)
+{
+	u32 status;
+
+	do {
+		int err = get_card_status(card, &status, 5);
+		if (err) {
+			printk(KERN_ERR "%s: error %d requesting status\n",
+			       req->rq_disk->disk_name, err);
+			return err;
+		}
+		/*
+		 * Some cards mishandle the status bits,
+		 * so make sure to check both the busy
+		 * indication and the card state.
+		 */
+	} while (!(status & R1_READY_FOR_DATA) ||
+		 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+
+	return 0;
+}
+
+/*
+ * Classify a completed r/w request. This runs from mmc_start_req() once
+ * the request is done and before the next prepared one is started, so
+ * the recovery commands below have the host to themselves.
+ */
+static int mmc_blk_err_check(struct mmc_card *card,
+			     struct mmc_async_req *areq)
+{
+	enum mmc_blk_status ret = MMC_BLK_SUCCESS;
+	struct mmc_queue_req *mq_mrq = container_of(areq, struct mmc_queue_req,
+						    mmc_active);
+	struct mmc_blk_request *brq = &mq_mrq->brq;
+	struct request *req = mq_mrq->req;
+
+	/*
+	 * sbc.error indicates a problem with the set block count
+	 * command.  No data will have been transferred.
+	 *
+	 * cmd.error indicates a problem with the r/w command.  No
+	 * data will have been transferred.
+	 *
+	 * stop.error indicates a problem with the stop command.  Data
+	 * may have been transferred, or may still be transferring.
+	 */
+	if (brq->sbc.error || brq->cmd.error || brq->stop.error) {
+		switch (mmc_blk_cmd_recovery(card, req, brq)) {
+		case ERR_RETRY:
+			/*
+			 * If it was a write, we may have transitioned to
+			 * program mode, which we have to wait for to
+			 * complete before the retry.
+			 */
+			if (!mmc_host_is_spi(card->host) &&
+			    rq_data_dir(req) != READ &&
+			    mmc_blk_wait_prg(card, req))
+				return MMC_BLK_CMD_ERR;
+			return MMC_BLK_RETRY;
+		case ERR_ABORT:
+			return MMC_BLK_ABORT;
+		case ERR_CONTINUE:
+			break;
+		}
+	}
+
+	/*
+	 * Check for errors relating to the execution of the
+	 * initial command - such as address errors.  No data
+	 * has been transferred.
+	 */
+	if (brq->cmd.resp[0] & CMD_ERRORS) {
+		pr_err("%s: r/w command failed, status = %#x\n",
+		       req->rq_disk->disk_name, brq->cmd.resp[0]);
+		return MMC_BLK_ABORT;
+	}
+
+	/*
+	 * Everything else is either success, or a data error of some
+	 * kind.  If it was a write, we may have transitioned to
+	 * program mode, which we have to wait for it to complete.
+	 */
+	if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ &&
+	    mmc_blk_wait_prg(card, req))
+		return MMC_BLK_CMD_ERR;
+
+	if (brq->data.error) {
+		pr_err("%s: error %d transferring data, sector %u, nr %u, cmd response %#x, card status %#x\n",
+		       req->rq_disk->disk_name, brq->data.error,
+		       (unsigned)blk_rq_pos(req),
+		       (unsigned)blk_rq_sectors(req),
+		       brq->cmd.resp[0], brq->stop.resp[0]);
+
+		if (rq_data_dir(req) == READ) {
+			if (brq->data.blocks > 1) {
+				/* Redo read one sector at a time */
+				pr_warning("%s: retrying using single block read\n",
+					   req->rq_disk->disk_name);
+				return MMC_BLK_RETRY_SINGLE;
+			}
+			return MMC_BLK_DATA_ERR;
+		} else {
+			return MMC_BLK_CMD_ERR;
+		}
+	}
+
+	if (mq_mrq->packed_cmd) {
+		if (brq->data.blocks << 9 != brq->data.bytes_xfered)
+			ret = MMC_BLK_PARTIAL;
+	} else if (blk_rq_bytes(req) != brq->data.bytes_xfered)
+		ret = MMC_BLK_PARTIAL;
+
+	return ret;
+}
+
+/*
+ * A packed write that failed leaves the card with an exception event
+ * pending, and EXT_CSD then tells which of the entries went wrong. The
+ * entries before that one have been written.
+ */
+static int mmc_blk_packed_err_check(struct mmc_card *card,
+				    struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_rq = container_of(areq, struct mmc_queue_req,
+						   mmc_active);
+	struct request *req = mq_rq->req;
+	struct mmc_packed *packed = mq_rq->packed;
+	enum mmc_blk_status check;
+	u32 status;
+	u8 *ext_csd;
+	int err;
+
+	packed->retries--;
+	check = mmc_blk_err_check(card, areq);
+
+	err = get_card_status(card, &status, 0);
+	if (err) {
+		pr_err("%s: error %d sending status command\n",
+		       req->rq_disk->disk_name, err);
+		return MMC_BLK_ABORT;
+	}
+
+	if (!(status & R1_EXCEPTION_EVENT))
+		return check;
+
+	ext_csd = kmalloc(512, GFP_KERNEL);
+	if (!ext_csd)
+		return MMC_BLK_ABORT;
+
+	err = mmc_send_ext_csd(card, ext_csd);
+	if (err) {
+		pr_err("%s: error %d sending ext_csd\n",
+		       req->rq_disk->disk_name, err);
+		check = MMC_BLK_ABORT;
+	} else if ((ext_csd[EXT_CSD_EXP_EVENTS_STATUS] &
+		    EXT_CSD_PACKED_FAILURE) &&
+		   (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+		    EXT_CSD_PACKED_GENERIC_ERROR)) {
+		if (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+		    EXT_CSD_PACKED_INDEXED_ERROR) {
+			packed->idx_failure =
+				ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] - 1;
+			check = MMC_BLK_PARTIAL;
+		}
+		pr_err("%s: packed write failed, nr %u, sectors %u, "
+		       "failure index %d\n", req->rq_disk->disk_name,
+		       packed->nr_entries, packed->blocks,
+		       packed->idx_failure);
+	}
+
+	kfree(ext_csd);
+	return check;
+}
+
+static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
+			       struct mmc_card *card,
+			       int disable_multi,
+			       struct mmc_queue *mq)
 {
+	u32 readcmd, writecmd;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
 	struct mmc_blk_data *md = mq->data;
-	struct mmc_card *card = md->queue.card;
-	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0, retry = 0;
 
 	/*
 	 * Reliable writes are used to implement Forced Unit Access and
@@ -866,241 +1112,512 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		(rq_data_dir(req) == WRITE) &&
 		(md->flags & MMC_BLK_REL_WR);
 
-	do {
-		u32 readcmd, writecmd;
-
-		memset(&brq, 0, sizeof(struct mmc_blk_request));
-		brq.mrq.cmd = &brq.cmd;
-		brq.mrq.data = &brq.data;
-
-		brq.cmd.arg = blk_rq_pos(req);
-		if (!mmc_card_blockaddr(card))
-			brq.cmd.arg <<= 9;
-		brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
-		brq.data.blksz = 512;
-		brq.stop.opcode = MMC_STOP_TRANSMISSION;
-		brq.stop.arg = 0;
-		brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-		brq.data.blocks = blk_rq_sectors(req);
-
-		/*
-		 * The block layer doesn't support all sector count
-		 * restrictions, so we need to be prepared for too big
-		 * requests.
-		 */
-		if (brq.data.blocks > card->host->max_blk_count)
-			brq.data.blocks = card->host->max_blk_count;
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
 
-		/*
-		 * After a read error, we redo the request one sector at a time
-		 * in order to accurately determine which sectors can be read
-		 * successfully.
-		 */
-		if (disable_multi && brq.data.blocks > 1)
-			brq.data.blocks = 1;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	brq->data.blocks = blk_rq_sectors(req);
 
-		if (brq.data.blocks > 1 || do_rel_wr) {
-			/* SPI multiblock writes terminate using a special
-			 * token, not a STOP_TRANSMISSION request.
-			 */
-			if (!mmc_host_is_spi(card->host) ||
-			    rq_data_dir(req) == READ)
-				brq.mrq.stop = &brq.stop;
-			readcmd = MMC_READ_MULTIPLE_BLOCK;
-			writecmd = MMC_WRITE_MULTIPLE_BLOCK;
-		} else {
-			brq.mrq.stop = NULL;
-			readcmd = MMC_READ_SINGLE_BLOCK;
-			writecmd = MMC_WRITE_BLOCK;
-		}
-		if (rq_data_dir(req) == READ) {
-			brq.cmd.opcode = readcmd;
-			brq.data.flags |= MMC_DATA_READ;
-		} else {
-			brq.cmd.opcode = writecmd;
-			brq.data.flags |= MMC_DATA_WRITE;
-		}
+	/*
+	 * The block layer doesn't support all sector count
+	 * restrictions, so we need to be prepared for too big
+	 * requests.
+	 */
+	if (brq->data.blocks > card->host->max_blk_count)
+		brq->data.blocks = card->host->max_blk_count;
 
-		if (do_rel_wr)
-			mmc_apply_rel_rw(&brq, card, req);
+	/*
+	 * After a read error, we redo the request one sector at a time
+	 * in order to accurately determine which sectors can be read
+	 * successfully.
+	 */
+	if (disable_multi && brq->data.blocks > 1)
+		brq->data.blocks = 1;
 
-		/*
-		 * Pre-defined multi-block transfers are preferable to
-		 * open ended-ones (and necessary for reliable writes).
-		 * However, it is not sufficient to just send CMD23,
-		 * and avoid the final CMD12, as on an error condition
-		 * CMD12 (stop) needs to be sent anyway. This, coupled
-		 * with Auto-CMD23 enhancements provided by some
-		 * hosts, means that the complexity of dealing
-		 * with this is best left to the host. If CMD23 is
-		 * supported by card and host, we'll fill sbc in and let
-		 * the host deal with handling it correctly. This means
-		 * that for hosts that don't expose MMC_CAP_CMD23, no
-		 * change of behavior will be observed.
-		 *
-		 * N.B: Some MMC cards experience perf degradation.
-		 * We'll avoid using CMD23-bounded multiblock writes for
-		 * these, while retaining features like reliable writes.
+	if (brq->data.blocks > 1 || do_rel_wr) {
+		/* SPI multiblock writes terminate using a special
+		 * token, not a STOP_TRANSMISSION request.
 		 */
+		if (!mmc_host_is_spi(card->host) ||
+		    rq_data_dir(req) == READ)
+			brq->mrq.stop = &brq->stop;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else {
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_SINGLE_BLOCK;
+		writecmd = MMC_WRITE_BLOCK;
+	}
+	if (rq_data_dir(req) == READ) {
+		brq->cmd.opcode = readcmd;
+		brq->data.flags |= MMC_DATA_READ;
+	} else {
+		brq->cmd.opcode = writecmd;
+		brq->data.flags |= MMC_DATA_WRITE;
+	}
 
-		if ((md->flags & MMC_BLK_CMD23) &&
-		    mmc_op_multi(brq.cmd.opcode) &&
-		    (do_rel_wr || !(card->quirks & MMC_QUIRK_BLK_NO_CMD23))) {
-			brq.sbc.opcode = MMC_SET_BLOCK_COUNT;
-			brq.sbc.arg = brq.data.blocks |
-				(do_rel_wr ? (1 << 31) : 0);
-			brq.sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
-			brq.mrq.sbc = &brq.sbc;
-		}
+	if (do_rel_wr)
+		mmc_apply_rel_rw(brq, card, req);
 
-		mmc_set_data_timeout(&brq.data, card);
+	/*
+	 * Pre-defined multi-block transfers are preferable to
+	 * open ended-ones (and necessary for reliable writes).
+	 * However, it is not sufficient to just send CMD23,
+	 * and avoid the final CMD12, as on an error condition
+	 * CMD12 (stop) needs to be sent anyway. This, coupled
+	 * with Auto-CMD23 enhancements provided by some
+	 * hosts, means that the complexity of dealing
+	 * with this is best left to the host. If CMD23 is
+	 * supported by card and host, we'll fill sbc in and let
+	 * the host deal with handling it correctly. This means
+	 * that for hosts that don't expose MMC_CAP_CMD23, no
+	 * change of behavior will be observed.
+	 *
+	 * N.B: Some MMC cards experience perf degradation.
+	 * We'll avoid using CMD23-bounded multiblock writes for
+	 * these, while retaining features like reliable writes.
+	 */
 
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+	if ((md->flags & MMC_BLK_CMD23) &&
+	    mmc_op_multi(brq->cmd.opcode) &&
+	    (do_rel_wr || !(card->quirks & MMC_QUIRK_BLK_NO_CMD23))) {
+		brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+		brq->sbc.arg = brq->data.blocks |
+			(do_rel_wr ? (1 << 31) : 0);
+		brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+		brq->mrq.sbc = &brq->sbc;
+	}
 
-		/*
-		 * Adjust the sg list so it is the same size as the
-		 * request.
-		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
-			int i, data_size = brq.data.blocks << 9;
-			struct scatterlist *sg;
-
-			for_each_sg(brq.data.sg, sg, brq.data.sg_len, i) {
-				data_size -= sg->length;
-				if (data_size <= 0) {
-					sg->length += data_size;
-					i++;
-					break;
-				}
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	/*
+	 * Adjust the sg list so it is the same size as the
+	 * request.
+	 */
+	if (brq->data.blocks != blk_rq_sectors(req)) {
+		int i, data_size = brq->data.blocks << 9;
+		struct scatterlist *sg;
+
+		for_each_sg(brq->data.sg, sg, brq->data.sg_len, i) {
+			data_size -= sg->length;
+			if (data_size <= 0) {
+				sg->length += data_size;
+				i++;
+				break;
 			}
-			brq.data.sg_len = i;
 		}
+		brq->data.sg_len = i;
+	}
 
-		mmc_queue_bounce_pre(mq);
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_err_check;
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+	mmc_queue_bounce_pre(mqrq);
+}
 
-		mmc_queue_bounce_post(mq);
+/*
+ * Ending a request may free it, so the latency type has to be taken
+ * from the request before it is completed.
+ */
+static inline enum mmc_lat_type mmc_blk_lat_type(struct request *req)
+{
+	return rq_data_dir(req) == READ ? MMC_LAT_READ : MMC_LAT_WRITE;
+}
 
-		/*
-		 * sbc.error indicates a problem with the set block count
-		 * command.  No data will have been transferred.
-		 *
-		 * cmd.error indicates a problem with the r/w command.  No
-		 * data will have been transferred.
-		 *
-		 * stop.error indicates a problem with the stop command.  Data
-		 * may have been transferred, or may still be transferring.
-		 */
-		if (brq.sbc.error || brq.cmd.error || brq.stop.error) {
-			switch (mmc_blk_cmd_recovery(card, req, &brq)) {
-			case ERR_RETRY:
-				if (retry++ < 5) {
-					/*
-					 * Everything else is either success, or a data error of some
-					 * kind.  If it was a write, we may have transitioned to
-					 * program mode, which we have to wait for it to complete.
-					 */
-					if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
-						u32 status;
-						do {
-							int err = get_card_status(card, &status, 5);
-							if (err) {
-								printk(KERN_ERR "%s: error %d requesting status\n",
-									   req->rq_disk->disk_name, err);
-								goto cmd_err;
-							}
-							/*
-							 * Some cards mishandle the status bits,
-							 * so make sure to check both the busy
-							 * indication and the card state.
-							 */
-						} while (!(status & R1_READY_FOR_DATA) ||
-							 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
-					}
-					continue;
-				}
-				pr_err("%s: retry count = %d\n", req->rq_disk->disk_name, retry);
-				if (retry < 8)
-					break;
-			case ERR_ABORT:
-				goto cmd_abort;
-			case ERR_CONTINUE:
-				break;
-			}
+static inline bool mmc_req_rel_wr(struct request *req)
+{
+	return (req->cmd_flags & REQ_FUA) || (req->cmd_flags & REQ_META);
+}
+
+static void mmc_blk_clear_packed(struct mmc_queue_req *mqrq)
+{
+	struct mmc_packed *packed = mqrq->packed;
+
+	mqrq->packed_cmd = false;
+	packed->nr_entries = 0;
+	packed->blocks = 0;
+	packed->retries = 0;
+	packed->idx_failure = MMC_PACKED_NR_IDX;
+}
+
+/*
+ * Gather the writes queued behind req into one packed write, for as long
+ * as they fit in a single transfer and the card's limit on entries. The
+ * request that ends the gathering goes back to the queue. Returns the
+ * number of requests packed, or 0 if req is to go out on its own.
+ */
+static unsigned int mmc_blk_prep_packed_list(struct mmc_queue *mq,
+					     struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = mq->card;
+	struct request_queue *q = mq->queue;
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct mmc_packed *packed = mqrq->packed;
+	struct mmc_packed_stats *stats = &mq->packed_stats;
+	unsigned int max_entries, max_blk_count, max_segs;
+	unsigned int sectors, segs, nr = 1;
+	enum mmc_packed_stop stop;
+	struct request *next;
+
+	if (!packed || rq_data_dir(req) != WRITE)
+		return 0;
+
+	if (mmc_req_rel_wr(req) && (md->flags & MMC_BLK_REL_WR)) {
+		stats->single++;
+		return 0;
+	}
+
+	max_entries = min_t(unsigned int, card->ext_csd.max_packed_writes,
+			    MMC_PACKED_MAX_ENTRIES);
+	/* CMD23 carries the block count in 16 bits */
+	max_blk_count = min3(card->host->max_blk_count,
+			     card->host->max_req_size >> 9, 0xffffU);
+	max_segs = queue_max_segments(q);
+
+	/* The header takes a block and a segment of its own */
+	sectors = blk_rq_sectors(req) + 1;
+	segs = req->nr_phys_segments + 1;
+
+	do {
+		if (nr >= max_entries) {
+			stop = MMC_PACKED_STOP_MAX_ENTRIES;
+			break;
 		}
 
-		/*
-		 * Check for errors relating to the execution of the
-		 * initial command - such as address errors.  No data
-		 * has been transferred.
-		 */
-		if (brq.cmd.resp[0] & CMD_ERRORS) {
-			pr_err("%s: r/w command failed, status = %#x\n",
-				req->rq_disk->disk_name, brq.cmd.resp[0]);
-			goto cmd_abort;
+		spin_lock_irq(&md->lock);
+		next = blk_fetch_request(q);
+		spin_unlock_irq(&md->lock);
+		if (!next) {
+			stop = MMC_PACKED_STOP_EMPTY;
+			break;
 		}
 
-		/*
-		 * Everything else is either success, or a data error of some
-		 * kind.  If it was a write, we may have transitioned to
-		 * program mode, which we have to wait for it to complete.
-		 */
-		if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
-			u32 status;
-			do {
-				int err = get_card_status(card, &status, 5);
-				if (err) {
-					printk(KERN_ERR "%s: error %d requesting status\n",
-					       req->rq_disk->disk_name, err);
-					goto cmd_err;
-				}
-				/*
-				 * Some cards mishandle the status bits,
-				 * so make sure to check both the busy
-				 * indication and the card state.
-				 */
-			} while (!(status & R1_READY_FOR_DATA) ||
-				 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+		if (next->cmd_flags & (REQ_DISCARD | REQ_FLUSH))
+			stop = MMC_PACKED_STOP_FLUSH_DISCARD;
+		else if (rq_data_dir(next) != WRITE)
+			stop = MMC_PACKED_STOP_DIR;
+		else if (mmc_req_rel_wr(next) && (md->flags & MMC_BLK_REL_WR))
+			stop = MMC_PACKED_STOP_REL_WR;
+		else if (sectors + blk_rq_sectors(next) > max_blk_count)
+			stop = MMC_PACKED_STOP_SECTORS;
+		else if (segs + next->nr_phys_segments > max_segs)
+			stop = MMC_PACKED_STOP_SEGMENTS;
+		else {
+			if (nr == 1)
+				list_add_tail(&req->queuelist, &packed->list);
+			list_add_tail(&next->queuelist, &packed->list);
+			sectors += blk_rq_sectors(next);
+			segs += next->nr_phys_segments;
+			nr++;
+			continue;
 		}
 
-		if (brq.data.error) {
-			pr_err("%s: error %d transferring data, sector %u, nr %u, cmd response %#x, card status %#x\n",
-				req->rq_disk->disk_name, brq.data.error,
-				(unsigned)blk_rq_pos(req),
-				(unsigned)blk_rq_sectors(req),
-				brq.cmd.resp[0], brq.stop.resp[0]);
-
-			if (rq_data_dir(req) == READ) {
-				if (brq.data.blocks > 1) {
-					/* Redo read one sector at a time */
-					pr_warning("%s: retrying using single block read\n",
-						req->rq_disk->disk_name);
-					disable_multi = 1;
-					continue;
-				}
+		spin_lock_irq(&md->lock);
+		blk_requeue_request(q, next);
+		spin_unlock_irq(&md->lock);
+		break;
+	} while (1);
+
+	stats->stop[stop]++;
+	if (nr == 1) {
+		stats->single++;
+		return 0;
+	}
+
+	stats->packed++;
+	stats->packed_reqs += nr;
+	stats->entries[nr]++;
+
+	packed->nr_entries = nr;
+	packed->retries = nr;
+	mqrq->packed_cmd = true;
+
+	return nr;
+}
+
+static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
+					struct mmc_card *card,
+					struct mmc_queue *mq)
+{
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct mmc_packed *packed = mqrq->packed;
+	__le32 *hdr = packed->cmd_hdr;
+	struct request *prq;
+	int i = 1;
+
+	memset(packed->cmd_hdr, 0, sizeof(packed->cmd_hdr));
+	hdr[0] = cpu_to_le32((packed->nr_entries << 16) |
+			     (PACKED_CMD_WR << 8) | PACKED_CMD_VER);
+	packed->blocks = 0;
+	packed->idx_failure = MMC_PACKED_NR_IDX;
+
+	/* The CMD23 and CMD25 arguments of each entry */
+	list_for_each_entry(prq, &packed->list, queuelist) {
+		hdr[i * 2] = cpu_to_le32(blk_rq_sectors(prq));
+		hdr[i * 2 + 1] = cpu_to_le32(mmc_card_blockaddr(card) ?
+					     blk_rq_pos(prq) :
+					     blk_rq_pos(prq) << 9);
+		packed->blocks += blk_rq_sectors(prq);
+		i++;
+	}
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+	brq->mrq.sbc = &brq->sbc;
+	brq->mrq.stop = &brq->stop;
+
+	brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq->sbc.arg = MMC_CMD23_ARG_PACKED | (packed->blocks + 1);
+	brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(mqrq->req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	brq->data.blksz = 512;
+	brq->data.blocks = packed->blocks + 1;
+	brq->data.flags |= MMC_DATA_WRITE;
+
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_packed_err_check;
+}
+
+static void mmc_blk_rq_prep(struct mmc_queue_req *mqrq,
+			    struct mmc_card *card,
+			    struct mmc_queue *mq)
+{
+	if (mqrq->packed_cmd)
+		mmc_blk_packed_hdr_wrq_prep(mqrq, card, mq);
+	else
+		mmc_blk_rw_rq_prep(mqrq, card, 0, mq);
+}
+
+/*
+ * Break a packed write up again: its first request stays with mq_rq, to
+ * be sent on its own, and the others go back to the block queue.
+ */
+static void mmc_blk_revert_packed_req(struct mmc_queue *mq,
+				      struct mmc_queue_req *mq_rq)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request *prq;
+
+	spin_lock_irq(&md->lock);
+	while (packed->list.prev != packed->list.next) {
+		prq = list_entry_rq(packed->list.prev);
+		list_del_init(&prq->queuelist);
+		blk_requeue_request(mq->queue, prq);
+	}
+	spin_unlock_irq(&md->lock);
+
+	prq = list_entry_rq(packed->list.next);
+	list_del_init(&prq->queuelist);
+	mq_rq->req = prq;
+	mmc_blk_clear_packed(mq_rq);
+}
+
+/*
+ * Complete the written requests of a finished packed write. Returns 1
+ * if requests are left to write; mq_rq is then still a packed write if
+ * the card named the entry that failed and retries are left, otherwise
+ * it has been reduced to its first request, which gets the usual error
+ * handling when resent on its own.
+ */
+static int mmc_blk_end_packed_req(struct mmc_queue *mq,
+				  struct mmc_queue_req *mq_rq,
+				  enum mmc_blk_status status)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request *prq;
+	enum mmc_lat_type type;
+	int done = 0;
+
+	if (status == MMC_BLK_SUCCESS)
+		done = packed->nr_entries;
+	else if (packed->idx_failure > 0 &&
+		 packed->idx_failure < packed->nr_entries)
+		done = packed->idx_failure;
 
+	spin_lock_irq(&md->lock);
+	while (done--) {
+		prq = list_entry_rq(packed->list.next);
+		list_del_init(&prq->queuelist);
+		type = mmc_blk_lat_type(prq);
+		__blk_end_request_all(prq, 0);
+		mmc_latency_record(mq->card, type, mq_rq->start);
+		packed->nr_entries--;
+	}
+	spin_unlock_irq(&md->lock);
+
+	if (!packed->nr_entries) {
+		mmc_blk_clear_packed(mq_rq);
+		return 0;
+	}
+
+	mq_rq->req = list_entry_rq(packed->list.next);
+	if (status != MMC_BLK_PARTIAL || !packed->retries ||
+	    packed->nr_entries == 1)
+		mmc_blk_revert_packed_req(mq, mq_rq);
+
+	return 1;
+}
+
+/*
+ * Issue the r/w request rqc, and complete the one issued before it.
+ * The host prepares rqc (maps it for DMA) while the previous request is
+ * still on the bus, and the previous request is only post-processed once
+ * rqc has been started. With rqc NULL, the previous request is finished
+ * and nothing new is started.
+ */
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_request *brq = &mq->mqrq_cur->brq;
+	int ret = 1, disable_multi = 0, retry = 0;
+	enum mmc_blk_status status;
+	struct mmc_queue_req *mq_rq;
+	struct request *req;
+	struct mmc_async_req *areq;
+	enum mmc_lat_type lat_type;
+
+	if (!rqc && !mq->mqrq_prev->req)
+		return 0;
+
+	if (rqc) {
+		mmc_blk_prep_packed_list(mq, rqc);
+		mq->mqrq_cur->start = ktime_get();
+	}
+
+	do {
+		if (rqc) {
+			mmc_blk_rq_prep(mq->mqrq_cur, card, mq);
+			areq = &mq->mqrq_cur->mmc_active;
+		} else
+			areq = NULL;
+		areq = mmc_start_req(card->host, areq, (int *) &status);
+		if (!areq)
+			return 0;
+
+		mq_rq = container_of(areq, struct mmc_queue_req, mmc_active);
+		brq = &mq_rq->brq;
+		req = mq_rq->req;
+		lat_type = mmc_blk_lat_type(req);
+		mmc_queue_bounce_post(mq_rq);
+
+		if (mq_rq->packed_cmd) {
+			ret = mmc_blk_end_packed_req(mq, mq_rq, status);
+			if (ret) {
+				mmc_blk_rq_prep(mq_rq, card, mq);
+				mmc_start_req(card->host, &mq_rq->mmc_active,
+					      NULL);
+			}
+			continue;
+		}
+
+		switch (status) {
+		case MMC_BLK_SUCCESS:
+		case MMC_BLK_PARTIAL:
+			/*
+			 * A block was successfully transferred.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, 0,
+						brq->data.bytes_xfered);
+			spin_unlock_irq(&md->lock);
+			if (!ret)
+				mmc_latency_record(card, lat_type,
+						   mq_rq->start);
+			if (status == MMC_BLK_SUCCESS && ret) {
 				/*
-				 * After an error, we redo I/O one sector at a
-				 * time, so we only reach here after trying to
-				 * read a single sector.
+				 * The blk_end_request has returned non zero
+				 * even though all data is transfered and no
+				 * erros returned by host.
+				 * If this happen it's a bug.
 				 */
+				printk(KERN_ERR "%s BUG rq_tot %d d_xfer %d\n",
+				       __func__, blk_rq_bytes(req),
+				       brq->data.bytes_xfered);
+				rqc = NULL;
+				goto cmd_abort;
+			}
+			break;
+		case MMC_BLK_CMD_ERR:
+			goto cmd_err;
+		case MMC_BLK_RETRY_SINGLE:
+			disable_multi = 1;
+			break;
+		case MMC_BLK_RETRY:
+			if (retry++ < 5)
+				break;
+			pr_err("%s: retry count = %d\n",
+			       req->rq_disk->disk_name, retry);
+			if (retry < 8) {
+				/* Keep what did make it and go on */
 				spin_lock_irq(&md->lock);
-				ret = __blk_end_request(req, -EIO, brq.data.blksz);
+				ret = __blk_end_request(req, 0,
+						brq->data.bytes_xfered);
 				spin_unlock_irq(&md->lock);
-				continue;
-			} else {
-				goto cmd_err;
+				if (!ret)
+					mmc_latency_record(card, lat_type,
+							   mq_rq->start);
+				break;
 			}
+			/* fall through */
+		case MMC_BLK_ABORT:
+			goto cmd_abort;
+		case MMC_BLK_DATA_ERR:
+			/*
+			 * After an error, we redo I/O one sector at a
+			 * time, so we only reach here after trying to
+			 * read a single sector.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, -EIO,
+						brq->data.blksz);
+			spin_unlock_irq(&md->lock);
+			if (!ret) {
+				mmc_latency_record(card, lat_type,
+						   mq_rq->start);
+				goto start_new_req;
+			}
+			break;
 		}
 
-		/*
-		 * A block was successfully transferred.
-		 */
-		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
-		spin_unlock_irq(&md->lock);
+		if (ret) {
+			/*
+			 * In case of a none complete request
+			 * prepare it again and resend.
+			 */
+			mmc_blk_rw_rq_prep(mq_rq, card, disable_multi, mq);
+			mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
+		}
 	} while (ret);
 
 	return 1;
@@ -1125,7 +1642,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		}
 	} else {
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	}
 
@@ -1134,6 +1651,13 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 	while (ret)
 		ret = __blk_end_request(req, -EIO, blk_rq_cur_bytes(req));
 	spin_unlock_irq(&md->lock);
+	mmc_latency_record(card, lat_type, mq_rq->start);
+
+ start_new_req:
+	if (rqc) {
+		mmc_blk_rq_prep(mq->mqrq_cur, card, mq);
+		mmc_start_req(card->host, &mq->mqrq_cur->mmc_active, NULL);
+	}
 
 	return 0;
 }
@@ -1146,22 +1670,36 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 	int ret;
 	struct mmc_blk_data *md = mq->data;
 	struct mmc_card *card = md->queue.card;
+	ktime_t start;
 
+	/* claim host only for the first request */
+	if (req && !mq->mqrq_prev->req) {
 #ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
-	if (mmc_bus_needs_resume(card->host)) {
-		mmc_resume_bus(card->host);
-		mmc_blk_set_blksize(md, card);
-	}
+		if (mmc_bus_needs_resume(card->host)) {
+			mmc_resume_bus(card->host);
+			mmc_blk_set_blksize(md, card);
+		}
 #endif
+		mmc_claim_host(card->host);
+		mmc_stop_bkops(card);
+	}
 
-	mmc_claim_host(card->host);
 	ret = mmc_blk_part_switch(card, md);
 	if (ret) {
+		if (req) {
+			spin_lock_irq(&md->lock);
+			__blk_end_request_all(req, -EIO);
+			spin_unlock_irq(&md->lock);
+		}
 		ret = 0;
 		goto out;
 	}
 
-	if (req->cmd_flags & REQ_DISCARD) {
+	if (req && req->cmd_flags & REQ_DISCARD) {
+		/* complete ongoing async transfer before issuing discard */
+		if (card->host->areq)
+			mmc_blk_issue_rw_rq(mq, NULL);
+		start = ktime_get();
 /*
 ** HASH:
 ** Patching *possible* TRIM bug in Samsung MAG2GA Chips
@@ -1173,14 +1711,28 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		else
 #endif
 			ret = mmc_blk_issue_discard_rq(mq, req);
-	} else if (req->cmd_flags & REQ_FLUSH) {
+		mmc_latency_record(card, MMC_LAT_DISCARD, start);
+	} else if (req && req->cmd_flags & REQ_FLUSH) {
+		/* complete ongoing async transfer before issuing flush */
+		if (card->host->areq)
+			mmc_blk_issue_rw_rq(mq, NULL);
+		start = ktime_get();
 		ret = mmc_blk_issue_flush(mq, req);
+		mmc_latency_record(card, MMC_LAT_FLUSH, start);
 	} else {
 		ret = mmc_blk_issue_rw_rq(mq, req);
 	}
 
 out:
-	mmc_release_host(card->host);
+	/*
+	 * Release host only when there are no more requests. The queue
+	 * is idle then, which is when the card gets to do background
+	 * operations it asked for.
+	 */
+	if (!req) {
+		mmc_start_bkops(card);
+		mmc_release_host(card->host);
+	}
 	return ret;
 }
 
@@ -1287,6 +1839,8 @@ static struct mmc_blk_data *mmc_blk_alloc_req(struct mmc_card *card,
 	     card->ext_csd.rel_sectors)) {
 		md->flags |= MMC_BLK_REL_WR;
 		blk_queue_flush(md->queue.queue, REQ_FLUSH | REQ_FUA);
+	} else if (card->ext_csd.cache_ctrl) {
+		blk_queue_flush(md->queue.queue, REQ_FLUSH);
 	}
 
 	return md;
@@ -1395,6 +1949,9 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 	if (md) {
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+			if (md->queue.mqrq_cur->packed)
+				device_remove_file(disk_to_dev(md->disk),
+						   &md->packed_stats);
 
 			/* Stop new requests from getting into the queue */
 			del_gendisk(md->disk);
@@ -1432,8 +1989,26 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	md->force_ro.attr.mode = S_IRUGO | S_IWUSR;
 	ret = device_create_file(disk_to_dev(md->disk), &md->force_ro);
 	if (ret)
-		del_gendisk(md->disk);
+		goto out;
+
+	if (md->queue.mqrq_cur->packed) {
+		md->packed_stats.show = packed_stats_show;
+		md->packed_stats.store = packed_stats_store;
+		sysfs_attr_init(&md->packed_stats.attr);
+		md->packed_stats.attr.name = "packed_stats";
+		md->packed_stats.attr.mode = S_IRUGO | S_IWUSR;
+		ret = device_create_file(disk_to_dev(md->disk),
+					 &md->packed_stats);
+		if (ret) {
+			device_remove_file(disk_to_dev(md->disk),
+					   &md->force_ro);
+			goto out;
+		}
+	}
 
+	return 0;
+out:
+	del_gendisk(md->disk);
 	return ret;
 }
 
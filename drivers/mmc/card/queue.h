@@ -4,19 +4,78 @@
 struct request;
 struct task_struct;
 
+struct mmc_blk_request {
+	struct mmc_request	mrq;
+	struct mmc_command	sbc;
+	struct mmc_command	cmd;
+	struct mmc_command	stop;
+	struct mmc_data		data;
+};
+
+/*
+ * A packed write is sent as one CMD23/CMD25 pair whose first block is a
+ * header describing the requests that follow: a header word, then the
+ * CMD23 and CMD25 arguments of each of them. A 512 byte header has room
+ * for 63 entries.
+ */
+#define MMC_PACKED_HDR_WORDS	128
+#define MMC_PACKED_MAX_ENTRIES	(MMC_PACKED_HDR_WORDS / 2 - 1)
+#define MMC_PACKED_NR_IDX	-1
+
+struct mmc_packed {
+	__le32			cmd_hdr[MMC_PACKED_HDR_WORDS];
+	struct list_head	list;		/* requests in the packed write */
+	unsigned int		nr_entries;
+	unsigned int		blocks;		/* data blocks, without header */
+	unsigned int		retries;
+	int			idx_failure;	/* entry reported failed */
+};
+
+/* Why gathering a packed write stopped */
+enum mmc_packed_stop {
+	MMC_PACKED_STOP_EMPTY,		/* no more queued requests */
+	MMC_PACKED_STOP_MAX_ENTRIES,	/* card or header limit reached */
+	MMC_PACKED_STOP_DIR,		/* next request is a read */
+	MMC_PACKED_STOP_FLUSH_DISCARD,	/* next request is a flush/discard */
+	MMC_PACKED_STOP_REL_WR,		/* next request needs reliable write */
+	MMC_PACKED_STOP_SECTORS,	/* would exceed max_blk_count */
+	MMC_PACKED_STOP_SEGMENTS,	/* would exceed max_segs */
+	MMC_PACKED_STOP_MAX,
+};
+
+struct mmc_packed_stats {
+	unsigned long		packed;		/* packed writes issued */
+	unsigned long		packed_reqs;	/* requests carried by them */
+	unsigned long		single;		/* writes issued on their own */
+	unsigned long		entries[MMC_PACKED_MAX_ENTRIES + 1];
+	unsigned long		stop[MMC_PACKED_STOP_MAX];
+};
+
+struct mmc_queue_req {
+	struct request		*req;
+	struct mmc_blk_request	brq;
+	struct scatterlist	*sg;
+	char			*bounce_buf;
+	struct scatterlist	*bounce_sg;
+	unsigned int		bounce_sg_len;
+	struct mmc_async_req	mmc_active;
+	struct mmc_packed	*packed;	/* NULL unless packing is used */
+	ktime_t			start;		/* when the request was issued */
+	bool			packed_cmd;	/* brq holds a packed write */
+};
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
 	struct semaphore	thread_sem;
 	unsigned int		flags;
-	struct request		*req;
 	int			(*issue_fn)(struct mmc_queue *, struct request *);
 	void			*data;
 	struct request_queue	*queue;
-	struct scatterlist	*sg;
-	char			*bounce_buf;
-	struct scatterlist	*bounce_sg;
-	unsigned int		bounce_sg_len;
+	struct mmc_queue_req	mqrq[2];
+	struct mmc_queue_req	*mqrq_cur;
+	struct mmc_queue_req	*mqrq_prev;
+	struct mmc_packed_stats	packed_stats;
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *,
@@ -25,8 +84,9 @@ extern void mmc_cleanup_queue(struct mmc_queue *);
 extern void mmc_queue_suspend(struct mmc_queue *);
 extern void mmc_queue_resume(struct mmc_queue *);
 
-extern unsigned int mmc_queue_map_sg(struct mmc_queue *);
-extern void mmc_queue_bounce_pre(struct mmc_queue *);
-extern void mmc_queue_bounce_post(struct mmc_queue *);
+extern unsigned int mmc_queue_map_sg(struct mmc_queue *,
+				     struct mmc_queue_req *);
+extern void mmc_queue_bounce_pre(struct mmc_queue_req *);
+extern void mmc_queue_bounce_post(struct mmc_queue_req *);
 
 #endif
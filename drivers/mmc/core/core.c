@@ -21,6 +21,7 @@
 #include <linux/leds.h>
 #include <linux/scatterlist.h>
 #include <linux/log2.h>
+#include <linux/slab.h>
 #include <linux/regulator/consumer.h>
 #include <linux/pm_runtime.h>
 #include <linux/wakelock.h>
@@ -199,9 +200,135 @@ mmc_start_request(struct mmc_host *host, struct mmc_request *mrq)
 
 static void mmc_wait_done(struct mmc_request *mrq)
 {
-	complete(mrq->done_data);
+	complete(&mrq->completion);
+}
+
+static void __mmc_start_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+	init_completion(&mrq->completion);
+	mrq->done = mmc_wait_done;
+	mmc_start_request(host, mrq);
+}
+
+static void mmc_wait_for_req_done(struct mmc_host *host,
+				  struct mmc_request *mrq)
+{
+	struct mmc_card *card = host->card;
+	struct mmc_command *cmd = mrq->cmd;
+
+	wait_for_completion(&mrq->completion);
+
+	/*
+	 * An eMMC raises an exception event in its R1 status once its
+	 * background operations become urgent. Note it, so they can be
+	 * started when the host is next idle.
+	 */
+	if (card && card->ext_csd.bkops_en && card->ext_csd.hpi_en &&
+	    !cmd->error && (mmc_resp_type(cmd) == MMC_RSP_R1 ||
+			    mmc_resp_type(cmd) == MMC_RSP_R1B) &&
+	    (cmd->resp[0] & R1_EXCEPTION_EVENT))
+		mmc_card_set_need_bkops(card);
+}
+
+/**
+ *	mmc_pre_req - Prepare for a new request
+ *	@host: MMC host to prepare command
+ *	@mrq: MMC request to prepare for
+ *	@is_first_req: true if there is no previous started request
+ *	               that may run in parallel to this call, otherwise false
+ *
+ *	mmc_pre_req() is called prior to mmc_start_req() to let
+ *	host prepare for the new request. Preparation of a request may be
+ *	performed while another request is running on the host.
+ */
+static void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq,
+		 bool is_first_req)
+{
+	if (host->ops->pre_req) {
+		mmc_host_clk_hold(host);
+		host->ops->pre_req(host, mrq, is_first_req);
+		mmc_host_clk_release(host);
+	}
+}
+
+/**
+ *	mmc_post_req - Post process a completed request
+ *	@host: MMC host to post process command
+ *	@mrq: MMC request to post process for
+ *	@err: Error, if non zero, clean up any resources made in pre_req
+ *
+ *	Let the host post process a completed request. Post processing of
+ *	a request may be performed while another request is running.
+ */
+static void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq,
+			 int err)
+{
+	if (host->ops->post_req) {
+		mmc_host_clk_hold(host);
+		host->ops->post_req(host, mrq, err);
+		mmc_host_clk_release(host);
+	}
 }
 
+/**
+ *	mmc_start_req - start a non-blocking request
+ *	@host: MMC host to start command
+ *	@areq: async request to start
+ *	@error: out parameter returns 0 for success, otherwise non zero
+ *
+ *	Start a new MMC custom command request for a host.
+ *	If there is an ongoing async request wait for completion
+ *	of that request and start the new one and return.
+ *	Does not wait for the new request to complete.
+ *
+ *	Returns the completed request, NULL in case of none completed.
+ *	Wait for an ongoing request (previously started) to complete and
+ *	return the completed request. If there is no ongoing request, NULL
+ *	is returned without waiting. NULL is not an error condition.
+ */
+struct mmc_async_req *mmc_start_req(struct mmc_host *host,
+				    struct mmc_async_req *areq, int *error)
+{
+	int err = 0;
+	struct mmc_async_req *data = host->areq;
+
+	/* Prepare a new request */
+	if (areq)
+		mmc_pre_req(host, areq->mrq, !host->areq);
+
+	if (host->areq) {
+		mmc_wait_for_req_done(host, host->areq->mrq);
+		err = host->areq->err_check(host->card, host->areq);
+		if (err) {
+			/* post process the completed failed request */
+			mmc_post_req(host, host->areq->mrq, 0);
+			if (areq)
+				/*
+				 * Cancel the new prepared request, because
+				 * it can't run until the failed
+				 * request has been properly handled.
+				 */
+				mmc_post_req(host, areq->mrq, -EINVAL);
+
+			host->areq = NULL;
+			goto out;
+		}
+	}
+
+	if (areq)
+		__mmc_start_req(host, areq->mrq);
+
+	if (host->areq)
+		mmc_post_req(host, host->areq->mrq, 0);
+
+	host->areq = areq;
+ out:
+	if (error)
+		*error = err;
+	return data;
+}
+EXPORT_SYMBOL(mmc_start_req);
+
 /**
  *	mmc_wait_for_req - start a request and wait for completion
  *	@host: MMC host to start command
@@ -213,14 +340,8 @@ static void mmc_wait_done(struct mmc_request *mrq)
  */
 void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
 {
-	DECLARE_COMPLETION_ONSTACK(complete);
-
-	mrq->done_data = &complete;
-	mrq->done = mmc_wait_done;
-
-	mmc_start_request(host, mrq);
-
-	wait_for_completion(&complete);
+	__mmc_start_req(host, mrq);
+	mmc_wait_for_req_done(host, mrq);
 }
 
 EXPORT_SYMBOL(mmc_wait_for_req);
@@ -1637,6 +1758,170 @@ int mmc_set_blocklen(struct mmc_card *card, unsigned int blocklen)
 }
 EXPORT_SYMBOL(mmc_set_blocklen);
 
+/*
+ * Write back the contents of the eMMC volatile cache. This is a no-op
+ * unless the cache was turned on when the card was initialised.
+ */
+int mmc_flush_cache(struct mmc_card *card)
+{
+	int err = 0;
+
+	if (mmc_card_mmc(card) && card->ext_csd.cache_ctrl) {
+		err = mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+				 EXT_CSD_FLUSH_CACHE, 1, 0);
+		if (err)
+			printk(KERN_ERR "%s: cache flush error %d\n",
+			       mmc_hostname(card->host), err);
+	}
+
+	return err;
+}
+EXPORT_SYMBOL(mmc_flush_cache);
+
+/*
+ * Interrupt whatever the card is busy with, and wait for it to be back
+ * in transfer state.
+ */
+static int mmc_interrupt_hpi(struct mmc_card *card)
+{
+	unsigned long prg_wait;
+	u32 status;
+	int err;
+
+	err = mmc_send_status(card, &status);
+	if (err)
+		return err;
+
+	/* Nothing to interrupt once the card has finished */
+	if (R1_CURRENT_STATE(status) != R1_STATE_PRG)
+		return 0;
+
+	err = mmc_send_hpi_cmd(card, &status);
+	if (err)
+		return err;
+	card->bkops_hpi++;
+
+	prg_wait = jiffies + msecs_to_jiffies(card->ext_csd.out_of_int_time);
+	do {
+		err = mmc_send_status(card, &status);
+		if (err)
+			return err;
+		if (R1_CURRENT_STATE(status) == R1_STATE_TRAN)
+			return 0;
+	} while (time_before_eq(jiffies, prg_wait));
+
+	return -ETIMEDOUT;
+}
+
+/**
+ *	mmc_start_bkops - start background operations on an idle card
+ *	@card: MMC card
+ *
+ *	Called by the block driver once its queue has gone idle. If the
+ *	card raised an exception event since, and reports that its
+ *	background operations are urgent, they are started without
+ *	waiting for them: the card works on them until it is done or
+ *	mmc_stop_bkops() interrupts it.
+ */
+void mmc_start_bkops(struct mmc_card *card)
+{
+	u8 *ext_csd;
+	int err;
+
+	if (!mmc_card_need_bkops(card) || mmc_card_doing_bkops(card))
+		return;
+
+	ext_csd = kmalloc(512, GFP_KERNEL);
+	if (!ext_csd)
+		return;
+
+	mmc_claim_host(card->host);
+	mmc_card_clr_need_bkops(card);
+
+	err = mmc_send_ext_csd(card, ext_csd);
+	if (err)
+		goto out;
+
+	card->ext_csd.raw_bkops_status = ext_csd[EXT_CSD_BKOPS_STATUS];
+	if (card->ext_csd.raw_bkops_status < EXT_CSD_BKOPS_LEVEL_2)
+		goto out;
+
+	err = __mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+			   EXT_CSD_BKOPS_START, 1, 0, false);
+	if (err) {
+		printk(KERN_WARNING "%s: failed to start background "
+		       "operations (%d)\n", mmc_hostname(card->host), err);
+		goto out;
+	}
+
+	mmc_card_set_doing_bkops(card);
+	card->bkops_started++;
+out:
+	mmc_release_host(card->host);
+	kfree(ext_csd);
+}
+EXPORT_SYMBOL(mmc_start_bkops);
+
+/**
+ *	mmc_stop_bkops - interrupt background operations
+ *	@card: MMC card
+ *
+ *	Must be called before the card is used while it may be doing
+ *	background operations. The time taken is accounted in the card's
+ *	MMC_LAT_HPI latency histogram.
+ */
+int mmc_stop_bkops(struct mmc_card *card)
+{
+	ktime_t start;
+	int err;
+
+	if (!mmc_card_doing_bkops(card))
+		return 0;
+
+	start = ktime_get();
+	mmc_claim_host(card->host);
+	err = mmc_interrupt_hpi(card);
+	mmc_card_clr_doing_bkops(card);
+	mmc_release_host(card->host);
+	mmc_latency_record(card, MMC_LAT_HPI, start);
+
+	if (err)
+		printk(KERN_ERR "%s: failed to interrupt background "
+		       "operations (%d)\n", mmc_hostname(card->host), err);
+
+	return err;
+}
+EXPORT_SYMBOL(mmc_stop_bkops);
+
+/**
+ *	mmc_latency_record - account a request in the latency histograms
+ *	@card: card the request went to
+ *	@type: type of request
+ *	@start: when the request was issued
+ *
+ *	The histograms are updated with the host claimed, and shown in the
+ *	card's "latency" debugfs file.
+ */
+void mmc_latency_record(struct mmc_card *card, enum mmc_lat_type type,
+			ktime_t start)
+{
+	struct mmc_lat_hist *lat = &card->lat;
+	s64 us = ktime_us_delta(ktime_get(), start);
+	unsigned int bucket = 0;
+
+	if (us < 0)
+		us = 0;
+	if (us >> 6)
+		bucket = min_t(unsigned int, ilog2((u64)us >> 6) + 1,
+			       MMC_LAT_BUCKETS - 1);
+
+	lat->count[type][bucket]++;
+	lat->total_us[type] += us;
+	if (us > lat->max_us[type])
+		lat->max_us[type] = min_t(s64, us, UINT_MAX);
+}
+EXPORT_SYMBOL(mmc_latency_record);
+
 static int mmc_rescan_try_freq(struct mmc_host *host, unsigned freq)
 {
 	host->f_init = freq;
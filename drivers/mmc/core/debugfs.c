@@ -242,6 +242,7 @@ static int mmc_ext_csd_open(struct inode *inode, struct file *filp)
 	}
 
 	mmc_claim_host(card->host);
+	mmc_stop_bkops(card);
 	err = mmc_send_ext_csd(card, ext_csd);
 	mmc_release_host(card->host);
 	if (err)
@@ -284,6 +285,72 @@ static const struct file_operations mmc_dbg_ext_csd_fops = {
 	.llseek		= default_llseek,
 };
 
+static int mmc_latency_show(struct seq_file *s, void *data)
+{
+	static const char *type_str[MMC_LAT_TYPES] = {
+		[MMC_LAT_READ]		= "read",
+		[MMC_LAT_WRITE]		= "write",
+		[MMC_LAT_DISCARD]	= "discard",
+		[MMC_LAT_FLUSH]		= "flush",
+		[MMC_LAT_HPI]		= "hpi",
+	};
+	struct mmc_card *card = s->private;
+	struct mmc_lat_hist *lat = &card->lat;
+	unsigned long n;
+	int t, i;
+
+	for (t = 0; t < MMC_LAT_TYPES; t++) {
+		for (n = 0, i = 0; i < MMC_LAT_BUCKETS; i++)
+			n += lat->count[t][i];
+		if (!n)
+			continue;
+
+		seq_printf(s, "%s: %lu requests, avg %lluus, max %uus\n",
+			   type_str[t], n, div_u64(lat->total_us[t], n),
+			   lat->max_us[t]);
+		for (i = 0; i < MMC_LAT_BUCKETS - 1; i++)
+			if (lat->count[t][i])
+				seq_printf(s, "  <%uus\t%lu\n", 64 << i,
+					   lat->count[t][i]);
+		if (lat->count[t][i])
+			seq_printf(s, "  >=%uus\t%lu\n", 64 << (i - 1),
+				   lat->count[t][i]);
+	}
+
+	if (card->ext_csd.bkops_en)
+		seq_printf(s, "bkops: %u started, %u interrupted, level %u\n",
+			   card->bkops_started, card->bkops_hpi,
+			   card->ext_csd.raw_bkops_status);
+
+	return 0;
+}
+
+static int mmc_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_latency_show, inode->i_private);
+}
+
+/* Any write clears the histograms */
+static ssize_t mmc_latency_write(struct file *file, const char __user *ubuf,
+				 size_t cnt, loff_t *ppos)
+{
+	struct mmc_card *card = ((struct seq_file *)file->private_data)->private;
+
+	mmc_claim_host(card->host);
+	memset(&card->lat, 0, sizeof(card->lat));
+	mmc_release_host(card->host);
+
+	return cnt;
+}
+
+static const struct file_operations mmc_dbg_latency_fops = {
+	.open		= mmc_latency_open,
+	.read		= seq_read,
+	.write		= mmc_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_card_debugfs(struct mmc_card *card)
 {
 	struct mmc_host	*host = card->host;
@@ -306,10 +373,14 @@ void mmc_add_card_debugfs(struct mmc_card *card)
 	if (!debugfs_create_x32("state", S_IRUSR, root, &card->state))
 		goto err;
 
-	if (mmc_card_mmc(card) || mmc_card_sd(card))
+	if (mmc_card_mmc(card) || mmc_card_sd(card)) {
 		if (!debugfs_create_file("status", S_IRUSR, root, card,
 					&mmc_dbg_card_status_fops))
 			goto err;
+		if (!debugfs_create_file("latency", S_IRUSR | S_IWUSR, root,
+					card, &mmc_dbg_latency_fops))
+			goto err;
+	}
 
 	if (mmc_card_mmc(card))
 		if (!debugfs_create_file("ext_csd", S_IRUSR, root, card,
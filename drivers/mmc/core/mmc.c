@@ -440,9 +440,48 @@ static int mmc_read_ext_csd(struct mmc_card *card, u8 *ext_csd)
 			ext_csd[EXT_CSD_TRIM_MULT];
 	}
 
-	if (card->ext_csd.rev >= 5)
+	if (card->ext_csd.rev >= 5) {
 		card->ext_csd.rel_param = ext_csd[EXT_CSD_WR_REL_PARAM];
 
+		/*
+		 * BKOPS_EN is one-time programmable and left to the
+		 * manufacturing tools; background operations are only
+		 * started on cards that have it set.
+		 */
+		if (ext_csd[EXT_CSD_BKOPS_SUPPORT] & 0x1) {
+			card->ext_csd.bkops = 1;
+			card->ext_csd.bkops_en = ext_csd[EXT_CSD_BKOPS_EN] & 0x1;
+			card->ext_csd.raw_bkops_status =
+				ext_csd[EXT_CSD_BKOPS_STATUS];
+		}
+
+		if (ext_csd[EXT_CSD_HPI_FEATURES] & 0x1) {
+			card->ext_csd.hpi = 1;
+			if (ext_csd[EXT_CSD_HPI_FEATURES] & 0x2)
+				card->ext_csd.hpi_cmd = MMC_STOP_TRANSMISSION;
+			else
+				card->ext_csd.hpi_cmd = MMC_SEND_STATUS;
+			card->ext_csd.out_of_int_time =
+				ext_csd[EXT_CSD_OUT_OF_INTERRUPT_TIME] * 10;
+		}
+	}
+
+	if (card->ext_csd.rev >= 6) {
+		card->ext_csd.cache_size =
+			ext_csd[EXT_CSD_CACHE_SIZE + 0] << 0 |
+			ext_csd[EXT_CSD_CACHE_SIZE + 1] << 8 |
+			ext_csd[EXT_CSD_CACHE_SIZE + 2] << 16 |
+			ext_csd[EXT_CSD_CACHE_SIZE + 3] << 24;
+
+		/*
+		 * The block driver only issues 512 byte sectors, so packed
+		 * commands are left alone on cards with a 4KB native sector.
+		 */
+		if (!ext_csd[EXT_CSD_DATA_SECTOR_SIZE])
+			card->ext_csd.max_packed_writes =
+				ext_csd[EXT_CSD_MAX_PACKED_WRITES];
+	}
+
 	card->ext_csd.raw_erased_mem_count = ext_csd[EXT_CSD_ERASED_MEM_CONT];
 	if (ext_csd[EXT_CSD_ERASED_MEM_CONT])
 		card->erased_byte = 0xFF;
@@ -880,6 +919,61 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 		}
 	}
 
+	/*
+	 * Turn the volatile cache on. Writes then complete once they are
+	 * in the cache, and the block driver issues FLUSH_CACHE for
+	 * REQ_FLUSH and before suspend.
+	 */
+	if ((host->caps2 & MMC_CAP2_CACHE_CTRL) &&
+	    card->ext_csd.cache_size > 0) {
+		err = mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+				 EXT_CSD_CACHE_CTRL, 1, 0);
+		if (err && err != -EBADMSG)
+			goto free_card;
+		card->ext_csd.cache_ctrl = !err;
+		if (err) {
+			printk(KERN_WARNING "%s: failed to enable %uKB cache "
+			       "(%d)\n", mmc_hostname(card->host),
+			       card->ext_csd.cache_size, err);
+			err = 0;
+		}
+	}
+
+	/*
+	 * HPI is what lets a request interrupt background operations, so
+	 * it is only turned on where those are used.
+	 */
+	if ((host->caps2 & MMC_CAP2_BKOPS) && card->ext_csd.hpi) {
+		err = mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+				 EXT_CSD_HPI_MGMT, 1, 0);
+		if (err && err != -EBADMSG)
+			goto free_card;
+		card->ext_csd.hpi_en = !err;
+		if (err) {
+			printk(KERN_WARNING "%s: failed to enable HPI (%d)\n",
+			       mmc_hostname(card->host), err);
+			err = 0;
+		}
+	}
+
+	/*
+	 * Have the card flag a failed packed write as an exception event,
+	 * so the block driver can find out which entry failed.
+	 */
+	if (mmc_host_packed_wr(host) && card->ext_csd.max_packed_writes > 0) {
+		err = mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+				 EXT_CSD_EXP_EVENTS_CTRL,
+				 EXT_CSD_PACKED_EVENT_EN, 0);
+		if (err && err != -EBADMSG)
+			goto free_card;
+		card->ext_csd.packed_event_en = !err;
+		if (err) {
+			printk(KERN_WARNING "%s: failed to enable packed "
+			       "events (%d)\n", mmc_hostname(card->host), err);
+			err = 0;
+		}
+	}
+
 	if (!oldcard)
 		host->card = card;
 
@@ -947,11 +1041,20 @@ static int mmc_suspend(struct mmc_host *host)
 	BUG_ON(!host->card);
 
 	mmc_claim_host(host);
+	err = mmc_stop_bkops(host->card);
+	if (err)
+		goto out;
+
+	err = mmc_flush_cache(host->card);
+	if (err)
+		goto out;
+
 	if (mmc_card_can_sleep(host))
 		err = mmc_card_sleep(host);
 	else if (!mmc_host_is_spi(host))
 		mmc_deselect_cards(host);
 	host->card->state &= ~MMC_STATE_HIGHSPEED;
+out:
 	mmc_release_host_sync(host);
 
 	return err;
@@ -994,6 +1097,10 @@ static int mmc_sleep(struct mmc_host *host)
 	struct mmc_card *card = host->card;
 	int err = -ENOSYS;
 
+	/* background operations had the card while the host was idle */
+	if (card)
+		mmc_stop_bkops(card);
+
 	//If Manufacturer ID is Samsung (0x15), bypass Sleep command transmission as Samsung EMMC goes automatically in sleep mode (HW feature) 
         if(card->cid.manfid == 0x15)
         return 0;
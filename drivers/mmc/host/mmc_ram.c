@@ -0,0 +1,543 @@
+/*
+ *  linux/drivers/mmc/host/mmc_ram.c - RAM-backed virtual MMC host
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ * The host emulates a byte-addressed eMMC v4.5 card kept in vmalloc()ed
+ * memory, so the MMC core, the block driver and mmc_test can be exercised
+ * and timed without hardware.  A request is completed from a workqueue no
+ * earlier than delay_us plus its size at rate_kbs after it was started,
+ * standing in for the bus transfer, which takes no CPU time with DMA.
+ *
+ * Before a data request can be started, the host spends prep_us of CPU
+ * time busy-waiting, standing in for the dma_map_sg() and descriptor table
+ * build of a DMA host.  With prepare_ahead set, this is done from pre_req()
+ * while the previous request is still in flight, the way omap_hsmmc does;
+ * otherwise it is done in the request path.  Loading the module once with
+ * each setting and running dd or fio on the card gives the throughput
+ * gained by preparing requests ahead.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/mmc/host.h>
+#include <linux/mmc/mmc.h>
+
+#define DRIVER_NAME	"mmc_ram"
+
+/* Capacity is set in 256KB units: C_SIZE counts 512 blocks of 512 bytes */
+#define MMC_RAM_MAX_MB	1024
+#define MMC_RAM_OCR	(MMC_CARD_BUSY | MMC_VDD_165_195 | 0x00ff8000)
+
+static unsigned int size_mb = 64;
+module_param(size_mb, uint, 0444);
+MODULE_PARM_DESC(size_mb, "Card size in megabytes (1-1024)");
+
+static unsigned int delay_us = 100;
+module_param(delay_us, uint, 0644);
+MODULE_PARM_DESC(delay_us, "Time taken by every request, in microseconds");
+
+static unsigned int rate_kbs = 20480;
+module_param(rate_kbs, uint, 0644);
+MODULE_PARM_DESC(rate_kbs, "Data transfer rate in KB/s, 0 for no limit");
+
+static unsigned int prep_us = 100;
+module_param(prep_us, uint, 0644);
+MODULE_PARM_DESC(prep_us, "CPU time taken to prepare a data request, "
+		 "in microseconds");
+
+static bool prepare_ahead = true;
+module_param(prepare_ahead, bool, 0444);
+MODULE_PARM_DESC(prepare_ahead, "Prepare the next request from pre_req() "
+		 "while the current one is in flight");
+
+struct mmc_ram_host {
+	struct mmc_host		*mmc;
+	struct mmc_request	*mrq;
+	struct workqueue_struct	*wq;
+	struct work_struct	work;
+	ktime_t			start;
+
+	u8			*mem;
+	unsigned long		size;
+
+	/* Card state */
+	unsigned int		state;
+	u16			rca;
+	bool			switch_error;
+	u32			cid[4];
+	u32			csd[4];
+	u8			ext_csd[512];
+
+	s32			next_cookie;
+};
+
+/* Set the bits start..start + size - 1 of a 128-bit register, see
+ * UNSTUFF_BITS() in drivers/mmc/core/mmc.c for the layout. */
+static void mmc_ram_stuff_bits(u32 *resp, int start, int size, u32 val)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		int bit = start + i;
+		u32 mask = 1U << (bit & 31);
+
+		if (val & (1U << i))
+			resp[3 - bit / 32] |= mask;
+		else
+			resp[3 - bit / 32] &= ~mask;
+	}
+}
+
+static void mmc_ram_init_card(struct mmc_ram_host *host)
+{
+	u32 *cid = host->cid, *csd = host->csd;
+	u8 *ext_csd = host->ext_csd;
+	const char *name = "RAMMMC";
+	unsigned int sectors = host->size >> 9;
+	int i;
+
+	memset(cid, 0, sizeof(host->cid));
+	mmc_ram_stuff_bits(cid, 120, 8, 0xfe);		/* MID */
+	mmc_ram_stuff_bits(cid, 104, 16, 0x4c58);	/* OID */
+	for (i = 0; i < 6; i++)				/* PNM */
+		mmc_ram_stuff_bits(cid, 96 - i * 8, 8, name[i]);
+	mmc_ram_stuff_bits(cid, 48, 8, 0x10);		/* PRV */
+	mmc_ram_stuff_bits(cid, 16, 32, 0x1);		/* PSN */
+	mmc_ram_stuff_bits(cid, 8, 8, 0x1f);		/* MDT */
+	mmc_ram_stuff_bits(cid, 0, 1, 1);
+
+	memset(csd, 0, sizeof(host->csd));
+	mmc_ram_stuff_bits(csd, 126, 2, 3);		/* CSD_STRUCTURE */
+	mmc_ram_stuff_bits(csd, 122, 4, 4);		/* SPEC_VERS */
+	mmc_ram_stuff_bits(csd, 112, 8, 0x27);		/* TAAC: 1ms */
+	mmc_ram_stuff_bits(csd, 104, 8, 1);		/* NSAC */
+	mmc_ram_stuff_bits(csd, 96, 8, 0x32);		/* TRAN_SPEED: 25MHz */
+	mmc_ram_stuff_bits(csd, 84, 12, 0x015);		/* CCC: 0, 2, 4 */
+	mmc_ram_stuff_bits(csd, 80, 4, 9);		/* READ_BL_LEN */
+	mmc_ram_stuff_bits(csd, 62, 12, (host->size >> 18) - 1); /* C_SIZE */
+	mmc_ram_stuff_bits(csd, 47, 3, 7);		/* C_SIZE_MULT */
+	mmc_ram_stuff_bits(csd, 26, 3, 2);		/* R2W_FACTOR */
+	mmc_ram_stuff_bits(csd, 22, 4, 9);		/* WRITE_BL_LEN */
+	mmc_ram_stuff_bits(csd, 0, 1, 1);
+
+	/* Fields the core reads and does not find here are left zero */
+	memset(ext_csd, 0, sizeof(host->ext_csd));
+	ext_csd[EXT_CSD_REV] = 5;
+	ext_csd[EXT_CSD_STRUCTURE] = 2;
+	ext_csd[EXT_CSD_CARD_TYPE] = EXT_CSD_CARD_TYPE_26 |
+				     EXT_CSD_CARD_TYPE_52;
+	ext_csd[EXT_CSD_SEC_CNT + 0] = sectors >> 0;
+	ext_csd[EXT_CSD_SEC_CNT + 1] = sectors >> 8;
+	ext_csd[EXT_CSD_SEC_CNT + 2] = sectors >> 16;
+	ext_csd[EXT_CSD_SEC_CNT + 3] = sectors >> 24;
+	ext_csd[EXT_CSD_ERASE_TIMEOUT_MULT] = 1;
+	ext_csd[EXT_CSD_HC_ERASE_GRP_SIZE] = 1;
+	ext_csd[EXT_CSD_REL_WR_SEC_C] = 1;
+	ext_csd[EXT_CSD_S_A_TIMEOUT] = 0x11;
+
+	host->state = R1_STATE_IDLE;
+	host->rca = 0;
+	host->switch_error = false;
+}
+
+static u32 mmc_ram_status(struct mmc_ram_host *host)
+{
+	u32 status = host->state << 9;
+
+	if (host->state == R1_STATE_TRAN)
+		status |= R1_READY_FOR_DATA;
+	if (host->switch_error)
+		status |= R1_SWITCH_ERROR;
+	return status;
+}
+
+/* CMD6: only the modes segment of EXT_CSD, below EXT_CSD_REV, is writable */
+static void mmc_ram_switch(struct mmc_ram_host *host, u32 arg)
+{
+	unsigned int mode = (arg >> 24) & 0x3;
+	unsigned int index = (arg >> 16) & 0xff;
+	u8 value = (arg >> 8) & 0xff;
+
+	if (index >= EXT_CSD_REV || mode == MMC_SWITCH_MODE_CMD_SET) {
+		host->switch_error = true;
+		return;
+	}
+
+	switch (mode) {
+	case MMC_SWITCH_MODE_SET_BITS:
+		host->ext_csd[index] |= value;
+		break;
+	case MMC_SWITCH_MODE_CLEAR_BITS:
+		host->ext_csd[index] &= ~value;
+		break;
+	case MMC_SWITCH_MODE_WRITE_BYTE:
+		host->ext_csd[index] = value;
+		break;
+	}
+}
+
+static void mmc_ram_command(struct mmc_ram_host *host,
+			    struct mmc_command *cmd, struct mmc_data *data)
+{
+	u32 status = mmc_ram_status(host);
+
+	cmd->error = 0;
+	memset(cmd->resp, 0, sizeof(cmd->resp));
+
+	switch (cmd->opcode) {
+	case MMC_GO_IDLE_STATE:
+		mmc_ram_init_card(host);
+		return;
+	case MMC_SEND_OP_COND:
+		cmd->resp[0] = MMC_RAM_OCR;
+		if (cmd->arg)
+			host->state = R1_STATE_READY;
+		return;
+	case MMC_ALL_SEND_CID:
+		memcpy(cmd->resp, host->cid, sizeof(host->cid));
+		host->state = R1_STATE_IDENT;
+		return;
+	case MMC_SET_RELATIVE_ADDR:
+		host->rca = cmd->arg >> 16;
+		host->state = R1_STATE_STBY;
+		break;
+	case MMC_SEND_CSD:
+		memcpy(cmd->resp, host->csd, sizeof(host->csd));
+		return;
+	case MMC_SEND_CID:
+		memcpy(cmd->resp, host->cid, sizeof(host->cid));
+		return;
+	case MMC_SELECT_CARD:
+		if ((cmd->arg >> 16) == host->rca)
+			host->state = R1_STATE_TRAN;
+		else
+			host->state = R1_STATE_STBY;
+		break;
+	case MMC_SEND_EXT_CSD:
+		/* Without data this is SD_SEND_IF_COND */
+		if (!data)
+			goto timeout;
+		break;
+	case MMC_SWITCH:
+		host->switch_error = false;
+		mmc_ram_switch(host, cmd->arg);
+		break;
+	case MMC_SEND_STATUS:
+		host->switch_error = false;
+		break;
+	case MMC_SET_BLOCKLEN:
+		if (cmd->arg != 512)
+			status |= R1_BLOCK_LEN_ERROR;
+		break;
+	case MMC_SET_BLOCK_COUNT:
+	case MMC_STOP_TRANSMISSION:
+	case MMC_READ_SINGLE_BLOCK:
+	case MMC_READ_MULTIPLE_BLOCK:
+	case MMC_WRITE_BLOCK:
+	case MMC_WRITE_MULTIPLE_BLOCK:
+		break;
+	default:
+		/* SDIO and SD probing, and anything else, times out */
+		goto timeout;
+	}
+
+	cmd->resp[0] = status;
+	return;
+
+timeout:
+	cmd->error = -ETIMEDOUT;
+}
+
+static void mmc_ram_transfer(struct mmc_ram_host *host,
+			     struct mmc_command *cmd, struct mmc_data *data)
+{
+	unsigned int len = data->blksz * data->blocks;
+	unsigned long addr = cmd->arg;
+	u8 *mem;
+
+	data->error = 0;
+	data->bytes_xfered = 0;
+
+	if (cmd->opcode == MMC_SEND_EXT_CSD) {
+		mem = host->ext_csd;
+		if (len > sizeof(host->ext_csd))
+			goto err;
+	} else {
+		mem = host->mem + addr;
+		if (addr >= host->size || len > host->size - addr) {
+			cmd->resp[0] |= R1_OUT_OF_RANGE;
+			goto err;
+		}
+	}
+
+	if (data->flags & MMC_DATA_READ)
+		sg_copy_from_buffer(data->sg, data->sg_len, mem, len);
+	else
+		sg_copy_to_buffer(data->sg, data->sg_len, mem, len);
+	data->bytes_xfered = len;
+	return;
+
+err:
+	data->error = -EIO;
+}
+
+/* Stand in for dma_map_sg() and the descriptor table build */
+static void mmc_ram_prepare_data(void)
+{
+	unsigned int us = prep_us;
+
+	if (us >= 1000)
+		mdelay(us / 1000);
+	udelay(us % 1000);
+}
+
+/* Wait until the request has been on the bus for as long as modelled */
+static void mmc_ram_bus_time(struct mmc_ram_host *host,
+			     struct mmc_request *mrq)
+{
+	u64 us = delay_us;
+	s64 left;
+
+	if (mrq->data && rate_kbs)
+		us += div_u64((u64)mrq->data->bytes_xfered * USEC_PER_SEC,
+			      rate_kbs * 1024);
+
+	left = us - ktime_us_delta(ktime_get(), host->start);
+	if (left > 0)
+		usleep_range(left, left + 20);
+}
+
+static void mmc_ram_work(struct work_struct *work)
+{
+	struct mmc_ram_host *host = container_of(work, struct mmc_ram_host,
+						 work);
+	struct mmc_request *mrq = host->mrq;
+	struct mmc_data *data = mrq->data;
+
+	if (mrq->sbc) {
+		mmc_ram_command(host, mrq->sbc, NULL);
+		if (mrq->sbc->error)
+			goto done;
+	}
+
+	mmc_ram_command(host, mrq->cmd, data);
+	if (mrq->cmd->error)
+		goto done;
+
+	if (data) {
+		mmc_ram_transfer(host, mrq->cmd, data);
+		if (data->stop && (!mrq->sbc || data->error))
+			mmc_ram_command(host, data->stop, NULL);
+	}
+
+done:
+	mmc_ram_bus_time(host, mrq);
+	host->mrq = NULL;
+	mmc_request_done(host->mmc, mrq);
+}
+
+static void mmc_ram_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct mmc_ram_host *host = mmc_priv(mmc);
+
+	WARN_ON(host->mrq != NULL);
+
+	if (mrq->data && !mrq->data->host_cookie)
+		mmc_ram_prepare_data();
+
+	host->mrq = mrq;
+	host->start = ktime_get();
+	queue_work(host->wq, &host->work);
+}
+
+static void mmc_ram_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			    bool is_first_req)
+{
+	struct mmc_ram_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	if (data->host_cookie) {
+		data->host_cookie = 0;
+		return;
+	}
+
+	mmc_ram_prepare_data();
+	if (++host->next_cookie < 0)
+		host->next_cookie = 1;
+	data->host_cookie = host->next_cookie;
+}
+
+static void mmc_ram_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			     int err)
+{
+	if (mrq->data)
+		mrq->data->host_cookie = 0;
+}
+
+static void mmc_ram_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
+{
+}
+
+static int mmc_ram_get_ro(struct mmc_host *mmc)
+{
+	return 0;
+}
+
+static int mmc_ram_get_cd(struct mmc_host *mmc)
+{
+	return 1;
+}
+
+static const struct mmc_host_ops mmc_ram_ops = {
+	.request	= mmc_ram_request,
+	.set_ios	= mmc_ram_set_ios,
+	.get_ro		= mmc_ram_get_ro,
+	.get_cd		= mmc_ram_get_cd,
+};
+
+static const struct mmc_host_ops mmc_ram_ahead_ops = {
+	.post_req	= mmc_ram_post_req,
+	.pre_req	= mmc_ram_pre_req,
+	.request	= mmc_ram_request,
+	.set_ios	= mmc_ram_set_ios,
+	.get_ro		= mmc_ram_get_ro,
+	.get_cd		= mmc_ram_get_cd,
+};
+
+static int __devinit mmc_ram_probe(struct platform_device *pdev)
+{
+	struct mmc_host *mmc;
+	struct mmc_ram_host *host;
+	int ret;
+
+	if (!size_mb || size_mb > MMC_RAM_MAX_MB) {
+		dev_err(&pdev->dev, "size_mb must be 1 to %d\n",
+			MMC_RAM_MAX_MB);
+		return -EINVAL;
+	}
+
+	mmc = mmc_alloc_host(sizeof(struct mmc_ram_host), &pdev->dev);
+	if (!mmc)
+		return -ENOMEM;
+
+	host = mmc_priv(mmc);
+	host->mmc = mmc;
+	host->size = (unsigned long)size_mb << 20;
+	INIT_WORK(&host->work, mmc_ram_work);
+
+	host->mem = vzalloc(host->size);
+	if (!host->mem) {
+		ret = -ENOMEM;
+		goto err_mem;
+	}
+
+	host->wq = create_singlethread_workqueue(DRIVER_NAME);
+	if (!host->wq) {
+		ret = -ENOMEM;
+		goto err_wq;
+	}
+
+	mmc_ram_init_card(host);
+
+	mmc->ops = prepare_ahead ? &mmc_ram_ahead_ops : &mmc_ram_ops;
+	mmc->f_min = 400000;
+	mmc->f_max = 52000000;
+	mmc->ocr_avail = MMC_VDD_32_33 | MMC_VDD_33_34 | MMC_VDD_165_195;
+	mmc->caps = MMC_CAP_4_BIT_DATA | MMC_CAP_8_BIT_DATA |
+		    MMC_CAP_MMC_HIGHSPEED | MMC_CAP_NONREMOVABLE |
+		    MMC_CAP_WAIT_WHILE_BUSY | MMC_CAP_CMD23;
+
+	mmc->max_segs = 1024;
+	mmc->max_blk_size = 512;
+	mmc->max_blk_count = 0xffff;
+	mmc->max_req_size = mmc->max_blk_size * mmc->max_blk_count;
+	mmc->max_seg_size = mmc->max_req_size;
+
+	platform_set_drvdata(pdev, host);
+
+	ret = mmc_add_host(mmc);
+	if (ret)
+		goto err_add;
+
+	dev_info(&pdev->dev, "%uMB, %uus + %uKB/s per request, "
+		 "%uus to prepare%s\n", size_mb, delay_us, rate_kbs, prep_us,
+		 prepare_ahead ? " ahead" : "");
+	return 0;
+
+err_add:
+	platform_set_drvdata(pdev, NULL);
+	destroy_workqueue(host->wq);
+err_wq:
+	vfree(host->mem);
+err_mem:
+	mmc_free_host(mmc);
+	return ret;
+}
+
+static int __devexit mmc_ram_remove(struct platform_device *pdev)
+{
+	struct mmc_ram_host *host = platform_get_drvdata(pdev);
+
+	mmc_remove_host(host->mmc);
+	destroy_workqueue(host->wq);
+	vfree(host->mem);
+	platform_set_drvdata(pdev, NULL);
+	mmc_free_host(host->mmc);
+
+	return 0;
+}
+
+static struct platform_driver mmc_ram_driver = {
+	.probe		= mmc_ram_probe,
+	.remove		= __devexit_p(mmc_ram_remove),
+	.driver		= {
+		.name	= DRIVER_NAME,
+		.owner	= THIS_MODULE,
+	},
+};
+
+static struct platform_device *mmc_ram_device;
+
+static int __init mmc_ram_init(void)
+{
+	int ret;
+
+	ret = platform_driver_register(&mmc_ram_driver);
+	if (ret)
+		return ret;
+
+	mmc_ram_device = platform_device_register_simple(DRIVER_NAME, -1,
+							 NULL, 0);
+	if (IS_ERR(mmc_ram_device)) {
+		platform_driver_unregister(&mmc_ram_driver);
+		return PTR_ERR(mmc_ram_device);
+	}
+
+	return 0;
+}
+
+static void __exit mmc_ram_exit(void)
+{
+	platform_device_unregister(mmc_ram_device);
+	platform_driver_unregister(&mmc_ram_driver);
+}
+
+module_init(mmc_ram_init);
+module_exit(mmc_ram_exit);
+
+MODULE_DESCRIPTION("RAM-backed virtual MMC host");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("platform:" DRIVER_NAME);
@@ -134,6 +134,11 @@
 #define DMA_TABLE_NUM_ENTRIES	1024
 #define ADMA_TABLE_SZ 	\
 	(DMA_TABLE_NUM_ENTRIES * sizeof(struct adma_desc_table))
+/*
+ * Two ADMA tables: one for the request on the bus, one being filled for
+ * the next request by omap_hsmmc_pre_req().
+ */
+#define ADMA_TABLE_NUM		2
 
 #define SDMA_XFER	1
 #define ADMA_XFER	2
@@ -197,6 +202,13 @@ struct adma_desc_table {
 	dma_addr_t addr;
 };
 
+/* A request prepared by omap_hsmmc_pre_req() ahead of being started */
+struct omap_hsmmc_next {
+	unsigned int	dma_len;	/* nonzero while one is pending */
+	s32		cookie;
+	int		adma_idx;	/* ADMA table built for it */
+};
+
 struct omap_hsmmc_host {
 	struct	device		*dev;
 	struct	mmc_host	*mmc;
@@ -238,6 +250,8 @@ struct omap_hsmmc_host {
 	int			dma_type, dma_ch;
 	struct adma_desc_table	*adma_table;
 	dma_addr_t		phy_adma_table;
+	int			adma_idx;	/* ADMA table on the bus */
+	struct omap_hsmmc_next	next_data;
 	int			dma_line_tx, dma_line_rx;
 	int			slot_id;
 	int			got_dbclk;
@@ -999,7 +1013,7 @@ omap_hsmmc_xfer_done(struct omap_hsmmc_host *host, struct mmc_data *data)
 
 	host->data = NULL;
 
-	if (host->dma_type == ADMA_XFER)
+	if (host->dma_type == ADMA_XFER && !data->host_cookie)
 		dma_unmap_sg(mmc_dev(host->mmc), data->sg, host->dma_len,
 					omap_hsmmc_get_dma_dir(host, data));
 
@@ -1095,9 +1109,10 @@ static void omap_hsmmc_dma_cleanup(struct omap_hsmmc_host *host, int errno)
 	spin_unlock(&host->irq_lock);
 
 	if ((host->dma_type == SDMA_XFER) && (dma_ch != -1)) {
-		dma_unmap_sg(mmc_dev(host->mmc), host->data->sg,
-			host->data->sg_len,
-			omap_hsmmc_get_dma_dir(host, host->data));
+		if (!host->data->host_cookie)
+			dma_unmap_sg(mmc_dev(host->mmc), host->data->sg,
+				host->data->sg_len,
+				omap_hsmmc_get_dma_dir(host, host->data));
 		omap_free_dma(dma_ch);
 	}
 	host->data = NULL;
@@ -1522,8 +1537,9 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 		return;
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-		omap_hsmmc_get_dma_dir(host, data));
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			omap_hsmmc_get_dma_dir(host, data));
 
 	req_in_progress = host->req_in_progress;
 	dma_ch = host->dma_ch;
@@ -1541,6 +1557,10 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 	}
 }
 
+static int omap_hsmmc_pre_dma_transfer(struct omap_hsmmc_host *host,
+				       struct mmc_data *data,
+				       struct omap_hsmmc_next *next);
+
 /*
  * Routine to configure and start DMA for the MMC card
  */
@@ -1575,8 +1595,11 @@ static int omap_hsmmc_start_sdma_transfer(struct omap_hsmmc_host *host,
 		return ret;
 	}
 
-	host->dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg,
-			data->sg_len, omap_hsmmc_get_dma_dir(host, data));
+	ret = omap_hsmmc_pre_dma_transfer(host, data, NULL);
+	if (ret) {
+		omap_free_dma(dma_ch);
+		return ret;
+	}
 	host->dma_ch = dma_ch;
 	host->dma_sg_idx = 0;
 
@@ -1586,17 +1609,15 @@ static int omap_hsmmc_start_sdma_transfer(struct omap_hsmmc_host *host,
 }
 
 static int mmc_populate_adma_desc_table(struct omap_hsmmc_host *host,
-		struct mmc_request *req, struct adma_desc_table *pdesc)
+		struct mmc_data *data, unsigned int dma_len,
+		struct adma_desc_table *pdesc)
 {
 	int i, j, dmalen;
 	int splitseg, xferaddr;
 	int numblocks = 0;
 	dma_addr_t dmaaddr;
-	struct mmc_data *data = req->data;
 
-	host->dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg,
-			data->sg_len, omap_hsmmc_get_dma_dir(host, data));
-	for (i = 0, j = 0; i < host->dma_len; i++) {
+	for (i = 0, j = 0; i < dma_len; i++) {
 		dmaaddr = sg_dma_address(data->sg + i);
 		dmalen = sg_dma_len(data->sg + i);
 		numblocks += dmalen / data->blksz;
@@ -1633,15 +1654,78 @@ static int mmc_populate_adma_desc_table(struct omap_hsmmc_host *host,
 	pdesc[i + j - 1].attr |= ADMA_XFER_END;
 	WARN_ON((i + j - 1) > DMA_TABLE_NUM_ENTRIES);
 	dev_dbg(mmc_dev(host->mmc),
-		"ADMA table has %d entries from %d sglist\n",
-		i + j, host->dma_len);
+		"ADMA table has %d entries from %u sglist\n",
+		i + j, dma_len);
 	return numblocks;
 }
 
 static void omap_hsmmc_start_adma_transfer(struct omap_hsmmc_host *host)
 {
 	wmb();
-	OMAP_HSMMC_WRITE(host->base, ADMA_SAL, host->phy_adma_table);
+	OMAP_HSMMC_WRITE(host->base, ADMA_SAL, host->phy_adma_table +
+			 host->adma_idx * ADMA_TABLE_SZ);
+}
+
+/*
+ * Map the data of a request for DMA and, with ADMA, build its descriptor
+ * table. Called with next set from omap_hsmmc_pre_req(), to do this while
+ * the current request is still on the bus; otherwise when the request is
+ * started, which takes over the prepared work if the cookie matches.
+ */
+static int omap_hsmmc_pre_dma_transfer(struct omap_hsmmc_host *host,
+				       struct mmc_data *data,
+				       struct omap_hsmmc_next *next)
+{
+	unsigned int dma_len;
+	int adma_idx = host->adma_idx;
+
+	if (!next && data->host_cookie &&
+	    data->host_cookie != host->next_data.cookie) {
+		dev_warn(mmc_dev(host->mmc), "%s: invalid cookie %d, "
+			 "expected %d\n", __func__, data->host_cookie,
+			 host->next_data.cookie);
+		data->host_cookie = 0;
+	}
+
+	/* Check if the request was already prepared */
+	if (!next && data->host_cookie) {
+		host->dma_len = host->next_data.dma_len;
+		host->adma_idx = host->next_data.adma_idx;
+		host->next_data.dma_len = 0;
+		return 0;
+	}
+
+	dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     omap_hsmmc_get_dma_dir(host, data));
+	if (!dma_len)
+		return -EINVAL;
+
+	if (host->dma_type == ADMA_XFER) {
+		int numblks;
+
+		/* Keep off the table in use, or the one kept for next */
+		if (next)
+			adma_idx = !host->adma_idx;
+		else if (host->next_data.dma_len)
+			adma_idx = !host->next_data.adma_idx;
+		numblks = mmc_populate_adma_desc_table(host, data, dma_len,
+				host->adma_table +
+				adma_idx * DMA_TABLE_NUM_ENTRIES);
+		WARN_ON(numblks != data->blocks);
+	}
+
+	if (next) {
+		next->dma_len = dma_len;
+		next->adma_idx = adma_idx;
+		if (++next->cookie < 0)
+			next->cookie = 1;
+		data->host_cookie = next->cookie;
+	} else {
+		host->dma_len = dma_len;
+		host->adma_idx = adma_idx;
+	}
+
+	return 0;
 }
 
 static void set_data_timeout(struct omap_hsmmc_host *host,
@@ -1688,7 +1772,6 @@ static int
 omap_hsmmc_prepare_data(struct omap_hsmmc_host *host, struct mmc_request *req)
 {
 	int ret;
-	int numblks;
 
 	host->data = req->data;
 
@@ -1714,14 +1797,50 @@ omap_hsmmc_prepare_data(struct omap_hsmmc_host *host, struct mmc_request *req)
 			return ret;
 		}
 	} else if (host->dma_type == ADMA_XFER) {
-		numblks = mmc_populate_adma_desc_table(host,
-				req, host->adma_table);
-		WARN_ON(numblks != req->data->blocks);
+		ret = omap_hsmmc_pre_dma_transfer(host, req->data, NULL);
+		if (ret != 0) {
+			dev_dbg(mmc_dev(host->mmc), "MMC map dma failure\n");
+			return ret;
+		}
 		omap_hsmmc_start_adma_transfer(host);
 	}
 	return 0;
 }
 
+static void omap_hsmmc_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+				int err)
+{
+	struct omap_hsmmc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (host->dma_type && data && data->host_cookie) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     omap_hsmmc_get_dma_dir(host, data));
+		/* Prepared but never started: free its ADMA table */
+		if (data->host_cookie == host->next_data.cookie)
+			host->next_data.dma_len = 0;
+		data->host_cookie = 0;
+	}
+}
+
+static void omap_hsmmc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			       bool is_first_req)
+{
+	struct omap_hsmmc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!host->dma_type || !data)
+		return;
+
+	if (data->host_cookie) {
+		data->host_cookie = 0;
+		return;
+	}
+
+	if (omap_hsmmc_pre_dma_transfer(host, data, &host->next_data))
+		data->host_cookie = 0;
+}
+
 /*
  * Request function. for read/write operation
  */
@@ -2250,6 +2369,8 @@ static int omap_hsmmc_disable_simple(struct mmc_host *mmc, int lazy)
 static const struct mmc_host_ops omap_hsmmc_ops = {
 	.enable = omap_hsmmc_enable_simple,
 	.disable = omap_hsmmc_disable_simple,
+	.post_req = omap_hsmmc_post_req,
+	.pre_req = omap_hsmmc_pre_req,
 	.request = omap_hsmmc_request,
 	.set_ios = omap_hsmmc_set_ios,
 	.get_cd = omap_hsmmc_get_cd,
@@ -2261,6 +2382,8 @@ static const struct mmc_host_ops omap_hsmmc_ops = {
 static const struct mmc_host_ops omap_hsmmc_ps_ops = {
 	.enable = omap_hsmmc_enable,
 	.disable = omap_hsmmc_disable,
+	.post_req = omap_hsmmc_post_req,
+	.pre_req = omap_hsmmc_pre_req,
 	.request = omap_hsmmc_request,
 	.set_ios = omap_hsmmc_set_ios,
 	.get_cd = omap_hsmmc_get_cd,
@@ -2516,7 +2639,8 @@ static int __init omap_hsmmc_probe(struct platform_device *pdev)
 		 * due to unset conherency mask
 		 */
 		host->adma_table = dma_alloc_coherent(NULL,
-			ADMA_TABLE_SZ, &host->phy_adma_table, 0);
+			ADMA_TABLE_SZ * ADMA_TABLE_NUM,
+			&host->phy_adma_table, 0);
 		if (host->adma_table != NULL)
 			host->dma_type = ADMA_XFER;
 	}
@@ -2558,8 +2682,12 @@ static int __init omap_hsmmc_probe(struct platform_device *pdev)
 	if (mmc->caps & MMC_CAP_8_BIT_DATA)
 		mmc->caps |= MMC_CAP_4_BIT_DATA;
 
-	if (mmc_slot(host).nonremovable)
+	/* the eMMC 4.5 cache, packed writes and BKOPS only matter for eMMC */
+	if (mmc_slot(host).nonremovable) {
 		mmc->caps |= MMC_CAP_NONREMOVABLE;
+		mmc->caps2 |= MMC_CAP2_CACHE_CTRL | MMC_CAP2_PACKED_WR |
+			      MMC_CAP2_BKOPS;
+	}
 
 	mmc->pm_caps = MMC_PM_KEEP_POWER | MMC_PM_IGNORE_PM_NOTIFY;
 	if (mmc_slot(host).mmc_data.built_in)
@@ -2673,7 +2801,7 @@ err_irq:
 	}
 err1:
 	if (host->adma_table != NULL)
-		dma_free_coherent(NULL, ADMA_TABLE_SZ,
+		dma_free_coherent(NULL, ADMA_TABLE_SZ * ADMA_TABLE_NUM,
 			host->adma_table, host->phy_adma_table);
 	iounmap(host->base);
 err_ioremap:
@@ -2704,7 +2832,7 @@ static int omap_hsmmc_remove(struct platform_device *pdev)
 		flush_work_sync(&host->mmc_carddetect_work);
 
 		if (host->adma_table != NULL)
-			dma_free_coherent(NULL, ADMA_TABLE_SZ,
+			dma_free_coherent(NULL, ADMA_TABLE_SZ * ADMA_TABLE_NUM,
 				host->adma_table, host->phy_adma_table);
 
 		mmc_release_host(host->mmc);
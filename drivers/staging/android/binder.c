@@ -32,6 +32,7 @@
 #include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/vmalloc.h>
 #include <linux/security.h>
 
@@ -40,6 +41,9 @@
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 static DEFINE_MUTEX(binder_mmap_lock);
+static DEFINE_MUTEX(binder_page_cache_lock);
+static DECLARE_WAIT_QUEUE_HEAD(binder_unpin_wait);
+static LIST_HEAD(binder_page_cache_procs);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -107,6 +111,18 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/*
+ * Number of freed buffer pages each proc keeps mapped for reuse by later
+ * transactions. Cached pages are returned to the system by the shrinker.
+ */
+static int binder_page_cache_high = 32;
+module_param_named(page_cache_high, binder_page_cache_high,
+		   int, S_IWUSR | S_IRUGO);
+
+/* Run synchronous transactions from SCHED_FIFO/RR callers at their policy */
+static int binder_inherit_rt = 1;
+module_param_named(inherit_rt, binder_inherit_rt, bool, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -149,13 +165,22 @@ enum binder_stat_types {
 
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	int bc[_IOC_NR(BC_REPLY_SG) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
+struct binder_page_cache_stats {
+	atomic_t cached;
+	atomic_t map_avoided;
+	atomic_t unmap_avoided;
+	atomic_t reclaimed;
+};
+
+static struct binder_page_cache_stats binder_page_cache_stats;
+
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
 	binder_stats.obj_deleted[type]++;
@@ -296,12 +321,22 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	/*
+	 * alloc_lock protects the buffer allocator state below (buffers,
+	 * free_buffers, allocated_buffers, free_async_space and pages) so
+	 * that senders can allocate and fill a target buffer without
+	 * holding binder_lock. Lock order is binder_lock -> alloc_lock.
+	 */
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	struct list_head cached_pages;	/* mapped but unused, via page->lru */
+	int cached_page_count;
+	struct list_head page_cache_entry;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -314,6 +349,7 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	atomic_t tmp_ref; /* senders copying into buffers without binder_lock */
 };
 
 enum {
@@ -356,6 +392,10 @@ struct binder_transaction {
 	unsigned int	flags;
 	long	priority;
 	long	saved_priority;
+	int	sched_policy;
+	int	rt_priority;
+	int	saved_sched_policy;
+	int	saved_rt_priority;
 	uid_t	sender_euid;
 };
 
@@ -517,6 +557,69 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static int binder_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+/* Kernel priority of the caller of t, lower is more urgent */
+static int binder_transaction_prio(struct binder_transaction *t)
+{
+	if (binder_rt_policy(t->sched_policy))
+		return MAX_RT_PRIO - 1 - t->rt_priority;
+	return MAX_RT_PRIO + 20 + t->priority;
+}
+
+static void binder_inherit_priority(struct binder_transaction *t)
+{
+	struct sched_param param;
+
+	t->saved_priority = task_nice(current);
+	t->saved_sched_policy = current->policy;
+	t->saved_rt_priority = current->rt_priority;
+
+	if (!binder_inherit_rt || !binder_rt_policy(t->sched_policy))
+		return;
+	if (binder_rt_policy(current->policy) &&
+	    current->rt_priority >= t->rt_priority)
+		return;
+	param.sched_priority = t->rt_priority;
+	sched_setscheduler_nocheck(current, t->sched_policy, &param);
+}
+
+static void binder_restore_priority(struct binder_transaction *t)
+{
+	struct sched_param param;
+
+	if (current->policy != t->saved_sched_policy ||
+	    current->rt_priority != t->saved_rt_priority) {
+		param.sched_priority = t->saved_rt_priority;
+		sched_setscheduler_nocheck(current, t->saved_sched_policy,
+					   &param);
+	}
+	binder_set_nice(t->saved_priority);
+}
+
+/*
+ * Queue t on a proc todo list behind all work that is at least as urgent,
+ * so threads picking up proc work serve high priority callers first.
+ * Non-transaction work is never overtaken.
+ */
+static void binder_enqueue_proc_work(struct binder_transaction *t,
+				     struct list_head *todo)
+{
+	struct binder_work *w;
+	int prio = binder_transaction_prio(t);
+
+	list_for_each_entry_reverse(w, todo, entry) {
+		if (w->type != BINDER_WORK_TRANSACTION ||
+		    binder_transaction_prio(container_of(w,
+				struct binder_transaction, work)) <= prio)
+			break;
+	}
+	list_add(&t->work.entry, &w->entry);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -585,8 +688,8 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->allocated_buffers);
 }
 
-static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
-						  void __user *user_ptr)
+static struct binder_buffer *__binder_buffer_lookup(struct binder_proc *proc,
+						    void __user *user_ptr)
 {
 	struct rb_node *n = proc->allocated_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -609,6 +712,47 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
+						  void __user *user_ptr)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_buffer_lookup(proc, user_ptr);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
+/*
+ * Pages on proc->cached_pages stay mapped in both the kernel and the user
+ * view of the buffer so that a later allocation covering the same
+ * address can use them without another alloc_page/map_vm_area/
+ * vm_insert_page round trip. They are never re-zeroed: they only ever
+ * held this proc's own transaction data. Called with proc->alloc_lock.
+ */
+static int binder_page_is_cached(struct page *page)
+{
+	return !list_empty(&page->lru);
+}
+
+static void binder_uncache_page(struct binder_proc *proc, struct page *page)
+{
+	list_del_init(&page->lru);
+	proc->cached_page_count--;
+	atomic_dec(&binder_page_cache_stats.cached);
+}
+
+static int binder_cache_page(struct binder_proc *proc, struct page *page)
+{
+	if (proc->vma == NULL ||
+	    proc->cached_page_count >= binder_page_cache_high)
+		return 0;
+	list_add(&page->lru, &proc->cached_pages);
+	proc->cached_page_count++;
+	atomic_inc(&binder_page_cache_stats.cached);
+	return 1;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -618,6 +762,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	struct vm_struct tmp_area;
 	struct page **page;
 	struct mm_struct *mm;
+	int need_mm = 0;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -626,6 +771,30 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (allocate) {
+			if (*page == NULL) {
+				need_mm = 1;
+				break;
+			}
+		} else if (binder_cache_page(proc, *page)) {
+			atomic_inc(&binder_page_cache_stats.unmap_avoided);
+		} else {
+			need_mm = 1;
+		}
+	}
+	if (!need_mm) {
+		for (page_addr = start; allocate && page_addr < end;
+		     page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE];
+			binder_uncache_page(proc, *page);
+			atomic_inc(&binder_page_cache_stats.map_avoided);
+		}
+		return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -655,13 +824,20 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
+		if (*page) {
+			BUG_ON(!binder_page_is_cached(*page));
+			binder_uncache_page(proc, *page);
+			atomic_inc(&binder_page_cache_stats.map_avoided);
+			continue;
+		}
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
+		INIT_LIST_HEAD(&(*page)->lru);
+		set_page_private(*page, (page_addr - proc->buffer) / PAGE_SIZE);
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
 		page_array_ptr = page;
@@ -693,6 +869,8 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (binder_page_is_cached(*page))
+			continue;
 		if (vma)
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
@@ -712,9 +890,91 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Unmap and free up to nr_to_scan of proc's cached pages, oldest first.
+ * Called from the shrinker, so never block on mmap_sem or alloc_lock.
+ */
+static int binder_shrink_proc(struct binder_proc *proc, int nr_to_scan)
+{
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	int freed = 0;
+
+	if (!mutex_trylock(&proc->alloc_lock))
+		return 0;
+	if (list_empty(&proc->cached_pages))
+		goto out_unlock;
+	mm = get_task_mm(proc->tsk);
+	if (mm && !down_read_trylock(&mm->mmap_sem)) {
+		mmput(mm);
+		goto out_unlock;
+	}
+	vma = proc->vma;
+	if (vma && (mm == NULL || vma->vm_mm != mm))
+		vma = NULL;
+
+	while (freed < nr_to_scan && !list_empty(&proc->cached_pages)) {
+		struct page *page = list_entry(proc->cached_pages.prev,
+					       struct page, lru);
+		unsigned long i = page_private(page);
+		void *page_addr = proc->buffer + i * PAGE_SIZE;
+
+		BUG_ON(proc->pages[i] != page);
+		binder_uncache_page(proc, page);
+		if (vma)
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page);
+		proc->pages[i] = NULL;
+		freed++;
+	}
+	atomic_add(freed, &binder_page_cache_stats.reclaimed);
+
+	if (mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+out_unlock:
+	mutex_unlock(&proc->alloc_lock);
+	return freed;
+}
+
+static int binder_page_cache_shrink(struct shrinker *s,
+				    struct shrink_control *sc)
+{
+	struct binder_proc *proc;
+	int nr_to_scan = sc->nr_to_scan;
+
+	if (nr_to_scan <= 0)
+		return atomic_read(&binder_page_cache_stats.cached);
+	if (!(sc->gfp_mask & __GFP_FS))
+		return -1;
+	if (!mutex_trylock(&binder_page_cache_lock))
+		return -1;
+
+	list_for_each_entry(proc, &binder_page_cache_procs, page_cache_entry) {
+		if (nr_to_scan <= 0)
+			break;
+		nr_to_scan -= binder_shrink_proc(proc, nr_to_scan);
+	}
+	/* start the next scan with another proc */
+	if (!list_empty(&binder_page_cache_procs))
+		list_rotate_left(&binder_page_cache_procs);
+	mutex_unlock(&binder_page_cache_lock);
+
+	return atomic_read(&binder_page_cache_stats.cached);
+}
+
+static struct shrinker binder_page_cache_shrinker = {
+	.shrink = binder_page_cache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -794,6 +1054,9 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->target_node = NULL;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
@@ -818,6 +1081,18 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -875,8 +1150,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -930,6 +1205,20 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+static void binder_unpin_proc(struct binder_proc *proc)
+{
+	if (atomic_dec_and_test(&proc->tmp_ref))
+		wake_up(&binder_unpin_wait);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1382,9 +1671,34 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/* Payload of a BC_TRANSACTION_SG/BC_REPLY_SG, already copied from user */
+struct binder_sg_payload {
+	struct iovec *iov;
+	unsigned long nr_segs;
+	ssize_t size;		/* total length, or -errno if iov is invalid */
+};
+
+static int binder_copy_payload(void *dst, struct binder_transaction_data *tr,
+			       const struct binder_sg_payload *sg)
+{
+	unsigned long i;
+
+	if (sg == NULL)
+		return copy_from_user(dst, tr->data.ptr.buffer, tr->data_size);
+
+	for (i = 0; i < sg->nr_segs; i++) {
+		if (copy_from_user(dst, sg->iov[i].iov_base,
+				   sg->iov[i].iov_len))
+			return -EFAULT;
+		dst += sg->iov[i].iov_len;
+	}
+	return 0;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_transaction_data *tr, int reply,
+			       const struct binder_sg_payload *sg)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1396,7 +1710,9 @@ static void binder_transaction(struct binder_proc *proc,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct binder_buffer *buffer;
 	uint32_t return_error;
+	int copy_failed = 0;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1415,7 +1731,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_restore_priority(in_reply_to);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1492,23 +1808,18 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
+	if (sg && (sg->size < 0 || sg->size != tr->data_size)) {
+		binder_user_error("binder: %d:%d got sg transaction with "
+			"invalid buffers, size %zd != %zd\n",
+			proc->pid, thread->pid, sg->size, tr->data_size);
+		return_error = BR_FAILED_REPLY;
+		goto err_bad_sg_buffers;
+	}
+
 	/* TODO: reuse incoming transaction for reply */
 	t = kzalloc(sizeof(*t), GFP_KERNEL);
 	if (t == NULL) {
@@ -1554,33 +1865,89 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
-	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
+	t->sched_policy = current->policy;
+	t->rt_priority = current->rt_priority;
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+
+	/*
+	 * Allocating the target buffer may fault in and map pages, and the
+	 * payload copy can be hundreds of KB, so do both without holding
+	 * binder_lock. Pinning target_proc keeps binder_deferred_release()
+	 * from tearing down its buffers until we are done; the allocator
+	 * itself is serialised by target_proc->alloc_lock.
+	 */
+	atomic_inc(&target_proc->tmp_ref);
+	mutex_unlock(&binder_lock);
+	buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
+	if (buffer) {
+		offp = (size_t *)(buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+		if (binder_copy_payload(buffer->data, tr, sg)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			copy_failed = 1;
+		} else if (copy_from_user(offp, tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n", proc->pid, thread->pid);
+			copy_failed = 1;
+		}
+	}
+	mutex_lock(&binder_lock);
+	binder_unpin_proc(target_proc);
+
+	if (buffer == NULL) {
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
+	t->buffer = buffer;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
-
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+	if (copy_failed) {
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+
+	/* Threads may have exited while binder_lock was dropped */
+	if (reply) {
+		if (in_reply_to->from == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target_thread;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d reply target %d:%d "
+				"transaction stack changed, expected %d\n",
+				proc->pid, thread->pid, target_proc->pid,
+				target_thread->pid, in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_target_thread;
+		}
+	} else if (!(t->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+		tmp = thread->transaction_stack;
+		while (tmp) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+			tmp = tmp->from_parent;
+		}
+		t->to_thread = target_thread;
 	}
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1757,7 +2124,10 @@ static void binder_transaction(struct binder_proc *proc,
 			target_node->has_async_transaction = 1;
 	}
 	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
+	if (target_list == &target_proc->todo)
+		binder_enqueue_proc_work(t, target_list);
+	else
+		list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
@@ -1772,6 +2142,7 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_dead_target_thread:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
@@ -1783,6 +2154,7 @@ err_alloc_tcomplete_failed:
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 err_alloc_t_failed:
+err_bad_sg_buffers:
 err_bad_call_stack:
 err_empty_call_stack:
 err_dead_binder:
@@ -1999,7 +2371,29 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY,
+					   NULL);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+			struct iovec iovstack[UIO_FASTIOV];
+			struct binder_sg_payload sg;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			sg.nr_segs = tr.buffer_count;
+			sg.size = rw_copy_check_uvector(WRITE,
+				tr.transaction_data.data.ptr.buffer,
+				tr.buffer_count, ARRAY_SIZE(iovstack),
+				iovstack, &sg.iov);
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, &sg);
+			if (sg.iov != iovstack)
+				kfree(sg.iov);
 			break;
 		}
 
@@ -2430,7 +2824,10 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
+			if (t->flags & TF_ONE_WAY)
+				t->saved_priority = task_nice(current);
+			else
+				binder_inherit_priority(t);
 			if (t->priority < target_node->min_priority &&
 			    !(t->flags & TF_ONE_WAY))
 				binder_set_nice(t->priority);
@@ -2881,6 +3278,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	proc->files = get_files_struct(proc->tsk);
 	proc->vma = vma;
 
+	mutex_lock(&binder_page_cache_lock);
+	list_add_tail(&proc->page_cache_entry, &binder_page_cache_procs);
+	mutex_unlock(&binder_page_cache_lock);
+
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n",
 		 proc->pid, vma->vm_start, vma->vm_end, proc->buffer);*/
 	return 0;
@@ -2915,6 +3316,10 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
+	atomic_set(&proc->tmp_ref, 0);
+	INIT_LIST_HEAD(&proc->cached_pages);
+	INIT_LIST_HEAD(&proc->page_cache_entry);
 	proc->default_priority = task_nice(current);
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
@@ -2981,6 +3386,17 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	/*
+	 * A sender may still be copying into one of our buffers without
+	 * binder_lock. No new sender can pin us once the vma is gone, so
+	 * this terminates.
+	 */
+	while (atomic_read(&proc->tmp_ref)) {
+		mutex_unlock(&binder_lock);
+		wait_event(binder_unpin_wait, !atomic_read(&proc->tmp_ref));
+		mutex_lock(&binder_lock);
+	}
+
 	hlist_del(&proc->proc_node);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
@@ -3062,6 +3478,11 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
+	mutex_lock(&binder_page_cache_lock);
+	list_del_init(&proc->page_cache_entry);
+	mutex_unlock(&binder_page_cache_lock);
+	atomic_sub(proc->cached_page_count, &binder_page_cache_stats.cached);
+
 	page_count = 0;
 	if (proc->pages) {
 		int i;
@@ -3310,9 +3731,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3361,7 +3784,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3442,9 +3867,12 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->alloc_lock);
 	seq_printf(m, "  buffers: %d\n", count);
+	seq_printf(m, "  cached pages: %d\n", proc->cached_page_count);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3498,6 +3926,12 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	seq_printf(m, "page cache: cached %d map avoided %d "
+		   "unmap avoided %d reclaimed %d\n",
+		   atomic_read(&binder_page_cache_stats.cached),
+		   atomic_read(&binder_page_cache_stats.map_avoided),
+		   atomic_read(&binder_page_cache_stats.unmap_avoided),
+		   atomic_read(&binder_page_cache_stats.reclaimed));
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
@@ -3596,6 +4030,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_page_cache_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
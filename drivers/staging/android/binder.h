@@ -147,6 +147,18 @@ struct binder_transaction_data {
 	} data;
 };
 
+/*
+ * Scatter-gather form of binder_transaction_data. data.ptr.buffer points
+ * to an array of buffer_count struct iovec whose lengths add up to
+ * data_size; the driver gathers them straight into the target's buffer
+ * so the sender need not flatten its parcel first. Offsets are relative
+ * to the start of the gathered data, exactly as for BC_TRANSACTION.
+ */
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	size_t		buffer_count;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +336,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with the data
+	 * supplied as a list of user buffers.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
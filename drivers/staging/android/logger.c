@@ -25,6 +25,9 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -40,32 +43,52 @@ static int metrics_init = 0;
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers never sleep on a lock: they reserve space for their entry under the
+ * spinlock 'lock', copy the payload in without any lock held and then commit
+ * the entry. Entries between c_off and w_off are reserved but possibly not yet
+ * committed; readers only ever see entries before c_off. The mutex 'mutex'
+ * serialises readers against each other.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
+	wait_queue_head_t	wwq;	/* wait queue for writers about to lap */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	struct mutex		mutex;	/* mutex serialising readers */
+	spinlock_t		lock;	/* protects offsets and reader list */
 	size_t			w_off;	/* current write head offset */
+	size_t			c_off;	/* end of the committed entries */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+#ifdef CONFIG_ANDROID_LOGGER_HISTORY
+	struct logger_history	*history; /* compressed history, if any */
+#endif
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. r_off and r_busy are protected by log->lock, the rest
+ * by log->mutex.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	bool			r_busy;	/* copying out the entry at r_off */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+#ifdef CONFIG_ANDROID_LOGGER_HISTORY
+	unsigned char		*h_buf;	/* history being read, NULL if none */
+	size_t			h_off;	/* next entry in h_buf */
+	size_t			h_len;	/* valid bytes in h_buf */
+	u64			h_seq;	/* next history chunk to read */
+	bool			h_staged; /* h_buf holds the staged tail */
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -119,7 +142,7 @@ static struct logger_entry *get_entry_header(struct logger_log *log,
  * get_entry_msg_len - Grabs the length of the message of the entry
  * starting from from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
 {
@@ -166,7 +189,8 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->mutex and have marked the reader busy, so that
+ * writers will not lap the entry at reader->r_off while it is copied out.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
@@ -207,36 +231,376 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
-
 	return count + get_user_hdr_len(reader->r_ver);
 }
 
+/* entries get_next_entry_by_uid() may walk before log->lock is dropped */
+#define UID_SCAN_BATCH		64
+
 /*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
+ * get_next_entry_by_uid - Starting at '*off', advance '*off' to the first
+ * entry in 'log->buffer' readable by 'euid', walking at most UID_SCAN_BATCH
+ * entries. Returns true if '*off' is now readable or at the commit head,
+ * false if the batch ran out first.
+ *
+ * Caller needs to hold log->lock.
  */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static bool get_next_entry_by_uid(struct logger_log *log,
+		size_t *off, uid_t euid)
 {
-	while (off != log->w_off) {
+	int n;
+
+	for (n = 0; n < UID_SCAN_BATCH; n++) {
 		struct logger_entry *entry;
 		struct logger_entry scratch;
 		size_t next_len;
 
-		entry = get_entry_header(log, off, &scratch);
+		if (*off == log->c_off)
+			return true;
+
+		entry = get_entry_header(log, *off, &scratch);
 
 		if (entry->euid == euid)
-			return off;
+			return true;
 
 		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(off + next_len);
+		*off = logger_offset(*off + next_len);
 	}
 
-	return off;
+	return *off == log->c_off;
+}
+
+/*
+ * reader_skip_foreign - move a restricted reader's head past the entries
+ * written by other uids
+ *
+ * The walk can cover the whole ring, so log->lock is dropped between batches
+ * to keep writers from spinning behind it. r_off is stored before each unlock;
+ * a writer lapping the reader meanwhile pulls it forward to a valid entry.
+ *
+ * Caller needs to hold log->lock; it may be released and retaken.
+ */
+static void reader_skip_foreign(struct logger_log *log,
+		struct logger_reader *reader)
+{
+	uid_t euid = current_euid();
+
+	while (!get_next_entry_by_uid(log, &reader->r_off, euid)) {
+		spin_unlock(&log->lock);
+		cond_resched();
+		spin_lock(&log->lock);
+	}
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_HISTORY
+/*
+ * Compressed history
+ *
+ * Entries that fix_up_readers() pushes off the head of a log are copied into
+ * a staging buffer while they are still intact. Full staging buffers are
+ * LZO-compressed by a work item into chunks kept on a per-log list, bounded
+ * by 'history_kb' of compressed data per log. A reader that issues
+ * LOGGER_READ_HISTORY is handed the history, oldest first, before it goes
+ * back to reading the ring.
+ */
+#define LOGGER_HISTORY_STAGE	(32 * 1024)
+
+static unsigned int history_kb = 256;
+module_param(history_kb, uint, S_IRUGO);
+MODULE_PARM_DESC(history_kb, "compressed history kept per log, in KB");
+
+static DEFINE_MUTEX(history_lzo_mutex);	/* protects the buffers below */
+static void *history_lzo_wrkmem;
+static unsigned char *history_lzo_dst;
+
+struct logger_history_chunk {
+	struct list_head	list;	/* entry in logger_history's chunks */
+	u64			seq;	/* position in the history */
+	size_t			clen;	/* compressed length */
+	unsigned char		data[0];
+};
+
+/*
+ * struct logger_history - the compressed history tier of a log
+ *
+ * The staging fields are protected by log->lock; 'stage[ready]' belongs to
+ * the work item while 'busy' is set. The chunk list is protected by 'mutex'.
+ */
+struct logger_history {
+	struct logger_log	*log;	/* owning log */
+	unsigned char		*stage[2]; /* evicted entries, uncompressed */
+	size_t			stage_len[2];
+	int			cur;	/* stage being filled */
+	int			ready;	/* stage being compressed */
+	bool			busy;	/* compression is in progress */
+	struct work_struct	work;	/* compresses stage[ready] */
+	struct mutex		mutex;	/* protects the fields below */
+	struct list_head	chunks;	/* compressed chunks, oldest first */
+	size_t			bytes;	/* compressed bytes held */
+	u64			seq;	/* sequence of the next chunk */
+};
+
+/*
+ * history_evict - stash the committed entries in [from, to) that are about to
+ * be overwritten. If the previous stage is still being compressed when this
+ * one fills up, the oldest staged entries are dropped.
+ *
+ * The caller needs to hold log->lock.
+ */
+static void history_evict(struct logger_log *log, size_t from, size_t to)
+{
+	struct logger_history *history = log->history;
+	size_t count = logger_offset(to - from);
+	unsigned char *dst;
+	size_t len;
+
+	if (!history || unlikely(count > LOGGER_HISTORY_STAGE))
+		return;
+
+	if (history->stage_len[history->cur] + count > LOGGER_HISTORY_STAGE) {
+		if (!history->busy) {
+			history->busy = true;
+			history->ready = history->cur;
+			history->cur ^= 1;
+			schedule_work(&history->work);
+		}
+		history->stage_len[history->cur] = 0;
+	}
+
+	dst = history->stage[history->cur] + history->stage_len[history->cur];
+	len = min(count, log->size - from);
+	memcpy(dst, log->buffer + from, len);
+	if (count != len)
+		memcpy(dst + len, log->buffer, count - len);
+	history->stage_len[history->cur] += count;
+}
+
+static void history_compress(struct work_struct *work)
+{
+	struct logger_history *history =
+		container_of(work, struct logger_history, work);
+	struct logger_log *log = history->log;
+	struct logger_history_chunk *chunk = NULL;
+	size_t clen;
+
+	mutex_lock(&history_lzo_mutex);
+	if (lzo1x_1_compress(history->stage[history->ready],
+			     history->stage_len[history->ready],
+			     history_lzo_dst, &clen,
+			     history_lzo_wrkmem) == LZO_E_OK) {
+		chunk = kmalloc(sizeof(*chunk) + clen, GFP_KERNEL);
+		if (chunk) {
+			chunk->clen = clen;
+			memcpy(chunk->data, history_lzo_dst, clen);
+		}
+	}
+	mutex_unlock(&history_lzo_mutex);
+
+	mutex_lock(&history->mutex);
+	if (chunk) {
+		chunk->seq = history->seq++;
+		list_add_tail(&chunk->list, &history->chunks);
+		history->bytes += chunk->clen;
+	}
+	while (history->bytes > history_kb * 1024) {
+		chunk = list_first_entry(&history->chunks,
+					 struct logger_history_chunk, list);
+		list_del(&chunk->list);
+		history->bytes -= chunk->clen;
+		kfree(chunk);
+	}
+
+	spin_lock(&log->lock);
+	history->busy = false;
+	spin_unlock(&log->lock);
+	mutex_unlock(&history->mutex);
+}
+
+/*
+ * history_load - refill the reader's history buffer with the next chunk.
+ * Once the compressed chunks are exhausted the reader gets what is still
+ * staged, so that the history runs right up to the log's head.
+ *
+ * Returns nonzero if the buffer was refilled. Caller must hold log->mutex.
+ */
+static int history_load(struct logger_log *log, struct logger_reader *reader)
+{
+	struct logger_history *history = log->history;
+	struct logger_history_chunk *chunk;
+	size_t len;
+	int ret = 1;
+
+	reader->h_off = 0;
+	reader->h_len = 0;
+
+	mutex_lock(&history->mutex);
+	list_for_each_entry(chunk, &history->chunks, list) {
+		if (chunk->seq < reader->h_seq)
+			continue;
+
+		len = LOGGER_HISTORY_STAGE;
+		if (lzo1x_decompress_safe(chunk->data, chunk->clen,
+					  reader->h_buf, &len) == LZO_E_OK)
+			reader->h_len = len;
+		reader->h_seq = chunk->seq + 1;
+		goto out;
+	}
+
+	if (reader->h_staged) {
+		ret = 0;
+		goto out;
+	}
+
+	/*
+	 * Holding history->mutex keeps the work item from publishing a chunk
+	 * we have not seen, so a stage it is still compressing is copied too.
+	 */
+	spin_lock(&log->lock);
+	if (history->busy) {
+		len = history->stage_len[history->ready];
+		memcpy(reader->h_buf, history->stage[history->ready], len);
+		reader->h_len = len;
+	}
+	len = history->stage_len[history->cur];
+	memcpy(reader->h_buf + reader->h_len, history->stage[history->cur], len);
+	reader->h_len += len;
+	spin_unlock(&log->lock);
+	reader->h_staged = true;
+out:
+	mutex_unlock(&history->mutex);
+	return ret;
 }
 
+/*
+ * history_read - read the next history entry readable by the caller into
+ * 'buf'. Returns zero once the history is exhausted.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t history_read(struct logger_log *log,
+			    struct logger_reader *reader,
+			    char __user *buf, size_t count)
+{
+	struct logger_entry *entry;
+	ssize_t ret;
+
+	for (;;) {
+		while (reader->h_off >= reader->h_len)
+			if (!history_load(log, reader)) {
+				vfree(reader->h_buf);
+				reader->h_buf = NULL;
+				return 0;
+			}
+
+		entry = (struct logger_entry *)(reader->h_buf + reader->h_off);
+		if (reader->h_off + sizeof(struct logger_entry) + entry->len >
+		    reader->h_len) {
+			/* truncated chunk, skip what is left of it */
+			reader->h_off = reader->h_len;
+			continue;
+		}
+		if (reader->r_all || entry->euid == current_euid())
+			break;
+		reader->h_off += sizeof(struct logger_entry) + entry->len;
+	}
+
+	ret = get_user_hdr_len(reader->r_ver) + entry->len;
+	if (count < ret)
+		return -EINVAL;
+
+	if (copy_header_to_user(reader->r_ver, entry, buf) ||
+	    copy_to_user(buf + get_user_hdr_len(reader->r_ver),
+			 entry + 1, entry->len))
+		return -EFAULT;
+
+	reader->h_off += sizeof(struct logger_entry) + entry->len;
+
+	return ret;
+}
+
+/*
+ * history_start - switch the reader to the log's history. Caller must hold
+ * log->mutex.
+ */
+static long history_start(struct logger_log *log,
+			  struct logger_reader *reader)
+{
+	if (!log->history)
+		return -EOPNOTSUPP;
+
+	if (!reader->h_buf) {
+		reader->h_buf = vmalloc(2 * LOGGER_HISTORY_STAGE);
+		if (!reader->h_buf)
+			return -ENOMEM;
+	}
+	reader->h_off = 0;
+	reader->h_len = 0;
+	reader->h_seq = 0;
+	reader->h_staged = false;
+
+	return 0;
+}
+
+static void __init history_init(struct logger_log *log)
+{
+	struct logger_history *history;
+
+	if (!history_kb)
+		return;
+
+	history = kzalloc(sizeof(*history), GFP_KERNEL);
+	if (history)
+		history->stage[0] = vmalloc(2 * LOGGER_HISTORY_STAGE);
+	if (!history || !history->stage[0]) {
+		kfree(history);
+		printk(KERN_ERR "logger: no memory for history of log '%s'\n",
+		       log->misc.name);
+		return;
+	}
+	history->stage[1] = history->stage[0] + LOGGER_HISTORY_STAGE;
+	history->log = log;
+	INIT_WORK(&history->work, history_compress);
+	mutex_init(&history->mutex);
+	INIT_LIST_HEAD(&history->chunks);
+
+	log->history = history;
+}
+
+static void __init history_lzo_init(void)
+{
+	if (!history_kb)
+		return;
+
+	history_lzo_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	history_lzo_dst = vmalloc(lzo1x_worst_compress(LOGGER_HISTORY_STAGE));
+	if (!history_lzo_wrkmem || !history_lzo_dst) {
+		vfree(history_lzo_wrkmem);
+		vfree(history_lzo_dst);
+		history_kb = 0;
+		printk(KERN_ERR "logger: no memory for compressed history\n");
+	}
+}
+#else
+static inline void history_evict(struct logger_log *log, size_t from,
+				 size_t to)
+{
+}
+
+static inline long history_start(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void history_init(struct logger_log *log)
+{
+}
+
+static inline void history_lzo_init(void)
+{
+}
+#endif
+
 /*
  * logger_read - our log's read() method
  *
@@ -254,16 +618,27 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t msg_len;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
+#ifdef CONFIG_ANDROID_LOGGER_HISTORY
+	if (reader->h_buf) {
+		mutex_lock(&log->mutex);
+		ret = history_read(log, reader, buf, count);
+		mutex_unlock(&log->mutex);
+		if (ret)
+			return ret;
+	}
+#endif
+
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		ret = (log->c_off == reader->r_off);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -285,28 +660,43 @@ start:
 		return ret;
 
 	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+		reader_skip_foreign(log, reader);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(log->c_off == reader->r_off)) {
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	msg_len = get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + msg_len;
 	if (count < ret) {
+		spin_unlock(&log->lock);
 		ret = -EINVAL;
 		goto out;
 	}
+	reader->r_busy = true;
+	spin_unlock(&log->lock);
 
 	/* get exactly one entry from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
 
+	spin_lock(&log->lock);
+	reader->r_busy = false;
+	if (ret >= 0)
+		reader->r_off = logger_offset(reader->r_off +
+			sizeof(struct logger_entry) + msg_len);
+	spin_unlock(&log->lock);
+
+	/* a writer may be waiting for us to finish with this entry */
+	if (waitqueue_active(&log->wwq))
+		wake_up(&log->wwq);
+
 out:
 	mutex_unlock(&log->mutex);
 
@@ -317,7 +707,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -356,7 +746,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -364,8 +754,12 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, log->head)) {
+		size_t head = get_next_entry(log, log->head, len);
+
+		history_evict(log, log->head, head);
+		log->head = head;
+	}
 
 	list_for_each_entry(reader, &log->readers, list)
 		if (clock_interval(old, new, reader->r_off))
@@ -373,50 +767,163 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * would_lap - would reserving 'len' bytes at the write head clobber an entry
+ * that is still being written, or one that a reader is copying out?
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static int would_lap(struct logger_log *log, size_t len)
+{
+	size_t old = log->w_off;
+	size_t new = logger_offset(old + len);
+	struct logger_reader *reader;
+
+	if (log->c_off != old && clock_interval(old, new, log->c_off))
+		return 1;
+
+	list_for_each_entry(reader, &log->readers, list)
+		if (reader->r_busy && clock_interval(old, new, reader->r_off))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at offset 'off'
+ *
+ * Returns the offset just past the written bytes.
+ */
+static size_t do_write_log(struct logger_log *log, size_t off,
+			   const void *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
 
-	log->w_off = logger_offset(log->w_off + count);
-
+	return logger_offset(off + count);
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf'
+ * to the log 'log' at offset 'off'
  *
- * The caller needs to hold log->mutex.
+ * The caller must own a reservation covering the written range.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
+/*
+ * do_clear_log - zeroes 'count' bytes of 'log' starting at offset 'off'
+ */
+static void do_clear_log(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memset(log->buffer + off, 0, len);
+
+	if (count != len)
+		memset(log->buffer, 0, count - len);
+}
+
+/*
+ * logger_reserve - reserve room in 'log' for the entry described by 'header'
+ * and return the offset of its payload.
+ *
+ * The header is written out with hdr_size zeroed, which marks the entry as
+ * not yet committed. If the reservation would lap an uncommitted entry or
+ * one a reader is busy copying out we wait for it, exactly as we used to
+ * wait on the log mutex.
+ */
+static size_t logger_reserve(struct logger_log *log,
+			     struct logger_entry *header)
+{
+	size_t len = sizeof(struct logger_entry) + header->len;
+	size_t off;
+	DEFINE_WAIT(wait);
+
+	spin_lock(&log->lock);
+	while (unlikely(would_lap(log, len))) {
+		prepare_to_wait(&log->wwq, &wait, TASK_UNINTERRUPTIBLE);
+		spin_unlock(&log->lock);
+		schedule();
+		finish_wait(&log->wwq, &wait);
+		spin_lock(&log->lock);
+	}
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset. We do this now
+	 * because if we partially fail, we can end up with clobbered log
+	 * entries that encroach on readable buffer.
+	 */
+	fix_up_readers(log, len);
+
+	off = log->w_off;
+	header->hdr_size = 0;
+	do_write_log(log, off, header, sizeof(struct logger_entry));
+	log->w_off = logger_offset(off + len);
+	spin_unlock(&log->lock);
+
+	return logger_offset(off + sizeof(struct logger_entry));
+}
+
+/*
+ * logger_commit - mark the entry whose payload starts at 'off' as complete
+ * and make every committed entry up to the first uncommitted one visible to
+ * readers. Entries may be committed out of order, but become visible in order.
+ */
+static void logger_commit(struct logger_log *log, size_t off,
+			  struct logger_entry *header)
+{
+	struct logger_entry scratch;
+	struct logger_entry *entry;
+	bool advanced = false;
+
+	off = logger_offset(off - sizeof(struct logger_entry));
+	header->hdr_size = sizeof(struct logger_entry);
+
+	spin_lock(&log->lock);
+	do_write_log(log, off, header, sizeof(struct logger_entry));
+
+	while (log->c_off != log->w_off) {
+		entry = get_entry_header(log, log->c_off, &scratch);
+		if (!entry->hdr_size)
+			break;
+		log->c_off = logger_offset(log->c_off +
+			sizeof(struct logger_entry) + entry->len);
+		advanced = true;
+	}
+	spin_unlock(&log->lock);
+
+	if (!advanced)
+		return;
+
+	/* wake up any writers waiting to lap and any blocked readers */
+	if (waitqueue_active(&log->wwq))
+		wake_up(&log->wwq);
+	wake_up_interruptible(&log->wq);
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -426,9 +933,9 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t start, off;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -439,23 +946,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
-	header.hdr_size = sizeof(struct logger_entry);
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	start = off = logger_reserve(log, &header);
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -465,21 +961,25 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			/*
+			 * Writers after us may already have reserved the
+			 * space following this entry, so we can't give it
+			 * back: blank out the rest of the payload rather
+			 * than expose stale log data.
+			 */
+			do_clear_log(log, off, header.len - ret);
+			ret = nr;
+			break;
 		}
 
+		off = logger_offset(off + nr);
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_commit(log, start, &header);
 
 	return ret;
 }
@@ -518,10 +1018,15 @@ static int logger_open(struct inode *inode, struct file *file)
 
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		reader->r_busy = false;
+#ifdef CONFIG_ANDROID_LOGGER_HISTORY
+		reader->h_buf = NULL;
+#endif
+
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -541,10 +1046,13 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
+#ifdef CONFIG_ANDROID_LOGGER_HISTORY
+		vfree(reader->h_buf);
+#endif
 		kfree(reader);
 	}
 
@@ -574,14 +1082,13 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+		reader_skip_foreign(log, reader);
 
-	if (log->w_off != reader->r_off)
+	if (log->c_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -618,10 +1125,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		spin_lock(&log->lock);
+		if (log->c_off >= reader->r_off)
+			ret = log->c_off - reader->r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = (log->size - reader->r_off) + log->c_off;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -629,25 +1138,34 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+		spin_lock(&log->lock);
 
 		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
+			reader_skip_foreign(log, reader);
 
-		if (log->w_off != reader->r_off)
+		if (log->c_off != reader->r_off)
 			ret = get_user_hdr_len(reader->r_ver) +
 				get_entry_msg_len(log, reader->r_off);
 		else
 			ret = 0;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
+		/*
+		 * Readers in the middle of copying out an entry keep their
+		 * position so that writers continue to respect it; they will
+		 * see whatever is committed after the flush point next.
+		 */
+		spin_lock(&log->lock);
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			if (!reader->r_busy)
+				reader->r_off = log->c_off;
+		log->head = log->c_off;
+		spin_unlock(&log->lock);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -666,6 +1184,14 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_READ_HISTORY:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		ret = history_start(log, reader);
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -700,9 +1226,12 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
+	.wwq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wwq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -724,6 +1253,7 @@ static void logger_kernel_write(const struct iovec *iov, unsigned long nr_segs)
 	struct timespec now;
 	unsigned long count = nr_segs;
 	size_t total_len = 0;
+	size_t start, off;
 
 	while (count-- > 0) {
 		total_len += iov[count].iov_len;
@@ -741,17 +1271,7 @@ static void logger_kernel_write(const struct iovec *iov, unsigned long nr_segs)
 	if (unlikely(!header.len))
 		return;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	start = off = logger_reserve(log, &header);
 
 	total_len = 0;
 
@@ -762,16 +1282,13 @@ static void logger_kernel_write(const struct iovec *iov, unsigned long nr_segs)
 		len = min_t(size_t, iov->iov_len, header.len - total_len);
 
 		/* write out this segment's payload */
-		do_write_log(log, iov->iov_base, len);
+		off = do_write_log(log, off, iov->iov_base, len);
 
 		iov++;
 		total_len += len;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_commit(log, start, &header);
 }
 
 void log_to_metrics(android_LogPriority priority, const char *domain, const char *log_msg)
@@ -805,9 +1322,9 @@ EXPORT_SYMBOL(log_to_metrics);
 ssize_t __alog_main(char *buf, unsigned int buflen)
 {
 	struct logger_log *log = &log_main;
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t off;
 	ssize_t ret = 0;
 
 	/* Only allow logging from process context for now
@@ -827,23 +1344,9 @@ ssize_t __alog_main(char *buf, unsigned int buflen)
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-	do_write_log(log, buf, buflen);
-
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	off = logger_reserve(log, &header);
+	do_write_log(log, off, buf, header.len);
+	logger_commit(log, off, &header);
 
 	return ret;
 }
@@ -890,6 +1393,8 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
+	history_init(log);
+
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
@@ -900,6 +1405,8 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	history_lzo_init();
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
@@ -16,6 +16,10 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * If free memory is projected to drop below a threshold within
+ * predict_window_ms while reclaim recovers less than predict_efficiency
+ * percent of the pages it scans, the kill happens ahead of the threshold.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -37,6 +41,12 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/lowmemorykiller.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -54,49 +64,482 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
-static struct task_struct *lowmem_deathpending;
+/*
+ * The mm of the last victim is pinned until it has been torn down, which is
+ * when the memory we killed for has actually been freed.
+ */
+static DEFINE_SPINLOCK(lowmem_deathpending_lock);
+static struct mm_struct *lowmem_deathpending_mm;
+static unsigned long lowmem_deathpending_start;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * Reclaim pressure, sampled at most every LOWMEM_SAMPLE_INTERVAL. 'decline'
+ * is the rate at which the memory checked against minfree is shrinking and
+ * 'efficiency' the share of scanned pages vmscan actually reclaimed, both
+ * smoothed over the last few samples.
+ */
+#define LOWMEM_SAMPLE_INTERVAL	(HZ / 20)
+
+static struct {
+	struct mutex	lock;
+	unsigned long	stamp;		/* jiffies of the last sample */
+	int		avail;		/* pages available at the last sample */
+	unsigned long	scanned;	/* vmscan counters at the last sample */
+	unsigned long	reclaimed;
+	int		decline;	/* pages per second */
+	int		efficiency;	/* percent */
+} lowmem_rate = {
+	.lock = __MUTEX_INITIALIZER(lowmem_rate.lock),
+	.efficiency = 100,
+};
+
+/*
+ * Kill ahead of a minfree threshold when it is projected to be crossed
+ * within predict_window_ms and vmscan is reclaiming less than
+ * predict_efficiency percent of what it scans. 0 disables prediction.
+ */
+static unsigned int lowmem_predict_window_ms = 300;
+static unsigned int lowmem_predict_efficiency = 30;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			pr_info(x);			\
 	} while (0)
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+/*
+ * Is the last kill still in progress? Waiting ends once the victim's address
+ * space has been torn down, or after a second at the most.
+ */
+static bool lowmem_death_pending(void)
+{
+	struct mm_struct *mm;
+
+	spin_lock(&lowmem_deathpending_lock);
+	mm = lowmem_deathpending_mm;
+	if (!mm) {
+		spin_unlock(&lowmem_deathpending_lock);
+		return false;
+	}
+	/*
+	 * mm_count only pins the mm_struct; the memory is returned when the
+	 * last user drops mm_users and the address space is torn down.
+	 */
+	if (atomic_read(&mm->mm_users) > 0 &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		spin_unlock(&lowmem_deathpending_lock);
+		return true;
+	}
+	lowmem_deathpending_mm = NULL;
+	spin_unlock(&lowmem_deathpending_lock);
+
+	lowmem_print(2, "victim mm %s after %ums\n",
+		     atomic_read(&mm->mm_users) > 0 ? "still busy" : "freed",
+		     jiffies_to_msecs(jiffies - lowmem_deathpending_start));
+	mmdrop(mm);
+
+	return false;
+}
+
+static void lowmem_set_deathpending(struct task_struct *victim)
+{
+	struct mm_struct *mm;
+	struct mm_struct *old;
+
+	task_lock(victim);
+	mm = victim->mm;
+	if (mm)
+		atomic_inc(&mm->mm_count);
+	task_unlock(victim);
+
+	spin_lock(&lowmem_deathpending_lock);
+	old = lowmem_deathpending_mm;
+	lowmem_deathpending_mm = mm;
+	lowmem_deathpending_start = jiffies;
+	lowmem_deathpending_timeout = jiffies + HZ;
+	spin_unlock(&lowmem_deathpending_lock);
+
+	if (old)
+		mmdrop(old);
+}
+
+/*
+ * Sum the vmscan counters without all_vm_events(), which takes the CPU
+ * hotplug lock and so could sleep here behind hotplug. A CPU going down
+ * drops out of the sum until its counters are folded into a live one, so
+ * the totals can briefly go backwards; lowmem_sample() skips such samples.
+ */
+static void lowmem_vmscan_counts(unsigned long *scanned,
+				 unsigned long *reclaimed)
+{
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	int cpu, i;
+#endif
+
+	*scanned = 0;
+	*reclaimed = 0;
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	for_each_online_cpu(cpu) {
+		unsigned long *ev = per_cpu(vm_event_states, cpu).event;
+
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			*scanned += ev[PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL + i] +
+				ev[PGSCAN_DIRECT_NORMAL - ZONE_NORMAL + i];
+			*reclaimed += ev[PGSTEAL_NORMAL - ZONE_NORMAL + i];
+		}
+	}
+#endif
+}
+
+static void lowmem_sample(int avail)
+{
+	unsigned long scanned, reclaimed;
+	unsigned long now = jiffies;
+	long elapsed;
+
+	if (time_before(now, lowmem_rate.stamp + LOWMEM_SAMPLE_INTERVAL))
+		return;
+	if (!mutex_trylock(&lowmem_rate.lock))
+		return;
+
+	lowmem_vmscan_counts(&scanned, &reclaimed);
+	elapsed = now - lowmem_rate.stamp;
+	if (elapsed > 0 && elapsed < 10 * HZ) {
+		int decline = (lowmem_rate.avail - avail) * HZ / elapsed;
+
+		lowmem_rate.decline = (3 * lowmem_rate.decline + decline) / 4;
+		if (scanned > lowmem_rate.scanned &&
+		    reclaimed >= lowmem_rate.reclaimed) {
+			int efficiency = (reclaimed - lowmem_rate.reclaimed) *
+				100 / (scanned - lowmem_rate.scanned);
+
+			lowmem_rate.efficiency =
+				(3 * lowmem_rate.efficiency + efficiency) / 4;
+		}
+	} else {
+		/* too long since the last sample to say anything */
+		lowmem_rate.decline = 0;
+		lowmem_rate.efficiency = 100;
+	}
+	lowmem_rate.stamp = now;
+	lowmem_rate.avail = avail;
+	lowmem_rate.scanned = scanned;
+	lowmem_rate.reclaimed = reclaimed;
+
+	mutex_unlock(&lowmem_rate.lock);
+}
+
+/*
+ * Returns the adj of the lowest minfree level that will be crossed within
+ * the prediction window while reclaim is struggling, or OOM_ADJUST_MAX + 1.
+ */
+static int lowmem_predict(int avail, int array_size, int *minfree)
+{
+	int decline = lowmem_rate.decline;
+	int i;
 
-static struct notifier_block task_nb = {
-	.notifier_call	= task_notify_func,
+	if (!lowmem_predict_window_ms || decline <= 0 ||
+	    lowmem_rate.efficiency >= lowmem_predict_efficiency)
+		return OOM_ADJUST_MAX + 1;
+
+	for (i = 0; i < array_size; i++) {
+		long margin = avail - (long)lowmem_minfree[i];
+
+		if (margin * 1000 / decline < lowmem_predict_window_ms) {
+			*minfree = lowmem_minfree[i];
+			lowmem_print(2, "predict minfree %d crossed in %ldms, "
+				     "%d pages/s, reclaim %d%%\n", *minfree,
+				     margin * 1000 / decline, decline,
+				     lowmem_rate.efficiency);
+			return lowmem_adj[i];
+		}
+	}
+
+	return OOM_ADJUST_MAX + 1;
+}
+
+/*
+ * Task index
+ *
+ * Thread groups are kept in buckets by oom_adj so that victim selection only
+ * has to look at the highest non-empty bucket instead of walking every
+ * process under tasklist_lock. Entries are added or moved when a process is
+ * forked, a kernel thread execs a program or an oom_adj is written, and are
+ * dropped when do_exit() takes the group's live count to zero. Kernel
+ * threads are not indexed. Each entry holds a reference on the group leader.
+ * The RSS of a task is cached and only refreshed when it is older than
+ * LOWMEM_RSS_TTL.
+ *
+ * The index lock is only taken from process context, and nests outside
+ * task_lock(). If the index can't be maintained because an allocation
+ * failed, selection falls back to walking the task list.
+ */
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LOWMEM_HASH_BITS	7
+#define LOWMEM_RSS_TTL		(HZ / 10)
+
+struct lowmem_task {
+	struct list_head	list;	/* entry in lowmem_buckets */
+	struct hlist_node	hash;	/* entry in lowmem_hash */
+	struct task_struct	*task;	/* thread group leader */
+	int			adj;	/* oom_adj of the bucket we're in */
+	int			rss;	/* cached RSS, in pages */
+	unsigned long		rss_stamp; /* jiffies when rss was sampled */
 };
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static struct hlist_head lowmem_hash[1 << LOWMEM_HASH_BITS];
+static bool lowmem_index_ready;
+
+static struct lowmem_task *lowmem_index_find(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(lt, node,
+			     &lowmem_hash[hash_ptr(task, LOWMEM_HASH_BITS)],
+			     hash)
+		if (lt->task == task)
+			return lt;
+
+	return NULL;
+}
+
+static void lowmem_index_del(struct lowmem_task *lt)
+{
+	list_del(&lt->list);
+	hlist_del(&lt->hash);
+	put_task_struct(lt->task);
+	kfree(lt);
+}
+
+/*
+ * Add or move the thread group of 'task'. Called with lowmem_index_lock held.
+ */
+static void lowmem_index_update(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	int adj;
+
+	/* kernel threads, and groups whose exit has already been seen */
+	if ((task->flags & PF_KTHREAD) || !atomic_read(&task->signal->live))
+		return;
+
+	task = task->group_leader;
+	adj = task->signal->oom_adj;
+	if (adj < OOM_DISABLE || adj > OOM_ADJUST_MAX)
+		return;
+
+	lt = lowmem_index_find(task);
+	if (!lt) {
+		lt = kmalloc(sizeof(*lt), GFP_ATOMIC);
+		if (!lt) {
+			pr_warn("no memory for task index, falling back to "
+				"task list scans\n");
+			lowmem_index_ready = false;
+			return;
+		}
+		get_task_struct(task);
+		lt->task = task;
+		hlist_add_head(&lt->hash,
+			&lowmem_hash[hash_ptr(task, LOWMEM_HASH_BITS)]);
+	} else {
+		list_del(&lt->list);
+	}
+
+	lt->adj = adj;
+	lt->rss = 0;
+	lt->rss_stamp = jiffies - LOWMEM_RSS_TTL - 1;
+	list_add_tail(&lt->list, &lowmem_buckets[adj - OOM_DISABLE]);
+}
+
+/*
+ * A non-leader thread exec'd and took over the group from 'old', so move
+ * the entry over to the new leader. Called with lowmem_index_lock held.
+ */
+static void lowmem_index_new_leader(struct task_struct *old)
+{
+	struct task_struct *task = old->group_leader;
+	struct lowmem_task *lt;
+
+	lt = lowmem_index_find(old);
+	if (!lt)
+		return;
+
+	hlist_del(&lt->hash);
+	put_task_struct(old);
+	get_task_struct(task);
+	lt->task = task;
+	hlist_add_head(&lt->hash,
+		&lowmem_hash[hash_ptr(task, LOWMEM_HASH_BITS)]);
+
+	/* the exec replaced the address space, so re-sample its RSS */
+	lowmem_index_update(task);
+}
+
+/* The last live thread of the group is exiting */
+static void lowmem_index_exit_group(struct task_struct *task)
 {
-	struct task_struct *task = data;
+	struct lowmem_task *lt;
 
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
+	lt = lowmem_index_find(task->group_leader);
+	if (lt)
+		lowmem_index_del(lt);
+}
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_index_ready) {
+		switch (val) {
+		case OOM_ADJ_LEADER_CHANGED:
+			lowmem_index_new_leader(data);
+			break;
+		case OOM_ADJ_GROUP_EXIT:
+			lowmem_index_exit_group(data);
+			break;
+		default:
+			lowmem_index_update(data);
+		}
+	}
+	spin_unlock(&lowmem_index_lock);
 
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+static int lowmem_task_rss(struct lowmem_task *lt)
+{
+	struct task_struct *p = lt->task;
+
+	if (time_before(jiffies, lt->rss_stamp + LOWMEM_RSS_TTL))
+		return lt->rss;
+
+	task_lock(p);
+	lt->rss = p->mm ? get_mm_rss(p->mm) : 0;
+	task_unlock(p);
+	lt->rss_stamp = jiffies;
+
+	return lt->rss;
+}
+
+/*
+ * Pick the largest task from the highest non-empty bucket at or above
+ * 'min_adj'. Returns the victim with a reference held, or NULL.
+ */
+static struct task_struct *lowmem_select_indexed(int min_adj, int *tasksize,
+						 int *oom_adj)
+{
+	struct task_struct *selected = NULL;
+	struct lowmem_task *lt, *next;
+	int adj;
+
+	spin_lock(&lowmem_index_lock);
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		list_for_each_entry_safe(lt, next,
+				&lowmem_buckets[adj - OOM_DISABLE], list) {
+			struct task_struct *p = lt->task;
+			int size;
+
+			size = lowmem_task_rss(lt);
+			if (size <= 0 || (selected && size <= *tasksize))
+				continue;
+			selected = p;
+			*tasksize = size;
+			*oom_adj = adj;
+			lowmem_print(2, "select '%s' (%d), adj %d, size %d, "
+				     "to kill\n", p->comm, p->pid, adj, size);
+		}
+	}
+	if (selected)
+		get_task_struct(selected);
+	spin_unlock(&lowmem_index_lock);
+
+	return selected;
+}
+
+/*
+ * Walk every process for the largest task with the highest oom_adj at or
+ * above 'min_adj'. Returns the victim with a reference held, or NULL.
+ */
+static struct task_struct *lowmem_select_scan(int min_adj, int *tasksize,
+					      int *oom_adj)
 {
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
+	int selected_tasksize = 0;
+	int selected_oom_adj = min_adj;
+	int size;
+
+	read_lock(&tasklist_lock);
+	for_each_process(p) {
+		struct mm_struct *mm;
+		struct signal_struct *sig;
+		int adj;
+
+		task_lock(p);
+		mm = p->mm;
+		sig = p->signal;
+		if (!mm || !sig) {
+			task_unlock(p);
+			continue;
+		}
+		adj = sig->oom_adj;
+		if (adj < min_adj) {
+			task_unlock(p);
+			continue;
+		}
+		size = get_mm_rss(mm);
+		task_unlock(p);
+		if (size <= 0)
+			continue;
+		if (selected) {
+			if (adj < selected_oom_adj)
+				continue;
+			if (adj == selected_oom_adj &&
+			    size <= selected_tasksize)
+				continue;
+		}
+		selected = p;
+		selected_tasksize = size;
+		selected_oom_adj = adj;
+		lowmem_print(2, "select '%s' (%d), adj %d, size %d, to kill\n",
+			     p->comm, p->pid, adj, size);
+	}
+	if (selected) {
+		get_task_struct(selected);
+		*tasksize = selected_tasksize;
+		*oom_adj = selected_oom_adj;
+	}
+	read_unlock(&tasklist_lock);
+
+	return selected;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int minfree = 0;
 	int selected_tasksize = 0;
-	int selected_oom_adj;
+	int selected_oom_adj = 0;
+	bool indexed = lowmem_index_ready;
+	ktime_t start;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
+	lowmem_sample(max(other_free, other_file));
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -104,8 +547,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+	if (lowmem_death_pending())
 		return 0;
 
 	if (lowmem_adj_size < array_size)
@@ -119,6 +561,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	if (sc->nr_to_scan > 0 && min_adj == OOM_ADJUST_MAX + 1)
+		min_adj = lowmem_predict(max(other_free, other_file),
+					 array_size, &minfree);
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -132,43 +577,18 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	start = ktime_get();
+	if (indexed)
+		selected = lowmem_select_indexed(min_adj, &selected_tasksize,
+						 &selected_oom_adj);
+	else
+		selected = lowmem_select_scan(min_adj, &selected_tasksize,
+					      &selected_oom_adj);
+	trace_lowmem_select(min_adj, selected ? selected->pid : 0,
+			    selected_oom_adj, selected_tasksize, indexed,
+			    ktime_to_ns(ktime_sub(ktime_get(), start)));
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select '%s' (%d), adj %d, size %d, to kill\n",
-			     p->comm, p->pid, oom_adj, tasksize);
-	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
@@ -185,14 +605,13 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     minfree * (long)(PAGE_SIZE / 1024),
 			     min_adj,
 			     other_free * (long)(PAGE_SIZE / 1024));
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_set_deathpending(selected);
 		force_sig(SIGKILL, selected);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -201,9 +620,44 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static void __init lowmem_index_init(void)
+{
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	oom_adj_register(&oom_adj_nb);
+
+	/* notifier first, so that nothing forked from here on is missed */
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_index_lock);
+	lowmem_index_ready = true;
+	for_each_process(p)
+		lowmem_index_update(p);
+	spin_unlock(&lowmem_index_lock);
+	read_unlock(&tasklist_lock);
+}
+
+static void lowmem_index_exit(void)
+{
+	struct lowmem_task *lt, *next;
+	int i;
+
+	oom_adj_unregister(&oom_adj_nb);
+
+	spin_lock(&lowmem_index_lock);
+	lowmem_index_ready = false;
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		list_for_each_entry_safe(lt, next, &lowmem_buckets[i], list)
+			lowmem_index_del(lt);
+	spin_unlock(&lowmem_index_lock);
+}
+
 static int __init lowmem_init(void)
 {
-	task_free_register(&task_nb);
+	lowmem_index_init();
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -211,7 +665,7 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
-	task_free_unregister(&task_nb);
+	lowmem_index_exit();
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -220,6 +674,10 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(predict_window_ms, lowmem_predict_window_ms, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(predict_efficiency, lowmem_predict_efficiency, uint,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
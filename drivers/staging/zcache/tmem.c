@@ -25,6 +25,8 @@
  */
 
 #include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
 
@@ -180,7 +182,7 @@ static void tmem_pool_flush(struct tmem_pool *pool, bool destroy)
 	int i;
 
 	BUG_ON(pool == NULL);
-	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
+	for (i = 0; i < (1 << pool->hashbucket_bits); i++, hb++) {
 		spin_lock(&hb->lock);
 		rbnode = rb_first(&hb->obj_rb_root);
 		while (rbnode != NULL) {
@@ -512,7 +514,7 @@ int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 	struct tmem_hashbucket *hb;
 
 	ephemeral = is_ephemeral(pool);
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	hb = &pool->hashbucket[tmem_oid_hash(pool, oidp)];
 	spin_lock(&hb->lock);
 	obj = objfound = tmem_obj_find(hb, oidp);
 	if (obj != NULL) {
@@ -582,7 +584,7 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp,
 	uint32_t ret = -1;
 	struct tmem_hashbucket *hb;
 
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	hb = &pool->hashbucket[tmem_oid_hash(pool, oidp)];
 	spin_lock(&hb->lock);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
@@ -624,7 +626,7 @@ int tmem_flush_page(struct tmem_pool *pool,
 	int ret = -1;
 	struct tmem_hashbucket *hb;
 
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	hb = &pool->hashbucket[tmem_oid_hash(pool, oidp)];
 	spin_lock(&hb->lock);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
@@ -653,7 +655,7 @@ int tmem_flush_object(struct tmem_pool *pool, struct tmem_oid *oidp)
 	struct tmem_hashbucket *hb;
 	int ret = -1;
 
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
+	hb = &pool->hashbucket[tmem_oid_hash(pool, oidp)];
 	spin_lock(&hb->lock);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
@@ -679,6 +681,8 @@ int tmem_destroy_pool(struct tmem_pool *pool)
 	if (pool == NULL)
 		goto out;
 	tmem_pool_flush(pool, 1);
+	kfree(pool->hashbucket);
+	pool->hashbucket = NULL;
 	ret = 0;
 out:
 	return ret;
@@ -686,18 +690,47 @@ out:
 
 static LIST_HEAD(tmem_global_pool_list);
 
+/*
+ * Pick the number of hash buckets for a new pool: one per
+ * 2^TMEM_HASH_PAGES_PER_BUCKET_SHIFT pages of RAM, bounded by
+ * TMEM_HASH_BUCKET_BITS and TMEM_HASH_BUCKET_BITS_MAX.
+ */
+static unsigned int tmem_hashbucket_bits(void)
+{
+	unsigned long buckets = totalram_pages >>
+				TMEM_HASH_PAGES_PER_BUCKET_SHIFT;
+	unsigned int bits = TMEM_HASH_BUCKET_BITS;
+
+	while (bits < TMEM_HASH_BUCKET_BITS_MAX && (1UL << bits) < buckets)
+		bits++;
+	return bits;
+}
+
 /*
  * Create a new tmem_pool with the provided flag and return
  * a pool id provided by the tmem host implementation.
+ * Returns 0 on success, or -ENOMEM if no hash buckets could be allocated.
  */
-void tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
+int tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
 {
 	int persistent = flags & TMEM_POOL_PERSIST;
 	int shared = flags & TMEM_POOL_SHARED;
-	struct tmem_hashbucket *hb = &pool->hashbucket[0];
+	unsigned int bits = tmem_hashbucket_bits();
+	struct tmem_hashbucket *hb;
 	int i;
 
-	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
+	/* fall back to fewer buckets rather than failing the pool */
+	for (;;) {
+		hb = kcalloc(1 << bits, sizeof(*hb), GFP_KERNEL | __GFP_NOWARN);
+		if (hb != NULL || bits == TMEM_HASH_BUCKET_BITS)
+			break;
+		bits--;
+	}
+	if (hb == NULL)
+		return -ENOMEM;
+	pool->hashbucket = hb;
+	pool->hashbucket_bits = bits;
+	for (i = 0; i < (1 << bits); i++, hb++) {
 		hb->obj_rb_root = RB_ROOT;
 		spin_lock_init(&hb->lock);
 	}
@@ -707,4 +740,5 @@ void tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
 	list_add_tail(&pool->pool_list, &tmem_global_pool_list);
 	pool->persistent = persistent;
 	pool->shared = shared;
+	return 0;
 }
@@ -54,11 +54,14 @@
  * usually corresponds to a large independent set of pages such as
  * a filesystem.  Each pool has an id, and certain attributes and counters.
  * It also contains a set of hash buckets, each of which contains an rbtree
- * of objects and a lock to manage concurrency within the pool.
+ * of objects and a lock to manage concurrency within the pool.  The number
+ * of buckets is sized from the amount of RAM when the pool is created, so
+ * that larger machines get more, shorter, less contended trees.
  */
 
-#define TMEM_HASH_BUCKET_BITS	8
-#define TMEM_HASH_BUCKETS	(1<<TMEM_HASH_BUCKET_BITS)
+#define TMEM_HASH_BUCKET_BITS		8	/* minimum */
+#define TMEM_HASH_BUCKET_BITS_MAX	12
+#define TMEM_HASH_PAGES_PER_BUCKET_SHIFT	8
 
 struct tmem_hashbucket {
 	struct rb_root obj_rb_root;
@@ -73,7 +76,8 @@ struct tmem_pool {
 	bool shared;
 	atomic_t obj_count;
 	atomic_t refcount;
-	struct tmem_hashbucket hashbucket[TMEM_HASH_BUCKETS];
+	unsigned int hashbucket_bits;
+	struct tmem_hashbucket *hashbucket;
 	DECL_SENTINEL
 };
 
@@ -124,10 +128,11 @@ static inline int tmem_oid_compare(struct tmem_oid *left,
 	return ret;
 }
 
-static inline unsigned tmem_oid_hash(struct tmem_oid *oidp)
+static inline unsigned tmem_oid_hash(struct tmem_pool *pool,
+					struct tmem_oid *oidp)
 {
 	return hash_long(oidp->oid[0] ^ oidp->oid[1] ^ oidp->oid[2],
-				TMEM_HASH_BUCKET_BITS);
+				pool->hashbucket_bits);
 }
 
 /*
@@ -191,5 +196,5 @@ extern int tmem_flush_page(struct tmem_pool *, struct tmem_oid *,
 			uint32_t index);
 extern int tmem_flush_object(struct tmem_pool *, struct tmem_oid *);
 extern int tmem_destroy_pool(struct tmem_pool *);
-extern void tmem_new_pool(struct tmem_pool *, uint32_t);
+extern int tmem_new_pool(struct tmem_pool *, uint32_t);
 #endif /* _TMEM_H */
@@ -21,8 +21,11 @@
 
 #include <linux/cpu.h>
 #include <linux/highmem.h>
+#include <linux/hrtimer.h>
 #include <linux/list.h>
 #include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -64,6 +67,11 @@
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * Unused zbpgs are first kept on a short per-cpu list so that the put
+ * and flush paths normally recycle them without touching the global
+ * unused list.  The per-cpu list is refilled from, and drained to, the
+ * global list ZBUD_PCPU_BATCH pages at a time.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -114,6 +122,20 @@ static unsigned long zcache_zbpg_unused_list_count;
 /* protects the unused page list */
 static DEFINE_SPINLOCK(zbpg_unused_list_spinlock);
 
+#define ZBUD_PCPU_BATCH	4
+#define ZBUD_PCPU_HIGH	(2 * ZBUD_PCPU_BATCH)
+
+/* per-cpu unused pages, only touched with irqs disabled */
+struct zbud_pcpu_list {
+	struct list_head list;
+	unsigned count;
+};
+static DEFINE_PER_CPU(struct zbud_pcpu_list, zbud_pcpu_unused);
+
+/* batch transfers between the per-cpu and global lists */
+static unsigned long zcache_zbpg_pcpu_refills;
+static unsigned long zcache_zbpg_pcpu_drains;
+
 static atomic_t zcache_zbud_curr_raw_pages;
 static atomic_t zcache_zbud_curr_zpages;
 static unsigned long zcache_zbud_curr_zbytes;
@@ -180,23 +202,94 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
  * zbud raw page management
  */
 
-static struct zbud_page *zbud_alloc_raw_page(void)
+/* move up to 'nr' pages from the global unused list to this cpu's list */
+static void zbud_pcpu_refill(struct zbud_pcpu_list *zl, int nr)
 {
-	struct zbud_page *zbpg = NULL;
-	struct zbud_hdr *zh0, *zh1;
-	bool recycled = 0;
+	struct zbud_page *zbpg;
+	unsigned count = zl->count;
 
-	/* if any pages on the zbpg list, use one */
 	spin_lock(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
+	while (nr-- > 0 && !list_empty(&zbpg_unused_list)) {
 		zbpg = list_first_entry(&zbpg_unused_list,
 				struct zbud_page, bud_list);
-		list_del_init(&zbpg->bud_list);
+		list_move(&zbpg->bud_list, &zl->list);
 		zcache_zbpg_unused_list_count--;
-		recycled = 1;
+		zl->count++;
 	}
+	if (zl->count != count)
+		zcache_zbpg_pcpu_refills++;
 	spin_unlock(&zbpg_unused_list_spinlock);
-	if (zbpg == NULL)
+}
+
+/* move up to 'nr' pages from this cpu's list back to the global list */
+static void zbud_pcpu_drain(struct zbud_pcpu_list *zl, int nr)
+{
+	struct zbud_page *zbpg;
+
+	spin_lock(&zbpg_unused_list_spinlock);
+	if (nr > 0 && zl->count)
+		zcache_zbpg_pcpu_drains++;
+	while (nr-- > 0 && zl->count) {
+		zbpg = list_first_entry(&zl->list, struct zbud_page, bud_list);
+		list_move(&zbpg->bud_list, &zbpg_unused_list);
+		zcache_zbpg_unused_list_count++;
+		zl->count--;
+	}
+	spin_unlock(&zbpg_unused_list_spinlock);
+}
+
+/* hand this cpu's unused pages back to the global list; runs with irqs off */
+static void zbud_pcpu_drain_local(void *unused)
+{
+	struct zbud_pcpu_list *zl = &__get_cpu_var(zbud_pcpu_unused);
+
+	if (zl->count)
+		zbud_pcpu_drain(zl, zl->count);
+}
+
+static struct zbud_page *zbud_pcpu_get(void)
+{
+	struct zbud_pcpu_list *zl;
+	struct zbud_page *zbpg = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	zl = &__get_cpu_var(zbud_pcpu_unused);
+	if (zl->count == 0)
+		zbud_pcpu_refill(zl, ZBUD_PCPU_BATCH);
+	if (zl->count) {
+		zbpg = list_first_entry(&zl->list, struct zbud_page, bud_list);
+		list_del_init(&zbpg->bud_list);
+		zl->count--;
+	}
+	local_irq_restore(flags);
+	return zbpg;
+}
+
+static void zbud_pcpu_put(struct zbud_page *zbpg)
+{
+	struct zbud_pcpu_list *zl;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	zl = &__get_cpu_var(zbud_pcpu_unused);
+	list_add(&zbpg->bud_list, &zl->list);
+	if (++zl->count > ZBUD_PCPU_HIGH)
+		zbud_pcpu_drain(zl, ZBUD_PCPU_BATCH);
+	local_irq_restore(flags);
+}
+
+static struct zbud_page *zbud_alloc_raw_page(void)
+{
+	struct zbud_page *zbpg;
+	struct zbud_hdr *zh0, *zh1;
+	bool recycled = 0;
+
+	/* if any unused zbpgs are cached, use one */
+	zbpg = zbud_pcpu_get();
+	if (zbpg != NULL)
+		recycled = 1;
+	else
 		/* none on zbpg list, try to get a kernel page */
 		zbpg = zcache_get_free_page();
 	if (likely(zbpg != NULL)) {
@@ -231,10 +324,7 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
 	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
 	INVERT_SENTINEL(zbpg, ZBPG);
 	spin_unlock(&zbpg->lock);
-	spin_lock(&zbpg_unused_list_spinlock);
-	list_add(&zbpg->bud_list, &zbpg_unused_list);
-	zcache_zbpg_unused_list_count++;
-	spin_unlock(&zbpg_unused_list_spinlock);
+	zbud_pcpu_put(zbpg);
 }
 
 /*
@@ -459,9 +549,16 @@ static void zbud_evict_pages(int nr)
 	struct zbud_page *zbpg;
 	int i;
 
-	/* first try freeing any pages on unused list */
+	/* pages cached on other cpus are unused too, so collect them first */
+	if (nr > 0)
+		on_each_cpu(zbud_pcpu_drain_local, NULL, 1);
+
+	/*
+	 * first try freeing any pages on unused list; irqs, not just bh, are
+	 * disabled because the list is also taken by zbud_pcpu_drain_local()
+	 */
 retry_unused_list:
-	spin_lock_bh(&zbpg_unused_list_spinlock);
+	spin_lock_irq(&zbpg_unused_list_spinlock);
 	if (!list_empty(&zbpg_unused_list)) {
 		/* can't walk list here, since it may change when unlocked */
 		zbpg = list_first_entry(&zbpg_unused_list,
@@ -469,14 +566,14 @@ retry_unused_list:
 		list_del_init(&zbpg->bud_list);
 		zcache_zbpg_unused_list_count--;
 		atomic_dec(&zcache_zbud_curr_raw_pages);
-		spin_unlock_bh(&zbpg_unused_list_spinlock);
+		spin_unlock_irq(&zbpg_unused_list_spinlock);
 		zcache_free_page(zbpg);
 		zcache_evicted_raw_pages++;
 		if (--nr <= 0)
 			goto out;
 		goto retry_unused_list;
 	}
-	spin_unlock_bh(&zbpg_unused_list_spinlock);
+	spin_unlock_irq(&zbpg_unused_list_spinlock);
 
 	/* now try freeing unbuddied pages, starting with least space avail */
 	for (i = 0; i < MAX_CHUNK; i++) {
@@ -531,8 +628,14 @@ out:
 
 static void zbud_init(void)
 {
+	unsigned int cpu;
 	int i;
 
+	for_each_possible_cpu(cpu) {
+		INIT_LIST_HEAD(&per_cpu(zbud_pcpu_unused, cpu).list);
+		per_cpu(zbud_pcpu_unused, cpu).count = 0;
+	}
+
 	INIT_LIST_HEAD(&zbud_buddied_list);
 	zcache_zbud_buddied_count = 0;
 	for (i = 0; i < NCHUNKS; i++) {
@@ -677,6 +780,26 @@ static unsigned long zcache_flobj_found;
 static unsigned long zcache_failed_eph_puts;
 static unsigned long zcache_failed_pers_puts;
 
+/* put/get latency, per-cpu so that accounting adds no shared cachelines */
+struct zcache_lat_stats {
+	unsigned long count;
+	unsigned long max_ns;
+	u64 total_ns;
+};
+static DEFINE_PER_CPU(struct zcache_lat_stats, zcache_put_lat);
+static DEFINE_PER_CPU(struct zcache_lat_stats, zcache_get_lat);
+
+/* caller must have irqs disabled */
+static void zcache_lat_account(struct zcache_lat_stats *st, ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	st->count++;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+}
+
 #define MAX_POOLS_PER_CLIENT 16
 
 static struct {
@@ -714,6 +837,7 @@ static unsigned long zcache_failed_get_free_pages;
 static unsigned long zcache_failed_alloc;
 static unsigned long zcache_put_to_flush;
 static unsigned long zcache_aborted_preload;
+static unsigned long zcache_preload_fast;
 static unsigned long zcache_aborted_shrink;
 
 /*
@@ -752,14 +876,32 @@ static int zcache_do_preload(struct tmem_pool *pool)
 {
 	struct zcache_preload *kp;
 	struct tmem_objnode *objnode;
-	struct tmem_obj *obj;
-	void *page;
+	struct tmem_obj *obj = NULL;
+	void *page = NULL;
+	bool need_obj, need_page;
 	int ret = -ENOMEM;
 
 	if (unlikely(zcache_objnode_cache == NULL))
 		goto out;
 	if (unlikely(zcache_obj_cache == NULL))
 		goto out;
+
+	/*
+	 * Puts that grow neither the object set nor a zbud page list leave
+	 * the preload full, so the next put on this cpu needs no allocation
+	 * and need not contend for zcache_direct_reclaim_lock.
+	 */
+	preempt_disable();
+	kp = &__get_cpu_var(zcache_preloads);
+	if (kp->nr == ARRAY_SIZE(kp->objnodes) &&
+	    kp->obj != NULL && kp->page != NULL) {
+		zcache_preload_fast++;
+		return 0;
+	}
+	need_obj = kp->obj == NULL;
+	need_page = kp->page == NULL;
+	preempt_enable_no_resched();
+
 	if (!spin_trylock(&zcache_direct_reclaim_lock)) {
 		zcache_aborted_preload++;
 		goto out;
@@ -782,27 +924,36 @@ static int zcache_do_preload(struct tmem_pool *pool)
 			kmem_cache_free(zcache_objnode_cache, objnode);
 	}
 	preempt_enable_no_resched();
-	obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
-	if (unlikely(obj == NULL)) {
-		zcache_failed_alloc++;
-		goto unlock_out;
+	if (need_obj) {
+		obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
+		if (unlikely(obj == NULL)) {
+			zcache_failed_alloc++;
+			goto unlock_out;
+		}
 	}
-	page = (void *)__get_free_page(ZCACHE_GFP_MASK);
-	if (unlikely(page == NULL)) {
-		zcache_failed_get_free_pages++;
-		kmem_cache_free(zcache_obj_cache, obj);
-		goto unlock_out;
+	if (need_page) {
+		page = (void *)__get_free_page(ZCACHE_GFP_MASK);
+		if (unlikely(page == NULL)) {
+			zcache_failed_get_free_pages++;
+			if (obj != NULL)
+				kmem_cache_free(zcache_obj_cache, obj);
+			goto unlock_out;
+		}
 	}
 	preempt_disable();
 	kp = &__get_cpu_var(zcache_preloads);
-	if (kp->obj == NULL)
-		kp->obj = obj;
-	else
-		kmem_cache_free(zcache_obj_cache, obj);
-	if (kp->page == NULL)
-		kp->page = page;
-	else
-		free_page((unsigned long)page);
+	if (obj != NULL) {
+		if (kp->obj == NULL)
+			kp->obj = obj;
+		else
+			kmem_cache_free(zcache_obj_cache, obj);
+	}
+	if (page != NULL) {
+		if (kp->page == NULL)
+			kp->page = page;
+		else
+			free_page((unsigned long)page);
+	}
 	ret = 0;
 unlock_out:
 	spin_unlock(&zcache_direct_reclaim_lock);
@@ -1055,6 +1206,13 @@ static int zcache_cpu_notifier(struct notifier_block *nb,
 		}
 		kmem_cache_free(zcache_obj_cache, kp->obj);
 		free_page((unsigned long)kp->page);
+		/* count is only ever nonzero once zbud_init has run */
+		if (per_cpu(zbud_pcpu_unused, cpu).count) {
+			local_irq_disable();
+			zbud_pcpu_drain(&per_cpu(zbud_pcpu_unused, cpu),
+					ZBUD_PCPU_HIGH + 1);
+			local_irq_enable();
+		}
 		break;
 	default:
 		break;
@@ -1100,6 +1258,34 @@ static struct notifier_block zcache_cpu_notifier_block = {
 		.show = zcache_##_name##_show, \
 	}
 
+static int zcache_show_lat(char *buf, struct zcache_lat_stats __percpu *lat)
+{
+	struct zcache_lat_stats *st;
+	unsigned long count = 0, max_ns = 0;
+	u64 total_ns = 0;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(lat, cpu);
+		count += st->count;
+		total_ns += st->total_ns;
+		if (st->max_ns > max_ns)
+			max_ns = st->max_ns;
+	}
+	return sprintf(buf, "count:%lu mean_ns:%llu max_ns:%lu\n", count,
+		count == 0 ? 0ULL : div64_u64(total_ns, count), max_ns);
+}
+
+static int zcache_show_put_latency(char *buf)
+{
+	return zcache_show_lat(buf, &zcache_put_lat);
+}
+
+static int zcache_show_get_latency(char *buf)
+{
+	return zcache_show_lat(buf, &zcache_get_lat);
+}
+
 ZCACHE_SYSFS_RO(curr_obj_count_max);
 ZCACHE_SYSFS_RO(curr_objnode_count_max);
 ZCACHE_SYSFS_RO(flush_total);
@@ -1113,6 +1299,8 @@ ZCACHE_SYSFS_RO(zbud_cumul_zpages);
 ZCACHE_SYSFS_RO(zbud_cumul_zbytes);
 ZCACHE_SYSFS_RO(zbud_buddied_count);
 ZCACHE_SYSFS_RO(zbpg_unused_list_count);
+ZCACHE_SYSFS_RO(zbpg_pcpu_refills);
+ZCACHE_SYSFS_RO(zbpg_pcpu_drains);
 ZCACHE_SYSFS_RO(evicted_raw_pages);
 ZCACHE_SYSFS_RO(evicted_unbuddied_pages);
 ZCACHE_SYSFS_RO(evicted_buddied_pages);
@@ -1120,6 +1308,7 @@ ZCACHE_SYSFS_RO(failed_get_free_pages);
 ZCACHE_SYSFS_RO(failed_alloc);
 ZCACHE_SYSFS_RO(put_to_flush);
 ZCACHE_SYSFS_RO(aborted_preload);
+ZCACHE_SYSFS_RO(preload_fast);
 ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
@@ -1130,6 +1319,8 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+ZCACHE_SYSFS_RO_CUSTOM(put_latency, zcache_show_put_latency);
+ZCACHE_SYSFS_RO_CUSTOM(get_latency, zcache_show_get_latency);
 
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1150,6 +1341,8 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_zbud_cumul_zbytes_attr.attr,
 	&zcache_zbud_buddied_count_attr.attr,
 	&zcache_zbpg_unused_list_count_attr.attr,
+	&zcache_zbpg_pcpu_refills_attr.attr,
+	&zcache_zbpg_pcpu_drains_attr.attr,
 	&zcache_evicted_raw_pages_attr.attr,
 	&zcache_evicted_unbuddied_pages_attr.attr,
 	&zcache_evicted_buddied_pages_attr.attr,
@@ -1157,9 +1350,12 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_failed_alloc_attr.attr,
 	&zcache_put_to_flush_attr.attr,
 	&zcache_aborted_preload_attr.attr,
+	&zcache_preload_fast_attr.attr,
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_put_latency_attr.attr,
+	&zcache_get_latency_attr.attr,
 	NULL,
 };
 
@@ -1216,6 +1412,7 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	ktime_t start = ktime_get();
 	int ret = -1;
 
 	BUG_ON(!irqs_disabled());
@@ -1240,6 +1437,7 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 			(void)tmem_flush_page(pool, oidp, index);
 		zcache_put_pool(pool);
 	}
+	zcache_lat_account(&__get_cpu_var(zcache_put_lat), start);
 out:
 	return ret;
 }
@@ -1254,9 +1452,12 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 	local_irq_save(flags);
 	pool = zcache_get_pool_by_id(pool_id);
 	if (likely(pool != NULL)) {
+		ktime_t start = ktime_get();
+
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, page);
 		zcache_put_pool(pool);
+		zcache_lat_account(&__get_cpu_var(zcache_get_lat), start);
 	}
 	local_irq_restore(flags);
 	return ret;
@@ -1348,11 +1549,16 @@ static int zcache_new_pool(uint32_t flags)
 	atomic_set(&pool->refcount, 0);
 	pool->client = &zcache_client;
 	pool->pool_id = poolid;
-	tmem_new_pool(pool, flags);
+	if (tmem_new_pool(pool, flags)) {
+		pr_info("zcache: pool creation failed: out of memory\n");
+		kfree(pool);
+		poolid = -1;
+		goto out;
+	}
 	zcache_client.tmem_pools[poolid] = pool;
-	pr_info("zcache: created %s tmem pool, id=%d\n",
+	pr_info("zcache: created %s tmem pool, id=%d, %u hash buckets\n",
 		flags & TMEM_POOL_PERSIST ? "persistent" : "ephemeral",
-		poolid);
+		poolid, 1U << pool->hashbucket_bits);
 out:
 	return poolid;
 }
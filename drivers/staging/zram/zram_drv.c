@@ -136,12 +136,12 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	unsigned long handle;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	read_lock(&zram->table_lock);
+	handle = zram->table[index].handle;
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -150,22 +150,20 @@ static void zram_free_page(struct zram *zram, size_t index)
 			zram_clear_flag(zram, index, ZRAM_ZERO);
 			zram_stat_dec(&zram->stats.pages_zero);
 		}
+		read_unlock(&zram->table_lock);
 		return;
 	}
 
+	clen = zram->table[index].size;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page((struct page *)handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	zs_free(zram->mem_pool, handle);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
@@ -173,8 +171,9 @@ out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+	read_unlock(&zram->table_lock);
 }
 
 static void handle_zero_page(struct page *page)
@@ -194,8 +193,7 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic((struct page *)zram->table[index].handle, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -217,20 +215,25 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
 		size_t clen;
+		unsigned long handle;
 		struct page *page;
 		struct zobj_header *zheader;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
+		read_lock(&zram->table_lock);
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			read_unlock(&zram->table_lock);
 			handle_zero_page(page);
 			index++;
 			continue;
 		}
 
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		handle = zram->table[index].handle;
+		if (unlikely(!handle)) {
+			read_unlock(&zram->table_lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			handle_zero_page(page);
@@ -241,6 +244,7 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			read_unlock(&zram->table_lock);
 			index++;
 			continue;
 		}
@@ -248,16 +252,16 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		user_mem = kmap_atomic(page, KM_USER0);
 		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 		ret = lzo1x_decompress_safe(
 			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
+			zram->table[index].size,
 			user_mem, &clen);
 
+		zs_unmap_object(zram->mem_pool, handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		read_unlock(&zram->table_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
 		if (unlikely(ret != LZO_E_OK)) {
@@ -279,6 +283,23 @@ out:
 	bio_io_error(bio);
 }
 
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *stream = &zram->streams[raw_smp_processor_id()];
+
+	if (!mutex_trylock(&stream->lock)) {
+		mutex_lock(&stream->lock);
+		stream->contended++;
+	}
+
+	return stream;
+}
+
+static void zram_stream_put(struct zram_stream *stream)
+{
+	mutex_unlock(&stream->lock);
+}
+
 static void zram_write(struct zram *zram, struct bio *bio)
 {
 	int i;
@@ -290,47 +311,56 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
 		size_t clen;
+		unsigned long handle;
 		struct zobj_header *zheader;
 		struct page *page, *page_store;
+		struct zram_stream *stream;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
 
 		/*
 		 * System overwrites unused sectors. Free memory associated
 		 * with this sector now.
 		 */
-		if (zram->table[index].page ||
+		if (zram->table[index].handle ||
 				zram_test_flag(zram, index, ZRAM_ZERO))
 			zram_free_page(zram, index);
 
-		mutex_lock(&zram->lock);
+		stream = zram_stream_get(zram);
+		src = stream->buffer;
 
 		user_mem = kmap_atomic(page, KM_USER0);
 		if (page_zero_filled(user_mem)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
+			zram_stream_put(stream);
+			mutex_lock(&zram->lock);
 			zram_stat_inc(&zram->stats.pages_zero);
 			zram_set_flag(zram, index, ZRAM_ZERO);
+			mutex_unlock(&zram->lock);
 			index++;
 			continue;
 		}
 
+		/* Compression runs on this CPU's stream, outside zram->lock */
 		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+					stream->workmem);
 
 		kunmap_atomic(user_mem, KM_USER0);
 
 		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+			zram_stream_put(stream);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
+		stream->pages++;
+		stream->compr_size += clen;
+
+		mutex_lock(&zram->lock);
+
 		/*
 		 * Page is incompressible. Store it as-is (uncompressed)
 		 * since we do not want to return too many disk write
@@ -341,6 +371,7 @@ static void zram_write(struct zram *zram, struct bio *bio)
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
 				mutex_unlock(&zram->lock);
+				zram_stream_put(stream);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,44 +379,41 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
+			src = kmap_atomic(page, KM_USER0);
+			cmem = kmap_atomic(page_store, KM_USER1);
+			memcpy(cmem, src, clen);
+			kunmap_atomic(cmem, KM_USER1);
+			kunmap_atomic(src, KM_USER0);
+
+			handle = (unsigned long)page_store;
 			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
 			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
 			goto memstore;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
+		handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader),
+				GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!handle)) {
 			mutex_unlock(&zram->lock);
+			zram_stream_put(stream);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-#if 0
 		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+		zheader = (struct zobj_header *)cmem;
+		zheader->table_idx = index;
+		memcpy(cmem + sizeof(*zheader), src, clen);
 
-		memcpy(cmem, src, clen);
+		zs_unmap_object(zram->mem_pool, handle);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+memstore:
+		zram->table[index].handle = handle;
+		zram->table[index].size = clen;
 
 		/* Update stats */
 		zram_stat64_add(zram, &zram->stats.compr_size, clen);
@@ -394,6 +422,7 @@ memstore:
 			zram_stat_inc(&zram->stats.good_compress);
 
 		mutex_unlock(&zram->lock);
+		zram_stream_put(stream);
 		index++;
 	}
 
@@ -453,6 +482,43 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_destroy_streams(struct zram *zram)
+{
+	int i;
+
+	if (!zram->streams)
+		return;
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		kfree(zram->streams[i].workmem);
+		free_pages((unsigned long)zram->streams[i].buffer, 1);
+	}
+	kfree(zram->streams);
+	zram->streams = NULL;
+}
+
+static int zram_create_streams(struct zram *zram)
+{
+	int i;
+
+	zram->streams = kcalloc(nr_cpu_ids, sizeof(*zram->streams),
+				GFP_KERNEL);
+	if (!zram->streams)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		struct zram_stream *stream = &zram->streams[i];
+
+		mutex_init(&stream->lock);
+		stream->workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!stream->workmem || !stream->buffer)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -461,33 +527,26 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_destroy_streams(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		unsigned long handle = zram->table[index].handle;
 
-		if (!page)
+		if (!handle)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page((struct page *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,17 +570,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret) {
+		pr_err("Error allocating compression streams\n");
 		goto fail;
 	}
 
@@ -540,7 +591,7 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -561,6 +612,53 @@ fail:
 	return ret;
 }
 
+/*
+ * Called by zs_compact() for each object it moves; 'obj' is a copy of the
+ * object, which starts with the back-reference to its table entry.
+ */
+static void zram_obj_migrate(void *priv, void *obj, unsigned long handle)
+{
+	struct zram *zram = priv;
+	struct zobj_header *zheader = obj;
+
+	zram->table[zheader->table_idx].handle = handle;
+}
+
+/*
+ * Move compressed objects out of sparsely used zspages and give the
+ * emptied pages back. Writers are held off by zram->lock and everyone else
+ * by table_lock, one size class at a time.
+ */
+int zram_compact(struct zram *zram)
+{
+	int i;
+	void *buf;
+	unsigned long migrated = 0, pages_freed = 0;
+
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	mutex_lock(&zram->lock);
+	for (i = 0; i < zs_get_num_classes(); i++) {
+		write_lock(&zram->table_lock);
+		migrated += zs_compact(zram->mem_pool, i, zram_obj_migrate,
+					zram, buf, &pages_freed);
+		write_unlock(&zram->table_lock);
+		cond_resched();
+	}
+	mutex_unlock(&zram->lock);
+
+	kfree(buf);
+
+	zram_stat64_add(zram, &zram->stats.num_migrated, migrated);
+	zram_stat64_add(zram, &zram->stats.pages_compacted, pages_freed);
+	pr_debug("compaction moved %lu objects, freed %lu pages\n",
+		migrated, pages_freed);
+
+	return 0;
+}
+
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
@@ -582,6 +680,7 @@ static int create_device(struct zram *zram, int device_id)
 	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->table_lock);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
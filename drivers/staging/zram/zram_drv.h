@@ -18,7 +18,7 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -33,9 +33,7 @@ static const unsigned max_num_devices = 32;
  * object. This is required to support memory defragmentation.
  */
 struct zobj_header {
-#if 0
 	u32 table_idx;
-#endif
 };
 
 /*-- Configurable parameters */
@@ -51,8 +49,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -76,10 +74,13 @@ enum zram_pageflags {
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * Allocated for each disk page. 'handle' is a zsmalloc handle, or the
+ * struct page itself for pages stored uncompressed.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;
+	u16 size;	/* compressed size, without the zobj_header */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -92,20 +93,39 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 num_migrated;	/* objects moved by compaction */
+	u64 pages_compacted;	/* pages freed by compaction */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Compression context. There is one per CPU so that writers on different
+ * CPUs compress in parallel; a writer that gets migrated may have to wait
+ * for another's stream, which is what 'contended' counts.
+ */
+struct zram_stream {
+	struct mutex lock;	/* protect the buffers and stats below */
+	void *workmem;
+	void *buffer;
+	u64 pages;		/* pages compressed with this stream */
+	u64 compr_size;		/* total compressed size of those pages */
+	u64 contended;		/* times a writer had to wait for it */
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_stream *streams;	/* nr_cpu_ids compression streams */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t table_lock;	/* taken for writing by compaction, which
+				 * moves objects and updates their table
+				 * entries, and for reading by everyone
+				 * else accessing objects */
+	struct mutex lock;	/* serialise storing compressed pages
+				 * and updating the table and stats */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +148,6 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_compact(struct zram *zram);
 
 #endif
@@ -0,0 +1,463 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are grouped by size into classes ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class carves its objects out of zspages: spans of one or more pages,
+ * sized so that the tail of the span wastes as little as possible. Objects
+ * may straddle two pages of a span, which is what lets odd sizes pack
+ * densely. Empty zspages go straight back to the page allocator, and
+ * zs_compact() migrates objects out of sparsely used zspages so that those
+ * can be freed too.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* Per-cpu state of a mapped object, see zs_map_object() */
+struct mapping_area {
+	char *vm_buf;		/* copy of an object straddling two pages */
+	char *vm_addr;		/* kmap_atomic() address of a single page */
+	enum zs_mapmode vm_mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the span length, in pages, that leaves the least unused space at
+ * the end of a zspage of objects of the given size.
+ */
+static int get_pages_per_zspage(int size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int usedpc = (zspage_size / size) * size * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static unsigned long obj_handle(struct zspage *zspage, int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+}
+
+static struct zspage *handle_to_zspage(unsigned long handle, int *idx)
+{
+	struct page *page = pfn_to_page(handle >> OBJ_INDEX_BITS);
+
+	*idx = handle & OBJ_INDEX_MASK;
+	return (struct zspage *)page_private(page);
+}
+
+/*
+ * Locate object 'idx' of 'zspage': the page it starts in and its offset
+ * within that page.
+ */
+static struct page *obj_location(struct zspage *zspage, int idx,
+				unsigned long *offset)
+{
+	unsigned long off = (unsigned long)idx * zspage->class->size;
+
+	*offset = off & ~PAGE_MASK;
+	return zspage->pages[off >> PAGE_SHIFT];
+}
+
+/*
+ * Copy 'size' bytes between 'buf' and the object at <page, off>, which
+ * continues into the next page of the zspage if it doesn't fit.
+ */
+static void obj_copy(struct zspage *zspage, struct page *page,
+			unsigned long off, void *buf, int size, bool to_obj)
+{
+	while (size) {
+		int len = min_t(int, size, PAGE_SIZE - off);
+		char *addr = kmap_atomic(page, KM_USER1);
+
+		if (to_obj)
+			memcpy(addr + off, buf, len);
+		else
+			memcpy(buf, addr + off, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		size -= len;
+		off = 0;
+		if (size)
+			page = zspage->pages[page->index + 1];
+	}
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < zspage->class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	struct zspage *zspage;
+	int i;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			BITS_TO_LONGS(class->objs_per_zspage) * sizeof(long),
+			flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(flags);
+
+		if (!page) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		page->index = i;
+		zspage->pages[i] = page;
+	}
+
+	return zspage;
+}
+
+/*
+ * Create a memory pool. Only the per-class metadata is allocated here,
+ * zspages are added as objects are allocated.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+	}
+
+	spin_lock_init(&pool->lock);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/*
+ * All objects must have been freed by now.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		if (class->zspages)
+			pr_info("Freeing non-empty class with size %d, "
+				"zspages=%lu\n", class->size, class->zspages);
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate an object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of the object
+ * @flags: flags for allocating a new zspage, if one is needed
+ *
+ * Returns a handle for the object, or 0 if no memory was available. The
+ * handle has to be mapped with zs_map_object() to access the object.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned long handle;
+	int idx;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&pool->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&pool->lock);
+
+		zspage = alloc_zspage(class, flags);
+		if (unlikely(!zspage))
+			return 0;
+
+		spin_lock(&pool->lock);
+		list_add(&zspage->list, &class->partial);
+		class->zspages++;
+		pool->total_pages += class->pages_per_zspage;
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	idx = find_first_zero_bit(zspage->freemap, class->objs_per_zspage);
+	__set_bit(idx, zspage->freemap);
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+	handle = obj_handle(zspage, idx);
+	spin_unlock(&pool->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	bool empty = false;
+	int idx;
+
+	zspage = handle_to_zspage(handle, &idx);
+	class = zspage->class;
+
+	spin_lock(&pool->lock);
+	__clear_bit(idx, zspage->freemap);
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_move(&zspage->list, &class->partial);
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		class->zspages--;
+		pool->total_pages -= class->pages_per_zspage;
+		empty = true;
+	}
+	spin_unlock(&pool->lock);
+
+	if (empty)
+		free_zspage(zspage);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get a pointer to the object behind a handle
+ * @pool: pool the object belongs to
+ * @handle: handle returned by zs_malloc()
+ * @mm: whether the object is going to be read, written, or both
+ *
+ * Objects within a single page are mapped directly. One straddling two
+ * pages is copied into a per-cpu buffer, and copied back on unmap unless it
+ * was mapped read-only. Like kmap_atomic(), this disables preemption until
+ * zs_unmap_object(), and only one object can be mapped at a time. KM_USER1
+ * is used for the mapping.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct mapping_area *area;
+	struct zspage *zspage;
+	struct page *page;
+	unsigned long off;
+	int idx, size;
+
+	BUG_ON(!handle);
+
+	zspage = handle_to_zspage(handle, &idx);
+	size = zspage->class->size;
+	page = obj_location(zspage, idx, &off);
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	if (off + size <= PAGE_SIZE) {
+		area->vm_addr = kmap_atomic(page, KM_USER1);
+		return area->vm_addr + off;
+	}
+
+	if (mm != ZS_MM_WO)
+		obj_copy(zspage, page, off, area->vm_buf, size, false);
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area;
+	struct zspage *zspage;
+	struct page *page;
+	unsigned long off;
+	int idx, size;
+
+	zspage = handle_to_zspage(handle, &idx);
+	size = zspage->class->size;
+	page = obj_location(zspage, idx, &off);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (off + size <= PAGE_SIZE)
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else if (area->vm_mm != ZS_MM_RO)
+		obj_copy(zspage, page, off, area->vm_buf, size, true);
+	put_cpu_var(zs_map_area);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+int zs_get_num_classes(void)
+{
+	return ZS_SIZE_CLASSES;
+}
+EXPORT_SYMBOL_GPL(zs_get_num_classes);
+
+/**
+ * zs_compact - migrate objects to free sparsely used zspages of a class
+ * @pool: pool to compact
+ * @class_idx: size class to compact, 0 <= class_idx < zs_get_num_classes()
+ * @migrate: called for every object moved
+ * @priv: passed to @migrate
+ * @buf: bounce buffer of at least ZS_MAX_ALLOC_SIZE bytes
+ * @pages_freed: incremented by the number of pages given back
+ *
+ * Objects are moved from the least used partial zspage of the class into
+ * the free slots of the most used one for as long as that can free a whole
+ * zspage. The caller must make sure that no object of this class is mapped
+ * or freed concurrently, and must switch its references over to the new
+ * handle in @migrate.
+ *
+ * Returns the number of objects moved.
+ */
+unsigned long zs_compact(struct zs_pool *pool, int class_idx,
+			zs_migrate_fn migrate, void *priv, void *buf,
+			unsigned long *pages_freed)
+{
+	struct size_class *class = &pool->size_class[class_idx];
+	int objs = class->objs_per_zspage;
+	unsigned long moved = 0;
+
+	spin_lock(&pool->lock);
+	for (;;) {
+		struct zspage *zspage, *src = NULL, *dst = NULL;
+		unsigned long free_objs = 0;
+
+		list_for_each_entry(zspage, &class->partial, list) {
+			free_objs += objs - zspage->inuse;
+			if (!src || zspage->inuse < src->inuse)
+				src = zspage;
+			if (!dst || zspage->inuse > dst->inuse)
+				dst = zspage;
+		}
+		/* not worth it unless a whole zspage can be emptied */
+		if (!src || src == dst || free_objs < objs)
+			break;
+
+		while (src->inuse && dst->inuse < objs) {
+			int sidx = find_first_bit(src->freemap, objs);
+			int didx = find_first_zero_bit(dst->freemap, objs);
+			unsigned long off;
+			struct page *page;
+
+			page = obj_location(src, sidx, &off);
+			obj_copy(src, page, off, buf, class->size, false);
+			page = obj_location(dst, didx, &off);
+			obj_copy(dst, page, off, buf, class->size, true);
+
+			__clear_bit(sidx, src->freemap);
+			src->inuse--;
+			__set_bit(didx, dst->freemap);
+			dst->inuse++;
+
+			migrate(priv, buf, obj_handle(dst, didx));
+			moved++;
+		}
+
+		if (dst->inuse == objs)
+			list_move(&dst->list, &class->full);
+		if (!src->inuse) {
+			list_del(&src->list);
+			class->zspages--;
+			pool->total_pages -= class->pages_per_zspage;
+			*pages_freed += class->pages_per_zspage;
+			free_zspage(src);
+		}
+	}
+	spin_unlock(&pool->lock);
+
+	return moved;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	u64 npages;
+
+	spin_lock(&pool->lock);
+	npages = pool->total_pages;
+	spin_unlock(&pool->lock);
+
+	return npages << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+subsys_initcall(zs_init);
@@ -0,0 +1,52 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+struct zs_pool;
+
+/*
+ * How an object is going to be accessed while it is mapped. Objects that
+ * straddle two pages are copied through a per-cpu buffer, and the mode
+ * tells us which way the copy needs to go.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,
+	ZS_MM_RO,
+	ZS_MM_WO,
+};
+
+/*
+ * Called by zs_compact() for every object it moves, with 'obj' pointing at
+ * a copy of the object's contents and 'handle' its new handle.
+ */
+typedef void (*zs_migrate_fn)(void *priv, void *obj, unsigned long handle);
+
+struct zs_pool *zs_create_pool(void);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+int zs_get_num_classes(void);
+unsigned long zs_compact(struct zs_pool *pool, int class_idx,
+			zs_migrate_fn migrate, void *priv, void *buf,
+			unsigned long *pages_freed);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+
+#endif
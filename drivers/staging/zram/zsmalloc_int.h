@@ -0,0 +1,76 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/*
+ * A zspage is a span of up to this many order-0 (possibly highmem) pages
+ * holding objects of a single size class. Objects may straddle the
+ * boundary between two pages of a span.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/* Size classes are separated by this many bytes */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE \
+					/ ZS_MIN_ALLOC_SIZE)
+
+/* End of user params */
+
+/*
+ * A handle is the pfn of the first page of a zspage with the index of the
+ * object within it in the low bits. Zero is never a valid handle.
+ */
+#define OBJ_INDEX_BITS		(ilog2(ZS_MAX_OBJS_PER_ZSPAGE) + 1)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+struct size_class;
+
+/*
+ * Metadata of a zspage. Each of its pages points back here through
+ * page_private() and has its position in the span in page->index.
+ */
+struct zspage {
+	struct list_head list;		/* entry in class's partial/full list */
+	struct size_class *class;
+	unsigned int inuse;		/* objects allocated */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long freemap[0];	/* bit set for allocated objects */
+};
+
+struct size_class {
+	int size;			/* object size */
+	int pages_per_zspage;
+	int objs_per_zspage;
+	struct list_head partial;	/* zspages with free objects */
+	struct list_head full;
+	unsigned long zspages;		/* zspages in this class */
+};
+
+struct zs_pool {
+	spinlock_t lock;
+	u64 total_pages;
+	struct size_class size_class[ZS_SIZE_CLASSES];
+};
+
+#endif
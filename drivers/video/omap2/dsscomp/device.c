@@ -469,6 +469,7 @@ static long comp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		struct dsscomp_display_info dis;
 		struct dsscomp_check_ovl_data chk;
 		struct dsscomp_setup_display_data sdis;
+		struct dsscomp_buffer_reg reg;
 	} u;
 
 	dsscomp_gralloc_init(cdev);
@@ -487,7 +488,7 @@ static long comp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case DSSCIOC_SETUP_DISPC:
 	{
 		r = copy_from_user(&u.dispc, ptr, sizeof(u.dispc)) ? :
-		    dsscomp_gralloc_queue_ioctl(&u.dispc);
+		    dsscomp_gralloc_queue_ioctl(&u.dispc, filp);
 		break;
 	}
 	case DSSCIOC_QUERY_DISPLAY:
@@ -535,6 +536,24 @@ static long comp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		r = copy_to_user(ptr, &platform_info, sizeof(platform_info));
 		break;
 	}
+	case DSSCIOC_REGISTER_BUFFER:
+	{
+		r = copy_from_user(&u.reg, ptr, sizeof(u.reg)) ? :
+		    dsscomp_gralloc_register(&u.reg, filp);
+		/* the caller cannot unregister an index it never received */
+		if (!r && copy_to_user(ptr, &u.reg, sizeof(u.reg))) {
+			dsscomp_gralloc_unregister(u.reg.ix, filp);
+			r = -EFAULT;
+		}
+		break;
+	}
+	case DSSCIOC_UNREGISTER_BUFFER:
+	{
+		u32 ix;
+		r = get_user(ix, (u32 __user *) ptr) ? :
+		    dsscomp_gralloc_unregister(ix, filp);
+		break;
+	}
 	default:
 		r = -EINVAL;
 	}
@@ -547,9 +566,17 @@ static int comp_open(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/* drop buffers registered through this file */
+static int comp_release(struct inode *inode, struct file *filp)
+{
+	dsscomp_gralloc_unregister_all(filp);
+	return 0;
+}
+
 static const struct file_operations comp_fops = {
 	.owner		= THIS_MODULE,
 	.open		= comp_open,
+	.release	= comp_release,
 	.unlocked_ioctl = comp_ioctl,
 };
 
@@ -599,6 +626,10 @@ static int dsscomp_probe(struct platform_device *pdev)
 			cdev->dbgfs, dsscomp_dbg_comps, &dsscomp_debug_fops);
 		debugfs_create_file("gralloc", S_IRUGO,
 			cdev->dbgfs, dsscomp_dbg_gralloc, &dsscomp_debug_fops);
+		debugfs_create_file("timing", S_IRUGO,
+			cdev->dbgfs, dsscomp_dbg_timing, &dsscomp_debug_fops);
+		debugfs_create_file("timing_raw", S_IRUGO,
+			cdev->dbgfs, NULL, &dsscomp_timing_raw_fops);
 #ifdef CONFIG_DSSCOMP_DEBUG_LOG
 		debugfs_create_file("log", S_IRUGO,
 			cdev->dbgfs, dsscomp_dbg_events, &dsscomp_debug_fops);
@@ -25,9 +25,7 @@
 #include <linux/miscdevice.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
-#ifdef CONFIG_DSSCOMP_DEBUG_LOG
 #include <linux/hrtimer.h>
-#endif
 
 #define MAX_OVERLAYS	5
 #define MAX_MANAGERS	3
@@ -114,6 +112,7 @@ struct dsscomp_data {
 	void *extra_cb_data;
 	bool must_apply;	/* whether composition must be applied */
 	bool m2m_only;
+	struct dsscomp_timing_rec timing;	/* phase timestamps */
 #ifdef CONFIG_DEBUG_FS
 	struct list_head dbg_q;
 	u32 dbg_used;
@@ -136,7 +135,8 @@ int dsscomp_queue_init(struct dsscomp_dev *cdev);
 void dsscomp_queue_exit(void);
 void dsscomp_gralloc_init(struct dsscomp_dev *cdev);
 void dsscomp_gralloc_exit(void);
-int dsscomp_gralloc_queue_ioctl(struct dsscomp_setup_dispc_data *d);
+int dsscomp_gralloc_queue_ioctl(struct dsscomp_setup_dispc_data *d,
+								void *owner);
 int dsscomp_wait(struct dsscomp_sync_obj *sync, enum dsscomp_wait_phase phase,
 								int timeout);
 int dsscomp_state_notifier(struct notifier_block *nb,
@@ -172,6 +172,18 @@ const char *dsscomp_get_color_name(enum omap_color_mode m);
 void dsscomp_dbg_comps(struct seq_file *s);
 void dsscomp_dbg_gralloc(struct seq_file *s);
 
+/*
+ * Composition timing
+ */
+static inline u64 dsscomp_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+void dsscomp_timing_record(struct dsscomp_data *comp);
+void dsscomp_dbg_timing(struct seq_file *s);
+extern const struct file_operations dsscomp_timing_raw_fops;
+
 /*
   * External function prototypes
   */
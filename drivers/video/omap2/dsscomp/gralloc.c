@@ -22,6 +22,7 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/vmalloc.h>
+#include <linux/pagemap.h>
 #include <mach/tiler.h>
 #include <video/dsscomp.h>
 #include <plat/android-display.h>
@@ -35,10 +36,12 @@ static bool blanked;
 static u32 dev_display_mask;
 
 #include <linux/ion.h>
+#include <linux/omap_ion.h>
 #include <plat/dma.h>
 
 extern struct ion_device *omap_ion_device;
 struct workqueue_struct *clone_wq;
+static struct ion_client *ion_client;	/* for registered ion buffers */
 
 struct dsscomp_dma_config {
 	u32 src_buf_addr;
@@ -80,8 +83,38 @@ struct dsscomp_gralloc_t {
 	atomic_t refs;
 	bool early_callback;
 	bool programmed;
+	u32 regbufs;			/* registered buffers in use */
 };
 
+/*
+ * registered buffers
+ *
+ * Buffers that are queued over and over (e.g. SurfaceFlinger's swap chain)
+ * are resolved to a DSS address once at registration.  Non-TILER memory is
+ * pinned into its own TILER 1D block for the lifetime of the registration,
+ * so queuing such a buffer needs no slot or pinning.  TILER blocks and ion
+ * buffers are referenced so that they cannot be freed while registered.
+ * Compositions hold a reference on the buffers they use; an unregistered
+ * buffer is released once the last composition using it is released.
+ */
+#define NUM_REGBUFS	32
+
+static struct dsscomp_regbuf {
+	void *owner;			/* NULL if not used */
+	u32 ba;
+	u32 uv;
+	u32 refs;			/* compositions using this buffer */
+	bool dying;			/* unregistered while in use */
+	tiler_blk_handle blk;		/* 1D block for non-TILER memory */
+	struct tiler_pa_info *pa;	/* pages pinned into blk */
+	tiler_blk_handle ba_blk;	/* referenced TILER blocks */
+	tiler_blk_handle uv_blk;
+	struct ion_handle *handle;	/* imported ion buffer */
+} regbufs[NUM_REGBUFS];
+
+/* direct/clone scanout statistics */
+static u32 clone_direct, clone_blit;
+
 /* local cache */
 static struct kmem_cache *gsync_cachep;
 
@@ -104,6 +137,177 @@ static void unpin_tiler_blocks(struct list_head *slots)
 	list_splice_init(slots, &free_slots);
 }
 
+/* must be called with mtx held */
+static void free_regbuf(struct dsscomp_regbuf *rb)
+{
+	u32 i;
+
+	if (!IS_ERR_OR_NULL(rb->blk)) {
+		tiler_unpin_block(rb->blk);
+		tiler_free_block_area(rb->blk);
+	}
+	if (rb->pa && rb->pa->memtype == TILER_MEM_GOT_PAGES)
+		for (i = 0; i < rb->pa->num_pg; i++)
+			page_cache_release(phys_to_page(rb->pa->mem[i]));
+	tiler_pa_free(rb->pa);
+	if (rb->ba_blk)
+		tiler_put_block(rb->ba_blk);
+	if (rb->uv_blk)
+		tiler_put_block(rb->uv_blk);
+	if (!IS_ERR_OR_NULL(rb->handle))
+		ion_free(ion_client, rb->handle);
+	memset(rb, 0, sizeof(*rb));
+}
+
+/* must be called with mtx held */
+static void put_regbufs(u32 mask)
+{
+	struct dsscomp_regbuf *rb;
+
+	while (mask) {
+		rb = regbufs + __ffs(mask);
+		mask &= mask - 1;
+		if (!--rb->refs && rb->dying)
+			free_regbuf(rb);
+	}
+}
+
+int dsscomp_gralloc_register(struct dsscomp_buffer_reg *reg, void *owner)
+{
+	struct dsscomp_regbuf rb = { .owner = owner };
+	u32 addr = (u32) reg->address, npages, phys;
+	size_t len;
+	int r, ix;
+
+	if (!owner || !reg->size)
+		return -EINVAL;
+
+	if (reg->addressing == OMAP_DSS_BUFADDR_ION) {
+		ion_phys_addr_t pa;
+
+		if (IS_ERR_OR_NULL(ion_client))
+			return -ENODEV;
+
+		/* the import holds the buffer until it is unregistered */
+		rb.handle = ion_import_fd(ion_client, (int) reg->address);
+		if (IS_ERR_OR_NULL(rb.handle))
+			return rb.handle ? PTR_ERR(rb.handle) : -EINVAL;
+
+		r = ion_phys(ion_client, rb.handle, &pa, &len);
+		if (r)
+			goto fail;
+		if (reg->size > len) {
+			r = -EINVAL;
+			goto fail;
+		}
+		rb.ba = pa;
+		rb.uv = reg->uv_offset ? rb.ba + reg->uv_offset : rb.ba;
+	} else if (reg->addressing == OMAP_DSS_BUFADDR_DIRECT) {
+		rb.ba = tiler_virt2phys(addr);
+		if (!rb.ba)
+			return -EFAULT;
+
+		if (is_tiler_addr(rb.ba)) {
+			/* keep the TILER blocks from being freed under us */
+			rb.ba_blk = tiler_get_block(rb.ba);
+			if (!rb.ba_blk)
+				return -EFAULT;
+
+			if (reg->uv_offset) {
+				rb.uv = tiler_virt2phys(addr + reg->uv_offset);
+				rb.uv_blk = rb.uv ? tiler_get_block(rb.uv) :
+									NULL;
+				if (!rb.uv_blk) {
+					r = -EFAULT;
+					goto fail;
+				}
+			}
+			goto add;
+		}
+
+		/* pin non-TILER memory into a 1D block of its own */
+		npages = PAGE_ALIGN(reg->size + (addr & ~PAGE_MASK)) >>
+								PAGE_SHIFT;
+		rb.pa = user_block_to_pa(addr & PAGE_MASK, npages);
+		if (IS_ERR_OR_NULL(rb.pa)) {
+			r = rb.pa ? PTR_ERR(rb.pa) : -ENOMEM;
+			return r;
+		}
+
+		rb.blk = tiler_alloc_block_area(TILFMT_PAGE,
+					npages << PAGE_SHIFT, 1, &phys, NULL);
+		if (IS_ERR_OR_NULL(rb.blk)) {
+			r = -ENOMEM;
+			goto fail;
+		}
+
+		r = tiler_pin_block(rb.blk, rb.pa->mem, npages);
+		if (r)
+			goto fail;
+
+		rb.ba = phys + (addr & ~PAGE_MASK);
+		rb.uv = reg->uv_offset ? rb.ba + reg->uv_offset : 0;
+	} else {
+		return -EINVAL;
+	}
+
+add:
+	mutex_lock(&mtx);
+	for (ix = 0; ix < NUM_REGBUFS; ix++)
+		if (!regbufs[ix].owner)
+			break;
+	if (ix < NUM_REGBUFS)
+		regbufs[ix] = rb;
+	mutex_unlock(&mtx);
+
+	if (ix == NUM_REGBUFS) {
+		r = -ENOSPC;
+		goto fail;
+	}
+
+	reg->ix = ix;
+	return 0;
+
+fail:
+	mutex_lock(&mtx);
+	free_regbuf(&rb);
+	mutex_unlock(&mtx);
+	return r;
+}
+EXPORT_SYMBOL(dsscomp_gralloc_register);
+
+int dsscomp_gralloc_unregister(u32 ix, void *owner)
+{
+	struct dsscomp_regbuf *rb;
+	int r = 0;
+
+	if (ix >= NUM_REGBUFS)
+		return -EINVAL;
+	rb = regbufs + ix;
+
+	mutex_lock(&mtx);
+	if (!owner || rb->owner != owner || rb->dying)
+		r = -EINVAL;
+	else if (rb->refs)
+		rb->dying = true;
+	else
+		free_regbuf(rb);
+	mutex_unlock(&mtx);
+
+	return r;
+}
+EXPORT_SYMBOL(dsscomp_gralloc_unregister);
+
+void dsscomp_gralloc_unregister_all(void *owner)
+{
+	u32 ix;
+
+	for (ix = 0; ix < NUM_REGBUFS; ix++)
+		if (regbufs[ix].owner == owner && !regbufs[ix].dying)
+			dsscomp_gralloc_unregister(ix, owner);
+}
+EXPORT_SYMBOL(dsscomp_gralloc_unregister_all);
+
 static void dsscomp_gralloc_cb(void *data, int status)
 {
 	struct dsscomp_gralloc_t *gsync = data, *gsync_;
@@ -115,8 +319,10 @@ static void dsscomp_gralloc_cb(void *data, int status)
 		gsync->programmed = true;
 
 	if (status & DSS_COMPLETION_RELEASED) {
-		if (atomic_dec_and_test(&gsync->refs))
+		if (atomic_dec_and_test(&gsync->refs)) {
 			unpin_tiler_blocks(&gsync->slots);
+			put_regbufs(gsync->regbufs);
+		}
 
 		log_event(0, 0, gsync, "--refs=%d on %s",
 				atomic_read(&gsync->refs),
@@ -157,7 +363,8 @@ static void dsscomp_gralloc_cb(void *data, int status)
 /* This is just test code for now that does the setup + apply.
    It still uses userspace virtual addresses, but maps non
    TILER buffers into 1D */
-int dsscomp_gralloc_queue_ioctl(struct dsscomp_setup_dispc_data *d)
+int dsscomp_gralloc_queue_ioctl(struct dsscomp_setup_dispc_data *d,
+								void *owner)
 {
 	struct tiler_pa_info *pas[MAX_OVERLAYS];
 	s32 ret;
@@ -173,6 +380,10 @@ int dsscomp_gralloc_queue_ioctl(struct dsscomp_setup_dispc_data *d)
 
 		pas[i] = NULL;
 
+		/* registered buffers are already resolved */
+		if (oi->addressing == OMAP_DSS_BUFADDR_REGISTERED)
+			continue;
+
 		/* assume virtual NV12 for now */
 		if (oi->cfg.color_mode == OMAP_DSS_COLOR_NV12)
 			oi->uv = tiler_virt2phys(addr +
@@ -187,7 +398,7 @@ int dsscomp_gralloc_queue_ioctl(struct dsscomp_setup_dispc_data *d)
 				PAGE_ALIGN(oi->cfg.height * oi->cfg.stride +
 					(addr & ~PAGE_MASK)) >> PAGE_SHIFT);
 	}
-	ret = dsscomp_gralloc_queue(d, pas, false, NULL, NULL);
+	ret = dsscomp_gralloc_queue(d, pas, false, NULL, NULL, owner);
 	for (i = 0; i < d->num_ovls; i++)
 		tiler_pa_free(pas[i]);
 	return ret;
@@ -327,10 +538,18 @@ static bool dsscomp_is_any_device_active(void)
 	return false;
 }
 
+/*
+ * dsscomp_gralloc_queue - queue a composition for display
+ *
+ * OMAP_DSS_BUFADDR_REGISTERED overlays are only accepted if they were
+ * registered with dsscomp_gralloc_register() by the same 'owner'; callers
+ * that never register buffers may pass NULL.
+ */
 int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 			struct tiler_pa_info **pas,
 			bool early_callback,
-			void (*cb_fn)(void *, int), void *cb_arg)
+			void (*cb_fn)(void *, int), void *cb_arg,
+			void *owner)
 {
 	u32 i;
 	int r = 0;
@@ -355,6 +574,7 @@ int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 	size_t tiler2d_size;
 	struct tiler_view_t view;
 	u32 wb_mgr_ix;
+	u64 queue_ns = dsscomp_now();
 
 	/* reserve tiler areas if not already done so */
 	dsscomp_gralloc_init(cdev);
@@ -504,6 +724,8 @@ int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 		}
 
 		comp[ch]->must_apply = true;
+		comp[ch]->frm.sync_id = d->sync_id;
+		comp[ch]->timing.queue_ns = queue_ns;
 		r = dsscomp_setup(comp[ch], d->mode, win);
 		if (r)
 			dev_err(DEV(cdev), "failed to setup comp (%d)\n", r);
@@ -581,7 +803,54 @@ int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 			oi->ba += fbi->fix.smem_start;
 			oi->uv += fbi_uv->fix.smem_start;
 			goto skip_map1d;
+		} else if (oi->addressing == OMAP_DSS_BUFADDR_REGISTERED) {
+			u32 j = oi->ba;
+			struct dsscomp_regbuf *rb;
+
+			/* only the registering file may queue its buffers */
+			mutex_lock(&mtx);
+			if (j >= NUM_REGBUFS || !owner ||
+			    regbufs[j].owner != owner || regbufs[j].dying) {
+				mutex_unlock(&mtx);
+				WARN(1, "Invalid registered buffer (%u)", j);
+				goto skip_buffer;
+			}
+
+			/* hold the buffer until the composition is released */
+			rb = regbufs + j;
+			if (!(gsync->regbufs & (1U << j))) {
+				gsync->regbufs |= 1U << j;
+				rb->refs++;
+			}
+			oi->ba = rb->ba;
+			oi->uv = rb->uv;
+			mutex_unlock(&mtx);
+			goto skip_map1d;
 		} else if (oi->addressing == OMAP_DSS_BUFADDR_ION) {
+			struct dss2_ovl_info *src = d->ovls;
+
+			/*
+			 * The clone destination is only needed if the
+			 * source cannot be scanned out as is.  An unrotated
+			 * TILER source in the same format can be shown on
+			 * the clone display directly, without a DMA blit.
+			 * The overlay then scans out the source buffer, so
+			 * it takes on the source's buffer geometry.
+			 */
+			if (i && src->cfg.enabled && is_tiler_addr(src->ba) &&
+			    src->cfg.color_mode == oi->cfg.color_mode &&
+			    !src->cfg.rotation && !src->cfg.mirror &&
+			    !oi->cfg.rotation && !oi->cfg.mirror) {
+				oi->ba = src->ba;
+				oi->uv = src->uv;
+				oi->cfg.stride = src->cfg.stride;
+				oi->cfg.width = src->cfg.width;
+				oi->cfg.height = src->cfg.height;
+				oi->cfg.crop = src->cfg.crop;
+				clone_direct++;
+				goto skip_map1d;
+			}
+
 			ion_phys_frm_dev(omap_ion_device,
 			(struct ion_handle *)oi->ba, &phys, &tiler2d_size);
 
@@ -590,6 +859,7 @@ int dsscomp_gralloc_queue(struct dsscomp_setup_dispc_data *d,
 
 			oi->ba = phys;
 			oi->uv = oi->ba;
+			clone_blit++;
 			goto skip_map1d;
 		}
 
@@ -728,6 +998,7 @@ skip_comp:
 }
 EXPORT_SYMBOL(dsscomp_gralloc_queue);
 
+
 #ifdef CONFIG_EARLYSUSPEND
 static int blank_complete;
 static DECLARE_WAIT_QUEUE_HEAD(early_suspend_wq);
@@ -749,7 +1020,8 @@ static void dsscomp_early_suspend(struct early_suspend *h)
 
 	/* use gralloc queue as we need to blank all screens */
 	blank_complete = false;
-	dsscomp_gralloc_queue(&d, NULL, false, dsscomp_early_suspend_cb, NULL);
+	dsscomp_gralloc_queue(&d, NULL, false, dsscomp_early_suspend_cb, NULL,
+									NULL);
 
 	/* wait until composition is displayed */
 	err = wait_event_timeout(early_suspend_wq, blank_complete,
@@ -782,6 +1054,21 @@ void dsscomp_dbg_gralloc(struct seq_file *s)
 	int i;
 
 	mutex_lock(&dbg_mtx);
+	mutex_lock(&mtx);
+	seq_printf(s, "REGISTERED BUFFERS\n\n");
+	for (i = 0; i < NUM_REGBUFS; i++) {
+		struct dsscomp_regbuf *rb = regbufs + i;
+
+		if (!rb->owner)
+			continue;
+		seq_printf(s, "  %2d: ba=%08x uv=%08x refs=%u%s%s\n", i,
+			   rb->ba, rb->uv, rb->refs, rb->blk ? " 1d" : "",
+			   rb->dying ? " dying" : "");
+	}
+	seq_printf(s, "\nclone: %u direct, %u blit\n\n",
+		   clone_direct, clone_blit);
+	mutex_unlock(&mtx);
+
 	seq_printf(s, "ACTIVE GRALLOC FLIPS\n\n");
 	list_for_each_entry(g, &flip_queue, q) {
 		char *sep = "";
@@ -891,6 +1178,17 @@ void dsscomp_gralloc_init(struct dsscomp_dev *cdev_)
 			pr_err("DSSCOMP: %s: can't create cache\n", __func__);
 	}
 
+	if (!ion_client) {
+		ion_client = ion_client_create(omap_ion_device,
+					1 << ION_HEAP_TYPE_CARVEOUT |
+					1 << OMAP_ION_HEAP_TYPE_TILER |
+					1 << ION_HEAP_TYPE_SYSTEM,
+					"dsscomp");
+		if (IS_ERR_OR_NULL(ion_client))
+			pr_err("DSSCOMP: %s: can't create ion client\n",
+								__func__);
+	}
+
 	if (!clone_wq) {
 		clone_wq = create_singlethread_workqueue("dsscomp_clone_wq");
 		if (!clone_wq)
@@ -905,6 +1203,7 @@ void dsscomp_gralloc_init(struct dsscomp_dev *cdev_)
 void dsscomp_gralloc_exit(void)
 {
 	struct tiler1d_slot *slot;
+	int i;
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 	unregister_early_suspend(&early_suspend_info);
@@ -915,4 +1214,14 @@ void dsscomp_gralloc_exit(void)
 		tiler_free_block_area(slot->slot);
 	}
 	INIT_LIST_HEAD(&free_slots);
+
+	mutex_lock(&mtx);
+	for (i = 0; i < NUM_REGBUFS; i++)
+		if (regbufs[i].owner)
+			free_regbuf(regbufs + i);
+	mutex_unlock(&mtx);
+
+	if (!IS_ERR_OR_NULL(ion_client))
+		ion_client_destroy(ion_client);
+	ion_client = NULL;
 }
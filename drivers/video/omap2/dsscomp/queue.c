@@ -32,6 +32,8 @@
 #include <linux/debugfs.h>
 
 #include "dsscomp.h"
+
+#include <trace/events/dsscomp.h>
 /* queue state */
 
 static DEFINE_MUTEX(mtx);
@@ -224,6 +226,7 @@ dsscomp_t dsscomp_new(struct omap_overlay_manager *mgr)
 	comp->frm.sync_id = 0;
 	comp->frm.mgr.ix = display_ix;
 	comp->state = DSSCOMP_STATE_ACTIVE;
+	comp->timing.queue_ns = dsscomp_now();
 
 	DO_IF_DEBUG_FS({
 		__log_state(comp, dsscomp_new, 0);
@@ -411,6 +414,7 @@ void dsscomp_drop(dsscomp_t comp)
 
 	DO_IF_DEBUG_FS(list_del(&comp->dbg_q));
 
+	dsscomp_timing_record(comp);
 	kfree(comp);
 }
 EXPORT_SYMBOL(dsscomp_drop);
@@ -461,10 +465,38 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 	mutex_unlock(&mtx);
 }
 
+/* timestamp completion events as they arrive, i.e. in interrupt context */
+static void dsscomp_timing_stamp(dsscomp_t comp, int status)
+{
+	struct dsscomp_timing_rec *t = &comp->timing;
+
+	if (status == DSS_COMPLETION_PROGRAMMED) {
+		if (!t->programmed_ns) {
+			t->programmed_ns = dsscomp_now();
+			trace_dsscomp_programmed(comp, comp->ix,
+							comp->frm.sync_id);
+		}
+	} else if (status == DSS_COMPLETION_DISPLAYED) {
+		if (!t->displayed_ns) {
+			t->displayed_ns = dsscomp_now();
+			trace_dsscomp_displayed(comp, comp->ix,
+							comp->frm.sync_id);
+		}
+	} else if (status & DSS_COMPLETION_RELEASED) {
+		if (!t->release_ns) {
+			t->release_ns = dsscomp_now();
+			trace_dsscomp_released(comp, comp->ix,
+							comp->frm.sync_id);
+		}
+	}
+}
+
 u32 dsscomp_mgr_callback(void *data, int id, int status)
 {
 	struct dsscomp_data *comp = data;
 
+	dsscomp_timing_stamp(comp, status);
+
 	if (status == DSS_COMPLETION_PROGRAMMED ||
 	    (status == DSS_COMPLETION_DISPLAYED &&
 	     comp->state != DSSCOMP_STATE_DISPLAYED) ||
@@ -496,6 +528,21 @@ static inline bool dssdev_manually_updated(struct omap_dss_device *dev)
 		dev->driver->get_update_mode(dev) != OMAP_DSS_UPDATE_AUTO;
 }
 
+/* frame period of a video-mode display, 0 if it has none */
+static u32 dssdev_frame_ns(struct omap_dss_device *dev)
+{
+	struct omap_video_timings *t = &dev->panel.timings;
+	u64 clocks;
+
+	if (!t->pixel_clock || dssdev_manually_updated(dev))
+		return 0;
+
+	clocks = (u64) (t->x_res + t->hsw + t->hfp + t->hbp) *
+			(t->y_res + t->vsw + t->vfp + t->vbp);
+	/* pixel_clock is in kHz */
+	return (u32) div_u64(clocks * 1000000, t->pixel_clock);
+}
+
 /* apply composition */
 /* at this point the composition is not on any queue */
 int dsscomp_apply(dsscomp_t comp)
@@ -523,6 +570,9 @@ int dsscomp_apply(dsscomp_t comp)
 
 	BUG_ON(comp->state != DSSCOMP_STATE_APPLYING);
 
+	comp->timing.apply_ns = dsscomp_now();
+	trace_dsscomp_apply(comp, comp->ix, comp->frm.sync_id);
+
 	/* check if the display is valid and used */
 	r = -ENODEV;
 	d = &comp->frm;
@@ -539,6 +589,7 @@ int dsscomp_apply(dsscomp_t comp)
 		goto done;
 
 	dump_comp_info(cdev, d, "apply");
+	comp->timing.frame_ns = dssdev_frame_ns(dssdev);
 
 	wb = omap_dss_get_wb(0);
 	wb->get_wb_info(wb, &wb_info);
@@ -756,10 +807,14 @@ skip_ovl_set:
 					"omap_dss_wb_apply failed %d", r);
 		}
 		r = mgr->apply(mgr);
-		if (r)
+		if (r) {
 			dev_err(DEV(cdev),
 					"failed while applying mgr[%d] r:%d\n",
 								mgr->id, r);
+		} else {
+			comp->timing.go_ns = dsscomp_now();
+			trace_dsscomp_go(comp, comp->ix, comp->frm.sync_id);
+		}
 		/* keep error if set_mgr_info failed */
 		if (!r && !cb_programmed)
 			r = -EINVAL;
@@ -844,8 +899,10 @@ static void dsscomp_do_apply(struct work_struct *work)
 {
 	struct dsscomp_apply_work *wk = container_of(work, typeof(*wk), work);
 	/* complete compositions that failed to apply */
-	if (dsscomp_apply(wk->comp))
+	if (dsscomp_apply(wk->comp)) {
+		wk->comp->timing.flags |= DSSCOMP_TIMING_FAILED;
 		dsscomp_mgr_callback(wk->comp, -1, DSS_COMPLETION_ECLIPSED_SET);
+	}
 	kmem_cache_free(dsscomp_app_wk_cachep, wk);
 }
 
@@ -867,6 +924,7 @@ int dsscomp_delayed_apply(dsscomp_t comp)
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	comp->state = DSSCOMP_STATE_APPLYING;
 	log_state(comp, dsscomp_delayed_apply, 0);
+	trace_dsscomp_queue(comp, comp->ix, comp->frm.sync_id);
 
 	if (debug & DEBUG_PHASES)
 		dev_info(DEV(cdev), "[%p] applying\n", comp);
@@ -0,0 +1,212 @@
+/*
+ * linux/drivers/video/omap2/dsscomp/timing.c
+ *
+ * DSS Composition frame timing telemetry
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+
+#include <video/omapdss.h>
+#include <video/dsscomp.h>
+#include <plat/dsscomp.h>
+
+#include "dsscomp.h"
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/dsscomp.h>
+
+/*
+ * Every applied composition leaves one dsscomp_timing_rec in the ring of
+ * the manager it was applied on when it is released.  A ring holds the
+ * last few seconds worth of frames, which is what is needed to explain a
+ * jank report.  Lifetime totals are kept alongside.
+ */
+#define TIMING_RING	256
+
+static struct {
+	struct dsscomp_timing_rec rec[TIMING_RING];
+	u32 head;		/* next slot to write */
+	u32 count;		/* valid records, up to TIMING_RING */
+	u32 frames;		/* lifetime totals */
+	u32 missed;
+	u32 failed;
+} timing[MAX_MANAGERS];
+
+static DEFINE_SPINLOCK(timing_lock);
+
+void dsscomp_timing_record(struct dsscomp_data *comp)
+{
+	struct dsscomp_timing_rec *r = &comp->timing;
+	unsigned long flags;
+	u32 ix = comp->ix;
+
+	/* only compositions that were queued for apply are of interest */
+	if (!r->apply_ns || ix >= MAX_MANAGERS)
+		return;
+
+	r->sync_id = comp->frm.sync_id;
+	r->mgr_ix = ix;
+	if (r->frame_ns && r->go_ns &&
+	    (!r->programmed_ns || r->programmed_ns - r->go_ns > r->frame_ns))
+		r->flags |= DSSCOMP_TIMING_MISSED;
+
+	trace_dsscomp_frame(r);
+
+	spin_lock_irqsave(&timing_lock, flags);
+	timing[ix].rec[timing[ix].head] = *r;
+	timing[ix].head = (timing[ix].head + 1) % TIMING_RING;
+	if (timing[ix].count < TIMING_RING)
+		timing[ix].count++;
+	timing[ix].frames++;
+	if (r->flags & DSSCOMP_TIMING_MISSED)
+		timing[ix].missed++;
+	if (r->flags & DSSCOMP_TIMING_FAILED)
+		timing[ix].failed++;
+	spin_unlock_irqrestore(&timing_lock, flags);
+}
+
+/* copy the records of a manager, oldest first; returns the number copied */
+static u32 timing_snapshot(u32 ix, struct dsscomp_timing_rec *out)
+{
+	unsigned long flags;
+	u32 i, start, n;
+
+	spin_lock_irqsave(&timing_lock, flags);
+	n = timing[ix].count;
+	start = (timing[ix].head + TIMING_RING - n) % TIMING_RING;
+	for (i = 0; i < n; i++)
+		out[i] = timing[ix].rec[(start + i) % TIMING_RING];
+	spin_unlock_irqrestore(&timing_lock, flags);
+
+	return n;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void seq_print_percentiles(struct seq_file *s, const char *what,
+				  u32 *v, u32 n)
+{
+	if (!n) {
+		seq_printf(s, "  %-18s n/a\n", what);
+		return;
+	}
+	sort(v, n, sizeof(*v), cmp_u32, NULL);
+	seq_printf(s, "  %-18s p50=%uus p90=%uus p99=%uus max=%uus\n", what,
+		   v[n / 2], v[n * 90 / 100], v[n * 99 / 100], v[n - 1]);
+}
+
+/* summary of missed frames and latency percentiles over the ring */
+void dsscomp_dbg_timing(struct seq_file *s)
+{
+	struct dsscomp_timing_rec *recs;
+	u32 *queue_us, *scanout_us;
+	u32 ix, i, n, nq, ns, missed;
+
+	recs = vmalloc(sizeof(*recs) * TIMING_RING);
+	queue_us = kmalloc(sizeof(u32) * TIMING_RING * 2, GFP_KERNEL);
+	if (!recs || !queue_us)
+		goto out;
+	scanout_us = queue_us + TIMING_RING;
+
+	for (ix = 0; ix < MAX_MANAGERS; ix++) {
+		n = timing_snapshot(ix, recs);
+		if (!n)
+			continue;
+
+		nq = ns = missed = 0;
+		for (i = 0; i < n; i++) {
+			struct dsscomp_timing_rec *r = recs + i;
+
+			if (r->flags & DSSCOMP_TIMING_MISSED)
+				missed++;
+			if (r->queue_ns && r->apply_ns >= r->queue_ns)
+				queue_us[nq++] = (u32) div_u64(r->apply_ns -
+							       r->queue_ns, 1000);
+			if (r->displayed_ns && r->displayed_ns >= r->apply_ns)
+				scanout_us[ns++] = (u32) div_u64(
+					r->displayed_ns - r->apply_ns, 1000);
+		}
+
+		seq_printf(s, "mgr%u: %u frames, %u missed, %u failed "
+			   "(last %u: %u missed, frame %uus)\n", ix,
+			   timing[ix].frames, timing[ix].missed,
+			   timing[ix].failed, n, missed,
+			   recs[n - 1].frame_ns / 1000);
+		seq_print_percentiles(s, "queue-to-apply", queue_us, nq);
+		seq_print_percentiles(s, "apply-to-scanout", scanout_us, ns);
+	}
+out:
+	kfree(queue_us);
+	vfree(recs);
+}
+
+/*
+ * timing_raw streams the rings as struct dsscomp_timing_rec, manager by
+ * manager and oldest first.  The records are snapshot on open so that a
+ * reader sees a consistent stream.
+ */
+struct timing_raw {
+	size_t len;
+	struct dsscomp_timing_rec rec[0];
+};
+
+static int timing_raw_open(struct inode *inode, struct file *file)
+{
+	struct timing_raw *raw;
+	u32 ix, n = 0;
+
+	raw = vmalloc(sizeof(*raw) +
+		      sizeof(raw->rec[0]) * TIMING_RING * MAX_MANAGERS);
+	if (!raw)
+		return -ENOMEM;
+
+	for (ix = 0; ix < MAX_MANAGERS; ix++)
+		n += timing_snapshot(ix, raw->rec + n);
+	raw->len = n * sizeof(raw->rec[0]);
+	file->private_data = raw;
+
+	return 0;
+}
+
+static ssize_t timing_raw_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct timing_raw *raw = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, raw->rec, raw->len);
+}
+
+static int timing_raw_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+const struct file_operations dsscomp_timing_raw_fops = {
+	.open		= timing_raw_open,
+	.read		= timing_raw_read,
+	.llseek		= default_llseek,
+	.release	= timing_raw_release,
+};
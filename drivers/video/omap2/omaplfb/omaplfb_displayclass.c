@@ -887,7 +887,8 @@ static IMG_BOOL ProcessFlipV1(IMG_HANDLE hCmdCookie,
 			comp.ovls[0].ba = (u32) psBuffer->sSysAddr.uiAddr;
 			dsscomp_gralloc_queue(&comp, pas, true,
 					      dsscomp_proxy_cmdcomplete,
-					      (void *) psBuffer->hCmdComplete);
+					      (void *) psBuffer->hCmdComplete,
+					      NULL);
 		} else
 #endif
 		{
@@ -1108,7 +1109,7 @@ static IMG_BOOL ProcessFlipV2(IMG_HANDLE hCmdCookie,
 	else
 		dsscomp_gralloc_queue(psDssData, apsTilerPAs, false,
 						dsscomp_proxy_cmdcomplete,
-						(void *)hCmdCookie);
+						(void *)hCmdCookie, NULL);
 
 	for(i = 0; i < ARRAY_SIZE(asMemInfo); i++)
 	{
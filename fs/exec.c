@@ -968,6 +968,7 @@ static int de_thread(struct task_struct *tsk)
 		leader->exit_state = EXIT_DEAD;
 		write_unlock_irq(&tasklist_lock);
 
+		oom_adj_leader_changed(leader);
 		release_task(leader);
 	}
 
@@ -1071,6 +1072,7 @@ void set_task_comm(struct task_struct *tsk, char *buf)
 
 int flush_old_exec(struct linux_binprm * bprm)
 {
+	bool kthread;
 	int retval;
 
 	/*
@@ -1094,7 +1096,11 @@ int flush_old_exec(struct linux_binprm * bprm)
 	bprm->mm = NULL;		/* We're using it now */
 
 	set_fs(USER_DS);
+	kthread = current->flags & PF_KTHREAD;
 	current->flags &= ~(PF_RANDOMIZE | PF_KTHREAD);
+	/* a kernel thread that became a process, e.g. a usermode helper */
+	if (kthread)
+		oom_adj_changed(current);
 	flush_thread();
 	current->personality &= ~bprm->per_clear;
 
@@ -31,6 +31,9 @@ void gc_unmap(struct gcimap *gcimap, bool fromuser);
 /* Arm a callback. */
 void gc_callback(struct gcicallbackarm *gcicallbackarm, bool fromuser);
 
+/* Check whether all submitted work has been executed. */
+bool gc_idle(void);
+
 /* Process cleanup. */
 void gc_release(void);
 
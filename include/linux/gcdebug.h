@@ -27,4 +27,17 @@ void gc_debug_dump_status(const char *function, int line);
 
 void gc_debug_blt(int srccount, int dstWidth, int dstHeight);
 
+/* Reasons for executing a command buffer. */
+enum gc_submit_reason {
+	GC_SUBMIT_IMMEDIATE,	/* coalescing disabled */
+	GC_SUBMIT_SYNC,		/* synchronous operation */
+	GC_SUBMIT_DEADLINE,	/* flush deadline expired */
+	GC_SUBMIT_FLUSH,	/* other client, MMU flush or idle */
+	GC_SUBMIT_FULL,		/* out of command buffer space */
+	GC_SUBMIT_REASONS
+};
+
+void gc_debug_submit(enum gc_submit_reason reason, unsigned int commits,
+		     unsigned int size, bool interrupt);
+
 #endif
@@ -10,6 +10,7 @@
 #ifndef LINUX_MMC_CARD_H
 #define LINUX_MMC_CARD_H
 
+#include <linux/ktime.h>
 #include <linux/mmc/core.h>
 #include <linux/mod_devicetable.h>
 
@@ -64,6 +65,17 @@ struct mmc_ext_csd {
 	unsigned long long	enhanced_area_offset;	/* Units: Byte */
 	unsigned int		enhanced_area_size;	/* Units: KB */
 	unsigned int		boot_size;		/* in bytes */
+	unsigned int		cache_size;		/* Units: KB */
+	bool			cache_ctrl;		/* cache is on */
+	u8			max_packed_writes;	/* 500 */
+	bool			packed_event_en;	/* packed failures reported */
+	bool			bkops;		/* background operations support */
+	bool			bkops_en;	/* host may start them (OTP) */
+	u8			raw_bkops_status;	/* 246 */
+	bool			hpi;		/* high priority interrupt support */
+	bool			hpi_en;		/* HPI enabled */
+	unsigned int		hpi_cmd;	/* CMD12 or CMD13 */
+	unsigned int		out_of_int_time;	/* Units: ms */
 	u8			raw_partition_support;	/* 160 */
 	u8			raw_erased_mem_count;	/* 181 */
 	u8			raw_ext_csd_structure;	/* 194 */
@@ -82,6 +94,28 @@ struct mmc_ext_csd {
 #define MMC_DISCARD_FEATURE	BIT(0)
 };
 
+/*
+ * Request latency histograms, per type of request. Bucket 0 counts
+ * requests under 64us, and each following bucket doubles that bound;
+ * the last one takes everything above.
+ */
+enum mmc_lat_type {
+	MMC_LAT_READ,
+	MMC_LAT_WRITE,
+	MMC_LAT_DISCARD,
+	MMC_LAT_FLUSH,
+	MMC_LAT_HPI,		/* interrupting background operations */
+	MMC_LAT_TYPES,
+};
+
+#define MMC_LAT_BUCKETS		16
+
+struct mmc_lat_hist {
+	unsigned long		count[MMC_LAT_TYPES][MMC_LAT_BUCKETS];
+	u64			total_us[MMC_LAT_TYPES];
+	u32			max_us[MMC_LAT_TYPES];
+};
+
 struct sd_scr {
 	unsigned char		sda_vsn;
 	unsigned char		sda_spec3;
@@ -181,6 +215,8 @@ struct mmc_card {
 #define MMC_STATE_ULTRAHIGHSPEED (1<<5)		/* card is in ultra high speed mode */
 #define MMC_CARD_SDXC		(1<<6)		/* card is SDXC */
 #define MMC_STATE_INSERTED	(1<<7)		/* card present in the slot */
+#define MMC_STATE_NEED_BKOPS	(1<<8)		/* card raised urgent BKOPS */
+#define MMC_STATE_DOING_BKOPS	(1<<9)		/* card is doing BKOPS */
 	unsigned int		quirks; 	/* card quirks */
 #define MMC_QUIRK_LENIENT_FN0	(1<<0)		/* allow SDIO FN0 writes outside of the VS CCCR range */
 #define MMC_QUIRK_BLKSZ_FOR_BYTE_MODE (1<<1)	/* use func->cur_blksize */
@@ -219,6 +255,10 @@ struct mmc_card {
 
 	unsigned int		sd_bus_speed;	/* Bus Speed Mode set for the card */
 
+	struct mmc_lat_hist	lat;		/* request latencies */
+	u32			bkops_started;	/* background operations started */
+	u32			bkops_hpi;	/* and interrupted with HPI */
+
 	struct dentry		*debugfs_root;
 };
 
@@ -329,6 +369,13 @@ static inline void __maybe_unused remove_quirk(struct mmc_card *card, int data)
 #define mmc_sd_card_set_uhs(c) ((c)->state |= MMC_STATE_ULTRAHIGHSPEED)
 #define mmc_card_set_ext_capacity(c) ((c)->state |= MMC_CARD_SDXC)
 
+#define mmc_card_need_bkops(c)	((c)->state & MMC_STATE_NEED_BKOPS)
+#define mmc_card_doing_bkops(c)	((c)->state & MMC_STATE_DOING_BKOPS)
+#define mmc_card_set_need_bkops(c) ((c)->state |= MMC_STATE_NEED_BKOPS)
+#define mmc_card_set_doing_bkops(c) ((c)->state |= MMC_STATE_DOING_BKOPS)
+#define mmc_card_clr_need_bkops(c) ((c)->state &= ~MMC_STATE_NEED_BKOPS)
+#define mmc_card_clr_doing_bkops(c) ((c)->state &= ~MMC_STATE_DOING_BKOPS)
+
 /*
  * Quirk add/remove for MMC products.
  */
@@ -409,4 +456,7 @@ extern void mmc_unregister_driver(struct mmc_driver *);
 extern void mmc_fixup_device(struct mmc_card *card,
 			     const struct mmc_fixup *table);
 
+extern void mmc_latency_record(struct mmc_card *card, enum mmc_lat_type type,
+			       ktime_t start);
+
 #endif
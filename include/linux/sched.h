@@ -1759,6 +1759,16 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 
 extern int task_free_register(struct notifier_block *n);
 extern int task_free_unregister(struct notifier_block *n);
+extern int oom_adj_register(struct notifier_block *n);
+extern int oom_adj_unregister(struct notifier_block *n);
+extern void oom_adj_changed(struct task_struct *tsk);
+extern void oom_adj_leader_changed(struct task_struct *old_leader);
+extern void oom_adj_group_exit(struct task_struct *tsk);
+
+/* oom_adj notifier events */
+#define OOM_ADJ_CHANGED		0	/* data is a task of the group */
+#define OOM_ADJ_LEADER_CHANGED	1	/* data is the former group leader */
+#define OOM_ADJ_GROUP_EXIT	2	/* data is the group's last live thread */
 
 /*
  * Per process flags
@@ -0,0 +1,92 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dsscomp
+
+#if !defined(_TRACE_DSSCOMP_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_DSSCOMP_H
+
+#include <linux/tracepoint.h>
+#include <video/dsscomp.h>
+
+DECLARE_EVENT_CLASS(dsscomp_phase,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id),
+
+	TP_STRUCT__entry(
+		__field(void *, comp)
+		__field(u32, mgr_ix)
+		__field(u32, sync_id)
+	),
+
+	TP_fast_assign(
+		__entry->comp = comp;
+		__entry->mgr_ix = mgr_ix;
+		__entry->sync_id = sync_id;
+	),
+
+	TP_printk("comp=%p mgr=%u sync_id=%08x",
+		  __entry->comp, __entry->mgr_ix, __entry->sync_id)
+);
+
+DEFINE_EVENT(dsscomp_phase, dsscomp_queue,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id)
+);
+
+DEFINE_EVENT(dsscomp_phase, dsscomp_apply,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id)
+);
+
+DEFINE_EVENT(dsscomp_phase, dsscomp_go,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id)
+);
+
+DEFINE_EVENT(dsscomp_phase, dsscomp_programmed,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id)
+);
+
+DEFINE_EVENT(dsscomp_phase, dsscomp_displayed,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id)
+);
+
+DEFINE_EVENT(dsscomp_phase, dsscomp_released,
+	TP_PROTO(void *comp, u32 mgr_ix, u32 sync_id),
+	TP_ARGS(comp, mgr_ix, sync_id)
+);
+
+TRACE_EVENT(dsscomp_frame,
+	TP_PROTO(const struct dsscomp_timing_rec *r),
+	TP_ARGS(r),
+
+	TP_STRUCT__entry(
+		__field(u32, mgr_ix)
+		__field(u32, sync_id)
+		__field(u32, flags)
+		__field(u32, queue_us)
+		__field(u32, scanout_us)
+	),
+
+	TP_fast_assign(
+		__entry->mgr_ix = r->mgr_ix;
+		__entry->sync_id = r->sync_id;
+		__entry->flags = r->flags;
+		__entry->queue_us = r->apply_ns && r->queue_ns ?
+			(u32) div_u64(r->apply_ns - r->queue_ns, 1000) : 0;
+		__entry->scanout_us = r->displayed_ns && r->apply_ns ?
+			(u32) div_u64(r->displayed_ns - r->apply_ns, 1000) : 0;
+	),
+
+	TP_printk("mgr=%u sync_id=%08x queue=%uus apply_to_scanout=%uus%s%s",
+		  __entry->mgr_ix, __entry->sync_id, __entry->queue_us,
+		  __entry->scanout_us,
+		  __entry->flags & DSSCOMP_TIMING_MISSED ? " missed" : "",
+		  __entry->flags & DSSCOMP_TIMING_FAILED ? " failed" : "")
+);
+
+#endif /* _TRACE_DSSCOMP_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,41 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_select,
+	TP_PROTO(int min_adj, pid_t pid, int adj, int tasksize,
+		 int indexed, s64 latency_ns),
+	TP_ARGS(min_adj, pid, adj, tasksize, indexed, latency_ns),
+
+	TP_STRUCT__entry(
+	    __field(int, min_adj    )
+	    __field(pid_t, pid      )
+	    __field(int, adj        )
+	    __field(int, tasksize   )
+	    __field(int, indexed    )
+	    __field(s64, latency_ns )
+	),
+
+	TP_fast_assign(
+	    __entry->min_adj = min_adj;
+	    __entry->pid = pid;
+	    __entry->adj = adj;
+	    __entry->tasksize = tasksize;
+	    __entry->indexed = indexed;
+	    __entry->latency_ns = latency_ns;
+	),
+
+	TP_printk("min_adj=%d pid=%d adj=%d size=%d indexed=%d latency=%lldns",
+	      __entry->min_adj, __entry->pid, __entry->adj,
+	      __entry->tasksize, __entry->indexed,
+	      (long long)__entry->latency_ns)
+);
+
+#endif /* _TRACE_LOWMEMORYKILLER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
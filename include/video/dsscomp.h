@@ -375,6 +375,7 @@ enum omapdss_buffer_addressing_type {
 	OMAP_DSS_BUFADDR_OVL_IX,	/* using a prior overlay */
 	OMAP_DSS_BUFADDR_LAYER_IX,	/* using a Post2 layer */
 	OMAP_DSS_BUFADDR_FB,		/* using framebuffer memory */
+	OMAP_DSS_BUFADDR_REGISTERED,	/* using a registered buffer index */
 };
 
 struct dss2_ovl_info {
@@ -696,6 +697,62 @@ struct dsscomp_platform_info {
 	enum dsscomp_fbmem_type fbmem_type; /* TILER2D vs VRAM */
 };
 
+/*
+ * ioctl: DSSCIOC_REGISTER_BUFFER, struct dsscomp_buffer_reg
+ *
+ * Registers a buffer that will be queued repeatedly (e.g. a framebuffer
+ * of a swap chain) so that its physical/TILER mapping is resolved once
+ * instead of on every frame.  addressing must be OMAP_DSS_BUFADDR_DIRECT
+ * (address is a user virtual address) or OMAP_DSS_BUFADDR_ION (address
+ * is an ion share fd from ION_IOC_SHARE).  The buffer is referenced while
+ * registered.  Non-TILER user memory is pinned and kept mapped into TILER
+ * 1D until unregistered.  Only the file that registered a buffer may queue
+ * or unregister it.
+ * uv_offset is the byte offset of the UV plane for NV12 buffers, or 0.
+ *
+ * On success ix is filled in.  Refer to the buffer from a composition by
+ * setting addressing to OMAP_DSS_BUFADDR_REGISTERED and ba to ix.
+ *
+ * ioctl: DSSCIOC_UNREGISTER_BUFFER, __u32 ix
+ *
+ * Releases a registration.  Compositions still using the buffer keep its
+ * mapping until they are released.  Buffers are also unregistered when
+ * the registering file descriptor is closed.
+ *
+ * Returns: 0 on success, <0 error value on failure.
+ */
+struct dsscomp_buffer_reg {
+	__u32 ix;			/* registration index (output) */
+	enum omapdss_buffer_addressing_type addressing;
+	void *address;			/* user address or ion share fd */
+	__u32 size;			/* buffer size in bytes */
+	__u32 uv_offset;		/* offset of UV plane, or 0 */
+};
+
+/*
+ * Composition timing record, as streamed from debugfs dsscomp/timing_raw.
+ * One record is logged per applied composition when it is released.  All
+ * times are CLOCK_MONOTONIC in nanoseconds; 0 means the phase was not seen.
+ */
+enum dsscomp_timing_flags {
+	DSSCOMP_TIMING_MISSED = (1 << 0),	/* GO not latched by next VSYNC */
+	DSSCOMP_TIMING_FAILED = (1 << 1),	/* apply failed */
+};
+
+struct dsscomp_timing_rec {
+	__u32 sync_id;
+	__u16 mgr_ix;		/* manager the composition was applied on */
+	__u16 flags;		/* enum dsscomp_timing_flags */
+	__u32 frame_ns;		/* display frame period, 0 if manual update */
+	__u32 reserved;
+	__u64 queue_ns;		/* queued by gralloc/ioctl */
+	__u64 apply_ns;		/* apply work started */
+	__u64 go_ns;		/* GO bit set */
+	__u64 programmed_ns;	/* shadow registers latched (VSYNC) */
+	__u64 displayed_ns;	/* first shown (VSYNC/FRAMEDONE) */
+	__u64 release_ns;	/* replaced on screen */
+};
+
 /* IOCTLS */
 #define DSSCIOC_SETUP_MGR	_IOW('O', 128, struct dsscomp_setup_mgr_data)
 #define DSSCIOC_CHECK_OVL	_IOWR('O', 129, struct dsscomp_check_ovl_data)
@@ -706,4 +763,6 @@ struct dsscomp_platform_info {
 #define DSSCIOC_SETUP_DISPC	_IOW('O', 133, struct dsscomp_setup_dispc_data)
 #define DSSCIOC_SETUP_DISPLAY	_IOW('O', 134, struct dsscomp_setup_display_data)
 #define DSSCIOC_QUERY_PLATFORM	_IOR('O', 135, struct dsscomp_platform_info)
+#define DSSCIOC_REGISTER_BUFFER	_IOWR('O', 136, struct dsscomp_buffer_reg)
+#define DSSCIOC_UNREGISTER_BUFFER	_IOW('O', 137, __u32)
 #endif
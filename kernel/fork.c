@@ -159,6 +159,9 @@ static struct kmem_cache *mm_cachep;
 /* Notifier list called when a task struct is freed */
 static ATOMIC_NOTIFIER_HEAD(task_free_notifier);
 
+/* Notifier list called when a thread group's oom_adj is set */
+static ATOMIC_NOTIFIER_HEAD(oom_adj_notifier);
+
 static void account_kernel_stack(struct thread_info *ti, int account)
 {
 	struct zone *zone = page_zone(virt_to_page(ti));
@@ -202,6 +205,46 @@ int task_free_unregister(struct notifier_block *n)
 }
 EXPORT_SYMBOL(task_free_unregister);
 
+int oom_adj_register(struct notifier_block *n)
+{
+	return atomic_notifier_chain_register(&oom_adj_notifier, n);
+}
+EXPORT_SYMBOL(oom_adj_register);
+
+int oom_adj_unregister(struct notifier_block *n)
+{
+	return atomic_notifier_chain_unregister(&oom_adj_notifier, n);
+}
+EXPORT_SYMBOL(oom_adj_unregister);
+
+/*
+ * Called when a new thread group inherits its oom_adj, or when the oom_adj
+ * of an existing one is written.
+ */
+void oom_adj_changed(struct task_struct *tsk)
+{
+	atomic_notifier_call_chain(&oom_adj_notifier, OOM_ADJ_CHANGED, tsk);
+}
+
+/*
+ * Called when a non-leader thread execs and takes over the thread group
+ * from 'old_leader', before the old leader is released.
+ */
+void oom_adj_leader_changed(struct task_struct *old_leader)
+{
+	atomic_notifier_call_chain(&oom_adj_notifier, OOM_ADJ_LEADER_CHANGED,
+				   old_leader);
+}
+
+/*
+ * Called from do_exit() by the thread that took signal->live to zero, so
+ * exactly once per thread group.
+ */
+void oom_adj_group_exit(struct task_struct *tsk)
+{
+	atomic_notifier_call_chain(&oom_adj_notifier, OOM_ADJ_GROUP_EXIT, tsk);
+}
+
 void __put_task_struct(struct task_struct *tsk)
 {
 	WARN_ON(!tsk->exit_state);
@@ -1543,6 +1586,9 @@ long do_fork(unsigned long clone_flags,
 		 */
 		p->flags &= ~PF_STARTING;
 
+		if (!(clone_flags & CLONE_THREAD))
+			oom_adj_changed(p);
+
 		wake_up_new_task(p);
 
 		tracehook_report_clone_complete(trace, regs,
@@ -15,11 +15,13 @@
 #define DEBUG
 
 #include <linux/file.h>
+#include <linux/hash.h>
 #include <linux/inetdevice.h>
 #include <linux/module.h>
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_qtaguid.h>
 #include <linux/ratelimit.h>
+#include <linux/seq_file.h>
 #include <linux/skbuff.h>
 #include <linux/workqueue.h>
 #include <net/addrconf.h>
@@ -139,10 +141,10 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
  *   iface_stat_list_lock
  *     (struct iface_stat)
  *
- * qtaguid_ctrl_proc_read()
+ * qtaguid_ctrl_proc_start()/next()
  *   sock_tag_list_lock
  *     (sock_tag_tree)
- *     (struct proc_qtu_data->sock_tag_list)
+ * qtaguid_ctrl_proc_show()
  *   prdebug_full_state()
  *     sock_tag_list_lock
  *       (sock_tag_tree)
@@ -151,7 +153,7 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
  *       (proc_qtu_data_tree)
  *     iface_stat_list_lock
  *
- * qtaguid_stats_proc_read()
+ * qtaguid_stats_proc_start()/next()
  *   iface_stat_list_lock
  *     struct iface_stat->tag_stat_list_lock
  *
@@ -187,15 +189,17 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
  * qtaguid_mt()
  *   account_for_uid()
  *     if_tag_stat_update()
+ *       (per-cpu qtu_cache hit: no locks)
+ *       get_iface_entry_cached()
+ *         iface_stat_list_lock
  *       get_sock_stat()
  *         sock_tag_list_lock
+ *       get_active_counter_set()
+ *         tag_counter_set_list_lock
  *       struct iface_stat->tag_stat_list_lock
- *         tag_stat_update()
- *           get_active_counter_set()
- *             tag_counter_set_list_lock
- *         tag_stat_update()
- *           get_active_counter_set()
- *             tag_counter_set_list_lock
+ *   iface_stat_update_from_skb()
+ *     get_iface_entry_cached()
+ *       iface_stat_list_lock
  *
  *
  * qtaguid_ctrl_parse()
@@ -233,6 +237,50 @@ static struct rb_root uid_tag_data_tree = RB_ROOT;
 static DEFINE_SPINLOCK(uid_tag_data_tree_lock);
 
 static struct rb_root proc_qtu_data_tree = RB_ROOT;
+
+/*
+ * The match keeps per-cpu caches of its lookups, so that most packets are
+ * accounted without taking any lock, walking iface_stat_list or searching
+ * the trees: an iface_stat per net_device and the tag_stat and active
+ * counter set per {sock, net_device, uid}.
+ * An entry is only valid while its gen matches qtu_cache_gen, which is
+ * bumped by everything that changes the result of a lookup. tag_stats are
+ * freed after an RCU grace period, as the match may still hold one it
+ * looked up just before the bump, and the bump is made before the free is
+ * queued, so that matches the grace period does not wait for miss.
+ */
+#define QTU_IFACE_CACHE_SIZE 8
+#define QTU_TAG_CACHE_BITS 4
+
+struct qtu_iface_cache_entry {
+	const struct net_device *dev;
+	unsigned int gen;
+	struct iface_stat *iface_entry;
+};
+
+struct qtu_tag_cache_entry {
+	const struct sock *sk;
+	const struct net_device *dev;
+	uid_t uid;
+	unsigned int gen;
+	struct tag_stat *ts_entry;
+	int active_set;
+};
+
+struct qtu_cache {
+	struct qtu_iface_cache_entry iface[QTU_IFACE_CACHE_SIZE];
+	struct qtu_tag_cache_entry tag[1 << QTU_TAG_CACHE_BITS];
+};
+
+static DEFINE_PER_CPU(struct qtu_cache, qtu_cache);
+static atomic_t qtu_cache_gen = ATOMIC_INIT(1);
+
+static inline void qtu_cache_invalidate(void)
+{
+	atomic_inc(&qtu_cache_gen);
+	/* order the bump before whatever the caller frees next */
+	smp_mb__after_atomic_inc();
+}
 /* No proc_qtu_data_tree_lock; use uid_tag_data_tree_lock */
 
 static struct qtaguid_event_counts qtu_events;
@@ -269,6 +317,12 @@ static inline void dc_add_byte_packets(struct data_counters *counters, int set,
 	counters->bpc[set][direction][ifs_proto].packets += packets;
 }
 
+static struct data_counters_pcpu *dc_pcpu_alloc(void)
+{
+	return kcalloc(nr_cpu_ids, sizeof(struct data_counters_pcpu),
+		       GFP_ATOMIC);
+}
+
 static struct tag_node *tag_node_tree_search(struct rb_root *root, tag_t tag)
 {
 	struct rb_node *node = root->rb_node;
@@ -770,6 +824,34 @@ done:
 	return iface_entry;
 }
 
+/*
+ * Find the entry for tracking the specified device through the per-cpu
+ * cache. Called from the match, with BHs disabled.
+ */
+static struct iface_stat *get_iface_entry_cached(
+	const struct net_device *net_dev, unsigned int gen)
+{
+	struct qtu_iface_cache_entry *ce;
+	struct iface_stat *iface_entry;
+
+	ce = &__get_cpu_var(qtu_cache).iface[net_dev->ifindex
+					     % QTU_IFACE_CACHE_SIZE];
+	if (likely(ce->gen == gen && ce->dev == net_dev))
+		return ce->iface_entry;
+
+	spin_lock_bh(&iface_stat_list_lock);
+	iface_entry = get_iface_entry(net_dev->name);
+	spin_unlock_bh(&iface_stat_list_lock);
+
+	/* iface_stat entries are never freed, only deactivated */
+	if (iface_entry) {
+		ce->dev = net_dev;
+		ce->iface_entry = iface_entry;
+		ce->gen = gen;
+	}
+	return iface_entry;
+}
+
 /* This is for fmt2 only */
 static int pp_iface_stat_line(bool header, char *outp,
 			      int char_count, struct iface_stat *iface_entry)
@@ -788,9 +870,9 @@ static int pp_iface_stat_line(bool header, char *outp,
 			       "tx_other_bytes tx_other_packets\n"
 			);
 	} else {
-		struct data_counters *cnts;
+		struct data_counters totals, *cnts = &totals;
 		int cnt_set = 0;   /* We only use one set for the device */
-		cnts = &iface_entry->totals_via_skb;
+		dc_pcpu_fold(iface_entry->totals_via_skb, cnts);
 		len = snprintf(
 			outp, char_count,
 			"%s "
@@ -991,6 +1073,14 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		kfree(new_iface);
 		return NULL;
 	}
+	new_iface->totals_via_skb = dc_pcpu_alloc();
+	if (new_iface->totals_via_skb == NULL) {
+		pr_err("qtaguid: iface_stat: create(%s): "
+		       "counters alloc failed\n", net_dev->name);
+		kfree(new_iface->ifname);
+		kfree(new_iface);
+		return NULL;
+	}
 	spin_lock_init(&new_iface->tag_stat_list_lock);
 	new_iface->tag_stat_tree = RB_ROOT;
 	_iface_stat_set_active(new_iface, net_dev, true);
@@ -1004,6 +1094,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		pr_err("qtaguid: iface_stat: create(%s): "
 		       "work alloc failed\n", new_iface->ifname);
 		_iface_stat_set_active(new_iface, net_dev, false);
+		kfree(new_iface->totals_via_skb);
 		kfree(new_iface->ifname);
 		kfree(new_iface);
 		return NULL;
@@ -1244,6 +1335,17 @@ data_counters_update(struct data_counters *dc, int set,
 	}
 }
 
+/* Account to this CPU's slice. Called from the match, with BHs disabled. */
+static void dc_pcpu_update(struct data_counters_pcpu *pcpu, int set,
+			   enum ifs_tx_rx direction, int proto, int bytes)
+{
+	struct data_counters_pcpu *slice = pcpu + smp_processor_id();
+
+	u64_stats_update_begin(&slice->syncp);
+	data_counters_update(&slice->dc, set, direction, proto, bytes);
+	u64_stats_update_end(&slice->syncp);
+}
+
 /*
  * Update stats for the specified interface. Do nothing if the entry
  * does not exist (when a device was never configured with an IP address).
@@ -1343,37 +1445,32 @@ static void iface_stat_update_from_skb(const struct sk_buff *skb,
 			 par->family, proto);
 	}
 
-	spin_lock_bh(&iface_stat_list_lock);
-	entry = get_iface_entry(el_dev->name);
+	entry = get_iface_entry_cached(el_dev,
+				       atomic_read(&qtu_cache_gen));
 	if (entry == NULL) {
 		IF_DEBUG("qtaguid: iface_stat: %s(%s): not tracked\n",
 			 __func__, el_dev->name);
-		spin_unlock_bh(&iface_stat_list_lock);
 		return;
 	}
 
 	IF_DEBUG("qtaguid: %s(%s): entry=%p\n", __func__,
 		 el_dev->name, entry);
 
-	data_counters_update(&entry->totals_via_skb, 0, direction, proto,
-			     bytes);
-	spin_unlock_bh(&iface_stat_list_lock);
+	dc_pcpu_update(entry->totals_via_skb, 0, direction, proto, bytes);
 }
 
-static void tag_stat_update(struct tag_stat *tag_entry,
+static void tag_stat_update(struct tag_stat *tag_entry, int active_set,
 			enum ifs_tx_rx direction, int proto, int bytes)
 {
-	int active_set;
-	active_set = get_active_counter_set(tag_entry->tn.tag);
 	MT_DEBUG("qtaguid: tag_stat_update(tag=0x%llx (uid=%u) set=%d "
 		 "dir=%d proto=%d bytes=%d)\n",
 		 tag_entry->tn.tag, get_uid_from_tag(tag_entry->tn.tag),
 		 active_set, direction, proto, bytes);
-	data_counters_update(&tag_entry->counters, active_set, direction,
-			     proto, bytes);
+	dc_pcpu_update(tag_entry->counters, active_set, direction,
+		       proto, bytes);
 	if (tag_entry->parent_counters)
-		data_counters_update(tag_entry->parent_counters, active_set,
-				     direction, proto, bytes);
+		dc_pcpu_update(tag_entry->parent_counters, active_set,
+			       direction, proto, bytes);
 }
 
 /*
@@ -1393,38 +1490,73 @@ static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
 		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
 		goto done;
 	}
+	new_tag_stat_entry->counters = dc_pcpu_alloc();
+	if (!new_tag_stat_entry->counters) {
+		pr_err("qtaguid: iface_stat: tag stat counters alloc failed\n");
+		kfree(new_tag_stat_entry);
+		new_tag_stat_entry = NULL;
+		goto done;
+	}
 	new_tag_stat_entry->tn.tag = tag;
 	tag_stat_tree_insert(new_tag_stat_entry, &iface_entry->tag_stat_tree);
 done:
 	return new_tag_stat_entry;
 }
 
-static void if_tag_stat_update(const char *ifname, uid_t uid,
+static void tag_stat_free_rcu(struct rcu_head *head)
+{
+	struct tag_stat *ts_entry = container_of(head, struct tag_stat, rcu);
+
+	kfree(ts_entry->counters);
+	kfree(ts_entry);
+}
+
+/*
+ * Called from the match, with BHs disabled and under rcu_read_lock().
+ */
+static void if_tag_stat_update(const struct net_device *net_dev, uid_t uid,
 			       const struct sock *sk, enum ifs_tx_rx direction,
 			       int proto, int bytes)
 {
+	struct qtu_tag_cache_entry *ce;
+	unsigned int gen;
 	struct tag_stat *tag_stat_entry;
 	tag_t tag, acct_tag;
 	tag_t uid_tag;
-	struct data_counters *uid_tag_counters;
+	struct data_counters_pcpu *uid_tag_counters;
 	struct sock_tag *sock_tag_entry;
 	struct iface_stat *iface_entry;
 	struct tag_stat *new_tag_stat = NULL;
+	int active_set;
 	MT_DEBUG("qtaguid: if_tag_stat_update(ifname=%s "
 		"uid=%u sk=%p dir=%d proto=%d bytes=%d)\n",
-		 ifname, uid, sk, direction, proto, bytes);
+		 net_dev->name, uid, sk, direction, proto, bytes);
 
+	/*
+	 * Read the generation before any lookup: whatever changes after
+	 * this point leaves the entry recorded below stale.
+	 */
+	gen = atomic_read(&qtu_cache_gen);
+	ce = &__get_cpu_var(qtu_cache).tag[
+		(hash_ptr((void *)sk, QTU_TAG_CACHE_BITS) ^ net_dev->ifindex)
+		& ((1 << QTU_TAG_CACHE_BITS) - 1)];
+	if (likely(ce->gen == gen && ce->sk == sk && ce->dev == net_dev &&
+		   ce->uid == uid)) {
+		tag_stat_update(ce->ts_entry, ce->active_set, direction,
+				proto, bytes);
+		return;
+	}
 
-	iface_entry = get_iface_entry(ifname);
+	iface_entry = get_iface_entry_cached(net_dev, gen);
 	if (!iface_entry) {
 		pr_err_ratelimited("qtaguid: iface_stat: stat_update() "
-				   "%s not found\n", ifname);
+				   "%s not found\n", net_dev->name);
 		return;
 	}
 	/* It is ok to process data when an iface_entry is inactive */
 
 	MT_DEBUG("qtaguid: iface_stat: stat_update() dev=%s entry=%p\n",
-		 ifname, iface_entry);
+		 net_dev->name, iface_entry);
 
 	/*
 	 * Look for a tagged sock.
@@ -1440,6 +1572,7 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		tag = combine_atag_with_uid(acct_tag, uid);
 		uid_tag = make_tag_from_uid(uid);
 	}
+	active_set = get_active_counter_set(tag);
 	MT_DEBUG("qtaguid: iface_stat: stat_update(): "
 		 " looking for tag=0x%llx (uid=%u) in ife=%p\n",
 		 tag, get_uid_from_tag(tag), iface_entry);
@@ -1453,9 +1586,8 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 * Updating the {acct_tag, uid_tag} entry handles both stats:
 		 * {0, uid_tag} will also get updated.
 		 */
-		tag_stat_update(tag_stat_entry, direction, proto, bytes);
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
-		return;
+		new_tag_stat = tag_stat_entry;
+		goto update;
 	}
 
 	/* Loop over tag list under this interface for {0,uid_tag} */
@@ -1470,9 +1602,9 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag);
 		if (!new_tag_stat)
 			goto unlock;
-		uid_tag_counters = &new_tag_stat->counters;
+		uid_tag_counters = new_tag_stat->counters;
 	} else {
-		uid_tag_counters = &tag_stat_entry->counters;
+		uid_tag_counters = tag_stat_entry->counters;
 	}
 
 	if (acct_tag) {
@@ -1492,7 +1624,15 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 */
 		BUG_ON(!new_tag_stat);
 	}
-	tag_stat_update(new_tag_stat, direction, proto, bytes);
+update:
+	tag_stat_update(new_tag_stat, active_set, direction, proto, bytes);
+
+	ce->sk = sk;
+	ce->dev = net_dev;
+	ce->uid = uid;
+	ce->ts_entry = new_tag_stat;
+	ce->active_set = active_set;
+	ce->gen = gen;
 unlock:
 	spin_unlock_bh(&iface_entry->tag_stat_list_lock);
 }
@@ -1501,6 +1641,9 @@ static int iface_netdev_event_handler(struct notifier_block *nb,
 				      unsigned long event, void *ptr) {
 	struct net_device *dev = ptr;
 
+	/* Devices can be renamed or freed under the match's cache */
+	qtu_cache_invalidate();
+
 	if (unlikely(module_passive))
 		return NOTIFY_DONE;
 
@@ -1743,7 +1886,7 @@ static void account_for_uid(const struct sk_buff *skb,
 			 par->hooknum, el_dev->name, el_dev->type,
 			 par->family, proto);
 
-		if_tag_stat_update(el_dev->name, uid,
+		if_tag_stat_update(el_dev, uid,
 				skb->sk ? skb->sk : alternate_sk,
 				par->in ? IFS_RX : IFS_TX,
 				proto, skb->len);
@@ -1937,112 +2080,158 @@ static void prdebug_full_state(int indent_level, const char *fmt, ...) {}
 #endif
 
 /*
- * Procfs reader to get all active socket tags using style "1)" as described in
- * fs/proc/generic.c
+ * The ctrl file is a seq_file of one line per socket tag, followed by the
+ * events line.
+ * The iterator keeps the socket of the line it is on, so that the next
+ * read() resumes with a tree search instead of skipping all the lines
+ * already returned. The tag is copied out under sock_tag_list_lock, and
+ * lines are printed without holding it.
  */
-static int qtaguid_ctrl_proc_read(char *page, char **num_items_returned,
-				  off_t items_to_skip, int char_count, int *eof,
-				  void *data)
-{
-	char *outp = page;
-	int len;
-	uid_t uid;
-	struct rb_node *node;
-	struct sock_tag *sock_tag_entry;
-	int item_index = 0;
-	int indent_level = 0;
+struct proc_ctrl_print_info {
+	struct sock *sk;
+	tag_t tag;
+	pid_t pid;
 	long f_count;
+	bool events;	/* on the events line */
+	bool valid;	/* the cursor points at a line */
+	loff_t pos;	/* seq_file position of the cursor */
+};
 
-	if (unlikely(module_passive)) {
-		*eof = 1;
-		return 0;
+/* Find the first sock_tag with a sk at or (!inclusive) above the given one */
+static struct sock_tag *sock_tag_tree_search_next(struct rb_root *root,
+						  const struct sock *sk,
+						  bool inclusive)
+{
+	struct rb_node *node = root->rb_node;
+	struct sock_tag *found = NULL;
+
+	while (node) {
+		struct sock_tag *data = rb_entry(node, struct sock_tag,
+						 sock_node);
+		if (sk < data->sk || (inclusive && sk == data->sk)) {
+			found = data;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
 	}
+	return found;
+}
 
-	if (*eof)
-		return 0;
+/* Move the cursor to the next line. Returns false past the events line. */
+static bool pp_ctrl_next(struct proc_ctrl_print_info *ppi, bool first)
+{
+	struct sock_tag *sock_tag_entry;
 
-	CT_DEBUG("qtaguid: proc ctrl pid=%u tgid=%u uid=%u "
-		 "page=%p off=%ld char_count=%d *eof=%d\n",
-		 current->pid, current->tgid, current_fsuid(),
-		 page, items_to_skip, char_count, *eof);
+	if (ppi->events) {
+		ppi->valid = false;
+		return false;
+	}
 
 	spin_lock_bh(&sock_tag_list_lock);
-	for (node = rb_first(&sock_tag_tree);
-	     node;
-	     node = rb_next(node)) {
-		if (item_index++ < items_to_skip)
-			continue;
-		sock_tag_entry = rb_entry(node, struct sock_tag, sock_node);
-		uid = get_uid_from_tag(sock_tag_entry->tag);
-		CT_DEBUG("qtaguid: proc_read(): sk=%p tag=0x%llx (uid=%u) "
-			 "pid=%u\n",
-			 sock_tag_entry->sk,
-			 sock_tag_entry->tag,
-			 uid,
-			 sock_tag_entry->pid
-			);
-		f_count = atomic_long_read(
+	sock_tag_entry = sock_tag_tree_search_next(&sock_tag_tree, ppi->sk,
+						   first);
+	if (sock_tag_entry) {
+		ppi->sk = sock_tag_entry->sk;
+		ppi->tag = sock_tag_entry->tag;
+		ppi->pid = sock_tag_entry->pid;
+		ppi->f_count = atomic_long_read(
 			&sock_tag_entry->socket->file->f_count);
-		len = snprintf(outp, char_count,
-			       "sock=%p tag=0x%llx (uid=%u) pid=%u "
-			       "f_count=%lu\n",
-			       sock_tag_entry->sk,
-			       sock_tag_entry->tag, uid,
-			       sock_tag_entry->pid, f_count);
-		if (len >= char_count) {
-			spin_unlock_bh(&sock_tag_list_lock);
-			*outp = '\0';
-			return outp - page;
-		}
-		outp += len;
-		char_count -= len;
-		(*num_items_returned)++;
+	} else {
+		ppi->events = true;
 	}
 	spin_unlock_bh(&sock_tag_list_lock);
 
-	if (item_index++ >= items_to_skip) {
-		len = snprintf(outp, char_count,
-			       "events: sockets_tagged=%llu "
-			       "sockets_untagged=%llu "
-			       "counter_set_changes=%llu "
-			       "delete_cmds=%llu "
-			       "iface_events=%llu "
-			       "match_calls=%llu "
-			       "match_calls_prepost=%llu "
-			       "match_found_sk=%llu "
-			       "match_found_sk_in_ct=%llu "
-			       "match_found_no_sk_in_ct=%llu "
-			       "match_no_sk=%llu "
-			       "match_no_sk_file=%llu\n",
-			       atomic64_read(&qtu_events.sockets_tagged),
-			       atomic64_read(&qtu_events.sockets_untagged),
-			       atomic64_read(&qtu_events.counter_set_changes),
-			       atomic64_read(&qtu_events.delete_cmds),
-			       atomic64_read(&qtu_events.iface_events),
-			       atomic64_read(&qtu_events.match_calls),
-			       atomic64_read(&qtu_events.match_calls_prepost),
-			       atomic64_read(&qtu_events.match_found_sk),
-			       atomic64_read(&qtu_events.match_found_sk_in_ct),
-			       atomic64_read(
-				       &qtu_events.match_found_no_sk_in_ct),
-			       atomic64_read(&qtu_events.match_no_sk),
-			       atomic64_read(&qtu_events.match_no_sk_file));
-		if (len >= char_count) {
-			*outp = '\0';
-			return outp - page;
-		}
-		outp += len;
-		char_count -= len;
-		(*num_items_returned)++;
+	ppi->valid = true;
+	return true;
+}
+
+static void *qtaguid_ctrl_proc_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct proc_ctrl_print_info *ppi = m->private;
+
+	(*pos)++;
+	ppi->pos = *pos;
+	if (!pp_ctrl_next(ppi, false))
+		return NULL;
+	return ppi;
+}
+
+static void *qtaguid_ctrl_proc_start(struct seq_file *m, loff_t *pos)
+{
+	struct proc_ctrl_print_info *ppi = m->private;
+	loff_t i = 0;
+	void *v;
+
+	if (unlikely(module_passive))
+		return NULL;
+
+	CT_DEBUG("qtaguid: proc ctrl pid=%u tgid=%u uid=%u pos=%lld\n",
+		 current->pid, current->tgid, current_fsuid(), *pos);
+
+	if (!ppi->pos || *pos < ppi->pos) {
+		ppi->sk = NULL;
+		ppi->events = false;
+		ppi->pos = 0;
+		v = pp_ctrl_next(ppi, true) ? ppi : NULL;
+	} else {
+		/* Carry on from where the previous read() stopped */
+		v = ppi->valid ? ppi : NULL;
+		i = ppi->pos;
 	}
+	while (v && i < *pos)
+		v = qtaguid_ctrl_proc_next(m, v, &i);
+	return v;
+}
+
+static void qtaguid_ctrl_proc_stop(struct seq_file *m, void *v)
+{
+}
+
+static int qtaguid_ctrl_proc_show(struct seq_file *m, void *v)
+{
+	struct proc_ctrl_print_info *ppi = v;
+	uid_t uid;
 
-	/* Count the following as part of the last item_index */
-	if (item_index > items_to_skip) {
-		prdebug_full_state(indent_level, "proc ctrl");
+	if (!ppi->events) {
+		uid = get_uid_from_tag(ppi->tag);
+		CT_DEBUG("qtaguid: proc_read(): sk=%p tag=0x%llx (uid=%u) "
+			 "pid=%u\n", ppi->sk, ppi->tag, uid, ppi->pid);
+		seq_printf(m, "sock=%p tag=0x%llx (uid=%u) pid=%u "
+			   "f_count=%lu\n",
+			   ppi->sk, ppi->tag, uid, ppi->pid, ppi->f_count);
+		return 0;
 	}
 
-	*eof = 1;
-	return outp - page;
+	seq_printf(m, "events: sockets_tagged=%llu "
+		   "sockets_untagged=%llu "
+		   "counter_set_changes=%llu "
+		   "delete_cmds=%llu "
+		   "iface_events=%llu "
+		   "match_calls=%llu "
+		   "match_calls_prepost=%llu "
+		   "match_found_sk=%llu "
+		   "match_found_sk_in_ct=%llu "
+		   "match_found_no_sk_in_ct=%llu "
+		   "match_no_sk=%llu "
+		   "match_no_sk_file=%llu\n",
+		   atomic64_read(&qtu_events.sockets_tagged),
+		   atomic64_read(&qtu_events.sockets_untagged),
+		   atomic64_read(&qtu_events.counter_set_changes),
+		   atomic64_read(&qtu_events.delete_cmds),
+		   atomic64_read(&qtu_events.iface_events),
+		   atomic64_read(&qtu_events.match_calls),
+		   atomic64_read(&qtu_events.match_calls_prepost),
+		   atomic64_read(&qtu_events.match_found_sk),
+		   atomic64_read(&qtu_events.match_found_sk_in_ct),
+		   atomic64_read(&qtu_events.match_found_no_sk_in_ct),
+		   atomic64_read(&qtu_events.match_no_sk),
+		   atomic64_read(&qtu_events.match_no_sk_file));
+
+	/* Count the following as part of the events line */
+	if (m->count < m->size)
+		prdebug_full_state(0, "proc ctrl");
+	return 0;
 }
 
 /*
@@ -2172,7 +2361,13 @@ static int ctrl_cmd_delete(const char *input)
 					 entry_uid);
 				rb_erase(&ts_entry->tn.node,
 					 &iface_entry->tag_stat_tree);
-				kfree(ts_entry);
+				/*
+				 * A match that starts after call_rcu() is not
+				 * waited for, so it must already see its
+				 * cached pointer to ts_entry as stale.
+				 */
+				qtu_cache_invalidate();
+				call_rcu(&ts_entry->rcu, tag_stat_free_rcu);
 			}
 		}
 		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
@@ -2202,6 +2397,7 @@ static int ctrl_cmd_delete(const char *input)
 	}
 	spin_unlock_bh(&uid_tag_data_tree_lock);
 
+	qtu_cache_invalidate();
 	atomic64_inc(&qtu_events.delete_cmds);
 	res = 0;
 
@@ -2261,6 +2457,7 @@ static int ctrl_cmd_counter_set(const char *input)
 	}
 	tcs->active_set = counter_set;
 	spin_unlock_bh(&tag_counter_set_list_lock);
+	qtu_cache_invalidate();
 	atomic64_inc(&qtu_events.counter_set_changes);
 	res = 0;
 
@@ -2399,6 +2596,7 @@ static int ctrl_cmd_tag(const char *input)
 		atomic64_inc(&qtu_events.sockets_tagged);
 	}
 	spin_unlock_bh(&sock_tag_list_lock);
+	qtu_cache_invalidate();
 	/* We keep the ref to the socket (file) until it is untagged */
 	CT_DEBUG("qtaguid: ctrl_tag(%s): done st@%p ...->f_count=%ld\n",
 		 input, sock_tag_entry,
@@ -2488,6 +2686,7 @@ static int ctrl_cmd_untag(const char *input)
 	 */
 	tag_ref_entry->num_sock_tags--;
 	spin_unlock_bh(&sock_tag_list_lock);
+	qtu_cache_invalidate();
 	/*
 	 * Release the sock_fd that was grabbed at tag time,
 	 * and once more for the sockfd_lookup() here.
@@ -2554,8 +2753,9 @@ err:
 }
 
 #define MAX_QTAGUID_CTRL_INPUT_LEN 255
-static int qtaguid_ctrl_proc_write(struct file *file, const char __user *buffer,
-			unsigned long count, void *data)
+static ssize_t qtaguid_ctrl_proc_write(struct file *file,
+				       const char __user *buffer,
+				       size_t count, loff_t *offp)
 {
 	char input_buf[MAX_QTAGUID_CTRL_INPUT_LEN];
 
@@ -2572,181 +2772,253 @@ static int qtaguid_ctrl_proc_write(struct file *file, const char __user *buffer,
 	return qtaguid_ctrl_parse(input_buf, count);
 }
 
+static const struct seq_operations proc_qtaguid_ctrl_seqops = {
+	.start = qtaguid_ctrl_proc_start,
+	.next = qtaguid_ctrl_proc_next,
+	.stop = qtaguid_ctrl_proc_stop,
+	.show = qtaguid_ctrl_proc_show,
+};
+
+static int proc_qtaguid_ctrl_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &proc_qtaguid_ctrl_seqops,
+				sizeof(struct proc_ctrl_print_info));
+}
+
+static const struct file_operations proc_qtaguid_ctrl_fops = {
+	.open		= proc_qtaguid_ctrl_open,
+	.read		= seq_read,
+	.write		= qtaguid_ctrl_proc_write,
+	.llseek		= seq_lseek,
+	.release	= seq_release_private,
+};
+
+/*
+ * The stats file is a seq_file of a header line, then one line per
+ * {tag_stat, counter set}.
+ * Like the ctrl file, the iterator keeps a cursor on the {iface_stat, tag}
+ * of the line it is on and resumes from it with a tree search. The counters
+ * of a tag_stat are folded into the cursor once, under the tag_stat_list_lock
+ * of its iface, and lines are printed without holding any lock.
+ * iface_stats are never freed, so the cursor can keep pointing at one.
+ */
 struct proc_print_info {
-	char *outp;
-	char **num_items_returned;
 	struct iface_stat *iface_entry;
-	struct tag_stat *ts_entry;
-	int item_index;
-	int items_to_skip;
-	int char_count;
+	tag_t tag;
+	int cnt_set;
+	bool valid;	/* the cursor points at a line */
+	loff_t pos;	/* seq_file position of the cursor */
+	struct data_counters counters;
 };
 
-static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
+/* Find the first tag_stat with a tag at or (!inclusive) above the given one */
+static struct tag_stat *tag_stat_tree_search_next(struct rb_root *root,
+						  tag_t tag, bool inclusive)
 {
-	int len;
-	struct data_counters *cnts;
+	struct rb_node *node = root->rb_node;
+	struct tag_stat *found = NULL;
 
-	if (!ppi->item_index) {
-		if (ppi->item_index++ < ppi->items_to_skip)
-			return 0;
-		len = snprintf(ppi->outp, ppi->char_count,
-			       "idx iface acct_tag_hex uid_tag_int cnt_set "
-			       "rx_bytes rx_packets "
-			       "tx_bytes tx_packets "
-			       "rx_tcp_bytes rx_tcp_packets "
-			       "rx_udp_bytes rx_udp_packets "
-			       "rx_other_bytes rx_other_packets "
-			       "tx_tcp_bytes tx_tcp_packets "
-			       "tx_udp_bytes tx_udp_packets "
-			       "tx_other_bytes tx_other_packets\n");
-	} else {
-		tag_t tag = ppi->ts_entry->tn.tag;
-		uid_t stat_uid = get_uid_from_tag(tag);
-		/* Detailed tags are not available to everybody */
-		if (get_atag_from_tag(tag)
-		    && !can_read_other_uid_stats(stat_uid)) {
-			CT_DEBUG("qtaguid: stats line: "
-				 "%s 0x%llx %u: insufficient priv "
-				 "from pid=%u tgid=%u uid=%u stats.gid=%u\n",
-				 ppi->iface_entry->ifname,
-				 get_atag_from_tag(tag), stat_uid,
-				 current->pid, current->tgid, current_fsuid(),
-				 xt_qtaguid_stats_file->gid);
-			return 0;
+	while (node) {
+		struct tag_stat *data = rb_entry(node, struct tag_stat,
+						 tn.node);
+		int result = tag_compare(tag, data->tn.tag);
+		if (result < 0 || (inclusive && !result)) {
+			found = data;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
 		}
-		if (ppi->item_index++ < ppi->items_to_skip)
-			return 0;
-		cnts = &ppi->ts_entry->counters;
-		len = snprintf(
-			ppi->outp, ppi->char_count,
-			"%d %s 0x%llx %u %u "
-			"%llu %llu "
-			"%llu %llu "
-			"%llu %llu "
-			"%llu %llu "
-			"%llu %llu "
-			"%llu %llu "
-			"%llu %llu "
-			"%llu %llu\n",
-			ppi->item_index,
-			ppi->iface_entry->ifname,
-			get_atag_from_tag(tag),
-			stat_uid,
-			cnt_set,
-			dc_sum_bytes(cnts, cnt_set, IFS_RX),
-			dc_sum_packets(cnts, cnt_set, IFS_RX),
-			dc_sum_bytes(cnts, cnt_set, IFS_TX),
-			dc_sum_packets(cnts, cnt_set, IFS_TX),
-			cnts->bpc[cnt_set][IFS_RX][IFS_TCP].bytes,
-			cnts->bpc[cnt_set][IFS_RX][IFS_TCP].packets,
-			cnts->bpc[cnt_set][IFS_RX][IFS_UDP].bytes,
-			cnts->bpc[cnt_set][IFS_RX][IFS_UDP].packets,
-			cnts->bpc[cnt_set][IFS_RX][IFS_PROTO_OTHER].bytes,
-			cnts->bpc[cnt_set][IFS_RX][IFS_PROTO_OTHER].packets,
-			cnts->bpc[cnt_set][IFS_TX][IFS_TCP].bytes,
-			cnts->bpc[cnt_set][IFS_TX][IFS_TCP].packets,
-			cnts->bpc[cnt_set][IFS_TX][IFS_UDP].bytes,
-			cnts->bpc[cnt_set][IFS_TX][IFS_UDP].packets,
-			cnts->bpc[cnt_set][IFS_TX][IFS_PROTO_OTHER].bytes,
-			cnts->bpc[cnt_set][IFS_TX][IFS_PROTO_OTHER].packets);
 	}
-	return len;
+	return found;
 }
 
-static bool pp_sets(struct proc_print_info *ppi)
+static bool pp_stats_permitted(struct iface_stat *iface_entry, tag_t tag)
 {
-	int len;
-	int counter_set;
-	for (counter_set = 0; counter_set < IFS_MAX_COUNTER_SETS;
-	     counter_set++) {
-		len = pp_stats_line(ppi, counter_set);
-		if (len >= ppi->char_count) {
-			*ppi->outp = '\0';
-			return false;
-		}
-		if (len) {
-			ppi->outp += len;
-			ppi->char_count -= len;
-			(*ppi->num_items_returned)++;
-		}
+	uid_t stat_uid = get_uid_from_tag(tag);
+
+	/* Detailed tags are not available to everybody */
+	if (get_atag_from_tag(tag) && !can_read_other_uid_stats(stat_uid)) {
+		CT_DEBUG("qtaguid: stats line: "
+			 "%s 0x%llx %u: insufficient priv "
+			 "from pid=%u tgid=%u uid=%u stats.gid=%u\n",
+			 iface_entry->ifname,
+			 get_atag_from_tag(tag), stat_uid,
+			 current->pid, current->tgid, current_fsuid(),
+			 xt_qtaguid_stats_file->gid);
+		return false;
 	}
 	return true;
 }
 
 /*
- * Procfs reader to get all tag stats using style "1)" as described in
- * fs/proc/generic.c
- * Groups all protocols tx/rx bytes.
+ * Move the cursor to the next tag_stat the reader may see, starting with
+ * the first one of the first iface if the cursor has no iface yet.
  */
-static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
-				off_t items_to_skip, int char_count, int *eof,
-				void *data)
+static bool pp_stats_next_entry(struct proc_print_info *ppi)
 {
-	struct proc_print_info ppi;
-	int len;
+	struct iface_stat *iface_entry = ppi->iface_entry;
+	bool first = false;
+	struct tag_stat *ts_entry;
+	struct rb_node *node;
 
-	ppi.outp = page;
-	ppi.item_index = 0;
-	ppi.char_count = char_count;
-	ppi.num_items_returned = num_items_returned;
-	ppi.items_to_skip = items_to_skip;
+	spin_lock_bh(&iface_stat_list_lock);
+	if (!iface_entry) {
+		iface_entry = list_entry(iface_stat_list.next,
+					 struct iface_stat, list);
+		first = true;
+	}
+	for (; &iface_entry->list != &iface_stat_list;
+	     iface_entry = list_entry(iface_entry->list.next,
+				      struct iface_stat, list),
+	     first = true) {
+		spin_lock_bh(&iface_entry->tag_stat_list_lock);
+		ts_entry = tag_stat_tree_search_next(
+			&iface_entry->tag_stat_tree,
+			first ? 0 : ppi->tag, first);
+		for (node = ts_entry ? &ts_entry->tn.node : NULL;
+		     node;
+		     node = rb_next(node)) {
+			ts_entry = rb_entry(node, struct tag_stat, tn.node);
+			if (!pp_stats_permitted(iface_entry, ts_entry->tn.tag))
+				continue;
+			ppi->iface_entry = iface_entry;
+			ppi->tag = ts_entry->tn.tag;
+			dc_pcpu_fold(ts_entry->counters, &ppi->counters);
+			spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+			spin_unlock_bh(&iface_stat_list_lock);
+			return true;
+		}
+		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+	}
+	spin_unlock_bh(&iface_stat_list_lock);
+	return false;
+}
 
-	if (unlikely(module_passive)) {
-		len = pp_stats_line(&ppi, 0);
-		/* The header should always be shorter than the buffer. */
-		BUG_ON(len >= ppi.char_count);
-		(*num_items_returned)++;
-		*eof = 1;
-		return len;
+static void *qtaguid_stats_proc_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct proc_print_info *ppi = m->private;
+
+	(*pos)++;
+	ppi->pos = *pos;
+	ppi->valid = false;
+	if (unlikely(module_passive))
+		return NULL;
+
+	if (v == SEQ_START_TOKEN) {
+		ppi->iface_entry = NULL;
+		ppi->cnt_set = 0;
+		if (!pp_stats_next_entry(ppi))
+			return NULL;
+	} else if (++ppi->cnt_set >= IFS_MAX_COUNTER_SETS) {
+		ppi->cnt_set = 0;
+		if (!pp_stats_next_entry(ppi))
+			return NULL;
 	}
+	ppi->valid = true;
+	return ppi;
+}
 
-	CT_DEBUG("qtaguid:proc stats pid=%u tgid=%u uid=%u "
-		 "page=%p *num_items_returned=%p off=%ld "
-		 "char_count=%d *eof=%d\n",
-		 current->pid, current->tgid, current_fsuid(),
-		 page, *num_items_returned,
-		 items_to_skip, char_count, *eof);
+static void *qtaguid_stats_proc_start(struct seq_file *m, loff_t *pos)
+{
+	struct proc_print_info *ppi = m->private;
+	loff_t i = 0;
+	void *v;
 
-	if (*eof)
-		return 0;
+	CT_DEBUG("qtaguid:proc stats pid=%u tgid=%u uid=%u pos=%lld\n",
+		 current->pid, current->tgid, current_fsuid(), *pos);
 
-	/* The idx is there to help debug when things go belly up. */
-	len = pp_stats_line(&ppi, 0);
-	/* Don't advance the outp unless the whole line was printed */
-	if (len >= ppi.char_count) {
-		*ppi.outp = '\0';
-		return ppi.outp - page;
-	}
-	if (len) {
-		ppi.outp += len;
-		ppi.char_count -= len;
-		(*num_items_returned)++;
+	if (!ppi->pos || *pos < ppi->pos) {
+		v = SEQ_START_TOKEN;
+	} else {
+		/* Carry on from where the previous read() stopped */
+		v = ppi->valid ? ppi : NULL;
+		i = ppi->pos;
 	}
+	while (v && i < *pos)
+		v = qtaguid_stats_proc_next(m, v, &i);
+	return v;
+}
 
-	spin_lock_bh(&iface_stat_list_lock);
-	list_for_each_entry(ppi.iface_entry, &iface_stat_list, list) {
-		struct rb_node *node;
-		spin_lock_bh(&ppi.iface_entry->tag_stat_list_lock);
-		for (node = rb_first(&ppi.iface_entry->tag_stat_tree);
-		     node;
-		     node = rb_next(node)) {
-			ppi.ts_entry = rb_entry(node, struct tag_stat, tn.node);
-			if (!pp_sets(&ppi)) {
-				spin_unlock_bh(
-					&ppi.iface_entry->tag_stat_list_lock);
-				spin_unlock_bh(&iface_stat_list_lock);
-				return ppi.outp - page;
-			}
-		}
-		spin_unlock_bh(&ppi.iface_entry->tag_stat_list_lock);
+static void qtaguid_stats_proc_stop(struct seq_file *m, void *v)
+{
+}
+
+/* Groups all protocols tx/rx bytes. */
+static int qtaguid_stats_proc_show(struct seq_file *m, void *v)
+{
+	struct proc_print_info *ppi = v;
+	struct data_counters *cnts;
+	int cnt_set;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "idx iface acct_tag_hex uid_tag_int cnt_set "
+			 "rx_bytes rx_packets "
+			 "tx_bytes tx_packets "
+			 "rx_tcp_bytes rx_tcp_packets "
+			 "rx_udp_bytes rx_udp_packets "
+			 "rx_other_bytes rx_other_packets "
+			 "tx_tcp_bytes tx_tcp_packets "
+			 "tx_udp_bytes tx_udp_packets "
+			 "tx_other_bytes tx_other_packets\n");
+		return 0;
 	}
-	spin_unlock_bh(&iface_stat_list_lock);
 
-	*eof = 1;
-	return ppi.outp - page;
+	cnts = &ppi->counters;
+	cnt_set = ppi->cnt_set;
+	/* The idx is there to help debug when things go belly up. */
+	seq_printf(m, "%d %s 0x%llx %u %u "
+		   "%llu %llu "
+		   "%llu %llu "
+		   "%llu %llu "
+		   "%llu %llu "
+		   "%llu %llu "
+		   "%llu %llu "
+		   "%llu %llu "
+		   "%llu %llu\n",
+		   (int)ppi->pos + 1,
+		   ppi->iface_entry->ifname,
+		   get_atag_from_tag(ppi->tag),
+		   get_uid_from_tag(ppi->tag),
+		   cnt_set,
+		   dc_sum_bytes(cnts, cnt_set, IFS_RX),
+		   dc_sum_packets(cnts, cnt_set, IFS_RX),
+		   dc_sum_bytes(cnts, cnt_set, IFS_TX),
+		   dc_sum_packets(cnts, cnt_set, IFS_TX),
+		   cnts->bpc[cnt_set][IFS_RX][IFS_TCP].bytes,
+		   cnts->bpc[cnt_set][IFS_RX][IFS_TCP].packets,
+		   cnts->bpc[cnt_set][IFS_RX][IFS_UDP].bytes,
+		   cnts->bpc[cnt_set][IFS_RX][IFS_UDP].packets,
+		   cnts->bpc[cnt_set][IFS_RX][IFS_PROTO_OTHER].bytes,
+		   cnts->bpc[cnt_set][IFS_RX][IFS_PROTO_OTHER].packets,
+		   cnts->bpc[cnt_set][IFS_TX][IFS_TCP].bytes,
+		   cnts->bpc[cnt_set][IFS_TX][IFS_TCP].packets,
+		   cnts->bpc[cnt_set][IFS_TX][IFS_UDP].bytes,
+		   cnts->bpc[cnt_set][IFS_TX][IFS_UDP].packets,
+		   cnts->bpc[cnt_set][IFS_TX][IFS_PROTO_OTHER].bytes,
+		   cnts->bpc[cnt_set][IFS_TX][IFS_PROTO_OTHER].packets);
+	return 0;
 }
 
+static const struct seq_operations proc_qtaguid_stats_seqops = {
+	.start = qtaguid_stats_proc_start,
+	.next = qtaguid_stats_proc_next,
+	.stop = qtaguid_stats_proc_stop,
+	.show = qtaguid_stats_proc_show,
+};
+
+static int proc_qtaguid_stats_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &proc_qtaguid_stats_seqops,
+				sizeof(struct proc_print_info));
+}
+
+static const struct file_operations proc_qtaguid_stats_fops = {
+	.open		= proc_qtaguid_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release_private,
+};
+
 /*------------------------------------------*/
 static int qtudev_open(struct inode *inode, struct file *file)
 {
@@ -2886,7 +3158,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 
 	spin_unlock_bh(&uid_tag_data_tree_lock);
 	spin_unlock_bh(&sock_tag_list_lock);
-
+	qtu_cache_invalidate();
 
 	sock_tag_tree_erase(&st_to_free_tree);
 
@@ -2920,29 +3192,30 @@ static int __init qtaguid_proc_register(struct proc_dir_entry **res_procdir)
 		goto no_dir;
 	}
 
-	xt_qtaguid_ctrl_file = create_proc_entry("ctrl", proc_ctrl_perms,
-						*res_procdir);
+	xt_qtaguid_ctrl_file = proc_create_data("ctrl", proc_ctrl_perms,
+						*res_procdir,
+						&proc_qtaguid_ctrl_fops,
+						NULL);
 	if (!xt_qtaguid_ctrl_file) {
 		pr_err("qtaguid: failed to create xt_qtaguid/ctrl "
 			" file\n");
 		ret = -ENOMEM;
 		goto no_ctrl_entry;
 	}
-	xt_qtaguid_ctrl_file->read_proc = qtaguid_ctrl_proc_read;
-	xt_qtaguid_ctrl_file->write_proc = qtaguid_ctrl_proc_write;
 
-	xt_qtaguid_stats_file = create_proc_entry("stats", proc_stats_perms,
-						*res_procdir);
+	xt_qtaguid_stats_file = proc_create_data("stats", proc_stats_perms,
+						 *res_procdir,
+						 &proc_qtaguid_stats_fops,
+						 NULL);
 	if (!xt_qtaguid_stats_file) {
 		pr_err("qtaguid: failed to create xt_qtaguid/stats "
 			"file\n");
 		ret = -ENOMEM;
 		goto no_stats_entry;
 	}
-	xt_qtaguid_stats_file->read_proc = qtaguid_stats_proc_read;
 	/*
 	 * TODO: add support counter hacking
-	 * xt_qtaguid_stats_file->write_proc = qtaguid_stats_proc_write;
+	 * .write = qtaguid_stats_proc_write in proc_qtaguid_stats_fops
 	 */
 	return 0;
 
@@ -11,8 +11,12 @@
 #define __XT_QTAGUID_INTERNAL_H__
 
 #include <linux/types.h>
+#include <linux/cpumask.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
+#include <linux/string.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 
 /* Iface handling */
@@ -197,6 +201,39 @@ static inline uint64_t dc_sum_packets(struct data_counters *counters,
 		+ counters->bpc[set][direction][IFS_PROTO_OTHER].packets;
 }
 
+/*
+ * Counters are kept as an array of nr_cpu_ids slices. A packet is only
+ * accounted to the slice of the CPU handling it, without locking; readers
+ * fold the slices together with dc_pcpu_fold().
+ */
+struct data_counters_pcpu {
+	struct data_counters dc;
+	struct u64_stats_sync syncp;
+} ____cacheline_aligned_in_smp;
+
+static inline void dc_pcpu_fold(struct data_counters_pcpu *pcpu,
+				struct data_counters *sum)
+{
+	struct data_counters snap;
+	struct byte_packet_counters *src, *dst;
+	unsigned int start;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		do {
+			start = u64_stats_fetch_begin_bh(&pcpu[cpu].syncp);
+			snap = pcpu[cpu].dc;
+		} while (u64_stats_fetch_retry_bh(&pcpu[cpu].syncp, start));
+
+		src = &snap.bpc[0][0][0];
+		dst = &sum->bpc[0][0][0];
+		for (i = 0; i < sizeof(snap) / sizeof(*src); i++) {
+			dst[i].bytes += src[i].bytes;
+			dst[i].packets += src[i].packets;
+		}
+	}
+}
 
 /* Generic X based nodes used as a base for rb_tree ops */
 struct tag_node {
@@ -206,12 +243,14 @@ struct tag_node {
 
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
+	struct data_counters_pcpu *counters;
 	/*
 	 * If this tag is acct_tag based, we need to count against the
 	 * matching parent uid_tag.
 	 */
-	struct data_counters *parent_counters;
+	struct data_counters_pcpu *parent_counters;
+	/* The match may still be using a deleted entry through its cache */
+	struct rcu_head rcu;
 };
 
 struct iface_stat {
@@ -222,7 +261,7 @@ struct iface_stat {
 	struct net_device *net_dev;
 
 	struct byte_packet_counters totals_via_dev[IFS_MAX_DIRECTIONS];
-	struct data_counters totals_via_skb;
+	struct data_counters_pcpu *totals_via_skb;
 	/*
 	 * We keep the last_known, because some devices reset their counters
 	 * just before NETDEV_UP, while some will reset just before
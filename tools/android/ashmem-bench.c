@@ -0,0 +1,221 @@
+/*
+ * ashmem-bench.c -- ashmem pin/unpin throughput across concurrent threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * For 1..N threads in turn, every thread unpins and re-pins random page
+ * ranges of an ashmem region for a fixed time, touching each range once it
+ * is pinned again, the way cursor windows and bitmap caches do.  By default
+ * each thread has a region of its own, so threads only contend on state
+ * shared by all regions; with -s they all work on one region.  With -p a
+ * further thread purges all unpinned ranges every millisecond, so pinning
+ * also races with the shrinker path.  Pin/unpin pairs per second and the
+ * number of pins that found their range purged are reported.
+ *
+ * Build with the Makefile in this directory, or:
+ *   $(CROSS_COMPILE)gcc -O2 -static -o ashmem-bench ashmem-bench.c -lpthread
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+#include "../../include/linux/ashmem.h"
+
+#define MAX_RANGE_PAGES	8
+
+static const char *dev = "/dev/ashmem";
+static int max_threads = 4;
+static int seconds = 5;
+static size_t region_pages = 256;
+static int shared_region;
+static int with_purger;
+
+static volatile int stop;
+static long page_size;
+
+struct region {
+	int		fd;
+	char		*map;
+};
+
+struct worker {
+	pthread_t	thread;
+	struct region	*region;
+	unsigned int	seed;
+	unsigned long	pairs;
+	unsigned long	purged;
+	unsigned long	errors;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void region_open(struct region *r)
+{
+	size_t size = region_pages * page_size;
+
+	r->fd = open(dev, O_RDWR);
+	if (r->fd < 0)
+		die(dev);
+	if (ioctl(r->fd, ASHMEM_SET_NAME, "ashmem-bench") < 0)
+		die("ASHMEM_SET_NAME");
+	if (ioctl(r->fd, ASHMEM_SET_SIZE, size) < 0)
+		die("ASHMEM_SET_SIZE");
+	r->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      r->fd, 0);
+	if (r->map == MAP_FAILED)
+		die("mmap");
+	memset(r->map, 0, size);
+}
+
+static void region_close(struct region *r)
+{
+	munmap(r->map, region_pages * page_size);
+	close(r->fd);
+}
+
+static void *worker(void *data)
+{
+	struct worker *w = data;
+	struct ashmem_pin pin;
+	size_t first, pages;
+	int ret;
+
+	while (!stop) {
+		pages = 1 + rand_r(&w->seed) % MAX_RANGE_PAGES;
+		if (pages > region_pages)
+			pages = region_pages;
+		first = rand_r(&w->seed) % (region_pages - pages + 1);
+		pin.offset = first * page_size;
+		pin.len = pages * page_size;
+
+		if (ioctl(w->region->fd, ASHMEM_UNPIN, &pin) < 0) {
+			w->errors++;
+			continue;
+		}
+		ret = ioctl(w->region->fd, ASHMEM_PIN, &pin);
+		if (ret < 0) {
+			w->errors++;
+			continue;
+		}
+		if (ret == ASHMEM_WAS_PURGED)
+			w->purged++;
+		w->region->map[pin.offset] = 1;
+		w->pairs++;
+	}
+	return NULL;
+}
+
+static void *purger(void *data)
+{
+	struct region *r = data;
+
+	while (!stop) {
+		ioctl(r->fd, ASHMEM_PURGE_ALL_CACHES);
+		usleep(1000);
+	}
+	return NULL;
+}
+
+static void run(int nr)
+{
+	struct region *regions;
+	struct worker *w;
+	pthread_t pthread;
+	unsigned long pairs = 0, purged = 0, errors = 0;
+	int nr_regions = shared_region ? 1 : nr;
+	int i;
+
+	regions = calloc(nr_regions, sizeof(*regions));
+	w = calloc(nr, sizeof(*w));
+	if (!regions || !w)
+		die("calloc");
+	for (i = 0; i < nr_regions; i++)
+		region_open(&regions[i]);
+
+	stop = 0;
+	if (with_purger && pthread_create(&pthread, NULL, purger, &regions[0]))
+		die("pthread_create");
+	for (i = 0; i < nr; i++) {
+		w[i].region = &regions[shared_region ? 0 : i];
+		w[i].seed = i + 1;
+		if (pthread_create(&w[i].thread, NULL, worker, &w[i]))
+			die("pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(w[i].thread, NULL);
+		pairs += w[i].pairs;
+		purged += w[i].purged;
+		errors += w[i].errors;
+	}
+	if (with_purger)
+		pthread_join(pthread, NULL);
+	for (i = 0; i < nr_regions; i++)
+		region_close(&regions[i]);
+
+	printf("%3d %12lu %12lu %10lu %8lu\n", nr, pairs / seconds,
+	       pairs / seconds / nr, purged, errors);
+	free(w);
+	free(regions);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-n threads] [-t seconds] [-r pages] "
+		"[-s] [-p]\n"
+		"  -s  all threads share one region\n"
+		"  -p  purge unpinned ranges concurrently\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	while ((i = getopt(argc, argv, "d:n:t:r:sp")) != -1) {
+		switch (i) {
+		case 'd': dev = optarg; break;
+		case 'n': max_threads = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		case 'r': region_pages = strtoul(optarg, NULL, 0); break;
+		case 's': shared_region = 1; break;
+		case 'p': with_purger = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || seconds < 1 || region_pages < 1)
+		usage(argv[0]);
+	page_size = sysconf(_SC_PAGESIZE);
+
+	printf("%s, %zu page %s, %ds per run%s\n", dev, region_pages,
+	       shared_region ? "shared region" : "region per thread",
+	       seconds, with_purger ? ", with purger" : "");
+	printf("%3s %12s %12s %10s %8s\n",
+	       "thr", "pairs/s", "per thread", "purged", "errors");
+	for (i = 1; i <= max_threads; i++)
+		run(i);
+	return 0;
+}
@@ -0,0 +1,540 @@
+/*
+ * binder-bench.c -- concurrent binder transaction throughput and latency
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * One server process with a pool of looper threads answers transactions
+ * from N client processes, each hammering it for a fixed time.  Every
+ * client times each transaction (to BR_REPLY, or to BR_TRANSACTION_COMPLETE
+ * for one-way calls) and the totals are reported as transactions per second
+ * and p50/p90/p99/max latency.  Run it on the kernel before and after a
+ * binder locking change, with the same arguments, to compare.
+ *
+ * The server publishes itself to servicemanager as "binder_bench" (this
+ * needs root or the system uid); with -m it instead becomes the context
+ * manager itself, for systems where servicemanager is not running.
+ *
+ * Build with the Makefile in this directory, or:
+ *   $(CROSS_COMPILE)gcc -O2 -static -o binder-bench binder-bench.c -lpthread
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	((1024 * 1024) - (4096 * 2))
+#define SERVICE_NAME	"binder_bench"
+#define BENCH_CODE	B_PACK_CHARS('_', 'B', 'N', 'C')
+
+/* servicemanager protocol */
+#define SVC_MGR_CHECK_SERVICE	2
+#define SVC_MGR_ADD_SERVICE	3
+static const char svcmgr_id[] = "android.os.IServiceManager";
+
+/* latency histogram: 1us buckets, everything past the end in the last one */
+#define HIST_BUCKETS	65536
+
+struct result {
+	unsigned long	calls;
+	unsigned long	failed;
+	unsigned long	max_ns;
+	uint32_t	hist[HIST_BUCKETS];
+};
+
+struct conn {
+	int		fd;
+	void		*map;
+};
+
+static const char *dev = "/dev/binder";
+static int nr_clients = 2;
+static int nr_loopers = 4;
+static int seconds = 10;
+static size_t payload = 64;
+static int oneway;
+static int ctx_mgr;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void conn_open(struct conn *c)
+{
+	struct binder_version vers;
+
+	c->fd = open(dev, O_RDWR);
+	if (c->fd < 0)
+		die(dev);
+	if (ioctl(c->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			(long)vers.protocol_version,
+			BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	c->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE | MAP_NORESERVE,
+		      c->fd, 0);
+	if (c->map == MAP_FAILED)
+		die("mmap");
+}
+
+static int write_read(struct conn *c, void *wbuf, size_t wsize,
+		      void *rbuf, size_t rsize, size_t *consumed)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	bwr.write_size = wsize;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.read_size = rsize;
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+
+	do {
+		ret = ioctl(c->fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+
+	if (consumed)
+		*consumed = bwr.read_consumed;
+	return ret;
+}
+
+static void write_cmd(struct conn *c, uint32_t cmd, const void *arg,
+		      size_t size)
+{
+	uint32_t buf[8];
+
+	buf[0] = cmd;
+	memcpy(&buf[1], arg, size);
+	if (write_read(c, buf, sizeof(uint32_t) + size, NULL, 0, NULL) < 0)
+		die("BINDER_WRITE_READ");
+}
+
+/*
+ * Acknowledge the reference count changes the driver asks of a process
+ * owning a node; anything else that does not need an answer is skipped.
+ */
+static void handle_refs(struct conn *c, uint32_t cmd, void *arg)
+{
+	size_t size = sizeof(struct binder_ptr_cookie);
+
+	if (cmd == BR_INCREFS)
+		write_cmd(c, BC_INCREFS_DONE, arg, size);
+	else if (cmd == BR_ACQUIRE)
+		write_cmd(c, BC_ACQUIRE_DONE, arg, size);
+}
+
+/*
+ * Send a transaction to 'handle' and wait for BR_TRANSACTION_COMPLETE and,
+ * unless it is one-way, BR_REPLY.  The reply buffer is left mapped for the
+ * caller, who must hand it back with BC_FREE_BUFFER.  Returns 0, or -1 if
+ * the driver failed the transaction.
+ */
+static int transact(struct conn *c, uint32_t handle, uint32_t code,
+		    uint32_t flags, const void *data, size_t size,
+		    const size_t *offs, size_t offs_size,
+		    struct binder_transaction_data *reply)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data txn;
+	} __attribute__((packed)) wr;
+	uint32_t rbuf[64];
+	void *wbuf = &wr;
+	size_t wsize = sizeof(wr);
+
+	memset(&wr, 0, sizeof(wr));
+	wr.cmd = BC_TRANSACTION;
+	wr.txn.target.handle = handle;
+	wr.txn.code = code;
+	wr.txn.flags = flags;
+	wr.txn.data_size = size;
+	wr.txn.offsets_size = offs_size;
+	wr.txn.data.ptr.buffer = data;
+	wr.txn.data.ptr.offsets = offs;
+
+	for (;;) {
+		size_t consumed, pos = 0;
+
+		if (write_read(c, wbuf, wsize, rbuf, sizeof(rbuf),
+			       &consumed) < 0)
+			die("BINDER_WRITE_READ");
+		wbuf = NULL;
+		wsize = 0;
+
+		while (pos < consumed) {
+			uint32_t cmd = *(uint32_t *)((char *)rbuf + pos);
+			void *arg = (char *)rbuf + pos + sizeof(uint32_t);
+
+			pos += sizeof(uint32_t) + _IOC_SIZE(cmd);
+			switch (cmd) {
+			case BR_TRANSACTION_COMPLETE:
+				if (flags & TF_ONE_WAY)
+					return 0;
+				break;
+			case BR_REPLY:
+				memcpy(reply, arg, sizeof(*reply));
+				return 0;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				return -1;
+			default:
+				handle_refs(c, cmd, arg);
+				break;
+			}
+		}
+	}
+}
+
+static void free_buffer(struct conn *c, const void *buffer)
+{
+	write_cmd(c, BC_FREE_BUFFER, &buffer, sizeof(buffer));
+}
+
+/* minimal Parcel writer, enough for servicemanager's requests */
+struct parcel {
+	uint32_t	data[64];
+	size_t		len;
+	size_t		offs[1];
+	size_t		noffs;
+};
+
+static void put_u32(struct parcel *p, uint32_t v)
+{
+	p->data[p->len / 4] = v;
+	p->len += 4;
+}
+
+static void put_string16(struct parcel *p, const char *s)
+{
+	size_t i, n = strlen(s);
+	uint16_t *d;
+
+	put_u32(p, n);
+	d = (uint16_t *)((char *)p->data + p->len);
+	for (i = 0; i < n; i++)
+		d[i] = s[i];
+	d[n] = 0;
+	p->len += ((n + 1) * 2 + 3) & ~3;
+}
+
+static void put_header(struct parcel *p, const char *name)
+{
+	put_u32(p, 0);			/* strict mode policy */
+	put_string16(p, svcmgr_id);
+	put_string16(p, name);
+}
+
+static void add_service(struct conn *c, void *node)
+{
+	struct binder_transaction_data reply;
+	struct flat_binder_object *obj;
+	struct parcel p;
+
+	memset(&p, 0, sizeof(p));
+	put_header(&p, SERVICE_NAME);
+	obj = (struct flat_binder_object *)((char *)p.data + p.len);
+	obj->type = BINDER_TYPE_BINDER;
+	obj->flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	obj->binder = node;
+	obj->cookie = NULL;
+	p.offs[p.noffs++] = p.len;
+	p.len += sizeof(*obj);
+	put_u32(&p, 0);			/* allow isolated */
+
+	if (transact(c, 0, SVC_MGR_ADD_SERVICE, 0, p.data, p.len,
+		     p.offs, p.noffs * sizeof(size_t), &reply) < 0) {
+		fprintf(stderr, "add_service(%s) failed\n", SERVICE_NAME);
+		exit(1);
+	}
+	free_buffer(c, reply.data.ptr.buffer);
+}
+
+static uint32_t check_service(struct conn *c)
+{
+	struct binder_transaction_data reply;
+	const struct flat_binder_object *obj;
+	uint32_t handle;
+	struct parcel p;
+
+	memset(&p, 0, sizeof(p));
+	put_header(&p, SERVICE_NAME);
+
+	if (transact(c, 0, SVC_MGR_CHECK_SERVICE, 0, p.data, p.len,
+		     NULL, 0, &reply) < 0 ||
+	    reply.offsets_size < sizeof(size_t)) {
+		fprintf(stderr, "check_service(%s) failed\n", SERVICE_NAME);
+		exit(1);
+	}
+	obj = (const void *)((const char *)reply.data.ptr.buffer +
+			     *(const size_t *)reply.data.ptr.offsets);
+	handle = obj->handle;
+
+	/* keep the handle once the reply holding it is freed */
+	write_cmd(c, BC_ACQUIRE, &handle, sizeof(handle));
+	free_buffer(c, reply.data.ptr.buffer);
+	return handle;
+}
+
+static void *looper(void *data)
+{
+	struct conn *c = data;
+	struct {
+		uint32_t free_cmd;
+		const void *buffer;
+		uint32_t reply_cmd;
+		struct binder_transaction_data txn;
+	} __attribute__((packed)) wr;
+	uint32_t status = 0;
+	uint32_t rbuf[64];
+	size_t wsize = sizeof(uint32_t);
+
+	wr.free_cmd = BC_ENTER_LOOPER;
+
+	for (;;) {
+		size_t consumed, pos = 0;
+
+		if (write_read(c, &wr, wsize, rbuf, sizeof(rbuf),
+			       &consumed) < 0)
+			die("BINDER_WRITE_READ");
+		wsize = 0;
+
+		while (pos < consumed) {
+			uint32_t cmd = *(uint32_t *)((char *)rbuf + pos);
+			struct binder_transaction_data *txn =
+				(void *)((char *)rbuf + pos + sizeof(uint32_t));
+
+			pos += sizeof(uint32_t) + _IOC_SIZE(cmd);
+			if (cmd != BR_TRANSACTION) {
+				handle_refs(c, cmd, txn);
+				continue;
+			}
+
+			wr.free_cmd = BC_FREE_BUFFER;
+			wr.buffer = txn->data.ptr.buffer;
+			wsize = sizeof(uint32_t) + sizeof(void *);
+			if (txn->flags & TF_ONE_WAY)
+				continue;
+
+			wr.reply_cmd = BC_REPLY;
+			memset(&wr.txn, 0, sizeof(wr.txn));
+			wr.txn.data_size = sizeof(status);
+			wr.txn.data.ptr.buffer = &status;
+			wsize = sizeof(wr);
+		}
+	}
+	return NULL;
+}
+
+static void server(int ready)
+{
+	static int node;
+	pthread_t thread;
+	struct conn c;
+	int i;
+
+	conn_open(&c);
+	if (ctx_mgr) {
+		if (ioctl(c.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+			die("BINDER_SET_CONTEXT_MGR");
+	} else {
+		add_service(&c, &node);
+	}
+	i = nr_loopers;
+	if (ioctl(c.fd, BINDER_SET_MAX_THREADS, &i) < 0)
+		die("BINDER_SET_MAX_THREADS");
+
+	for (i = 0; i < nr_loopers; i++)
+		if (pthread_create(&thread, NULL, looper, &c))
+			die("pthread_create");
+
+	if (write(ready, "", 1) != 1)
+		die("write");
+	close(ready);
+	for (;;)
+		pause();
+}
+
+static void client(struct result *res)
+{
+	uint32_t flags = oneway ? TF_ONE_WAY : 0;
+	struct binder_transaction_data reply;
+	unsigned long long start, end, deadline;
+	uint32_t handle = 0;
+	struct conn c;
+	void *data;
+
+	conn_open(&c);
+	if (!ctx_mgr)
+		handle = check_service(&c);
+
+	data = calloc(1, payload ? payload : 1);
+	if (!data)
+		die("calloc");
+
+	deadline = now_ns() + seconds * 1000000000ULL;
+	do {
+		unsigned long us;
+
+		start = now_ns();
+		if (transact(&c, handle, BENCH_CODE, flags, data, payload,
+			     NULL, 0, &reply) < 0) {
+			res->failed++;
+			end = now_ns();
+			continue;
+		}
+		end = now_ns();
+		if (!oneway)
+			free_buffer(&c, reply.data.ptr.buffer);
+
+		res->calls++;
+		if (end - start > res->max_ns)
+			res->max_ns = end - start;
+		us = (end - start) / 1000;
+		res->hist[us < HIST_BUCKETS ? us : HIST_BUCKETS - 1]++;
+	} while (end < deadline);
+
+	exit(0);
+}
+
+static unsigned long percentile(const uint32_t *hist, unsigned long total,
+				unsigned int pct)
+{
+	unsigned long want = (total * pct + 99) / 100, seen = 0;
+	unsigned long i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= want)
+			return i;
+	}
+	return HIST_BUCKETS - 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-p clients] [-l loopers] [-t seconds]\n"
+		"          [-s payload] [-o] [-m]\n"
+		"  -o  one-way transactions\n"
+		"  -m  be the context manager, not a servicemanager client\n",
+		argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct result *res, total;
+	unsigned long b;
+	pid_t srv;
+	int pipefd[2];
+	char c;
+	int i;
+
+	while ((i = getopt(argc, argv, "d:p:l:t:s:om")) != -1) {
+		switch (i) {
+		case 'd': dev = optarg; break;
+		case 'p': nr_clients = atoi(optarg); break;
+		case 'l': nr_loopers = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		case 's': payload = strtoul(optarg, NULL, 0); break;
+		case 'o': oneway = 1; break;
+		case 'm': ctx_mgr = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (nr_clients < 1 || nr_loopers < 1 || seconds < 1)
+		usage(argv[0]);
+
+	res = mmap(NULL, nr_clients * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		die("mmap");
+
+	if (pipe(pipefd) < 0)
+		die("pipe");
+	srv = fork();
+	if (srv < 0)
+		die("fork");
+	if (!srv) {
+		close(pipefd[0]);
+		server(pipefd[1]);
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_clients; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			client(&res[i]);
+	}
+	for (i = 0; i < nr_clients; i++)
+		wait(NULL);
+	kill(srv, SIGTERM);
+	waitpid(srv, NULL, 0);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nr_clients; i++) {
+		total.calls += res[i].calls;
+		total.failed += res[i].failed;
+		if (res[i].max_ns > total.max_ns)
+			total.max_ns = res[i].max_ns;
+		for (b = 0; b < HIST_BUCKETS; b++)
+			total.hist[b] += res[i].hist[b];
+	}
+	if (!total.calls) {
+		fprintf(stderr, "no transactions completed\n");
+		return 1;
+	}
+
+	printf("%d clients, %d loopers, %zu byte %s transactions, %ds\n",
+	       nr_clients, nr_loopers, payload, oneway ? "one-way" : "two-way",
+	       seconds);
+	printf("throughput: %lu txn/s (%lu failed)\n",
+	       total.calls / seconds, total.failed);
+	printf("latency us: p50 %lu  p90 %lu  p99 %lu  max %lu\n",
+	       percentile(total.hist, total.calls, 50),
+	       percentile(total.hist, total.calls, 90),
+	       percentile(total.hist, total.calls, 99),
+	       total.max_ns / 1000);
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * logger-bench.c -- logger write throughput across concurrent writers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * For 1..N writer threads in turn, every thread writes entries laid out the
+ * way liblog writes them (priority, tag, message) to a log device for a
+ * fixed time.  Writes per second are reported for each thread count, so
+ * a kernel where writers serialise shows flat throughput as threads are
+ * added.  With -r, a reader drains the log at the same time, which keeps
+ * fix_up_readers() and the reader paths busy too.
+ *
+ * Build with the Makefile in this directory, or:
+ *   $(CROSS_COMPILE)gcc -O2 -static -o logger-bench logger-bench.c -lpthread
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define LOG_PRIO_INFO	4
+
+/* as in drivers/staging/android/logger.h */
+#define LOGGER_ENTRY_MAX_PAYLOAD	4076
+#define LOGGER_ENTRY_MAX_LEN		(5 * 1024)
+
+static const char *dev = "/dev/log/main";
+static int max_threads = 4;
+static int seconds = 5;
+static size_t msg_len = 100;
+static int with_reader;
+
+static volatile int stop;
+
+struct writer {
+	pthread_t	thread;
+	int		fd;
+	unsigned long	writes;
+	unsigned long	errors;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *writer(void *data)
+{
+	struct writer *w = data;
+	unsigned char prio = LOG_PRIO_INFO;
+	char tag[] = "logger-bench";
+	char *msg;
+	struct iovec vec[3];
+
+	msg = malloc(msg_len + 1);
+	if (!msg)
+		die("malloc");
+	memset(msg, 'x', msg_len);
+	msg[msg_len] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = tag;
+	vec[1].iov_len = sizeof(tag);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_len + 1;
+
+	while (!stop) {
+		if (writev(w->fd, vec, 3) < 0)
+			w->errors++;
+		else
+			w->writes++;
+	}
+	free(msg);
+	return NULL;
+}
+
+static void *reader(void *data)
+{
+	int fd = *(int *)data;
+	char buf[LOGGER_ENTRY_MAX_LEN + 1];
+
+	/* the log is opened non-blocking, so idle readers spin: that's fine */
+	while (!stop)
+		if (read(fd, buf, sizeof(buf)) < 0 && errno != EAGAIN)
+			break;
+	return NULL;
+}
+
+static void run(int nr)
+{
+	struct writer *w;
+	pthread_t rthread;
+	unsigned long writes = 0, errors = 0;
+	int rfd = -1;
+	int i;
+
+	w = calloc(nr, sizeof(*w));
+	if (!w)
+		die("calloc");
+
+	if (with_reader) {
+		rfd = open(dev, O_RDONLY | O_NONBLOCK);
+		if (rfd < 0)
+			die(dev);
+		if (pthread_create(&rthread, NULL, reader, &rfd))
+			die("pthread_create");
+	}
+
+	stop = 0;
+	for (i = 0; i < nr; i++) {
+		w[i].fd = open(dev, O_WRONLY);
+		if (w[i].fd < 0)
+			die(dev);
+		if (pthread_create(&w[i].thread, NULL, writer, &w[i]))
+			die("pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(w[i].thread, NULL);
+		close(w[i].fd);
+		writes += w[i].writes;
+		errors += w[i].errors;
+	}
+	if (with_reader) {
+		pthread_join(rthread, NULL);
+		close(rfd);
+	}
+
+	printf("%3d %12lu %12lu %8lu\n", nr, writes / seconds,
+	       writes / seconds / nr, errors);
+	free(w);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-n threads] [-t seconds] [-s len] [-r]\n"
+		"  -r  drain the log with a concurrent reader\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	while ((i = getopt(argc, argv, "d:n:t:s:r")) != -1) {
+		switch (i) {
+		case 'd': dev = optarg; break;
+		case 'n': max_threads = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		case 's': msg_len = strtoul(optarg, NULL, 0); break;
+		case 'r': with_reader = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || seconds < 1 ||
+	    msg_len > LOGGER_ENTRY_MAX_PAYLOAD)
+		usage(argv[0]);
+
+	printf("%s, %zu byte messages, %ds per run%s\n", dev, msg_len,
+	       seconds, with_reader ? ", with reader" : "");
+	printf("%3s %12s %12s %8s\n",
+	       "thr", "writes/s", "per thread", "errors");
+	for (i = 1; i <= max_threads; i++)
+		run(i);
+	return 0;
+}
@@ -0,0 +1,2 @@
+/* userspace stand-in, see linux/interactive-shim.h */
+#include <linux/interactive-shim.h>
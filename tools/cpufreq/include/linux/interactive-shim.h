@@ -0,0 +1,423 @@
+/*
+ * interactive-shim.h -- the kernel API used by cpufreq_interactive.c, for a
+ * userspace build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * Only what cpufreq_interactive.c needs is provided.  The replay harness is
+ * single threaded and calls into the governor from its simulated timer,
+ * idle and input events, so the locks are no-ops.  Everything that reaches
+ * outside the governor (timers, the idle and transition notifiers, the
+ * speed change thread, sysfs, the input core and the cpufreq core) is
+ * implemented by interactive-replay.c.
+ */
+#ifndef _INTERACTIVE_SHIM_H
+#define _INTERACTIVE_SHIM_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define NR_CPUS		4
+
+#define __init
+#define __exit
+#define THIS_MODULE	NULL
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define module_init(fn)	int (*shim_module_init)(void) = fn
+#define module_exit(fn)	void (*shim_module_exit)(void) = fn
+#define fs_initcall(fn)	module_init(fn)
+
+#define pr_warn(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+#define WARN_ON_ONCE(cond)	({					\
+	static bool __warned;						\
+	int __ret = !!(cond);						\
+	if (__ret && !__warned) {					\
+		fprintf(stderr, "WARN_ON_ONCE(%s) at %s:%d\n", #cond,	\
+			__FILE__, __LINE__);				\
+		__warned = true;					\
+	}								\
+	__ret;								\
+})
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define __stringify(x)	#x
+
+#define IS_ERR(ptr)	((unsigned long)(ptr) >= (unsigned long)-4095)
+#define PTR_ERR(ptr)	((long)(ptr))
+
+#define do_div(n, base)	({						\
+	u32 __base = (base);						\
+	u32 __rem = (n) % __base;					\
+	(n) /= __base;							\
+	__rem;								\
+})
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+	return dividend / divisor;
+}
+
+/* cpus, all of them online; smp_processor_id() is set by the harness */
+extern int shim_cpu;
+extern unsigned int shim_nr_cpus;
+#define smp_processor_id()	shim_cpu
+#define cpu_online(cpu)		((unsigned int)(cpu) < shim_nr_cpus)
+
+typedef struct cpumask {
+	unsigned long bits;
+} cpumask_t;
+typedef cpumask_t cpumask_var_t[1];
+
+static inline void cpumask_set_cpu(unsigned int cpu, cpumask_t *mask)
+{
+	mask->bits |= 1UL << cpu;
+}
+
+static inline int cpumask_test_cpu(unsigned int cpu, const cpumask_t *mask)
+{
+	return !!(mask->bits & (1UL << cpu));
+}
+
+static inline void cpumask_clear(cpumask_t *mask)
+{
+	mask->bits = 0;
+}
+
+static inline int cpumask_empty(const cpumask_t *mask)
+{
+	return !mask->bits;
+}
+
+#define for_each_cpu(cpu, mask)						\
+	for ((cpu) = 0; (cpu) < NR_CPUS; (cpu)++)			\
+		if (!cpumask_test_cpu(cpu, mask)) ; else
+#define for_each_possible_cpu(cpu)					\
+	for ((cpu) = 0; (cpu) < shim_nr_cpus; (cpu)++)
+#define for_each_online_cpu(cpu)	for_each_possible_cpu(cpu)
+
+#define DEFINE_PER_CPU(type, name)	__typeof__(type) name[NR_CPUS]
+#define per_cpu(var, cpu)		((var)[cpu])
+
+/* locking */
+typedef int spinlock_t;
+#define spin_lock_init(lock)			((void)(lock))
+#define spin_lock_irqsave(lock, flags)		((void)(lock), (flags) = 0)
+#define spin_unlock_irqrestore(lock, flags)	((void)(lock), (void)(flags))
+
+struct mutex {
+	int locked;
+};
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_lock(m)		((m)->locked++)
+#define mutex_unlock(m)		((m)->locked--)
+
+struct rw_semaphore {
+	int count;
+};
+#define init_rwsem(sem)		((sem)->count = 0)
+#define down_read_trylock(sem)	((sem)->count >= 0 ? ++(sem)->count : 0)
+#define up_read(sem)		((sem)->count--)
+#define down_write(sem)		((sem)->count = -1)
+#define up_write(sem)		((sem)->count = 0)
+
+/* time, as simulated by the harness */
+#define USEC_PER_MSEC	1000L
+#define USEC_PER_SEC	1000000L
+
+extern unsigned int shim_hz;
+extern unsigned long jiffies;
+#define HZ		shim_hz
+
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+
+static inline unsigned long usecs_to_jiffies(unsigned int u)
+{
+	return ((u64)u * HZ + USEC_PER_SEC - 1) / USEC_PER_SEC;
+}
+
+typedef s64 ktime_t;
+ktime_t ktime_get(void);
+#define ktime_to_us(kt)	((kt) / 1000)
+
+u64 get_cpu_idle_time_us(int cpu, u64 *last_update_time);
+
+/* timers; deferrable ones do not wake an idle cpu */
+struct timer_list {
+	unsigned long expires;
+	void (*function)(unsigned long);
+	unsigned long data;
+	bool deferrable;
+	bool pending;
+	int cpu;
+};
+
+void shim_init_timer(struct timer_list *timer, bool deferrable);
+#define init_timer(timer)		shim_init_timer(timer, false)
+#define init_timer_deferrable(timer)	shim_init_timer(timer, true)
+void add_timer_on(struct timer_list *timer, int cpu);
+int mod_timer_pinned(struct timer_list *timer, unsigned long expires);
+int del_timer(struct timer_list *timer);
+#define del_timer_sync(timer)	del_timer(timer)
+
+static inline int timer_pending(const struct timer_list *timer)
+{
+	return timer->pending;
+}
+
+/*
+ * Threads.  A woken thread is run by the harness until it sleeps again;
+ * kthread_should_stop() is true so that it then returns.
+ */
+struct task_struct {
+	int (*threadfn)(void *data);
+	void *data;
+	bool woken;
+};
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+#define set_current_state(state)	do { } while (0)
+#define schedule()			do { } while (0)
+#define kthread_should_stop()		1
+
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data,
+				   const char *name);
+int kthread_stop(struct task_struct *task);
+int wake_up_process(struct task_struct *task);
+#define get_task_struct(task)	do { } while (0)
+#define put_task_struct(task)	do { } while (0)
+
+struct sched_param {
+	int sched_priority;
+};
+#define MAX_RT_PRIO	100
+#define SCHED_FIFO	1
+
+static inline int sched_setscheduler_nocheck(struct task_struct *task,
+					     int policy,
+					     const struct sched_param *param)
+{
+	return 0;
+}
+
+/* notifiers */
+struct notifier_block {
+	int (*notifier_call)(struct notifier_block *nb, unsigned long val,
+			     void *data);
+	struct notifier_block *next;
+	int priority;
+};
+
+#define IDLE_START	1
+#define IDLE_END	2
+void idle_notifier_register(struct notifier_block *nb);
+void idle_notifier_unregister(struct notifier_block *nb);
+
+/* sysfs */
+struct kobject {
+	const char *name;
+};
+
+struct attribute {
+	const char *name;
+	unsigned short mode;
+};
+
+struct attribute_group {
+	const char *name;
+	struct attribute **attrs;
+};
+
+#define __ATTR(_name, _mode, _show, _store) {				\
+	.attr = { .name = __stringify(_name), .mode = _mode },		\
+	.show = _show,							\
+	.store = _store,						\
+}
+
+#define S_IRUGO		0444
+#define S_IWUSR		0200
+
+int sysfs_create_group(struct kobject *kobj,
+		       const struct attribute_group *grp);
+void sysfs_remove_group(struct kobject *kobj,
+			const struct attribute_group *grp);
+
+static inline int kstrtoul(const char *s, unsigned int base,
+			   unsigned long *res)
+{
+	char *end;
+
+	errno = 0;
+	*res = strtoul(s, &end, base);
+	if (errno || end == s || (*end && *end != '\n'))
+		return -EINVAL;
+	return 0;
+}
+
+static inline int kstrtol(const char *s, unsigned int base, long *res)
+{
+	char *end;
+
+	errno = 0;
+	*res = strtol(s, &end, base);
+	if (errno || end == s || (*end && *end != '\n'))
+		return -EINVAL;
+	return 0;
+}
+
+#define strict_strtoul	kstrtoul
+
+/* slab */
+#define GFP_KERNEL	0
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+
+/* cpufreq core */
+struct cpufreq_policy {
+	cpumask_var_t cpus;
+	unsigned int cpu;
+	unsigned int min;
+	unsigned int max;
+	unsigned int cur;
+};
+
+struct cpufreq_governor {
+	char name[16];
+	int (*governor)(struct cpufreq_policy *policy, unsigned int event);
+	unsigned int max_transition_latency;
+	void *owner;
+};
+
+struct cpufreq_freqs {
+	unsigned int cpu;
+	unsigned int old;
+	unsigned int new;
+	u8 flags;
+};
+
+struct cpufreq_frequency_table {
+	unsigned int index;
+	unsigned int frequency;
+};
+
+#define CPUFREQ_ENTRY_INVALID	~0
+#define CPUFREQ_TABLE_END	~1
+
+#define CPUFREQ_RELATION_L	0
+#define CPUFREQ_RELATION_H	1
+
+#define CPUFREQ_GOV_START	1
+#define CPUFREQ_GOV_STOP	2
+#define CPUFREQ_GOV_LIMITS	3
+
+#define CPUFREQ_PRECHANGE	0
+#define CPUFREQ_POSTCHANGE	1
+#define CPUFREQ_TRANSITION_NOTIFIER	0
+
+struct global_attr {
+	struct attribute attr;
+	ssize_t (*show)(struct kobject *kobj,
+			struct attribute *attr, char *buf);
+	ssize_t (*store)(struct kobject *a, struct attribute *b,
+			 const char *c, size_t count);
+};
+
+#define define_one_global_rw(_name)			\
+static struct global_attr _name =			\
+__ATTR(_name, 0644, show_##_name, store_##_name)
+
+extern struct kobject *cpufreq_global_kobject;
+
+int cpufreq_register_governor(struct cpufreq_governor *governor);
+void cpufreq_unregister_governor(struct cpufreq_governor *governor);
+int cpufreq_register_notifier(struct notifier_block *nb, unsigned int list);
+int cpufreq_unregister_notifier(struct notifier_block *nb,
+				unsigned int list);
+int __cpufreq_driver_target(struct cpufreq_policy *policy,
+			    unsigned int target_freq, unsigned int relation);
+int cpufreq_frequency_table_target(struct cpufreq_policy *policy,
+				   struct cpufreq_frequency_table *table,
+				   unsigned int target_freq,
+				   unsigned int relation,
+				   unsigned int *index);
+struct cpufreq_frequency_table *cpufreq_frequency_get_table(unsigned int cpu);
+
+/* input core */
+#define BITS_PER_LONG		(8 * sizeof(long))
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+#define EV_SYN			0x00
+#define EV_ABS			0x03
+#define EV_CNT			0x20
+#define BTN_TOUCH		0x14a
+#define KEY_CNT			0x300
+#define ABS_X			0x00
+#define ABS_MT_POSITION_X	0x35
+#define ABS_CNT			0x40
+
+#define INPUT_DEVICE_ID_MATCH_EVBIT	0x0010
+#define INPUT_DEVICE_ID_MATCH_KEYBIT	0x0020
+#define INPUT_DEVICE_ID_MATCH_ABSBIT	0x0080
+
+struct input_device_id {
+	unsigned long flags;
+	unsigned long evbit[BITS_TO_LONGS(EV_CNT)];
+	unsigned long keybit[BITS_TO_LONGS(KEY_CNT)];
+	unsigned long absbit[BITS_TO_LONGS(ABS_CNT)];
+};
+
+struct input_dev {
+	const char *name;
+};
+
+struct input_handler;
+
+struct input_handle {
+	const char *name;
+	struct input_dev *dev;
+	struct input_handler *handler;
+};
+
+struct input_handler {
+	void (*event)(struct input_handle *handle, unsigned int type,
+		      unsigned int code, int value);
+	int (*connect)(struct input_handler *handler, struct input_dev *dev,
+		       const struct input_device_id *id);
+	void (*disconnect)(struct input_handle *handle);
+	const char *name;
+	const struct input_device_id *id_table;
+};
+
+int input_register_handler(struct input_handler *handler);
+void input_unregister_handler(struct input_handler *handler);
+int input_register_handle(struct input_handle *handle);
+void input_unregister_handle(struct input_handle *handle);
+#define input_open_device(handle)	0
+#define input_close_device(handle)	do { } while (0)
+
+#endif
@@ -0,0 +1,2 @@
+/* userspace stand-in, see interactive-shim.h */
+#include "interactive-shim.h"
@@ -0,0 +1,12 @@
+/* userspace stand-in: the replay harness keeps its own statistics */
+#ifndef _TRACE_CPUFREQ_INTERACTIVE_H
+#define _TRACE_CPUFREQ_INTERACTIVE_H
+
+#define trace_cpufreq_interactive_setspeed(...)	do { } while (0)
+#define trace_cpufreq_interactive_target(...)	do { } while (0)
+#define trace_cpufreq_interactive_already(...)	do { } while (0)
+#define trace_cpufreq_interactive_notyet(...)	do { } while (0)
+#define trace_cpufreq_interactive_boost(...)	do { } while (0)
+#define trace_cpufreq_interactive_unboost(...)	do { } while (0)
+
+#endif
@@ -0,0 +1,827 @@
+/*
+ * interactive-replay.c -- replay load traces through the interactive governor
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * drivers/cpufreq/cpufreq_interactive.c is built unmodified against the
+ * stand-ins in include/ and run on simulated CPUs that share one clock, as
+ * the OMAP4 MPU cores do.  The harness plays the parts of the timer core
+ * (deferrable timers only run on a busy CPU or one woken by another timer),
+ * the idle loop notifiers, the speed change thread, the cpufreq core and
+ * the input core.  The trace is read from a file or stdin, one event per
+ * line, times in microseconds:
+ *
+ *	<time> w <cpu> <cycles> <deadline>	work of <cycles> arrives on
+ *						<cpu>, due <deadline> us later
+ *	<time> i				touchscreen event
+ *	<time> b				write to boostpulse
+ *	# ...					comment
+ *
+ * Each CPU runs its work first come, first served at the current speed.
+ * Reported are the jobs that finished after their deadline and by how
+ * much, the number of speed changes, and an energy proxy: the sum over all
+ * executed cycles of the square of the voltage they ran at, relative to
+ * running every cycle at the lowest OPP.  With -v the time and cycles
+ * spent at each OPP are listed as well.  Leakage and transition latency
+ * are not modelled.
+ *
+ * Governor tunables are set through the governor's own sysfs store
+ * functions with -o, so settings can be compared on the same trace:
+ *
+ *	./interactive-replay -g 60 > trace
+ *	for w in 0 25 50 75; do
+ *		./interactive-replay -o predict_weight=$w trace
+ *	done
+ *
+ * With -g, a synthetic trace of the given number of seconds is written to
+ * stdout instead: touch gestures that each drive a run of 60 fps frames,
+ * with light background work in between.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+
+#include <linux/interactive-shim.h>
+
+#define MAX_TIMERS	(2 * NR_CPUS)
+#define MAX_OPPS	8
+#define MAX_OPTIONS	16
+
+/* MPU OPPs from arch/arm/mach-omap2/opp4xxx_data.c, Nitro ones included */
+struct opp {
+	unsigned int	khz;
+	unsigned int	uv;
+};
+
+static const struct {
+	const char	*name;
+	struct opp	opps[MAX_OPPS];
+} socs[] = {
+	{ "4430", { { 300000, 1025000 }, { 600000, 1200000 },
+		    { 800000, 1325000 }, { 1008000, 1388000 },
+		    { 1200000, 1398000 } } },
+	{ "4460", { { 350000, 1025000 }, { 700000, 1203000 },
+		    { 920000, 1317000 }, { 1200000, 1380000 },
+		    { 1500000, 1390000 } } },
+	{ "4470", { { 396800, 1025000 }, { 800000, 1200000 },
+		    { 1100000, 1312000 }, { 1300000, 1375000 },
+		    { 1500000, 1380000 } } },
+};
+
+/* state the stand-ins share with the governor */
+int shim_cpu;
+unsigned int shim_nr_cpus = 2;
+unsigned int shim_hz = 128;	/* OMAP_32K_TIMER_HZ */
+unsigned long jiffies;
+static struct kobject global_kobject = { .name = "cpufreq" };
+struct kobject *cpufreq_global_kobject = &global_kobject;
+
+extern int (*shim_module_init)(void);
+extern void (*shim_module_exit)(void);
+
+static struct cpufreq_governor *governor;
+static struct cpufreq_policy policy;
+static struct cpufreq_frequency_table freq_table[MAX_OPPS + 1];
+static const struct opp *opps;
+static unsigned int nr_opps;
+
+static struct timer_list *timers[MAX_TIMERS];
+static unsigned int nr_timers;
+static struct task_struct thread;
+static struct notifier_block *idle_nb, *transition_nb;
+static const struct attribute_group *attr_group;
+static struct input_handler *input_handler;
+static struct input_handle *input_handle;
+static struct input_dev touchscreen = { .name = "touchscreen" };
+
+/* simulated clock, ns */
+static u64 now;
+
+struct job {
+	u64		arrival;
+	u64		deadline;
+	u64		cycles;		/* left to run */
+	struct job	*next;
+};
+
+static struct sim_cpu {
+	struct job	*head, *tail;
+	bool		busy;
+	u64		idle_ns;	/* before idle_since */
+	u64		idle_since;
+} cpus[NR_CPUS];
+
+static struct {
+	unsigned long	jobs;
+	unsigned long	missed;
+	u64		late_ns;
+	u64		max_late_ns;
+	unsigned long	transitions;
+	double		busy_ns[MAX_OPPS];	/* summed over cpus */
+	double		cycles[MAX_OPPS];
+} st;
+
+static void die(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+/* clock */
+
+ktime_t ktime_get(void)
+{
+	return now;
+}
+
+u64 get_cpu_idle_time_us(int cpu, u64 *last_update_time)
+{
+	struct sim_cpu *c = &cpus[cpu];
+	u64 idle = c->idle_ns;
+
+	if (!c->busy)
+		idle += now - c->idle_since;
+	*last_update_time = now / 1000;
+	return idle / 1000;
+}
+
+/* timers */
+
+void shim_init_timer(struct timer_list *timer, bool deferrable)
+{
+	if (nr_timers == MAX_TIMERS)
+		die("too many timers\n");
+	memset(timer, 0, sizeof(*timer));
+	timer->deferrable = deferrable;
+	timers[nr_timers++] = timer;
+}
+
+void add_timer_on(struct timer_list *timer, int cpu)
+{
+	timer->cpu = cpu;
+	timer->pending = true;
+}
+
+int mod_timer_pinned(struct timer_list *timer, unsigned long expires)
+{
+	int was_pending = timer->pending;
+
+	timer->expires = expires;
+	timer->cpu = smp_processor_id();
+	timer->pending = true;
+	return was_pending;
+}
+
+int del_timer(struct timer_list *timer)
+{
+	int was_pending = timer->pending;
+
+	timer->pending = false;
+	return was_pending;
+}
+
+/* speed change thread */
+
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data,
+				   const char *name)
+{
+	thread.threadfn = threadfn;
+	thread.data = data;
+	return &thread;
+}
+
+int kthread_stop(struct task_struct *task)
+{
+	task->threadfn = NULL;
+	return 0;
+}
+
+int wake_up_process(struct task_struct *task)
+{
+	task->woken = true;
+	return 1;
+}
+
+static void run_thread(void)
+{
+	while (thread.woken && thread.threadfn) {
+		thread.woken = false;
+		thread.threadfn(thread.data);
+	}
+}
+
+/* notifiers */
+
+void idle_notifier_register(struct notifier_block *nb)
+{
+	idle_nb = nb;
+}
+
+void idle_notifier_unregister(struct notifier_block *nb)
+{
+	idle_nb = NULL;
+}
+
+static void idle_notify(int cpu, unsigned long val)
+{
+	shim_cpu = cpu;
+	if (idle_nb)
+		idle_nb->notifier_call(idle_nb, val, NULL);
+	run_thread();
+}
+
+int cpufreq_register_notifier(struct notifier_block *nb, unsigned int list)
+{
+	transition_nb = nb;
+	return 0;
+}
+
+int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
+{
+	transition_nb = NULL;
+	return 0;
+}
+
+/* sysfs */
+
+int sysfs_create_group(struct kobject *kobj,
+		       const struct attribute_group *grp)
+{
+	attr_group = grp;
+	return 0;
+}
+
+void sysfs_remove_group(struct kobject *kobj,
+			const struct attribute_group *grp)
+{
+	attr_group = NULL;
+}
+
+static int store_tunable(const char *name, const char *val)
+{
+	struct attribute **attr;
+	struct global_attr *ga;
+	ssize_t ret;
+
+	for (attr = attr_group ? attr_group->attrs : NULL; attr && *attr;
+	     attr++) {
+		if (strcmp((*attr)->name, name))
+			continue;
+		ga = container_of(*attr, struct global_attr, attr);
+		if (!ga->store)
+			return -EPERM;
+		ret = ga->store(cpufreq_global_kobject, *attr, val,
+				strlen(val));
+		return ret < 0 ? ret : 0;
+	}
+	return -ENOENT;
+}
+
+/* input core, with one touchscreen */
+
+int input_register_handler(struct input_handler *handler)
+{
+	input_handler = handler;
+	return handler->connect(handler, &touchscreen, handler->id_table);
+}
+
+void input_unregister_handler(struct input_handler *handler)
+{
+	if (input_handle)
+		handler->disconnect(input_handle);
+	input_handler = NULL;
+}
+
+int input_register_handle(struct input_handle *handle)
+{
+	input_handle = handle;
+	return 0;
+}
+
+void input_unregister_handle(struct input_handle *handle)
+{
+	input_handle = NULL;
+}
+
+static void touch(void)
+{
+	if (!input_handler || !input_handle)
+		return;
+	shim_cpu = 0;
+	input_handler->event(input_handle, EV_ABS, ABS_MT_POSITION_X, 100);
+	input_handler->event(input_handle, EV_SYN, 0, 0);
+	run_thread();
+}
+
+/* cpufreq core */
+
+int cpufreq_register_governor(struct cpufreq_governor *gov)
+{
+	governor = gov;
+	return 0;
+}
+
+void cpufreq_unregister_governor(struct cpufreq_governor *gov)
+{
+	governor = NULL;
+}
+
+struct cpufreq_frequency_table *cpufreq_frequency_get_table(unsigned int cpu)
+{
+	return freq_table;
+}
+
+/* as drivers/cpufreq/freq_table.c */
+int cpufreq_frequency_table_target(struct cpufreq_policy *policy,
+				   struct cpufreq_frequency_table *table,
+				   unsigned int target_freq,
+				   unsigned int relation,
+				   unsigned int *index)
+{
+	struct cpufreq_frequency_table optimal = { .index = ~0 };
+	struct cpufreq_frequency_table suboptimal = { .index = ~0 };
+	unsigned int i, freq;
+
+	if (relation == CPUFREQ_RELATION_H)
+		suboptimal.frequency = ~0;
+	else
+		optimal.frequency = ~0;
+
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		freq = table[i].frequency;
+		if (freq < policy->min || freq > policy->max)
+			continue;
+		if (relation == CPUFREQ_RELATION_H) {
+			if (freq <= target_freq) {
+				if (freq >= optimal.frequency) {
+					optimal.frequency = freq;
+					optimal.index = i;
+				}
+			} else if (freq <= suboptimal.frequency) {
+				suboptimal.frequency = freq;
+				suboptimal.index = i;
+			}
+		} else {
+			if (freq >= target_freq) {
+				if (freq <= optimal.frequency) {
+					optimal.frequency = freq;
+					optimal.index = i;
+				}
+			} else if (freq >= suboptimal.frequency) {
+				suboptimal.frequency = freq;
+				suboptimal.index = i;
+			}
+		}
+	}
+
+	if (optimal.index != ~0U)
+		*index = optimal.index;
+	else if (suboptimal.index != ~0U)
+		*index = suboptimal.index;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+static unsigned int opp_index(unsigned int khz)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_opps - 1 && opps[i].khz < khz; i++)
+		;
+	return i;
+}
+
+int __cpufreq_driver_target(struct cpufreq_policy *policy,
+			    unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned int index, cpu;
+
+	if (cpufreq_frequency_table_target(policy, freq_table, target_freq,
+					   relation, &index))
+		return -EINVAL;
+
+	freqs.old = policy->cur;
+	freqs.new = freq_table[index].frequency;
+	freqs.flags = 0;
+	if (freqs.new == freqs.old)
+		return 0;
+
+	for_each_cpu(cpu, policy->cpus) {
+		freqs.cpu = cpu;
+		if (transition_nb)
+			transition_nb->notifier_call(transition_nb,
+						     CPUFREQ_PRECHANGE,
+						     &freqs);
+	}
+	policy->cur = freqs.new;
+	st.transitions++;
+	for_each_cpu(cpu, policy->cpus) {
+		freqs.cpu = cpu;
+		if (transition_nb)
+			transition_nb->notifier_call(transition_nb,
+						     CPUFREQ_POSTCHANGE,
+						     &freqs);
+	}
+	return 0;
+}
+
+/* simulation */
+
+static void run_timers(int cpu)
+{
+	struct timer_list *t;
+	bool woken = cpus[cpu].busy;
+	unsigned int i;
+
+	/* deferrable timers wait until something else wakes an idle cpu */
+	for (i = 0; i < nr_timers && !woken; i++) {
+		t = timers[i];
+		woken = t->pending && t->cpu == cpu && !t->deferrable &&
+			time_after_eq(jiffies, t->expires);
+	}
+	if (!woken)
+		return;
+
+	for (i = 0; i < nr_timers; i++) {
+		t = timers[i];
+		if (!t->pending || t->cpu != cpu ||
+		    !time_after_eq(jiffies, t->expires))
+			continue;
+		t->pending = false;
+		shim_cpu = cpu;
+		t->function(t->data);
+		run_thread();
+	}
+}
+
+static void arrive(unsigned int cpu, u64 cycles, u64 deadline)
+{
+	struct sim_cpu *c = &cpus[cpu];
+	struct job *j = calloc(1, sizeof(*j));
+
+	if (!j)
+		die("out of memory\n");
+	j->arrival = now;
+	j->deadline = now + deadline;
+	j->cycles = cycles;
+	if (c->tail)
+		c->tail->next = j;
+	else
+		c->head = j;
+	c->tail = j;
+
+	if (!c->busy) {
+		c->idle_ns += now - c->idle_since;
+		c->busy = true;
+		idle_notify(cpu, IDLE_END);
+	}
+}
+
+/* run each cpu for step ns at the current speed */
+static void execute(u64 step)
+{
+	unsigned int khz = policy.cur, i = opp_index(khz), cpu;
+	bool went_idle[NR_CPUS] = { false };
+	struct sim_cpu *c;
+	struct job *j;
+	u64 left, need, done, late;
+
+	for (cpu = 0; cpu < shim_nr_cpus; cpu++) {
+		c = &cpus[cpu];
+		if (!c->busy)
+			continue;
+
+		for (left = step; left && c->head; ) {
+			j = c->head;
+			need = (j->cycles * 1000000 + khz - 1) / khz;
+			if (need > left) {
+				done = left * khz / 1000000;
+				j->cycles -= done;
+				st.cycles[i] += done;
+				st.busy_ns[i] += left;
+				left = 0;
+				break;
+			}
+
+			st.cycles[i] += j->cycles;
+			st.busy_ns[i] += need;
+			left -= need;
+			st.jobs++;
+			late = now + step - left;
+			if (late > j->deadline) {
+				late -= j->deadline;
+				st.missed++;
+				st.late_ns += late;
+				if (late > st.max_late_ns)
+					st.max_late_ns = late;
+			}
+			c->head = j->next;
+			if (!c->head)
+				c->tail = NULL;
+			free(j);
+		}
+
+		if (!c->head) {
+			c->busy = false;
+			c->idle_since = now + step - left;
+			went_idle[cpu] = true;
+		}
+	}
+
+	/* the idle loop is entered at the step boundary */
+	now += step;
+	for (cpu = 0; cpu < shim_nr_cpus; cpu++)
+		if (went_idle[cpu])
+			idle_notify(cpu, IDLE_START);
+}
+
+static void start(unsigned int max_khz)
+{
+	unsigned int i, cpu;
+
+	for (i = 0; i < nr_opps; i++) {
+		freq_table[i].index = i;
+		freq_table[i].frequency = opps[i].khz;
+	}
+	freq_table[i].index = i;
+	freq_table[i].frequency = CPUFREQ_TABLE_END;
+
+	for (cpu = 0; cpu < shim_nr_cpus; cpu++)
+		cpumask_set_cpu(cpu, policy.cpus);
+	policy.cpu = 0;
+	policy.min = opps[0].khz;
+	for (i = nr_opps - 1; i && max_khz && opps[i].khz > max_khz; i--)
+		;
+	policy.max = opps[i].khz;
+	policy.cur = policy.min;
+
+	if (shim_module_init() || !governor)
+		die("governor init failed\n");
+	shim_cpu = 0;
+	if (governor->governor(&policy, CPUFREQ_GOV_START))
+		die("governor start failed\n");
+	run_thread();
+}
+
+static void stop(void)
+{
+	governor->governor(&policy, CPUFREQ_GOV_STOP);
+	shim_module_exit();
+}
+
+static void report(char **options, int nr_options, bool verbose)
+{
+	double energy = 0, cycles = 0, ns = now;
+	double vmin = opps[0].uv;
+	unsigned int i;
+	int o;
+
+	for (i = 0; i < nr_opps; i++) {
+		energy += st.cycles[i] * pow(opps[i].uv / vmin, 2);
+		cycles += st.cycles[i];
+	}
+
+	for (o = 0; o < nr_options; o++)
+		printf("%s ", options[o]);
+	printf("%s%lu jobs %lu missed (%.1f%%) late %.1f ms max %.1f ms | "
+	       "energy %.3f | %lu transitions\n",
+	       nr_options ? "| " : "", st.jobs, st.missed,
+	       st.jobs ? 100.0 * st.missed / st.jobs : 0.0,
+	       st.late_ns / 1e6, st.max_late_ns / 1e6,
+	       cycles ? energy / cycles : 0.0, st.transitions);
+
+	if (!verbose)
+		return;
+	printf("%8s %6s %8s %8s\n", "MHz", "mV", "busy%", "cycles%");
+	for (i = 0; i < nr_opps; i++)
+		printf("%8.1f %6u %8.2f %8.2f\n", opps[i].khz / 1000.0,
+		       opps[i].uv / 1000,
+		       100.0 * st.busy_ns[i] / (ns * shim_nr_cpus),
+		       cycles ? 100.0 * st.cycles[i] / cycles : 0.0);
+}
+
+static void replay(FILE *f, u64 step)
+{
+	unsigned long line = 0;
+	unsigned int cpu;
+	u64 t = 0, last = 0, cycles, deadline;
+	bool pending = false, eof = false;
+	char buf[256], kind;
+	int n;
+
+	for (;;) {
+		jiffies = now * shim_hz / 1000000000;
+
+		/* feed the events due by now */
+		while (!eof) {
+			if (!pending) {
+				if (!fgets(buf, sizeof(buf), f)) {
+					eof = true;
+					break;
+				}
+				line++;
+				if (buf[0] == '#' || buf[0] == '\n')
+					continue;
+				if (sscanf(buf, "%llu %c%n",
+					   (unsigned long long *)&t, &kind,
+					   &n) != 2)
+					die("line %lu: cannot parse: %s",
+					    line, buf);
+				if (t < last)
+					die("line %lu: time goes back\n",
+					    line);
+				last = t;
+				pending = true;
+			}
+			if (t * 1000 > now)
+				break;
+			pending = false;
+
+			switch (kind) {
+			case 'w':
+				if (sscanf(buf + n, "%u %llu %llu", &cpu,
+					   (unsigned long long *)&cycles,
+					   (unsigned long long *)&deadline)
+				    != 3 || cpu >= shim_nr_cpus)
+					die("line %lu: bad work: %s",
+					    line, buf);
+				arrive(cpu, cycles, deadline * 1000);
+				break;
+			case 'i':
+				touch();
+				break;
+			case 'b':
+				shim_cpu = 0;
+				store_tunable("boostpulse", "1");
+				run_thread();
+				break;
+			default:
+				die("line %lu: unknown event: %s", line, buf);
+			}
+		}
+
+		for (cpu = 0; cpu < shim_nr_cpus; cpu++)
+			run_timers(cpu);
+
+		if (eof) {
+			for (cpu = 0; cpu < shim_nr_cpus; cpu++)
+				if (cpus[cpu].busy)
+					break;
+			if (cpu == shim_nr_cpus)
+				break;
+		}
+		execute(step);
+	}
+}
+
+/*
+ * Synthetic workload.  A gesture starts with a touch, reports touch events
+ * every 10 ms while it lasts and drives 60 fps frames until shortly after:
+ * a UI thread job on cpu 0 and a render thread job on cpu 1, the first
+ * frames heavier than the rest.  Between gestures, short background jobs
+ * with relaxed deadlines arrive on either cpu.
+ */
+static double uniform(double lo, double hi)
+{
+	return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+/* touch events every 10 ms, up to limit */
+static void touches(u64 *next, u64 limit, u64 gesture_end)
+{
+	for (; *next < limit && *next < gesture_end; *next += 10000)
+		printf("%llu i\n", (unsigned long long)*next);
+}
+
+static void generate(double seconds, unsigned int seed)
+{
+	const u64 frame = 16667;
+	u64 t = 0, end = seconds * 1e6, gesture_end, frames_end, f, next;
+	unsigned int n;
+	double scale;
+
+	srand(seed);
+	printf("# interactive-replay -g %g -s %u\n", seconds, seed);
+
+	while (t < end) {
+		/* background until the next gesture */
+		next = t + uniform(300000, 3000000);
+		for (t += uniform(20000, 150000); t < next && t < end;
+		     t += uniform(20000, 150000))
+			printf("%llu w %u %llu 50000\n",
+			       (unsigned long long)t, rand() % 2,
+			       (unsigned long long)uniform(2e5, 2e6));
+		t = next;
+		if (t >= end)
+			break;
+
+		gesture_end = t + uniform(150000, 1500000);
+		frames_end = gesture_end + uniform(100000, 400000);
+		next = t;
+		for (f = t, n = 0; f < frames_end; f += frame, n++) {
+			scale = n < 3 ? 2.0 : 1.0;
+			touches(&next, f + 2000, gesture_end);
+			printf("%llu w 0 %llu %llu\n",
+			       (unsigned long long)f + 2000,
+			       (unsigned long long)(scale * uniform(3e6, 7e6)),
+			       (unsigned long long)frame);
+			touches(&next, f + 5000, gesture_end);
+			printf("%llu w 1 %llu %llu\n",
+			       (unsigned long long)f + 5000,
+			       (unsigned long long)(scale * uniform(2e6, 6e6)),
+			       (unsigned long long)frame - 3000);
+			touches(&next, f + frame, gesture_end);
+		}
+		t = frames_end;
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-p 4430|4460|4470] [-M max_khz] [-c cpus] "
+		"[-z hz] [-t step_us]\n"
+		"          [-o tunable=value]... [-v] [trace]\n"
+		"       %s -g seconds [-s seed]\n", argv0, argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	char *options[MAX_OPTIONS], *val;
+	const char *soc = "4470";
+	unsigned int seed = 1, max_khz = 0, i;
+	int nr_options = 0, opt, ret;
+	double gen = 0;
+	u64 step = 100;
+	bool verbose = false;
+	FILE *f = stdin;
+
+	while ((opt = getopt(argc, argv, "p:M:c:z:t:o:vg:s:")) != -1) {
+		switch (opt) {
+		case 'p': soc = optarg; break;
+		case 'M': max_khz = atoi(optarg); break;
+		case 'c': shim_nr_cpus = atoi(optarg); break;
+		case 'z': shim_hz = atoi(optarg); break;
+		case 't': step = strtoull(optarg, NULL, 0); break;
+		case 'o':
+			if (nr_options == MAX_OPTIONS || !strchr(optarg, '='))
+				usage(argv[0]);
+			options[nr_options++] = optarg;
+			break;
+		case 'v': verbose = true; break;
+		case 'g': gen = atof(optarg); break;
+		case 's': seed = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!shim_nr_cpus || shim_nr_cpus > NR_CPUS || !shim_hz || !step)
+		usage(argv[0]);
+
+	if (gen > 0) {
+		generate(gen, seed);
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(socs) && strcmp(socs[i].name, soc); i++)
+		;
+	if (i == ARRAY_SIZE(socs))
+		usage(argv[0]);
+	opps = socs[i].opps;
+	for (nr_opps = 0; nr_opps < MAX_OPPS && opps[nr_opps].khz; nr_opps++)
+		;
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	start(max_khz);
+	for (opt = 0; opt < nr_options; opt++) {
+		val = strchr(options[opt], '=');
+		*val = '\0';
+		ret = store_tunable(options[opt], val + 1);
+		*val = '=';
+		if (ret)
+			die("%s: %s\n", options[opt], strerror(-ret));
+	}
+
+	replay(f, step * 1000);
+	report(options, nr_options, verbose);
+	stop();
+	return 0;
+}
@@ -0,0 +1,595 @@
+/*
+ * gcbv-bench.c -- run BLTsville operations through gcbv's CPU backend
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * drivers/misc/gcx/gcbv/gcparser.c and gccpu.c are built unmodified against
+ * the stand-ins in include/ and fed bvbltparams from a text corpus, one
+ * operation per line:
+ *
+ *	<op> <format> <src geom> <src rect> <dst geom> <dst rect> [<clip>]
+ *	# ...
+ *
+ * <op> is "copy" (ROP 0xCCCC) or "over" (premultiplied SRC1OVER), <format>
+ * an ocdformat name without the OCDFMT_ prefix, used for both surfaces, a
+ * geometry is <width>x<height>@<orientation> and a rectangle
+ * <left>,<top>,<width>,<height>.  As in bv_blt(), a 1x1 source makes a
+ * fill, equal sizes a copy and anything else a filtered scale.
+ *
+ * Every operation is parsed and prepared the way bv_blt() does it for a
+ * single source, run once on random surfaces and compared, over the whole
+ * destination buffer, with a plain per-pixel rendering.  That rendering
+ * finds each pixel with its own rotation arithmetic and filters in floating
+ * point, so fills, copies and blends should match it exactly and scales to
+ * within a few steps; -e sets the difference still counted as a match.  It
+ * shares the orientation convention of gccpu.c, which only a capture from
+ * the 2D core can check.  The operation is then repeated for throughput.
+ * Operations that cpu_prepare() turns down, and that would go to the 2D
+ * core, are reported as skipped.
+ *
+ * With -g, a corpus of every operation, format and orientation, followed by
+ * a few screen sized operations, is written to stdout instead:
+ *
+ *	./gcbv-bench -g | ./gcbv-bench -e 3
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+
+#include <linux/gcbv-shim.h>
+
+#include "gcbv.h"
+
+#define MAX_PARAMS	4
+
+static struct {
+	const char	*name;
+	void		*value;
+} params[MAX_PARAMS];
+static int nr_params;
+
+static int iterations = 10;
+static int tolerance;
+
+static struct {
+	unsigned long	ops;
+	unsigned long	skipped;
+	unsigned long	exact;
+	unsigned long	close;
+	unsigned long	differ;
+	unsigned long long pixels;
+	unsigned long long ns;
+} st;
+
+static const struct {
+	const char	*name;
+	enum ocdformat	format;
+	int		bytes;
+} formats[] = {
+	{ "RGB16",	OCDFMT_RGB16,	2 },
+	{ "BGR16",	OCDFMT_BGR16,	2 },
+	{ "xRGB24",	OCDFMT_xRGB24,	4 },
+	{ "BGRx24",	OCDFMT_BGRx24,	4 },
+	{ "ARGB24",	OCDFMT_ARGB24,	4 },
+	{ "ABGR24",	OCDFMT_ABGR24,	4 },
+	{ "RGBA24",	OCDFMT_RGBA24,	4 },
+	{ "BGRA24",	OCDFMT_BGRA24,	4 },
+	{ "nBGRA24",	OCDFMT_nBGRA24,	4 },
+};
+
+struct surface {
+	struct bvbuffdesc	desc;
+	struct bvsurfgeom	geom;
+	unsigned char		*buf;
+	int			bytes;
+};
+
+
+/*******************************************************************************
+ * What the rest of gcbv would provide.
+ */
+
+void shim_param(const char *name, void *value)
+{
+	if (nr_params == MAX_PARAMS)
+		abort();
+	params[nr_params].name = name;
+	params[nr_params].value = value;
+	nr_params++;
+}
+
+static void *param(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nr_params; i++)
+		if (!strcmp(params[i].name, name))
+			return params[i].value;
+	fprintf(stderr, "no module parameter %s\n", name);
+	exit(1);
+}
+
+struct gccontext *get_context(void)
+{
+	static struct gccontext gccontext;
+	return &gccontext;
+}
+
+bool gc_idle(void)
+{
+	return true;
+}
+
+bool async_idle(void)
+{
+	return true;
+}
+
+unsigned char gcfp2norm8(float value)
+{
+	if (value <= 0.0f)
+		return 0;
+	if (value >= 1.0f)
+		return 255;
+	return (unsigned char) (value * 255.0f + 0.5f);
+}
+
+
+/*******************************************************************************
+ * Surfaces and the reference rendering.
+ */
+
+static void surface_init(struct surface *s, int f, unsigned int width,
+			 unsigned int height, int orientation)
+{
+	unsigned int physwidth, physheight;
+
+	if (orientation % 180) {
+		physwidth = height;
+		physheight = width;
+	} else {
+		physwidth = width;
+		physheight = height;
+	}
+
+	memset(s, 0, sizeof(*s));
+	s->bytes = formats[f].bytes;
+	s->geom.structsize = sizeof(s->geom);
+	s->geom.format = formats[f].format;
+	s->geom.width = width;
+	s->geom.height = height;
+	s->geom.orientation = orientation;
+	/* gcbv wants the stride aligned to bitspp bytes */
+	s->geom.virtstride = GC_ALIGN(physwidth * s->bytes, 64);
+
+	s->desc.structsize = sizeof(s->desc);
+	s->desc.length = s->geom.virtstride * physheight;
+	s->desc.auxtype = BVAT_NONE;
+	s->buf = malloc(s->desc.length);
+	if (!s->buf) {
+		perror("malloc");
+		exit(1);
+	}
+	s->desc.virtaddr = s->buf;
+}
+
+/* Oriented position (x, y) to the pixel in memory: a surface holds its
+ * image rotated by its orientation, counterclockwise. */
+static unsigned char *pixel(struct surface *s, int x, int y)
+{
+	int w = s->geom.width, h = s->geom.height;
+	int px, py;
+
+	switch (s->geom.orientation) {
+	case 90:
+		px = y;
+		py = w - 1 - x;
+		break;
+	case 180:
+		px = w - 1 - x;
+		py = h - 1 - y;
+		break;
+	case 270:
+		px = h - 1 - y;
+		py = x;
+		break;
+	default:
+		px = x;
+		py = y;
+	}
+	return s->buf + py * s->geom.virtstride + px * s->bytes;
+}
+
+/* Random content; premultiplied colour channels never exceed alpha. */
+static void surface_fill(struct surface *s, int alphashift)
+{
+	unsigned long i;
+	u32 *p, a;
+	int c;
+
+	for (i = 0; i < s->desc.length; i++)
+		s->buf[i] = rand();
+	if (alphashift < 0)
+		return;
+
+	for (p = (u32 *) s->buf; (unsigned char *) (p + 1) <=
+	     s->buf + s->desc.length; p++) {
+		a = (*p >> alphashift) & 0xFF;
+		for (c = 0; c < 32; c += 8)
+			if (c != alphashift && ((*p >> c) & 0xFF) > a)
+				*p = (*p & ~(0xFFU << c)) | (a << c);
+	}
+}
+
+/* Bilinear sample at a pixel center mapped into the source rectangle. */
+static void sample(struct surface *src, struct bvrect *r, double u, double v,
+		   unsigned char *out)
+{
+	int x0, y0, x1, y1, c;
+	double fx, fy;
+
+	u = fmin(fmax(u, 0.0), r->width - 1);
+	v = fmin(fmax(v, 0.0), r->height - 1);
+	x0 = (int) u;
+	y0 = (int) v;
+	x1 = min(x0 + 1, (int) r->width - 1);
+	y1 = min(y0 + 1, (int) r->height - 1);
+	fx = u - x0;
+	fy = v - y0;
+
+	for (c = 0; c < src->bytes; c++) {
+		double top, bottom;
+
+		top = pixel(src, r->left + x0, r->top + y0)[c] * (1 - fx)
+		    + pixel(src, r->left + x1, r->top + y0)[c] * fx;
+		bottom = pixel(src, r->left + x0, r->top + y1)[c] * (1 - fx)
+		       + pixel(src, r->left + x1, r->top + y1)[c] * fx;
+		out[c] = (unsigned char) floor(top * (1 - fy) + bottom * fy
+					       + 0.5);
+	}
+}
+
+static void reference(struct bvbltparams *bp, struct surface *src,
+		      struct surface *dst, struct bvrect *clip, int alphashift)
+{
+	struct bvrect *sr = &bp->src1rect, *dr = &bp->dstrect;
+	bool blend = (bp->flags & BVFLAG_OP_MASK) == BVFLAG_BLEND;
+	unsigned char s[4], *d;
+	int x, y, c;
+
+	for (y = clip->top; y < clip->top + (int) clip->height; y++)
+		for (x = clip->left; x < clip->left + (int) clip->width; x++) {
+			if (sr->width == 1 && sr->height == 1)
+				memcpy(s, pixel(src, sr->left, sr->top),
+				       src->bytes);
+			else if (sr->width == dr->width &&
+				 sr->height == dr->height)
+				memcpy(s, pixel(src, sr->left + x - dr->left,
+						sr->top + y - dr->top),
+				       src->bytes);
+			else
+				sample(src, sr,
+				       (x - dr->left + 0.5) * sr->width /
+				       dr->width - 0.5,
+				       (y - dr->top + 0.5) * sr->height /
+				       dr->height - 0.5, s);
+
+			/* an opaque source covers the destination */
+			d = pixel(dst, x, y);
+			if (!blend || alphashift < 0) {
+				memcpy(d, s, dst->bytes);
+				continue;
+			}
+			for (c = 0; c < 4; c++)
+				d[c] = s[c] + (d[c] * (255 - s[alphashift / 8])
+					       + 127) / 255;
+		}
+}
+
+static void compare(struct surface *a, struct surface *b,
+		    unsigned long *diffs, int *maxerr)
+{
+	unsigned long i;
+	int c, err, pixerr;
+
+	*diffs = 0;
+	*maxerr = 0;
+	for (i = 0; i < a->desc.length; i += a->bytes) {
+		pixerr = 0;
+		for (c = 0; c < a->bytes; c++) {
+			err = abs(a->buf[i + c] - b->buf[i + c]);
+			pixerr = max(pixerr, err);
+		}
+		if (pixerr)
+			(*diffs)++;
+		*maxerr = max(*maxerr, pixerr);
+	}
+}
+
+
+/*******************************************************************************
+ * Replay.
+ */
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* bv_blt() for one source and no batching, up to the choice of engine */
+static bool prepare(struct bvbltparams *bp, struct gcbatch *batch,
+		    struct surfaceinfo *srcinfo, struct gccpuop *op)
+{
+	struct gcalpha gca;
+
+	if ((bp->flags & BVFLAG_OP_MASK) == BVFLAG_BLEND &&
+	    parse_blend(bp, bp->op.blend, &gca) != BVERR_NONE)
+		return false;
+
+	memset(srcinfo, 0, sizeof(*srcinfo));
+	srcinfo->index = 0;
+	srcinfo->buf = bp->src1;
+	srcinfo->geom = bp->src1geom;
+	srcinfo->newgeom = batch->batchflags & BVBATCH_SRC1;
+	srcinfo->newrect = batch->batchflags & (BVBATCH_SRC1RECT_ORIGIN |
+						BVBATCH_SRC1RECT_SIZE);
+	if (parse_source(bp, batch, &bp->src1rect, srcinfo) != BVERR_NONE)
+		return false;
+
+	return cpu_prepare(bp, batch, srcinfo, op);
+}
+
+static void run(unsigned long line, const char *opname, int f,
+		struct surface *src, struct bvrect *srcrect,
+		struct surface *dst, struct bvrect *dstrect,
+		struct bvrect *clip)
+{
+	static const char * const kinds[] = { "fill", "copy", "scale" };
+	struct bvbltparams bp;
+	struct gcbatch *batch;
+	struct surfaceinfo srcinfo;
+	struct gccpuop op;
+	struct surface ref;
+	struct bvrect visible;
+	const struct bvcomponent *alpha;
+	unsigned long long t;
+	unsigned long diffs;
+	int alphashift = -1, maxerr, i;
+
+	memset(&bp, 0, sizeof(bp));
+	bp.structsize = sizeof(bp);
+	if (!strcmp(opname, "over")) {
+		bp.flags = BVFLAG_BLEND;
+		bp.op.blend = BVBLEND_SRC1OVER;
+		bp.src2.desc = &dst->desc;
+		bp.src2geom = &dst->geom;
+		bp.src2rect = *dstrect;
+	} else {
+		bp.flags = BVFLAG_ROP;
+		bp.op.rop = 0xCCCC;
+	}
+	bp.dstdesc = &dst->desc;
+	bp.dstgeom = &dst->geom;
+	bp.dstrect = *dstrect;
+	bp.src1.desc = &src->desc;
+	bp.src1geom = &src->geom;
+	bp.src1rect = *srcrect;
+	if (clip) {
+		bp.flags |= BVFLAG_CLIP;
+		bp.cliprect = *clip;
+	}
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch) {
+		perror("calloc");
+		exit(1);
+	}
+	batch->batchflags = 0x7FFFFFFF;
+
+	st.ops++;
+	if (!prepare(&bp, batch, &srcinfo, &op)) {
+		printf("%6lu %-4s %-7s %-5s skipped\n", line, opname,
+		       formats[f].name, "-");
+		st.skipped++;
+		free(batch);
+		return;
+	}
+
+	if (srcinfo.format.type == BVFMT_RGB) {
+		alpha = &srcinfo.format.cs.rgb.comp->a;
+		if (alpha->size == 8)
+			alphashift = alpha->shift;
+	}
+	surface_fill(src, alphashift);
+	surface_fill(dst, -1);
+
+	surface_init(&ref, f, dst->geom.width, dst->geom.height,
+		     dst->geom.orientation);
+	memcpy(ref.buf, dst->buf, dst->desc.length);
+	visible.left = batch->dstclipped.left;
+	visible.top = batch->dstclipped.top;
+	visible.width = batch->dstclipped.right - batch->dstclipped.left;
+	visible.height = batch->dstclipped.bottom - batch->dstclipped.top;
+	reference(&bp, src, &ref, &visible, alphashift);
+
+	cpu_execute(&op);
+	compare(dst, &ref, &diffs, &maxerr);
+	if (!maxerr)
+		st.exact++;
+	else if (maxerr <= tolerance)
+		st.close++;
+	else
+		st.differ++;
+
+	t = now_ns();
+	for (i = 0; i < iterations; i++)
+		cpu_execute(&op);
+	t = now_ns() - t;
+	st.ns += t;
+	st.pixels += (unsigned long long) visible.width * visible.height *
+		     iterations;
+
+	printf("%6lu %-4s %-7s %-5s %8.1f Mpix/s %7lu diff %3d max%s\n",
+	       line, opname, formats[f].name, kinds[op.type],
+	       t ? (double) visible.width * visible.height * iterations *
+		   1000 / t : 0.0,
+	       diffs, maxerr, maxerr > tolerance ? "  MISMATCH" : "");
+
+	cpu_release(&op);
+	free(ref.buf);
+	free(batch);
+}
+
+static void replay(FILE *f)
+{
+	unsigned int sw, sh, dw, dh;
+	int sa, da, fmt, n;
+	struct bvrect sr, dr, clip;
+	struct surface src, dst;
+	unsigned long line = 0;
+	char buf[256], opname[8], format[16];
+
+	*(bool *) param("cpublit") = true;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		if (buf[0] == '#' || buf[0] == '\n')
+			continue;
+
+		n = sscanf(buf, "%7s %15s %ux%u@%d %d,%d,%u,%u %ux%u@%d "
+			   "%d,%d,%u,%u %d,%d,%u,%u", opname, format,
+			   &sw, &sh, &sa,
+			   &sr.left, &sr.top, &sr.width, &sr.height,
+			   &dw, &dh, &da,
+			   &dr.left, &dr.top, &dr.width, &dr.height,
+			   &clip.left, &clip.top, &clip.width, &clip.height);
+		if ((n != 16 && n != 20) ||
+		    (strcmp(opname, "copy") && strcmp(opname, "over")))
+			goto bad;
+
+		for (fmt = 0; fmt < (int) countof(formats); fmt++)
+			if (!strcmp(format, formats[fmt].name))
+				break;
+		if (fmt == countof(formats))
+			goto bad;
+
+		surface_init(&src, fmt, sw, sh, sa);
+		surface_init(&dst, fmt, dw, dh, da);
+		run(line, opname, fmt, &src, &sr, &dst, &dr,
+		    n == 20 ? &clip : NULL);
+		free(src.buf);
+		free(dst.buf);
+		continue;
+bad:
+		fprintf(stderr, "line %lu: cannot parse: %s", line, buf);
+		exit(1);
+	}
+
+	printf("%lu ops: %lu skipped, %lu exact, %lu within %d, %lu differ; "
+	       "%.1f Mpix/s, %u on the CPU\n", st.ops, st.skipped, st.exact,
+	       st.close, tolerance, st.differ,
+	       st.ns ? (double) st.pixels * 1000 / st.ns : 0.0,
+	       *(unsigned int *) param("cpucount"));
+}
+
+/*
+ * Corpus: every format, operation and pair of orientations on small
+ * surfaces, with and without a clip rectangle cutting into the destination,
+ * then screen sized operations for throughput.
+ */
+static const struct {
+	unsigned int	sw, sh, dw, dh;
+} shapes[] = {
+	{ 1,	1,	100,	70 },		/* fill */
+	{ 100,	70,	100,	70 },		/* copy */
+	{ 41,	29,	100,	70 },		/* scale up */
+	{ 190,	150,	61,	47 },		/* scale down */
+};
+
+static void generate_small(const char *op, const char *format)
+{
+	unsigned int k, sa, da;
+
+	for (k = 0; k < countof(shapes); k++)
+		for (sa = 0; sa < 360; sa += 90)
+			for (da = 0; da < 360; da += 90) {
+				printf("%s %s 200x160@%u 3,5,%u,%u "
+				       "128x96@%u 11,13,%u,%u\n",
+				       op, format, sa, shapes[k].sw,
+				       shapes[k].sh, da, shapes[k].dw,
+				       shapes[k].dh);
+				printf("%s %s 200x160@%u 3,5,%u,%u "
+				       "128x96@%u 11,13,%u,%u 30,20,64,200\n",
+				       op, format, sa, shapes[k].sw,
+				       shapes[k].sh, da, shapes[k].dw,
+				       shapes[k].dh);
+			}
+}
+
+static void generate(void)
+{
+	static const char * const screen[] = {
+		"copy %s 1280x800@0 0,0,1,1 1280x800@%u 0,0,1280,800\n",
+		"copy %s 1280x800@0 0,0,1280,800 1280x800@%u 0,0,1280,800\n",
+		"over %s 1280x800@0 0,0,1280,800 1280x800@%u 0,0,1280,800\n",
+		"copy %s 640x400@0 0,0,640,400 1280x800@%u 0,0,1280,800\n",
+	};
+	unsigned int f, i, da;
+
+	for (f = 0; f < countof(formats); f++) {
+		generate_small("copy", formats[f].name);
+		generate_small("over", formats[f].name);
+	}
+
+	printf("# screen sized\n");
+	for (f = 0; f < countof(formats); f++) {
+		if (strcmp(formats[f].name, "RGB16") &&
+		    strcmp(formats[f].name, "BGRA24"))
+			continue;
+		for (da = 0; da < 180; da += 90)
+			for (i = 0; i < countof(screen); i++)
+				printf(screen[i], formats[f].name, da);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-n iterations] [-e tolerance] [corpus]\n"
+		"       %s -g\n", argv0, argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:e:g")) != -1) {
+		switch (opt) {
+		case 'n': iterations = atoi(optarg); break;
+		case 'e': tolerance = atoi(optarg); break;
+		case 'g': generate(); return 0;
+		default: usage(argv[0]);
+		}
+	}
+	if (iterations < 1 || tolerance < 0)
+		usage(argv[0]);
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	srand(1);
+	replay(f);
+	return 0;
+}
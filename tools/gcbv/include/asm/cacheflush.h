@@ -0,0 +1,2 @@
+/* userspace stand-in, see linux/gcbv-shim.h */
+#include <linux/gcbv-shim.h>
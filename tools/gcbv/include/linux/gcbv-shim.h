@@ -0,0 +1,108 @@
+/*
+ * gcbv-shim.h -- the kernel API used by gcbv's parser and CPU backend, for
+ * a userspace build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * The gcx headers include some kernel headers by quoted name, which would
+ * find the real ones next to them; their include guards are defined here
+ * so that only the few definitions below are seen instead.  Surfaces are
+ * always given by virtual address, so the physical page helpers only have
+ * to make cpu_map() refuse anything else, and cache maintenance is a
+ * no-op.
+ */
+#ifndef _GCBV_SHIM_H
+#define _GCBV_SHIM_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _LINUX_SLAB_H
+#define _LINUX_SCHED_H
+#define __LINUX_SEMAPHORE_H
+#define _LINUX_LIST_H
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define KERN_ERR	""
+#define KERN_WARNING	""
+#define KERN_INFO	""
+#define printk		printf
+
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#define max(x, y)	((x) > (y) ? (x) : (y))
+#define min_t(type, x, y)	min((type)(x), (type)(y))
+#define max_t(type, x, y)	max((type)(x), (type)(y))
+
+/* module parameters are registered so the harness can set and read them */
+void shim_param(const char *name, void *value);
+#define module_param(name, type, perm)					\
+	static void __attribute__((constructor)) __param_##name(void)	\
+	{								\
+		shim_param(#name, &name);				\
+	}
+#define MODULE_PARM_DESC(name, desc)
+
+/* slab */
+#define GFP_KERNEL	0
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+
+/* list */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+/* locking; the harness is single threaded */
+struct semaphore {
+	int count;
+};
+
+/* memory */
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+#define VM_MAP		0
+#define PAGE_KERNEL	0
+
+struct page;
+
+#define offset_in_page(p)	((unsigned long)(p) & (PAGE_SIZE - 1))
+#define pfn_valid(pfn)		((void)(pfn), 0)
+#define pfn_to_page(pfn)	((struct page *)NULL)
+#define page_to_phys(page)	((void)(page), 0UL)
+#define virt_addr_valid(addr)	((void)(addr), 1)
+#define is_vmalloc_addr(addr)	((void)(addr), 0)
+#define vmalloc_to_page(addr)	((struct page *)NULL)
+#define __pa(addr)		((unsigned long)(addr))
+#define vmap(pages, count, flags, prot)	((void)(pages), (void *)NULL)
+#define vunmap(addr)		do { } while (0)
+
+/* cache maintenance */
+enum dma_data_direction {
+	DMA_BIDIRECTIONAL = 0,
+	DMA_TO_DEVICE = 1,
+	DMA_FROM_DEVICE = 2,
+	DMA_NONE = 3,
+};
+
+#define dmac_flush_range(start, end)		do { } while (0)
+#define dmac_map_area(start, size, dir)		do { } while (0)
+#define outer_flush_range(start, end)		do { } while (0)
+#define outer_clean_range(start, end)		do { } while (0)
+
+#endif
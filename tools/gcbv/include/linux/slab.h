@@ -0,0 +1,2 @@
+/* userspace stand-in, see gcbv-shim.h */
+#include "gcbv-shim.h"
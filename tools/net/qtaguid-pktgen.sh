@@ -0,0 +1,146 @@
+#!/bin/sh
+#
+# qtaguid-pktgen.sh -- receive throughput with and without xt_qtaguid
+#
+# pktgen floods one end of a veth pair with small UDP packets addressed to
+# the other end, where a UDP socket is bound, so every packet goes through
+# the receive path up to the socket in the softirq of the sending CPU.
+# Rounds alternate between no rules and the rules netd installs for
+# bandwidth accounting: "-m owner --socket-exists" (the qtaguid match) in
+# raw PREROUTING, which updates the interface totals, and in INPUT, which
+# charges the packet to the socket's uid.  Since pktgen and the receive
+# softirq share the CPU, accounting cost shows up as a lower receive rate
+# and more backlog drops.  Packets accounted in /proc/net/xt_qtaguid/stats
+# are summed after each round as a check that none were lost between the
+# per-cpu counters and the stats file.
+#
+# Needs root, pktgen, veth, ip, iptables and xt_qtaguid; nc to bind the
+# receiving socket.  Creates and removes veth interfaces pg0 and pg1.
+#
+# usage: qtaguid-pktgen.sh [-n packets] [-r rounds] [-c cpu] [-p port]
+
+count=2000000
+rounds=3
+cpu=0
+port=9999
+tx=pg0
+rx=pg1
+net=10.99.0
+
+while getopts n:r:c:p: opt; do
+	case $opt in
+	n) count=$OPTARG ;;
+	r) rounds=$OPTARG ;;
+	c) cpu=$OPTARG ;;
+	p) port=$OPTARG ;;
+	*) echo "usage: $0 [-n packets] [-r rounds] [-c cpu] [-p port]" >&2
+	   exit 2 ;;
+	esac
+done
+
+[ -d /proc/net/pktgen ] || modprobe pktgen 2>/dev/null
+pgthread=/proc/net/pktgen/kpktgend_$cpu
+if [ ! -e $pgthread ]; then
+	echo "$pgthread: no such file (is pktgen loaded?)" >&2
+	exit 1
+fi
+if [ ! -e /proc/net/xt_qtaguid/stats ]; then
+	echo "/proc/net/xt_qtaguid/stats: no such file" >&2
+	exit 1
+fi
+for cmd in ip iptables nc; do
+	if ! command -v $cmd >/dev/null 2>&1; then
+		echo "$cmd not found" >&2
+		exit 1
+	fi
+done
+
+nc_pid=
+cleanup() {
+	echo rem_device_all > $pgthread
+	iptables -t raw -D PREROUTING -i $rx -m owner --socket-exists \
+		2>/dev/null
+	iptables -D INPUT -i $rx -m owner --socket-exists 2>/dev/null
+	[ -n "$nc_pid" ] && kill $nc_pid
+	ip link del $tx 2>/dev/null
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+ip link add $tx type veth peer name $rx || exit 1
+ip addr add $net.1/24 dev $rx
+ip link set $tx up
+ip link set $rx up
+# the source address is not local, so let it through whatever rp_filter says
+echo 0 > /proc/sys/net/ipv4/conf/$rx/rp_filter
+
+# toybox and busybox disagree on how the port is given
+nc -u -l -p $port > /dev/null 2>&1 &
+nc_pid=$!
+sleep 1
+if ! kill -0 $nc_pid 2>/dev/null; then
+	nc -u -l $port > /dev/null 2>&1 &
+	nc_pid=$!
+fi
+
+echo rem_device_all > $pgthread
+echo "add_device $tx" > $pgthread
+pgdev=/proc/net/pktgen/$tx
+for p in "count $count" "clone_skb 0" "pkt_size 60" "delay 0" \
+	 "dst $net.1" "src_min $net.2" "src_max $net.2" \
+	 "dst_mac $(cat /sys/class/net/$rx/address)" \
+	 "udp_src_min 9" "udp_src_max 9" \
+	 "udp_dst_min $port" "udp_dst_max $port"; do
+	echo "$p" > $pgdev
+	if ! grep -q "^Result: OK" $pgdev; then
+		grep "^Result:" $pgdev >&2
+		exit 1
+	fi
+done
+
+rx_stat() {
+	cat /sys/class/net/$rx/statistics/$1
+}
+
+# rx_packets of every counter set and tag of the receiving interface
+accounted() {
+	awk -v dev=$rx '$2 == dev { n += $7 } END { print n + 0 }' \
+		/proc/net/xt_qtaguid/stats
+}
+
+rules() {
+	iptables -t raw -$1 PREROUTING -i $rx -m owner --socket-exists &&
+	iptables -$1 INPUT -i $rx -m owner --socket-exists
+}
+
+echo "$count packets per round, pktgen on cpu $cpu, $tx -> $rx:$port"
+printf "%-8s %10s %10s %10s %10s\n" \
+	qtaguid "tx pps" "rx pps" "rx drop" accounted
+
+round=0
+while [ $round -lt $rounds ]; do
+	for mode in off on; do
+		[ $mode = on ] && { rules I || exit 1; }
+		rx0=$(rx_stat rx_packets)
+		drop0=$(rx_stat rx_dropped)
+		acct0=$(accounted)
+
+		echo start > /proc/net/pktgen/pgctrl
+
+		rx1=$(rx_stat rx_packets)
+		drop1=$(rx_stat rx_dropped)
+		acct1=$(accounted)
+		[ $mode = on ] && rules D
+		awk -v mode=$mode -v rx=$((rx1 - rx0)) \
+		    -v drop=$((drop1 - drop0)) -v acct=$((acct1 - acct0)) '
+			/^Result: OK:/ { usec = $3 + 0 }
+			/pps/ && usec { tx = $1 + 0 }
+			END {
+				if (!usec)
+					exit 1
+				printf "%-8s %10d %10d %10d %10d\n", mode, tx,
+				       rx * 1e6 / usec, drop, acct
+			}' $pgdev || { grep "^Result:" $pgdev >&2; exit 1; }
+	done
+	round=$((round + 1))
+done
@@ -0,0 +1,2 @@
+/* userspace stand-in, see tcm-shim.h */
+#include "tcm-shim.h"
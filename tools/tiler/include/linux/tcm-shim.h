@@ -0,0 +1,131 @@
+/*
+ * tcm-shim.h -- the kernel API used by tcm-sita.c, for a userspace build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * Only what tcm-sita.c and tcm.h need is provided.  The replay harness is
+ * single threaded, so the mutexes are no-ops.
+ */
+#ifndef _TCM_SHIM_H
+#define _TCM_SHIM_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define KERN_NOTICE	""
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+#define printk		printf
+
+#define BUG_ON(cond)	do { if (cond) abort(); } while (0)
+#define WARN_ON(cond)	({						\
+	int __ret = !!(cond);						\
+	if (__ret)							\
+		fprintf(stderr, "WARN_ON(%s) at %s:%d\n", #cond,	\
+			__FILE__, __LINE__);				\
+	__ret;								\
+})
+
+#define __ALIGN_KERNEL_MASK(x, mask)	(((x) + (mask)) & ~(mask))
+#define ALIGN(x, a)	__ALIGN_KERNEL_MASK(x, (typeof(x))(a) - 1)
+
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#define max(x, y)	((x) > (y) ? (x) : (y))
+#define min_t(type, x, y)	min((type)(x), (type)(y))
+#define max_t(type, x, y)	max((type)(x), (type)(y))
+
+/* slab */
+#define GFP_KERNEL	0
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+
+/* mutex */
+struct mutex {
+	int locked;
+};
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_destroy(m)	do { } while (0)
+#define mutex_lock(m)		((m)->locked++)
+#define mutex_unlock(m)		((m)->locked--)
+
+/* bitmap */
+#define BITS_PER_LONG		(8 * sizeof(long))
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+static inline unsigned long __find_next(const unsigned long *addr,
+					unsigned long size,
+					unsigned long offset,
+					unsigned long invert)
+{
+	unsigned long word;
+
+	if (offset >= size)
+		return size;
+
+	word = (addr[BIT_WORD(offset)] ^ invert) &
+	       (~0UL << (offset % BITS_PER_LONG));
+	offset -= offset % BITS_PER_LONG;
+	while (!word) {
+		offset += BITS_PER_LONG;
+		if (offset >= size)
+			return size;
+		word = addr[BIT_WORD(offset)] ^ invert;
+	}
+	offset += __builtin_ctzl(word);
+	return offset < size ? offset : size;
+}
+
+static inline unsigned long find_next_bit(const unsigned long *addr,
+					  unsigned long size,
+					  unsigned long offset)
+{
+	return __find_next(addr, size, offset, 0);
+}
+
+static inline unsigned long find_next_zero_bit(const unsigned long *addr,
+					       unsigned long size,
+					       unsigned long offset)
+{
+	return __find_next(addr, size, offset, ~0UL);
+}
+
+static inline void bitmap_set(unsigned long *map, int start, int nr)
+{
+	for (; nr > 0; start++, nr--)
+		map[BIT_WORD(start)] |= BIT_MASK(start);
+}
+
+static inline void bitmap_clear(unsigned long *map, int start, int nr)
+{
+	for (; nr > 0; start++, nr--)
+		map[BIT_WORD(start)] &= ~BIT_MASK(start);
+}
+
+static inline int bitmap_weight(const unsigned long *map, int nbits)
+{
+	int i, w = 0;
+
+	for (i = 0; i < nbits; i++)
+		w += !!(map[BIT_WORD(i)] & BIT_MASK(i));
+	return w;
+}
+
+#endif
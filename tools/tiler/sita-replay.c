@@ -0,0 +1,382 @@
+/*
+ * sita-replay.c -- replay TILER container alloc/free traces through SiTA
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * drivers/media/video/tiler/tcm/tcm-sita.c is built unmodified against the
+ * stand-ins in include/linux and driven from a text trace, one operation
+ * per line, sizes in slots:
+ *
+ *	a <id> 2d <width> <height> [<align>]	reserve a 2D area
+ *	a <id> 1d <slots>			reserve a 1D area
+ *	f <id>					free area <id>
+ *	# ...					comment
+ *
+ * Freeing an area whose reservation failed is not an error, so generated
+ * traces need not know which reservations fail.
+ *
+ * Every reservation is checked against a shadow map of the container for
+ * overlaps.  Reported are failed reservations, split into those that had
+ * enough free slots (lost to fragmentation) and those that did not, the
+ * positions probed and time spent per reservation, and the free slot,
+ * free run and longest run counts from tcm_get_stats().  The time is only
+ * comparable between runs of this harness: the bitmap stand-ins are not
+ * the kernel's optimised ones.
+ *
+ * With -g, a synthetic trace of video, camera, graphics and 1D buffers is
+ * written to stdout instead:
+ *
+ *	./sita-replay -g 200000 | ./sita-replay
+ */
+
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+
+#include <linux/tcm-shim.h>
+
+#include "tcm.h"
+#include "tcm/tcm-sita.h"
+
+/* OMAP4 container */
+static u16 cont_w = 256, cont_h = 128;
+static int interval;
+
+struct slot {
+	struct tcm_area	area;
+	bool		used;
+	bool		failed;		/* so its free is ignored */
+};
+
+/* SiTA keeps pointers to the areas in its map, so they must not move */
+static struct slot **areas;
+static unsigned int nr_areas;
+static u32 *shadow;		/* owning id + 1 for every slot, 0 if free */
+
+static struct {
+	unsigned long	ops;
+	unsigned long	reserved;
+	unsigned long	failed_frag;
+	unsigned long	failed_full;
+	unsigned long	live_slots;
+	unsigned long	peak_slots;
+	unsigned long long ns;
+} st;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct slot *get_slot(unsigned int id)
+{
+	if (id >= nr_areas) {
+		unsigned int n = max(id + 1, nr_areas * 2);
+
+		areas = realloc(areas, n * sizeof(*areas));
+		if (!areas) {
+			perror("realloc");
+			exit(1);
+		}
+		memset(areas + nr_areas, 0, (n - nr_areas) * sizeof(*areas));
+		nr_areas = n;
+	}
+	if (!areas[id]) {
+		areas[id] = calloc(1, sizeof(**areas));
+		if (!areas[id]) {
+			perror("calloc");
+			exit(1);
+		}
+	}
+	return areas[id];
+}
+
+/* mark (or clear, with owner 0) the slots of an area in the shadow map */
+static void shadow_fill(struct tcm_area *a, u32 owner, unsigned long line)
+{
+	u32 x, y, i, first, last;
+
+	if (a->is2d) {
+		for (y = a->p0.y; y <= a->p1.y; y++)
+			for (x = a->p0.x; x <= a->p1.x; x++) {
+				i = y * cont_w + x;
+				if (owner && shadow[i]) {
+					fprintf(stderr, "line %lu: overlaps "
+						"area %u at (%u,%u)\n", line,
+						shadow[i] - 1, x, y);
+					exit(1);
+				}
+				shadow[i] = owner;
+			}
+		return;
+	}
+
+	first = a->p0.y * cont_w + a->p0.x;
+	last = a->p1.y * cont_w + a->p1.x;
+	for (i = first; i <= last; i++) {
+		if (owner && shadow[i]) {
+			fprintf(stderr, "line %lu: overlaps area %u at %u\n",
+				line, shadow[i] - 1, i);
+			exit(1);
+		}
+		shadow[i] = owner;
+	}
+}
+
+static void report(struct tcm *tcm)
+{
+	struct tcm_stats ts;
+	unsigned long tries = st.reserved + st.failed_frag + st.failed_full;
+
+	tcm_get_stats(tcm, &ts);
+	printf("%9lu ops %8lu ok %6lu frag-fail %6lu full-fail | "
+	       "%6.1f probes %7.0f ns/res | free %5u runs %5u max-run %3u\n",
+	       st.ops, st.reserved, st.failed_frag, st.failed_full,
+	       tries ? (double)ts.probes / tries : 0.0,
+	       tries ? (double)st.ns / tries : 0.0,
+	       ts.free_slots, ts.free_runs, ts.max_run);
+}
+
+static void replay(FILE *f)
+{
+	struct tcm_pt div_pt = { .x = cont_w, .y = (3 * cont_h) / 4 };
+	u32 total = (u32)cont_w * cont_h;
+	unsigned int id, w, h, align;
+	unsigned long line = 0;
+	unsigned long long t;
+	struct tcm *tcm;
+	struct slot *s;
+	char buf[256], kind[4];
+	u32 size;
+	s32 ret;
+
+	tcm = sita_init(cont_w, cont_h, &div_pt);
+	shadow = calloc((size_t)cont_w * cont_h, sizeof(*shadow));
+	if (!tcm || !shadow) {
+		fprintf(stderr, "cannot set up a %ux%u container\n",
+			cont_w, cont_h);
+		exit(1);
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		if (buf[0] == '#' || buf[0] == '\n')
+			continue;
+
+		if (sscanf(buf, "f %u", &id) == 1) {
+			s = get_slot(id);
+			if (s->failed) {
+				s->failed = false;
+				goto next;
+			}
+			if (!s->used) {
+				fprintf(stderr, "line %lu: area %u not "
+					"reserved\n", line, id);
+				exit(1);
+			}
+			shadow_fill(&s->area, 0, line);
+			st.live_slots -= tcm_sizeof(s->area);
+			tcm_free(&s->area);
+			s->used = false;
+		} else if (sscanf(buf, "a %u %3s", &id, kind) == 2) {
+			s = get_slot(id);
+			if (s->used) {
+				fprintf(stderr, "line %lu: area %u already "
+					"reserved\n", line, id);
+				exit(1);
+			}
+			align = 1;
+			if (!strcmp(kind, "2d") &&
+			    sscanf(buf, "a %*u 2d %u %u %u",
+				   &w, &h, &align) >= 2) {
+				size = w * h;
+				t = now_ns();
+				ret = tcm_reserve_2d(tcm, w, h, align,
+						     &s->area);
+			} else if (!strcmp(kind, "1d") &&
+				   sscanf(buf, "a %*u 1d %u", &size) == 1) {
+				t = now_ns();
+				ret = tcm_reserve_1d(tcm, size, &s->area);
+			} else {
+				goto bad;
+			}
+			st.ns += now_ns() - t;
+
+			if (ret) {
+				if (size <= total - st.live_slots)
+					st.failed_frag++;
+				else
+					st.failed_full++;
+				s->failed = true;
+			} else {
+				shadow_fill(&s->area, id + 1, line);
+				s->used = true;
+				st.reserved++;
+				st.live_slots += tcm_sizeof(s->area);
+				st.peak_slots = max(st.peak_slots,
+						    st.live_slots);
+			}
+		} else {
+			goto bad;
+		}
+
+next:
+		if (++st.ops % interval == 0)
+			report(tcm);
+		continue;
+bad:
+		fprintf(stderr, "line %lu: cannot parse: %s", line, buf);
+		exit(1);
+	}
+
+	if (interval == INT_MAX || st.ops % interval)
+		report(tcm);
+	printf("peak use %lu of %u slots\n", st.peak_slots, total);
+
+	for (id = 0; id < nr_areas; id++) {
+		if (areas[id] && areas[id]->used)
+			tcm_free(&areas[id]->area);
+		free(areas[id]);
+	}
+	tcm_deinit(tcm);
+}
+
+/*
+ * Synthetic workload: buffer sets that come and go together, as video
+ * decoders, camera previews and the compositor allocate them.  A set is
+ * started while less than 'fill' percent of the container is in use, and
+ * a random live set is freed otherwise.
+ */
+struct set {
+	unsigned int	first, count, slots;
+};
+
+static void generate(unsigned long ops, unsigned int seed, unsigned int fill)
+{
+	static const unsigned int video[][2] = {
+		{ 1920, 1088 }, { 1280, 720 }, { 720, 480 }, { 640, 480 },
+	};
+	struct set *sets = calloc(ops + 1, sizeof(*sets));
+	unsigned long live_slots = 0, n = 0;
+	unsigned int nr_sets = 0, next_id = 0, i;
+	unsigned int total = (u32)cont_w * cont_h;
+
+	if (!sets) {
+		perror("calloc");
+		exit(1);
+	}
+	srand(seed);
+	printf("# sita-replay -g %lu -s %u -f %u\n", ops, seed, fill);
+
+	while (n < ops) {
+		bool full = live_slots * 100 >= (unsigned long)total * fill;
+		struct set *s;
+
+		if (nr_sets && (full || rand() % 3 == 0)) {
+			i = rand() % nr_sets;
+			s = &sets[i];
+			for (i = 0; i < s->count; i++)
+				printf("f %u\n", s->first + i);
+			n += s->count;
+			live_slots -= s->slots;
+			*s = sets[--nr_sets];
+			continue;
+		}
+
+		s = &sets[nr_sets++];
+		s->first = next_id;
+		s->count = 0;
+		s->slots = 0;
+
+		switch (rand() % 4) {
+		case 0:		/* video decoder: NV12 Y (8-bit), UV (16-bit) */
+		case 1: {	/* camera preview: same layout, fewer buffers */
+			const unsigned int *v = video[rand() % 4];
+			unsigned int bufs = 3 + rand() % 6;
+			unsigned int yw = (v[0] + 63) / 64;
+			unsigned int yh = (v[1] + 63) / 64;
+			unsigned int uh = (v[1] / 2 + 63) / 64;
+
+			for (i = 0; i < bufs; i++) {
+				printf("a %u 2d %u %u\n", next_id++, yw, yh);
+				printf("a %u 2d %u %u\n", next_id++, yw, uh);
+				s->slots += yw * yh + yw * uh;
+			}
+			s->count = 2 * bufs;
+			break;
+		}
+		case 2: {	/* graphics: 32-bit surfaces */
+			unsigned int w = 1 + rand() % 40, h = 1 + rand() % 25;
+
+			printf("a %u 2d %u %u %u\n", next_id++, w, h,
+			       rand() % 2 ? 1 : 32);
+			s->slots = w * h;
+			s->count = 1;
+			break;
+		}
+		default: {	/* page mode */
+			unsigned int pages = 1 + rand() % 512;
+
+			printf("a %u 1d %u\n", next_id++, pages);
+			s->slots = pages;
+			s->count = 1;
+			break;
+		}
+		}
+		n += s->count;
+		live_slots += s->slots;
+	}
+	free(sets);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-W width] [-H height] [-i interval] [trace]\n"
+		"       %s -g ops [-s seed] [-f fill%%]\n", argv0, argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long gen = 0;
+	unsigned int seed = 1, fill = 90;
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "W:H:i:g:s:f:")) != -1) {
+		switch (opt) {
+		case 'W': cont_w = atoi(optarg); break;
+		case 'H': cont_h = atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		case 'g': gen = strtoul(optarg, NULL, 0); break;
+		case 's': seed = atoi(optarg); break;
+		case 'f': fill = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!cont_w || !cont_h || interval < 0)
+		usage(argv[0]);
+	if (!interval)
+		interval = INT_MAX;
+
+	if (gen) {
+		generate(gen, seed, fill);
+		return 0;
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	replay(f);
+	return 0;
+}
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# zram-bench.sh -- swap-style throughput of a zram device, using fio
+#
+# Swap reaches zram as single-page direct I/O from whichever CPUs are
+# reclaiming or faulting, so this drives the device the same way: 4k
+# direct writes and reads from one fio job per CPU, each over its own slice
+# of the disk, with partly compressible buffers.  The device is reset and
+# sized first, and the per-stream statistics are printed after each pass,
+# which shows how evenly compression was spread across the streams and how
+# often writers waited for one.
+#
+# Needs root, fio, and a zram device that is not in use (it gets reset).
+#
+# usage: zram-bench.sh [-d zram<id>] [-s size_mb] [-j jobs] [-c compress%]
+#                      [-t seconds]
+
+dev=zram0
+size_mb=128
+jobs=$(grep -c '^processor' /proc/cpuinfo)
+compress=50
+runtime=30
+
+while getopts d:s:j:c:t: opt; do
+	case $opt in
+	d) dev=$OPTARG ;;
+	s) size_mb=$OPTARG ;;
+	j) jobs=$OPTARG ;;
+	c) compress=$OPTARG ;;
+	t) runtime=$OPTARG ;;
+	*) echo "usage: $0 [-d zram<id>] [-s size_mb] [-j jobs]" \
+		"[-c compress%] [-t seconds]" >&2
+	   exit 2 ;;
+	esac
+done
+
+sys=/sys/block/$dev
+if [ ! -d $sys ]; then
+	echo "$sys: no such device (is the zram module loaded?)" >&2
+	exit 1
+fi
+if ! command -v fio >/dev/null 2>&1; then
+	echo "fio not found" >&2
+	exit 1
+fi
+# Android keeps block device nodes under /dev/block
+blk=/dev/$dev
+[ -b $blk ] || blk=/dev/block/$dev
+if grep -q "^$blk " /proc/swaps /proc/mounts; then
+	echo "$blk is in use" >&2
+	exit 1
+fi
+
+echo 1 > $sys/reset
+echo $((size_mb * 1024 * 1024)) > $sys/disksize
+
+slice=$((size_mb / jobs))M
+
+show_stats() {
+	for f in orig_data_size compr_data_size mem_used_total; do
+		echo "$f $(cat $sys/$f)"
+	done
+	cat $sys/streams
+	echo
+}
+
+# write pass first so the reads have something to decompress
+for rw in write randwrite read randread; do
+	echo "== $rw: $jobs jobs x $slice, 4k direct, ${compress}% compressible"
+	fio --name=zram-$rw --filename=$blk --rw=$rw --bs=4k \
+	    --direct=1 --ioengine=psync --numjobs=$jobs --size=$slice \
+	    --offset_increment=$slice --runtime=$runtime \
+	    --buffer_compress_percentage=$compress --refill_buffers \
+	    --group_reporting --minimal |
+	awk -F';' '{ printf "read %d KB/s %d iops, write %d KB/s %d iops\n",
+		     $7, $8, $48, $49 }'
+	show_stats
+done
+
+echo 1 > $sys/reset